@@ -0,0 +1,74 @@
+#!/usr/bin/env bash
+#
+# conn_memory.sh: compares what idle connections cost in each server mode.
+#
+# Starts ./server in threaded mode and then in epoll mode, opens N named but idle
+# connections against each one (straight from bash with /dev/tcp, so no client
+# threads get in the way), and reads the server's RSS and thread count from /proc.
+# Also asks the server's admin socket (with curl, if it's there) how many bytes the
+# average session holds by its own accounting: its client_t, any buffers it still has,
+# and in threaded mode its thread's stack. Idle sessions give their buffers back, after
+# IDLE_SECS (5) in threaded mode, so that one's read once they have.
+#
+# Usage: bench/conn_memory.sh [connections] [port]
+#   e.g. bench/conn_memory.sh 2000 8990
+
+N=${1:-1000}
+PORT=${2:-8990}
+SERVER=$(cd "$(dirname "$0")/.." && pwd)/server
+
+if [ ! -x "$SERVER" ]; then
+	echo "Build the server first (make build)."
+	exit 1
+fi
+
+# every connection needs a descriptor on our side, and the history files go in a scratch dir.
+ulimit -n $((N + 64)) 2>/dev/null || { echo "ulimit -n $((N + 64)) not allowed"; exit 1; }
+WORKDIR=$(mktemp -d)
+cd "$WORKDIR" || exit 1
+
+status_field() {
+	awk -v f="$2:" '$1 == f { print $2 }' "/proc/$1/status"
+}
+
+printf "%-10s %12s %12s %10s %16s %16s\n" "mode" "conns" "rss_kb" "threads" "kb_per_conn" "session_bytes"
+
+for mode in threaded epoll; do
+	"$SERVER" -m "$mode" -c $((N + 10)) -a "$WORKDIR/admin.sock" "$PORT" > /dev/null 2>&1 &
+	pid=$!
+	sleep 0.5
+
+	base_rss=$(status_field "$pid" VmRSS)
+
+	fds=()
+	for ((i = 0; i < N; i++)); do
+		exec {fd}<>"/dev/tcp/127.0.0.1/$PORT" || break
+		# a JOIN frame (irc_proto.h) with the 10 byte name.
+		printf '\xfa\x01\x01\x00\x00\x00\x00\x0aidle%06d' "$i" >&"$fd"
+		fds+=("$fd")
+	done
+
+	# give the server a moment to finish the joins.
+	sleep 2
+
+	rss=$(status_field "$pid" VmRSS)
+	threads=$(status_field "$pid" Threads)
+	conns=${#fds[@]}
+	per_conn=$(awk -v a="$rss" -v b="$base_rss" -v n="$conns" 'BEGIN { printf "%.2f", (a - b) / (n ? n : 1) }')
+
+	session="-"
+	if command -v curl > /dev/null; then
+		[ "$mode" = threaded ] && sleep 4
+		session=$(curl -s --unix-socket "$WORKDIR/admin.sock" http://localhost/metrics |
+			awk '$1 == "chat_session_bytes_per_client" { print $2 }')
+	fi
+	printf "%-10s %12d %12d %10d %16s %16s\n" "$mode" "$conns" "$rss" "$threads" "$per_conn" "$session"
+
+	for fd in "${fds[@]}"; do
+		exec {fd}>&-
+	done
+	kill "$pid"
+	wait "$pid" 2>/dev/null
+done
+
+rm -rf "$WORKDIR"
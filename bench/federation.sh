@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+#
+# federation.sh: what linking servers together costs, against one server doing it all.
+#
+# First runs bench/loadgen against one ./server, then against NODES servers linked in a full mesh on
+# loopback (see irc_link.h), with the connections spread over them, so every room has members on every
+# node. Prints one line per setup: delivery throughput over all nodes, latency for every delivery and
+# for the ones that crossed a link (the "remote" columns), and the relays the nodes sent, received and
+# dropped as duplicates, from their admin sockets. Needs curl (to read the admin sockets).
+#
+# Usage: [NODES=3] [CONNS=900] [GROUP=30] [RATE=3000] [SIZE=64] [DURATION=5] bench/federation.sh [port]
+#   Node n takes clients on port+n and links on port+100+n.
+
+PORT=${1:-8995}
+NODES=${NODES:-3}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ ! -x "$ROOT/server" ] || [ ! -x "$ROOT/bench/loadgen" ]; then
+	echo "Build the server and bench/loadgen first (make bench_federation)."
+	exit 1
+fi
+if ! command -v curl > /dev/null; then
+	echo "federation.sh reads the servers' counters with curl, which isn't installed."
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+cd "$WORKDIR" || exit 1
+
+# run <label> <node count>: starts that many linked servers, loads them, prints a line and stops them.
+run(){
+	local label=$1 count=$2 pids=() ports=""
+
+	for ((n = 0; n < count; n++)); do
+		local links=()
+		if [ "$count" -gt 1 ]; then
+			links=(-L $((PORT + 100 + n)))
+			for ((m = 0; m < count; m++)); do
+				[ $m != $n ] && links+=(-P 127.0.0.1:$((PORT + 100 + m)))
+			done
+		fi
+		mkdir -p "node$n"
+		"$ROOT/server" -r 0 -R 0 -d "node$n" -a "$WORKDIR/node$n.sock" "${links[@]}" $((PORT + n)) > /dev/null 2>&1 &
+		pids+=($!)
+		ports+="${ports:+,}$((PORT + n))"
+	done
+
+	# give the links a moment to come up (peers that aren't listening yet are dialed again every second).
+	sleep $([ "$count" -gt 1 ] && echo 1.5 || echo 0.3)
+
+	out=$("$ROOT/bench/loadgen" -t -c "${CONNS:-900}" -g "${GROUP:-30}" -r "${RATE:-3000}" -s "${SIZE:-64}" \
+		-d "${DURATION:-5}" "$ports" | tail -1)
+
+	counts=$(for ((n = 0; n < count; n++)); do
+		curl -s --unix-socket "$WORKDIR/node$n.sock" http://localhost/metrics
+	done | awk '
+		$1 == "chat_link_relays_sent_total" { s += $2 }
+		$1 == "chat_link_relays_received_total" { r += $2 }
+		$1 == "chat_link_duplicates_total" { d += $2 }
+		END { printf "%d\t%d\t%d", s, r, d }')
+
+	echo "$out" | awk -v label="$label" -v counts="$counts" -F'\t' '{
+		split(counts, c, "\t")
+		printf "%-8s %12s %8s %10s %10s %10s %10s %10s %10s %6s\n", label, $6, $7, $8, $10,
+			(NF > 13 ? $14 : "-"), (NF > 13 ? $15 : "-"), c[1], c[2], c[3]
+	}'
+
+	kill "${pids[@]}"
+	wait "${pids[@]}" 2>/dev/null
+}
+
+printf "%-8s %12s %8s %10s %10s %10s %10s %10s %10s %6s\n" "setup" "delivered/s" "missing" "p50_us" "p99_us" \
+	"remote_p50" "remote_p99" "relays_out" "relays_in" "dups"
+run "1 node" 1
+run "$NODES nodes" "$NODES"
+
+rm -rf "$WORKDIR"
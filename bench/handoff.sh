@@ -0,0 +1,48 @@
+#!/usr/bin/env bash
+#
+# handoff.sh: hot restarts under load.
+#
+# Starts ./server with a handoff socket (-U), points bench/loadgen at it, and a third and two thirds of the way
+# through starts another ./server on the same socket, which takes the clients over (see irc_handoff.h).
+# Prints loadgen's line (the "missing" column should be 0, and max_us shows the pause) and what each
+# handoff took, from the servers' own output.
+#
+# Usage: [CONNS=1000] [GROUP=10] [RATE=2000] [SIZE=64] [DURATION=6] bench/handoff.sh [port]
+
+PORT=${1:-8996}
+DURATION=${DURATION:-6}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ ! -x "$ROOT/server" ] || [ ! -x "$ROOT/bench/loadgen" ]; then
+	echo "Build the server and bench/loadgen first (make bench_handoff)."
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+cd "$WORKDIR" || exit 1
+
+# start <n>: one more server on the handoff socket; the one before it hands over and exits.
+start(){
+	"$ROOT/server" -r 0 -R 0 -U "$WORKDIR/handoff.sock" "$PORT" > "server$1.log" 2>&1 &
+	last=$!
+}
+
+start 0
+sleep 0.3
+
+"$ROOT/bench/loadgen" -t -c "${CONNS:-1000}" -g "${GROUP:-10}" -r "${RATE:-2000}" -s "${SIZE:-64}" \
+	-d "$DURATION" "$PORT" > loadgen.out &
+loadgen=$!
+
+for n in 1 2; do
+	sleep "$(awk -v d="$DURATION" 'BEGIN { print d / 3 }')"
+	start $n
+done
+
+wait $loadgen
+cat loadgen.out
+grep -h "Handed\|Took over\|ERROR" server*.log
+
+kill "$last"
+wait "$last" 2>/dev/null
+rm -rf "$WORKDIR"
@@ -0,0 +1,66 @@
+#!/usr/bin/env bash
+#
+# history.sh: what compacting a day of history (.seg + .idx -> .segz) saves on disk, and what it
+# does to reading it back.
+#
+# Starts a fresh ./server, has bench/loadgen -w chat at it for DURATION seconds (RATE messages a second
+# of SIZE bytes, random words, CONNS connections in rooms of GROUP), stops it, and moves the day it
+# logged back to 2000-01-01 so it counts as finished. Then compacts a copy with "query -z" and times
+# the same queries against both: everything (every block read), one room, and one room plus a word
+# (most blocks ruled out by the index). Times are the best of 5 runs, with the files in the page cache.
+#
+# Usage: [CONNS=200] [GROUP=10] [RATE=5000] [SIZE=80] [DURATION=10] bench/history.sh [port]
+
+PORT=${1:-8994}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ ! -x "$ROOT/server" ] || [ ! -x "$ROOT/query" ] || [ ! -x "$ROOT/bench/loadgen" ]; then
+	echo "Build the server, the query tool and bench/loadgen first (make bench_history)."
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+cd "$WORKDIR" || exit 1
+mkdir plain packed
+
+"$ROOT/server" -r 0 -d plain "$PORT" > /dev/null 2>&1 &
+pid=$!
+sleep 0.3
+"$ROOT/bench/loadgen" -w -t -c "${CONNS:-200}" -g "${GROUP:-10}" -r "${RATE:-5000}" -s "${SIZE:-80}" \
+	-d "${DURATION:-10}" "$PORT" > /dev/null
+kill "$pid"
+wait "$pid" 2>/dev/null
+
+for f in plain/*.seg plain/*.idx; do
+	mv "$f" "plain/2000-01-01.${f##*.}"
+done
+cp plain/* packed/
+"$ROOT/query" -d packed -z
+
+# best of 5, in milliseconds, and what query -v said about the last run.
+best_ms() {
+	local best=
+	for _ in 1 2 3 4 5; do
+		local t0 t1
+		t0=$(date +%s%N)
+		"$ROOT/query" "$@" -v > /dev/null 2> "$WORKDIR/v.txt"
+		t1=$(date +%s%N)
+		local ms=$(( (t1 - t0) / 1000000 ))
+		if [ -z "$best" ] || [ "$ms" -lt "$best" ]; then
+			best=$ms
+		fi
+	done
+	echo "$best"
+}
+
+printf "%-8s %12s %10s %12s %10s %14s\n" "files" "bytes" "all_ms" "records/s" "room_ms" "room+word_ms"
+for dir in plain packed; do
+	bytes=$(cat "$dir"/* | wc -c)
+	all=$(best_ms -d "$dir")
+	records=$(sed -n 's/.* \([0-9]*\) records read.*/\1/p' "$WORKDIR/v.txt")
+	room=$(best_ms -d "$dir" -c "#load3")
+	word=$(best_ms -d "$dir" -c "#load3" -k "coffee friday")
+	printf "%-8s %12d %10d %12d %10d %14d\n" "$dir" "$bytes" "$all" $(( records * 1000 / (all > 0 ? all : 1) )) "$room" "$word"
+done
+
+rm -rf "$WORKDIR"
@@ -0,0 +1,516 @@
+/*
+ * File: bench/loadgen.c
+ * Project: CSCI 3160 Chat Project
+ * Description: A headless load generator for the chat server.
+ *
+ *	Opens a few thousand framed connections, puts them in rooms of `group` members (or all in
+ *	#lobby with -g 0), then sends `rate` chat messages a second of `size` bytes each, round robin
+ *	over the connections, for `duration` seconds. Every message carries the time it was sent,
+ *	so every delivery to every other member of the room is timed end to end.
+ *
+ *	Latencies go into a log-linear histogram in the style of HdrHistogram (every power of two is
+ *	split into 128 linear sub-buckets, so any value is off by less than 1%), which is what the
+ *	percentiles are read from. Also reported: how fast connections were set up (connect until the
+ *	server said we're in our room), send and delivery throughput, and anything that never arrived.
+ *
+ *	Given several ports ("9101,9102,9103", one per linked server, see irc_link.h) connection i goes to
+ *	port i % nports, so every room is spread over every node, and deliveries from a sender on another node
+ *	get their own histogram too: that's what a relay between nodes costs on top.
+ *
+ * Usage: bench/loadgen [-c connections] [-g group] [-r rate] [-s size] [-d seconds] [-m max_p99_us] [-w] [-t] <port>[,<port>...]
+ *	-t prints one tab separated line (with a header) instead of the report, for scripts.
+ *	-w fills messages with random words instead of x's, so the history they leave looks more like chat.
+ *	-m exits with status 2 if the p99 delivery latency is over max_p99_us, to catch regressions.
+ *	bench/loadgen.sh runs it against each server mode ("make bench").
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "../irc_proto.h"
+
+#define MAX_EVENTS 256
+
+/// @brief how many connections may be waiting on the server at once while we set up.
+#define SETUP_INFLIGHT 256
+
+/// @brief what every timed message starts with, followed by the send time in nanoseconds and the sender's index.
+#define STAMP "LG "
+
+/// @brief how many servers (ports) one run can spread its connections over.
+#define MAX_PORTS 16
+
+/* Histogram */
+
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_SLOTS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/// @brief values (nanoseconds) below 2^HIST_SUB_BITS are counted exactly; above that each
+//			power of two [2^k, 2^(k+1)) gets HIST_SUB equal slots.
+typedef struct{
+	uint64_t counts[HIST_SLOTS];
+	uint64_t total;
+	uint64_t max;
+	double sum;
+} hist_t;
+
+static int hist_index(uint64_t v){
+	if(v < HIST_SUB){
+		return (int)v;
+	}
+	int k = 63 - __builtin_clzll(v);
+	int shift = k - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+/// @brief the highest value that lands in slot i.
+static uint64_t hist_value(int i){
+	if(i < HIST_SUB){
+		return (uint64_t)i;
+	}
+	int shift = i / HIST_SUB - 1;
+	uint64_t low = (uint64_t)(i % HIST_SUB + HIST_SUB) << shift;
+	return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void hist_record(hist_t *h, uint64_t v){
+	h->counts[hist_index(v)]++;
+	h->total++;
+	h->sum += (double)v;
+	if(v > h->max){
+		h->max = v;
+	}
+}
+
+/// @brief the value at percentile p (0-100).
+static uint64_t hist_percentile(const hist_t *h, double p){
+	if(h->total == 0){
+		return 0;
+	}
+	uint64_t want = (uint64_t)((double)h->total * p / 100.0 + 0.5);
+	if(want < 1){
+		want = 1;
+	}
+	uint64_t seen = 0;
+	for(int i = 0; i < HIST_SLOTS; i++){
+		seen += h->counts[i];
+		if(seen >= want){
+			uint64_t v = hist_value(i);
+			return v < h->max ? v : h->max;
+		}
+	}
+	return h->max;
+}
+
+/* Connections */
+
+typedef struct{
+	int fd;
+	int joined;
+	long connect_ns;
+
+	/// @brief received bytes not parsed yet.
+	char *buf;
+	size_t len;
+	size_t cap;
+} conn_t;
+
+static conn_t *conns;
+static int nconns = 1000, group = 10, rate = 1000, size = 64, duration = 10, wordy = 0;
+static int ports[MAX_PORTS], nports = 0;
+static int epfd;
+
+static hist_t latency, setup, remote;
+static long sent, stalled, delivered, stamp_errors;
+static long bytes_in;
+
+static long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void room_of(int i, char *out, size_t len){
+	if(group == 0){
+		snprintf(out, len, "#lobby");
+	} else {
+		snprintf(out, len, "#load%d", i / group);
+	}
+}
+
+/// @brief connects connection i and asks to be put in its room.
+/// @return 0 on success, -1 on failure.
+static int conn_open(int i){
+	struct sockaddr_in addr;
+	char buf[64], room[32];
+	conn_t *c = &conns[i];
+
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(ports[i % nports]);
+
+	c->connect_ns = now_ns();
+	if(c->fd < 0 || connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+		perror("connect");
+		return -1;
+	}
+
+	//name, room, and out of the lobby, all in one go.
+	snprintf(buf, sizeof(buf), "lg%d_%d", (int)getpid(), i);
+	irc_send_frame(c->fd, IRC_JOIN, buf, strlen(buf));
+	room_of(i, room, sizeof(room));
+	if(group > 0){
+		snprintf(buf, sizeof(buf), "join %s", room);
+		irc_send_frame(c->fd, IRC_CONTROL, buf, strlen(buf));
+		irc_send_frame(c->fd, IRC_CONTROL, "part #lobby", 11);
+	}
+
+	c->cap = 4096;
+	while(c->cap < 2 * (size_t)(size + IRC_FRAME_HDR)){
+		c->cap *= 2;
+	}
+	c->buf = malloc(c->cap);
+	if(!c->buf){
+		return -1;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u32 = (uint32_t)i;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+/// @brief what -w makes messages out of.
+static const char *vocab[] = {
+	"the", "a", "to", "and", "is", "it", "you", "i", "that", "of", "in", "for", "on", "we", "this", "so",
+	"lol", "ok", "yeah", "no", "what", "when", "lunch", "friday", "meeting", "build", "deploy", "broke",
+	"fixed", "server", "tests", "pushed", "review", "merge", "branch", "tomorrow", "today", "anyone",
+	"coffee", "thanks", "sounds", "good", "can", "someone", "look", "at", "my", "pr", "again", "later"
+};
+
+/// @brief fills text[0 .. len) with random words from vocab.
+static void fill_words(char *text, int len){
+	int at = 0;
+	while(at < len){
+		const char *w = vocab[rand() % (int)(sizeof(vocab) / sizeof(vocab[0]))];
+		int n = (int)strlen(w);
+		if(n > len - at){
+			n = len - at;
+		}
+		memcpy(text + at, w, (size_t)n);
+		at += n;
+		if(at < len){
+			text[at++] = ' ';
+		}
+	}
+}
+
+/// @brief sends one timed chat message of `size` bytes from connection i.
+//			Never blocks on a server that stopped reading us (the -p backpressure policy does that):
+//			the message is skipped and counted instead, since blocking here would stop us reading too.
+static void conn_send(int i, char *frame){
+	int len = snprintf(frame + IRC_FRAME_HDR, (size_t)size, STAMP "%ld %d ", now_ns(), i);
+	if(wordy){
+		fill_words(frame + IRC_FRAME_HDR + len, size - len - 1);
+	} else {
+		memset(frame + IRC_FRAME_HDR + len, 'x', (size_t)(size - len - 1));
+	}
+	frame[IRC_FRAME_HDR + size - 1] = '\n';
+	irc_frame_header(frame, IRC_CHAT, 0, (uint32_t)size);
+
+	size_t total = IRC_FRAME_HDR + (size_t)size, done = 0;
+	ssize_t n = send(conns[i].fd, frame, total, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if(n < 0){
+		stalled++;
+		return;
+	}
+
+	//half a frame would wedge the connection, so the rest goes out even if we have to wait.
+	done = (size_t)n;
+	while(done < total && (n = send(conns[i].fd, frame + done, total - done, MSG_NOSIGNAL)) > 0){
+		done += (size_t)n;
+	}
+	sent++;
+}
+
+/// @brief handles one frame from the server.
+static void conn_frame(conn_t *c, irc_frame_t *f, long now){
+	irc_msg_t m;
+
+	//a chat line: someone's timed message.
+	if(f->type == IRC_MSG){
+		if(irc_msg_parse(f->payload, f->len, f->flags, &m) < 0 || m.len <= sizeof(STAMP) - 1
+			|| memcmp(m.text, STAMP, sizeof(STAMP) - 1) != 0){
+			return;
+		}
+		char *end;
+		long then = strtol(m.text + sizeof(STAMP) - 1, &end, 10);
+		if(end == m.text + sizeof(STAMP) - 1 || then > now){
+			stamp_errors++;
+			return;
+		}
+		hist_record(&latency, (uint64_t)(now - then));
+		delivered++;
+
+		//sent from a connection on another server: it came over a link.
+		int from = (int)strtol(end, NULL, 10);
+		if(from % nports != (int)(c - conns) % nports){
+			hist_record(&remote, (uint64_t)(now - then));
+		}
+		return;
+	}
+	if(f->type != IRC_CHAT){
+		return;
+	}
+
+	//"Now talking in #load3." says we made it into our room.
+	if(!c->joined && f->len > 16 && memcmp(f->payload, "Now talking in ", 15) == 0){
+		char room[32];
+		room_of((int)(c - conns), room, sizeof(room));
+		size_t rlen = strlen(room);
+		if(f->len >= 15 + rlen + 1 && memcmp(f->payload + 15, room, rlen) == 0 && f->payload[15 + rlen] == '.'){
+			c->joined = 1;
+			hist_record(&setup, (uint64_t)(now - c->connect_ns));
+		}
+	}
+}
+
+/// @brief reads whatever the server sent connection i.
+/// @return 0, or -1 if the server hung up.
+static int conn_read(int i){
+	conn_t *c = &conns[i];
+	ssize_t n = recv(c->fd, c->buf + c->len, c->cap - c->len, MSG_DONTWAIT);
+	if(n <= 0){
+		return (n < 0 && (errno == EAGAIN || errno == EINTR)) ? 0 : -1;
+	}
+	c->len += (size_t)n;
+	bytes_in += n;
+
+	long now = now_ns();
+	irc_frame_t f;
+	size_t off = 0;
+	int r;
+	while((r = irc_frame_next(c->buf, c->len, &off, &f)) == 1){
+		conn_frame(c, &f, now);
+	}
+	if(r < 0){
+		fprintf(stderr, "connection %d: the server sent something that isn't a frame\n", i);
+		return -1;
+	}
+
+	//keep the partial frame; grow the buffer if it won't fit (join replays can be long).
+	memmove(c->buf, c->buf + off, c->len - off);
+	c->len -= off;
+	long need = irc_frame_size(c->buf, c->len);
+	if(need > (long)c->cap){
+		char *grown = realloc(c->buf, (size_t)need);
+		if(!grown){
+			return -1;
+		}
+		c->buf = grown;
+		c->cap = (size_t)need;
+	}
+	return 0;
+}
+
+/// @brief waits up to timeout_ms for events and reads everything that came in.
+/// @return how many connections the server dropped.
+static int poll_once(int timeout_ms){
+	struct epoll_event events[MAX_EVENTS];
+	int lost = 0;
+
+	int n = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);
+	for(int e = 0; e < n; e++){
+		int i = (int)events[e].data.u32;
+		if(conn_read(i) < 0){
+			epoll_ctl(epfd, EPOLL_CTL_DEL, conns[i].fd, NULL);
+			lost++;
+		}
+	}
+	return lost;
+}
+
+static void usage(char *prog){
+	fprintf(stderr, "Usage: %s [-c connections] [-g group] [-r rate] [-s size] [-d seconds] [-m max_p99_us] [-w] [-t] <port>[,<port>...]\n", prog);
+}
+
+int main(int argc, char **argv){
+	int opt, table = 0;
+	long max_p99_us = 0;
+
+	while((opt = getopt(argc, argv, "c:g:r:s:d:m:wt")) != -1){
+		switch(opt){
+		case 'c':
+			nconns = atoi(optarg);
+			break;
+		case 'g':
+			group = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'm':
+			max_p99_us = atol(optarg);
+			break;
+		case 'w':
+			wordy = 1;
+			break;
+		case 't':
+			table = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(optind != argc - 1 || nconns < 2 || group == 1 || group < 0 || rate < 1 || duration < 1
+		|| size < 32 || size > IRC_MAX_PAYLOAD){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	for(char *p = argv[optind]; ; p++){
+		ports[nports] = (int)strtol(p, &p, 10);
+		if(ports[nports++] <= 0 || (*p && (*p != ',' || nports == MAX_PORTS))){
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		if(!*p){
+			break;
+		}
+	}
+
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0){
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	conns = calloc((size_t)nconns, sizeof(conn_t));
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(!conns || epfd < 0){
+		perror("setup");
+		return EXIT_FAILURE;
+	}
+
+	//connect everyone, with at most SETUP_INFLIGHT waiting to hear they're in their room.
+	int opened = 0, joined = 0, lost = 0;
+	long setup_start = now_ns();
+	while(joined + lost < nconns){
+		while(opened < nconns && opened - joined < SETUP_INFLIGHT){
+			if(conn_open(opened) < 0){
+				return EXIT_FAILURE;
+			}
+			opened++;
+		}
+		lost += poll_once(10);
+
+		joined = 0;
+		for(int i = 0; i < opened; i++){
+			joined += conns[i].joined;
+		}
+	}
+	double setup_s = (double)(now_ns() - setup_start) / 1e9;
+
+	//let the join notices die down, then start counting.
+	long quiet = now_ns() + 500000000L;
+	while(now_ns() < quiet){
+		lost += poll_once(10);
+	}
+	memset(&latency, 0, sizeof(latency));
+	memset(&remote, 0, sizeof(remote));
+	delivered = stamp_errors = bytes_in = 0;
+
+	//send at `rate` per second for `duration` seconds, round robin over the connections.
+	char *frame = malloc(IRC_FRAME_HDR + (size_t)size);
+	long start = now_ns(), end = start + (long)duration * 1000000000L;
+	int next = 0;
+	while(1){
+		long now = now_ns();
+		if(now >= end){
+			break;
+		}
+
+		long due = (long)((double)(now - start) * rate / 1e9);
+		while(sent + stalled < due){
+			conn_send(next, frame);
+			next = (next + 1) % nconns;
+		}
+
+		lost += poll_once(1);
+	}
+	double send_s = (double)(now_ns() - start) / 1e9;
+
+	//whatever's still on its way gets a second to arrive.
+	long expected = sent * ((group > 0 ? group : nconns) - 1);
+	long grace = now_ns() + 1000000000L;
+	while(delivered < expected && now_ns() < grace){
+		lost += poll_once(10);
+	}
+
+	double us = 1000.0;
+	if(table){
+		printf("conns\tconn_per_s\tsetup_p99_us\tsent_per_s\tskipped\tdelivered_per_s\tmissing\tp50_us\tp90_us\tp99_us\tp999_us\tmax_us\tbytes_per_msg%s\n",
+			nports > 1 ? "\tremote_p50_us\tremote_p99_us" : "");
+		printf("%d\t%.0f\t%.0f\t%.0f\t%ld\t%.0f\t%ld\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f",
+			nconns, nconns / setup_s, hist_percentile(&setup, 99) / us, sent / send_s, stalled, delivered / send_s,
+			expected - delivered, hist_percentile(&latency, 50) / us, hist_percentile(&latency, 90) / us,
+			hist_percentile(&latency, 99) / us, hist_percentile(&latency, 99.9) / us, latency.max / us,
+			delivered ? (double)bytes_in / delivered : 0.0);
+		if(nports > 1){
+			printf("\t%.1f\t%.1f", hist_percentile(&remote, 50) / us, hist_percentile(&remote, 99) / us);
+		}
+		printf("\n");
+	} else {
+		printf("connections  %d in %.2f s (%.0f conn/s), setup p50 %.0f us, p99 %.0f us%s\n",
+			nconns, setup_s, nconns / setup_s, hist_percentile(&setup, 50) / us, hist_percentile(&setup, 99) / us,
+			lost ? ", some dropped by the server" : "");
+		printf("sent         %ld messages of %d bytes in %.1f s (%.0f msg/s)", sent, size, send_s, sent / send_s);
+		if(stalled){
+			printf(", %ld more skipped, the server wasn't reading", stalled);
+		}
+		printf("\n");
+		printf("delivered    %ld of %ld (%.0f msg/s, %.1f MB/s in, %.1f bytes per message)%s\n", delivered, expected,
+			delivered / send_s, bytes_in / send_s / 1e6, delivered ? (double)bytes_in / delivered : 0.0,
+			stamp_errors ? ", some with bad stamps" : "");
+		printf("latency      p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us  p99.99 %.1f us  max %.1f us  mean %.1f us\n",
+			hist_percentile(&latency, 50) / us, hist_percentile(&latency, 90) / us, hist_percentile(&latency, 99) / us,
+			hist_percentile(&latency, 99.9) / us, hist_percentile(&latency, 99.99) / us, latency.max / us,
+			latency.total ? latency.sum / latency.total / us : 0.0);
+		if(nports > 1){
+			printf("cross-node   %lu deliveries, p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us  mean %.1f us\n",
+				(unsigned long)remote.total, hist_percentile(&remote, 50) / us, hist_percentile(&remote, 90) / us,
+				hist_percentile(&remote, 99) / us, hist_percentile(&remote, 99.9) / us, remote.max / us,
+				remote.total ? remote.sum / remote.total / us : 0.0);
+		}
+	}
+
+	for(int i = 0; i < nconns; i++){
+		close(conns[i].fd);
+	}
+
+	if(max_p99_us > 0 && hist_percentile(&latency, 99) / us > (double)max_p99_us){
+		fprintf(stderr, "p99 latency %.1f us is over the %ld us budget\n", hist_percentile(&latency, 99) / us, max_p99_us);
+		return 2;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+#
+# loadgen.sh: end to end latency, throughput and connection setup rate of each server mode.
+#
+# For each mode, starts a fresh ./server and points bench/loadgen at it: CONNS connections in rooms
+# of GROUP, RATE messages a second of SIZE bytes for DURATION seconds. Prints one line per mode.
+# Set P99_MAX (microseconds) to fail if either mode's p99 goes over it, e.g. in a regression run.
+#
+# Usage: [CONNS=1000] [GROUP=10] [RATE=1000] [SIZE=64] [DURATION=5] [P99_MAX=us] bench/loadgen.sh [port] [modes...]
+#   e.g. CONNS=5000 RATE=5000 bench/loadgen.sh 8992 epoll
+
+PORT=${1:-8992}
+shift
+MODES=${*:-threaded epoll}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ ! -x "$ROOT/server" ] || [ ! -x "$ROOT/bench/loadgen" ]; then
+	echo "Build the server and bench/loadgen first (make bench)."
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+cd "$WORKDIR" || exit 1
+
+status=0
+header=1
+for mode in $MODES; do
+	"$ROOT/server" -m "$mode" -r 0 "$PORT" > /dev/null 2>&1 &
+	pid=$!
+	sleep 0.3
+
+	out=$("$ROOT/bench/loadgen" -t -c "${CONNS:-1000}" -g "${GROUP:-10}" -r "${RATE:-1000}" -s "${SIZE:-64}" \
+		-d "${DURATION:-5}" ${P99_MAX:+-m "$P99_MAX"} "$PORT") || status=1
+	if [ $header = 1 ]; then
+		printf "mode\t%s\n" "$(echo "$out" | head -1)"
+		header=0
+	fi
+	printf "%s\t%s\n" "$mode" "$(echo "$out" | tail -1)"
+
+	kill "$pid"
+	wait "$pid" 2>/dev/null
+done
+
+rm -rf "$WORKDIR"
+exit $status
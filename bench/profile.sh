@@ -0,0 +1,72 @@
+#!/usr/bin/env bash
+#
+# profile.sh: where the server spends its time under load, as a perf profile and a flame graph.
+#
+# Starts ./server in MODE, records it with perf (call graphs from frame pointers, so build it with
+# -fno-omit-frame-pointer: make perf does) while bench/loadgen sends CONNS connections in rooms of GROUP
+# RATE messages a second of SIZE bytes for DURATION seconds, and writes to profile/:
+#   perf.data    the recording, for perf report / perf annotate
+#   report.txt   the hottest functions, with and without what they call
+#   loadgen.txt  what the load looked like (throughput and latency), to compare runs by
+#   server.svg   a flame graph, if the FlameGraph scripts (stackcollapse-perf.pl, flamegraph.pl) are on the
+#                PATH or in FLAMEGRAPH_DIR
+#
+# Usage: [MODE=epoll] [CONNS=1000] [GROUP=10] [RATE=20000] [SIZE=64] [DURATION=10] [FREQ=999] bench/profile.sh [port]
+
+PORT=${1:-8998}
+MODE=${MODE:-epoll}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+OUT="$ROOT/profile"
+
+if [ ! -x "$ROOT/server" ] || [ ! -x "$ROOT/bench/loadgen" ]; then
+	echo "Build the server and bench/loadgen first (make perf)."
+	exit 1
+fi
+if ! command -v perf > /dev/null; then
+	echo "profile.sh records with perf, which isn't installed (linux-perf or linux-tools-\$(uname -r))."
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+mkdir -p "$OUT"
+cd "$WORKDIR" || exit 1
+
+"$ROOT/server" -m "$MODE" -r 0 -R 0 "$PORT" > /dev/null 2>&1 &
+pid=$!
+sleep 0.3
+
+perf record -F "${FREQ:-999}" -g -p "$pid" -o "$OUT/perf.data" 2> perf.log &
+perf_pid=$!
+sleep 0.5
+if ! kill -0 "$perf_pid" 2> /dev/null; then
+	cat perf.log
+	echo "perf couldn't attach to the server (try: sudo sysctl kernel.perf_event_paranoid=1)."
+	kill "$pid"
+	rm -rf "$WORKDIR"
+	exit 1
+fi
+
+"$ROOT/bench/loadgen" -t -c "${CONNS:-1000}" -g "${GROUP:-10}" -r "${RATE:-20000}" -s "${SIZE:-64}" \
+	-d "${DURATION:-10}" "$PORT" > "$OUT/loadgen.txt"
+
+kill -INT "$perf_pid"
+wait "$perf_pid" 2> /dev/null
+kill "$pid"
+wait "$pid" 2> /dev/null
+
+perf report -i "$OUT/perf.data" --stdio --no-children --percent-limit 1 2> /dev/null > "$OUT/report.txt"
+perf report -i "$OUT/perf.data" --stdio --children --percent-limit 5 -g none 2> /dev/null >> "$OUT/report.txt"
+
+PATH="$PATH${FLAMEGRAPH_DIR:+:$FLAMEGRAPH_DIR}"
+if command -v stackcollapse-perf.pl > /dev/null && command -v flamegraph.pl > /dev/null; then
+	perf script -i "$OUT/perf.data" 2> /dev/null | stackcollapse-perf.pl | flamegraph.pl --title "server -m $MODE" \
+		> "$OUT/server.svg"
+fi
+
+cat "$OUT/loadgen.txt"
+echo
+grep -v '^#' "$OUT/report.txt" | grep '%' | head -15
+echo
+echo "Full report: $OUT/report.txt$([ -s "$OUT/server.svg" ] && echo ", flame graph: $OUT/server.svg")"
+
+rm -rf "$WORKDIR"
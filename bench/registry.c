@@ -0,0 +1,318 @@
+/*
+ * File: bench/registry.c
+ * Project: CSCI 3160 Chat Project
+ * Description: What the client registry (irc_registry.c) costs per operation, and whether it holds up under churn.
+ *
+ *	First, one thread registers `clients` clients (registry_add and registry_set_name, like a join), looks
+ *	each one up by uid and by name in random order, and removes them all again in random order, and prints
+ *	the nanoseconds per add, lookup and remove.
+ *
+ *	Then `readers` threads look up random clients by uid and by name, and now and then walk the whole uid
+ *	table, for `seconds` seconds, while `writers` threads keep adding and removing clients (freed with
+ *	rcu_retire, like the server does) and every so often take half of theirs out at once and put them back,
+ *	so the tables shrink and grow under the readers. A lookup has to find a client with the key it asked
+ *	for, and a walk mustn't see anyone twice. Built with sanitizers (make bench_registry CFLAGS="-O1 -g
+ *	-fsanitize=thread", or address) this is the race and use after free check for the registry and irc_rcu.c.
+ *
+ * Usage: bench/registry [-c clients] [-r readers] [-w writers] [-s seconds]
+ *	Exits with status 1 if a reader saw anything wrong.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../irc_registry.h"
+#include "../irc_rcu.h"
+
+/// @brief how many clients the churn runs with (some registered, some not at any time).
+#define CHURN_CLIENTS 20000
+
+typedef struct{
+	reg_node_t reg;
+	char name[16];
+} client_t;
+
+static registry_t reg;
+static _Atomic int stop = 0;
+static _Atomic long errors = 0;
+
+static long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/// @brief xorshift, so every thread has its own random numbers without a lock.
+static uint64_t next_rand(uint64_t *s){
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static client_t *client_new(int uid){
+	client_t *c = malloc(sizeof(client_t));
+	if(!c){
+		abort();
+	}
+	c->reg.uid = uid;
+	snprintf(c->name, sizeof(c->name), "user%d", uid);
+	c->reg.name = c->name;
+	return c;
+}
+
+/// @brief an order to visit 0 .. n-1 in.
+static int *shuffled(int n, uint64_t *seed){
+	int *order = malloc(sizeof(int) * (size_t)n);
+	for(int i = 0; i < n; i++){
+		order[i] = i;
+	}
+	for(int i = n - 1; i > 0; i--){
+		int j = (int)(next_rand(seed) % (uint64_t)(i + 1)), t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	return order;
+}
+
+static void time_ops(int n){
+	client_t **clients = malloc(sizeof(client_t *) * (size_t)n);
+	uint64_t seed = 88172645463325252ull;
+	char name[16];
+
+	for(int i = 0; i < n; i++){
+		clients[i] = client_new(i + 1);
+	}
+
+	long t0 = now_ns();
+	for(int i = 0; i < n; i++){
+		if(registry_add(&reg, &clients[i]->reg) < 0 || registry_set_name(&reg, &clients[i]->reg) < 0){
+			fprintf(stderr, "couldn't add client %d\n", i + 1);
+			exit(EXIT_FAILURE);
+		}
+	}
+	long t_add = now_ns() - t0;
+
+	int *order = shuffled(n, &seed);
+	t0 = now_ns();
+	rcu_read_lock();
+	for(int i = 0; i < n; i++){
+		if(!registry_find_uid(&reg, order[i] + 1)){
+			atomic_fetch_add(&errors, 1);
+		}
+	}
+	rcu_read_unlock();
+	long t_uid = now_ns() - t0;
+
+	//the names are made up front, so only the lookups are timed.
+	char (*names)[16] = malloc(sizeof(name) * (size_t)n);
+	for(int i = 0; i < n; i++){
+		snprintf(names[i], sizeof(names[i]), "user%d", order[i] + 1);
+	}
+	t0 = now_ns();
+	rcu_read_lock();
+	for(int i = 0; i < n; i++){
+		if(!registry_find_name(&reg, names[i])){
+			atomic_fetch_add(&errors, 1);
+		}
+	}
+	rcu_read_unlock();
+	long t_name = now_ns() - t0;
+
+	free(order);
+	order = shuffled(n, &seed);
+	t0 = now_ns();
+	for(int i = 0; i < n; i++){
+		registry_remove(&reg, &clients[order[i]]->reg);
+	}
+	long t_remove = now_ns() - t0;
+
+	printf("%d clients: add %.0f ns, lookup by uid %.0f ns, by name %.0f ns, remove %.0f ns\n", n,
+		(double)t_add / n, (double)t_uid / n, (double)t_name / n, (double)t_remove / n);
+
+	//nothing's reading any more, so these can go right away.
+	rcu_synchronize();
+	for(int i = 0; i < n; i++){
+		free(clients[i]);
+	}
+	free(clients);
+	free(order);
+	free(names);
+}
+
+typedef struct{
+	int id;
+	long lookups;
+	long walks;
+	long churns;
+} worker_t;
+
+static void *reader(void *arg){
+	worker_t *w = arg;
+	uint64_t seed = 0x9e3779b97f4a7c15ull * (uint64_t)(w->id + 1);
+	unsigned *walked = calloc(CHURN_CLIENTS + 1, sizeof(unsigned));
+	unsigned walk = 0;
+	char name[16];
+
+	while(!atomic_load(&stop)){
+		int uid = (int)(next_rand(&seed) % CHURN_CLIENTS) + 1;
+		snprintf(name, sizeof(name), "user%d", uid);
+
+		rcu_read_lock();
+		reg_node_t *n = registry_find_uid(&reg, uid);
+		if(n && n->uid != uid){
+			atomic_fetch_add(&errors, 1);
+		}
+		n = registry_find_name(&reg, name);
+		if(n && (strcmp(n->name, name) != 0 || n->uid != uid)){
+			atomic_fetch_add(&errors, 1);
+		}
+		w->lookups += 2;
+
+		if(w->lookups % 4096 == 0){
+			reg_table_t *t = registry_table(&reg);
+			walk++;
+			for(size_t i = 0; i < t->cap; i++){
+				n = registry_slot(t, i);
+				if(!n){
+					continue;
+				}
+				if(n->uid < 1 || n->uid > CHURN_CLIENTS || walked[n->uid] == walk){
+					atomic_fetch_add(&errors, 1);
+				} else {
+					walked[n->uid] = walk;
+				}
+			}
+			w->walks++;
+		}
+		rcu_read_unlock();
+	}
+	free(walked);
+	return NULL;
+}
+
+static int nwriters = 2;
+
+static void *writer(void *arg){
+	worker_t *w = arg;
+	uint64_t seed = 0x2545f4914f6cdd1dull * (uint64_t)(w->id + 1);
+
+	//this writer's clients: uids id + 1, id + 1 + nwriters, ...
+	int mine = (CHURN_CLIENTS - w->id + nwriters - 1) / nwriters;
+	client_t **in = calloc((size_t)mine, sizeof(client_t *));
+
+	while(!atomic_load(&stop)){
+		int i = (int)(next_rand(&seed) % (uint64_t)mine);
+		if(in[i]){
+			registry_remove(&reg, &in[i]->reg);
+			rcu_retire(in[i], free);
+			in[i] = NULL;
+		} else {
+			client_t *c = client_new(w->id + 1 + i * nwriters);
+			if(registry_add(&reg, &c->reg) < 0 || registry_set_name(&reg, &c->reg) < 0){
+				atomic_fetch_add(&errors, 1);
+				registry_remove(&reg, &c->reg);
+				rcu_retire(c, free);
+			} else {
+				in[i] = c;
+			}
+		}
+		w->churns++;
+
+		//a crowd leaving and coming back, so the tables get rebuilt while they're read.
+		if(w->churns % 20000 == 0){
+			for(int j = 0; j < mine; j += 2){
+				if(in[j]){
+					registry_remove(&reg, &in[j]->reg);
+					rcu_retire(in[j], free);
+					in[j] = NULL;
+				}
+			}
+		}
+	}
+
+	for(int i = 0; i < mine; i++){
+		if(in[i]){
+			registry_remove(&reg, &in[i]->reg);
+			rcu_retire(in[i], free);
+		}
+	}
+	free(in);
+	return NULL;
+}
+
+static void churn(int nreaders, int seconds){
+	pthread_t *tids = malloc(sizeof(pthread_t) * (size_t)(nreaders + nwriters));
+	worker_t *workers = calloc((size_t)(nreaders + nwriters), sizeof(worker_t));
+
+	for(int i = 0; i < nreaders + nwriters; i++){
+		workers[i].id = i < nreaders ? i : i - nreaders;
+		pthread_create(&tids[i], NULL, i < nreaders ? reader : writer, &workers[i]);
+	}
+	sleep((unsigned)seconds);
+	atomic_store(&stop, 1);
+
+	long lookups = 0, walks = 0, churns = 0;
+	for(int i = 0; i < nreaders + nwriters; i++){
+		pthread_join(tids[i], NULL);
+		lookups += workers[i].lookups;
+		walks += workers[i].walks;
+		churns += workers[i].churns;
+	}
+	printf("churn: %d readers, %d writers, %d s: %ld lookups, %ld walks, %ld adds and removes, %ld left\n",
+		nreaders, nwriters, seconds, lookups, walks, churns, (long)registry_count(&reg));
+	free(tids);
+	free(workers);
+}
+
+static void usage(char *prog){
+	fprintf(stderr, "Usage: %s [-c clients] [-r readers] [-w writers] [-s seconds]\n", prog);
+}
+
+int main(int argc, char **argv){
+	int clients = 200000, nreaders = 4, seconds = 2, opt;
+
+	while((opt = getopt(argc, argv, "c:r:w:s:")) != -1){
+		switch(opt){
+		case 'c':
+			clients = atoi(optarg);
+			break;
+		case 'r':
+			nreaders = atoi(optarg);
+			break;
+		case 'w':
+			nwriters = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(optind != argc || clients < 1 || nreaders < 0 || nwriters < 1 || seconds < 0){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(registry_init(&reg) < 0){
+		return EXIT_FAILURE;
+	}
+
+	time_ops(clients);
+	churn(nreaders, seconds);
+
+	long bad = atomic_load(&errors);
+	if(bad > 0){
+		printf("%ld lookups or walks went wrong\n", bad);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/*
+ * File: bench/room_fanout.c
+ * Project: CSCI 3160 Chat Project
+ * Description: How long a message to one room takes to reach that room's members, with N other rooms around.
+ *
+ *	Fills the server with `rooms` unrelated rooms of 4 idle members each, then puts one sender and
+ *	`members` receivers in #bench, and times every message from the sender's send() until the last
+ *	receiver has it. With per-room member lists the time shouldn't move as the unrelated rooms grow.
+ *	-s puts the idle clients in #bench too (everyone in one room, the way the server used to work),
+ *	for comparison. -c times joins and parts instead: one more client joins #bench and parts it again,
+ *	rounds times, each from its send() until the server says it's done. With -s that's joining and
+ *	leaving a room of everyone, which shouldn't cost more than joining a small one.
+ *
+ * Usage: bench/room_fanout [-m members] [-n messages] [-s] [-c rounds] <port> <rooms>
+ *	bench/room_fanout.sh runs it against a fresh server for a few room counts.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "../irc_proto.h"
+
+#define ROOM_SIZE 4
+
+static long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b){
+	long x = *(const long *)a, y = *(const long *)b;
+	return (x > y) - (x < y);
+}
+
+/// @brief connects, sends our name, moves into room and out of the lobby.
+/// @return the socket, or -1.
+static int join_as(int port, const char *name, const char *room){
+	struct sockaddr_in addr;
+	char cmd[64];
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(port);
+	if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+		perror("connect");
+		return -1;
+	}
+
+	irc_send_frame(fd, IRC_JOIN, name, strlen(name));
+	snprintf(cmd, sizeof(cmd), "join %s", room);
+	irc_send_frame(fd, IRC_CONTROL, cmd, strlen(cmd));
+	if(strcmp(room, "#lobby") != 0){
+		irc_send_frame(fd, IRC_CONTROL, "part #lobby", 11);
+	}
+	return fd;
+}
+
+/// @brief reads until the receiver has been sent the chat line `want`.
+/// @return 0 once it has, -1 if the connection went away.
+static int wait_for(int fd, irc_reader_t *r, const char *want, size_t len){
+	irc_frame_t f;
+	while(1){
+		int got;
+		while((got = irc_reader_next(r, &f)) == 1){
+			irc_msg_t m;
+			if(f.type == IRC_CHAT && f.len == len && memcmp(f.payload, want, len) == 0){
+				return 0;
+			}
+			if(f.type == IRC_MSG && irc_msg_parse(f.payload, f.len, f.flags, &m) == 0 && m.len == len
+				&& memcmp(m.text, want, len) == 0){
+				return 0;
+			}
+		}
+		if(got < 0 || irc_reader_fill(r, fd) <= 0){
+			return -1;
+		}
+	}
+}
+
+/// @brief throws away whatever the receivers have been sent so far (join notices and such).
+static void drain(int *fds, irc_reader_t *readers, int n){
+	struct pollfd pfd;
+	irc_frame_t f;
+	for(int i = 0; i < n; i++){
+		pfd.fd = fds[i];
+		pfd.events = POLLIN;
+		while(irc_reader_next(&readers[i], &f) == 1 || (poll(&pfd, 1, 0) > 0 && irc_reader_fill(&readers[i], fds[i]) > 0)){
+			//skip it.
+		}
+	}
+}
+
+/// @brief joins #bench and parts it again, rounds times, from a client that talks in #home in between
+//			(so both say "Now talking in ..."), and times each round into lat.
+/// @return 0, or -1 if the connection went away.
+static int time_churn(int port, int rounds, long *lat){
+	static const char in_bench[] = "Now talking in #bench.\n", in_home[] = "Now talking in #home.\n";
+	irc_reader_t r;
+	irc_reader_init(&r);
+
+	int fd = join_as(port, "bench_churner", "#home");
+	if(fd < 0 || wait_for(fd, &r, in_home, sizeof(in_home) - 1) < 0){
+		return -1;
+	}
+	for(int i = 0; i < rounds; i++){
+		long t0 = now_ns();
+		irc_send_frame(fd, IRC_CONTROL, "join #bench", 11);
+		if(wait_for(fd, &r, in_bench, sizeof(in_bench) - 1) < 0){
+			fprintf(stderr, "the churner lost its connection\n");
+			return -1;
+		}
+		irc_send_frame(fd, IRC_CONTROL, "part #bench", 11);
+		if(wait_for(fd, &r, in_home, sizeof(in_home) - 1) < 0){
+			fprintf(stderr, "the churner lost its connection\n");
+			return -1;
+		}
+		lat[i] = now_ns() - t0;
+	}
+	return 0;
+}
+
+static void usage(char *prog){
+	fprintf(stderr, "Usage: %s [-m members] [-n messages] [-s] [-c rounds] <port> <rooms>\n", prog);
+}
+
+int main(int argc, char **argv){
+	int members = 8, messages = 2000, shared = 0, rounds = 0, opt;
+
+	while((opt = getopt(argc, argv, "m:n:sc:")) != -1){
+		switch(opt){
+		case 'm':
+			members = atoi(optarg);
+			break;
+		case 'n':
+			messages = atoi(optarg);
+			break;
+		case 's':
+			shared = 1;
+			break;
+		case 'c':
+			rounds = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(optind != argc - 2 || members < 1 || messages < 1){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	int port = atoi(argv[optind]);
+	int rooms = atoi(argv[optind + 1]);
+
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0){
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	//the unrelated rooms. These clients never read; they're only there to be skipped.
+	int nidle = rooms * ROOM_SIZE;
+	int *idle = malloc(sizeof(int) * (size_t)(nidle + 1));
+	char name[32], room[32];
+	for(int i = 0; i < nidle; i++){
+		snprintf(name, sizeof(name), "idle%d", i);
+		snprintf(room, sizeof(room), "#room%d", i / ROOM_SIZE);
+		if((idle[i] = join_as(port, name, shared ? "#bench" : room)) < 0){
+			return EXIT_FAILURE;
+		}
+
+		//let the server keep up, so its accept backlog never overflows.
+		if(i % 256 == 255){
+			usleep(20000);
+		}
+	}
+
+	int sender = join_as(port, "bench_sender", "#bench");
+	int *recv_fd = malloc(sizeof(int) * (size_t)members);
+	irc_reader_t *readers = malloc(sizeof(irc_reader_t) * (size_t)members);
+	for(int i = 0; i < members; i++){
+		snprintf(name, sizeof(name), "bench%d", i);
+		recv_fd[i] = join_as(port, name, "#bench");
+		irc_reader_init(&readers[i]);
+		if(recv_fd[i] < 0){
+			return EXIT_FAILURE;
+		}
+	}
+	if(sender < 0){
+		return EXIT_FAILURE;
+	}
+
+	//everyone has to be in #bench before the first message, or it'll never reach them.
+	//The server may still be working through the idle clients' joins at this point.
+	static const char joined[] = "Now talking in #bench.\n";
+	for(int i = 0; i < members; i++){
+		if(wait_for(recv_fd[i], &readers[i], joined, sizeof(joined) - 1) < 0){
+			fprintf(stderr, "receiver %d never made it into #bench\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	usleep(200000);
+	drain(recv_fd, readers, members);
+
+	long *lat = malloc(sizeof(long) * (size_t)(rounds > 0 ? rounds : messages));
+	char line[64];
+	if(rounds > 0){
+		messages = rounds;
+		if(time_churn(port, rounds, lat) < 0){
+			return EXIT_FAILURE;
+		}
+	} else {
+		for(int i = 0; i < messages; i++){
+			int len = snprintf(line, sizeof(line), "bench %d", i);
+			long t0 = now_ns();
+			irc_send_frame(sender, IRC_CHAT, line, (uint32_t)len);
+			for(int r = 0; r < members; r++){
+				if(wait_for(recv_fd[r], &readers[r], line, (size_t)len) < 0){
+					fprintf(stderr, "receiver %d lost its connection\n", r);
+					return EXIT_FAILURE;
+				}
+			}
+			lat[i] = now_ns() - t0;
+		}
+	}
+
+	qsort(lat, (size_t)messages, sizeof(long), cmp_long);
+	double sum = 0;
+	for(int i = 0; i < messages; i++){
+		sum += (double)lat[i];
+	}
+	printf("%-8s %8d %8d %10.1f %10.1f %10.1f\n", rounds > 0 ? "churn" : shared ? "shared" : "rooms", rooms,
+		nidle + members + 1 + (rounds > 0),
+		sum / messages / 1000.0, lat[messages / 2] / 1000.0, lat[(long)messages * 99 / 100] / 1000.0);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+#
+# room_fanout.sh: shows that delivering to a room costs the same however many other rooms there are.
+#
+# For each room count, starts a fresh ./server (epoll mode), fills it with that many unrelated
+# 4-member rooms, and times messages from one sender to the 8 other members of #bench
+# (bench/room_fanout.c). Then does the same with everyone in #bench, which is what every message
+# cost before rooms existed. Times are microseconds from send until the last member has it.
+# Last, "churn" times one more client joining and parting the room of everyone, over and over
+# (microseconds per join and part), which shouldn't grow with the room.
+#
+# Usage: bench/room_fanout.sh [port] [room counts...]
+#   e.g. bench/room_fanout.sh 8991 0 100 1000 2000
+
+PORT=${1:-8991}
+shift
+COUNTS=${*:-0 100 1000}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ ! -x "$ROOT/server" ] || [ ! -x "$ROOT/bench/room_fanout" ]; then
+	echo "Build the server and bench/room_fanout first (make bench_rooms)."
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+cd "$WORKDIR" || exit 1
+
+printf "%-8s %8s %8s %10s %10s %10s\n" "setup" "rooms" "clients" "mean_us" "p50_us" "p99_us"
+
+for shared in "" "-s" "-s -c 2000"; do
+	for rooms in $COUNTS; do
+		"$ROOT/server" -m epoll -r 0 -R 0 "$PORT" > /dev/null 2>&1 &
+		pid=$!
+		sleep 0.3
+
+		"$ROOT/bench/room_fanout" $shared "$PORT" "$rooms"
+
+		kill "$pid"
+		wait "$pid" 2>/dev/null
+	done
+done
+
+rm -rf "$WORKDIR"
@@ -0,0 +1,61 @@
+#!/usr/bin/env bash
+#
+# syscalls.sh: how many syscalls the server spends per message it delivers, with and without batching.
+#
+# Runs bench/loadgen against a fresh ./server for each setup below, then reads the server's own
+# syscall counters off its admin socket (recv, write/writev/TCP_CORK, epoll_wait/poll and epoll_ctl
+# on client sockets; see irc_metrics.c) and divides by the messages it delivered:
+#   threaded      one thread per client, one write() per recipient per message
+#   epoll -l off  one write() per recipient per message, like epoll mode did before batching
+#   epoll         messages batched per recipient for one loop round, then one writev each (the default)
+#   epoll -l 1000 the same, but a batch may wait up to 1ms for more to join it
+#   uring         batched like epoll, but on io_uring: a pass's recvs and sends all go in with the one
+#                 io_uring_enter that waits for the next pass (counted as a wait, not as reads or writes)
+# Busy rooms are where batching pays, so by default it's 500 connections in rooms of 50 at 5000 msg/s.
+# Needs curl (to read the admin socket).
+#
+# Usage: [CONNS=500] [GROUP=50] [RATE=5000] [SIZE=64] [DURATION=5] bench/syscalls.sh [port]
+
+PORT=${1:-8993}
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+
+if [ ! -x "$ROOT/server" ] || [ ! -x "$ROOT/bench/loadgen" ]; then
+	echo "Build the server and bench/loadgen first (make bench_syscalls)."
+	exit 1
+fi
+if ! command -v curl > /dev/null; then
+	echo "syscalls.sh reads the server's counters with curl, which isn't installed."
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+cd "$WORKDIR" || exit 1
+
+printf "%-14s %10s %10s %10s %10s %10s %12s %14s %10s %10s\n" "setup" "delivered" "recv" "write" \
+	"wait" "ctl" "writes/msg" "syscalls/msg" "p50_us" "p99_us"
+
+for setup in "threaded" "epoll -l off" "epoll" "epoll -l 1000" "uring"; do
+	"$ROOT/server" -m $setup -r 0 -a "$WORKDIR/admin.sock" "$PORT" > /dev/null 2>&1 &
+	pid=$!
+	sleep 0.3
+
+	lg=$("$ROOT/bench/loadgen" -t -c "${CONNS:-500}" -g "${GROUP:-50}" -r "${RATE:-5000}" -s "${SIZE:-64}" \
+		-d "${DURATION:-5}" "$PORT" | tail -1)
+
+	curl -s --unix-socket "$WORKDIR/admin.sock" http://localhost/metrics | awk -v setup="$setup" -v lg="$lg" '
+		{ v[$1] = $2 }
+		END {
+			split(lg, f, "\t")
+			msgs = v["chat_messages_sent_total"]
+			rd = v["chat_read_calls_total"]; wr = v["chat_write_calls_total"]
+			wt = v["chat_poll_calls_total"]; ctl = v["chat_epoll_ctl_calls_total"]
+			n = msgs ? msgs : 1
+			printf "%-14s %10d %10d %10d %10d %10d %12.3f %14.3f %10s %10s\n", setup, msgs, rd, wr, wt, ctl,
+				wr / n, (rd + wr + wt + ctl) / n, f[8], f[10]
+		}'
+
+	kill "$pid"
+	wait "$pid" 2>/dev/null
+done
+
+rm -rf "$WORKDIR"
@@ -8,15 +8,18 @@
  * Usage: (See the readme.txt)
  *  Navigate to your folder containing irc_client.c and irc_server.c.
  *	Login to your WSL by typing in "wsl -d Ubuntu-3160 -u csci3160".
- *	Build irc_server.c by typing in "gcc -o server irc_server.c" in your Powershell. 
+ *	Build irc_server.c the way its own header (or readme.txt) says; it's built from more files than this one. 
  *	Afterwards, build irc_client.c by typing in "gcc -o client irc_client.c". 
  *
- *	Alternatively, you can build with "make" if the Makefile is present.
+ *	Alternatively, you can build both with "make build" (the Makefile's SERVER_SRC lists the server's files).
  *
  *	Launch the server on port 8888 by typing in "./server 8888".
  *	Launch the client on port 8888 by typing in "./client 8888". 
  *	You may launch multiple clients by opening different powershells and doing steps 1, 2, and 5.
  *	Type in the name of the client and press enter. Congrats! You (the client) have connected!
+ *
+ *	"./client -n bot -f lines.txt 8888" runs it as a bot instead: every line of lines.txt (or of stdin, with -f -)
+ *	is sent as fast as the connection takes it (or -r <lines a second>), and it leaves at the end of the file.
  * Version: Stable 1
  * 
  * This code was based off of a few sources:
@@ -32,27 +35,118 @@
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
-#include <pthread.h>
+#include <time.h>
+
+#include "irc_proto.h"
 
 #define LENGTH 2048
 
+/// @brief reconnecting: the first wait, the longest wait, and how long we keep trying (the server's default grace).
+#define RECONNECT_MIN_MS 100
+#define RECONNECT_MAX_MS 4000
+#define RECONNECT_GIVE_UP_MS 30000
+
+/// @brief how many of the latest sequence numbers we remember, to skip a message we're sent twice.
+#define SEEN_SZ 64
+
+/// @brief we stop taking lines from the input while this much is waiting to go out to the server.
+#define OUT_HIGH (256 * 1024)
+
+/// @brief how many rooms' rosters (and last message numbers) we keep (the server lets us be in 16 rooms).
+#define ROSTERS 16
+
 // Global variables
 
 /// @brief https://stackoverflow.com/questions/16057213/volatile-keyword-in-c: 
 /// "Basically, volatile tells the compiler 'the value here might be changed by something external to this program'."
 volatile sig_atomic_t flag = 0;
 
+/// @brief set once we sent LEAVE, so the server hanging up on us isn't taken for a dropped connection.
+int leaving = 0;
+
 /// @brief Socket file descriptor. https://stackoverflow.com/questions/5256599/what-are-file-descriptors-explained-in-simple-terms
 /// @brief File Descriptor: "an integer number that uniquely represents an opened file for the process. If your process opens 10 files then your Process table will have 10 entries for file descriptors."
 int sockfd = 0;
 char name[32];
 
+/// @brief the room our lines go to, as the server last told us (CONTROL "room <name>").
+char room[32] = "#lobby";
+
+/// @brief what we need to pick our session back up if the connection drops: the token the server gave us
+//			(CONTROL "session <token> <seq>") and the highest message number we got, for rooms we got nothing from.
+char session_token[24] = "";
+uint64_t last_seq = 0;
+
+/// @brief the number of the last message we got in each room (MSG and ROSTER frames say which room), which is where
+//			a resume picks that room up. Rooms on different server threads don't keep pace with each other, so going by
+//			the highest number of all could skip one still on its way from another room when the connection dropped.
+struct {
+	char room[32];
+	uint64_t seq;
+} room_seqs[ROSTERS];
+
+/// @brief who sent MSG frames from which uid, as the server told us (IRC_USER), by uid % IRC_USER_SLOTS.
+struct {
+	uint32_t uid;
+	char name[32];
+} users[IRC_USER_SLOTS];
+
+/// @brief who's in each room we're in, as the server told us (IRC_ROSTER): the snapshot we got when we joined,
+//			with every delta since applied. version is the roster's version that makes; show is set while a snapshot
+//			waits to be printed once it's all in: 1 for the one we joined with (the first few names), 2 for one we
+//			asked for with /who (everyone).
+struct roster {
+	char room[32];
+	uint32_t version;
+	char (*names)[32];
+	size_t n;
+	size_t cap;
+	int show;
+} rosters[ROSTERS];
+
+/// @brief the room we asked the server for a roster of (/who before we had one), so it's printed when it comes.
+char who_pending[32] = "";
+
+/// @brief the latest message numbers we got, and the number of the CHAT (or MSG) frame coming next (0 if it has none).
+uint64_t seen[SEEN_SZ];
+unsigned nseen = 0;
+uint64_t next_seq = 0;
+
+struct sockaddr_in server_addr;
+
+/// @brief frames read from the server. Static because it holds a whole maximum-size frame.
+static irc_reader_t reader;
+
+/// @brief frames waiting to go out: [out_off, out_len) is still unsent. The socket is non-blocking,
+//			so nothing we send ever keeps us from reading.
+static char *out;
+static size_t out_len, out_off, out_cap;
+
+/// @brief what we read from the input that isn't a whole line yet (or wasn't handled yet).
+static char in[LENGTH * 4];
+static size_t in_len;
+static int in_fd = 0;
+static int in_eof = 0;
+
+/// @brief -f: the lines come from a file or a pipe, not a person (no prompt, no banner, leave at the end),
+//			-r: at most this many a second (0: as fast as the server takes them), -q: don't print what we get.
+static int scripted = 0;
+static int rate = 0;
+static int quiet = 0;
+
 /// @brief String Overwrite Standard Out.
 void str_overwrite_stdout() {
+	if (scripted) {
+		return;
+	}
   printf("%s", "> ");
 
   ///https://www.man7.org/linux/man-pages/man3/fflush.3.html: discards any buffered data that has been fetched from the underlying file, but has not been consumed by the application.
@@ -74,127 +168,616 @@ void str_trim_lf (char* arr, int length) {
 
 
 void catch_ctrl_c_and_exit(int sig) {
+    (void)sig;
     flag = 1;
 }
 
-/// @brief "Send Message Handler": This function manages sending messages to the server.
-void send_msg_handler() {
-  char message[LENGTH] = {};
-  char buffer[LENGTH + 32] = {};
+/// @brief nanoseconds on the monotonic clock.
+long long now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-  while(1) {
-  	str_overwrite_stdout();
+/// @brief queues one frame for the server. It goes out when the socket takes it (see out_flush).
+/// @return 0 on success, -1 if we're out of memory.
+int out_frame(int type, const char *payload, uint32_t len) {
+	if (out_off == out_len) {
+		out_off = out_len = 0;
+	}
+	if (out_len + IRC_FRAME_HDR + len > out_cap) {
+		//slide what's unsent to the front first, and only grow if that isn't enough.
+		memmove(out, out + out_off, out_len - out_off);
+		out_len -= out_off;
+		out_off = 0;
+		if (out_len + IRC_FRAME_HDR + len > out_cap) {
+			size_t cap = out_cap ? out_cap : 4096;
+			while (cap < out_len + IRC_FRAME_HDR + len) {
+				cap *= 2;
+			}
+			char *grown = realloc(out, cap);
+			if (!grown) {
+				return -1;
+			}
+			out = grown;
+			out_cap = cap;
+		}
+	}
+	irc_frame_header(out + out_len, type, 0, len);
+	memcpy(out + out_len + IRC_FRAME_HDR, payload, len);
+	out_len += IRC_FRAME_HDR + len;
+	return 0;
+}
 
-	//Accepts all user input on a line.
-    fgets(message, LENGTH, stdin);
+/// @brief sends as much of what's queued as the socket takes right now.
+/// @return 0 if the connection is fine, -1 if it broke.
+int out_flush(void) {
+	while (out_off < out_len) {
+		ssize_t n = send(sockfd, out + out_off, out_len - out_off, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		out_off += (size_t)n;
+	}
+	return 0;
+}
 
-	//Converts the first occurence of \n to \0.
-    str_trim_lf(message, LENGTH);
+/// @brief connects to the server, with TCP_NODELAY set, non-blocking from then on.
+/// @return the socket, or -1.
+int server_connect(void){
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
+		close(fd);
+		return -1;
+	}
 
+	//every line goes out as one whole frame as soon as it's typed, so don't let Nagle hold it back
+	//until the server ACKs the previous one.
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+/// @brief the slot for room (rlen bytes) in room_seqs, or with make, a fresh one for it (a free one, or the one
+//			with the oldest number: a room we left).
+/// @return its index, or -1.
+int room_seq_slot(const char *which, size_t rlen, int make) {
+	int slot = 0;
+	for (int i = 0; i < ROSTERS; i++) {
+		if (strlen(room_seqs[i].room) == rlen && memcmp(room_seqs[i].room, which, rlen) == 0) {
+			return i;
+		}
+		if (room_seqs[i].seq < room_seqs[slot].seq) {
+			slot = i;
+		}
+	}
+	if (!make) {
+		return -1;
+	}
+	memcpy(room_seqs[slot].room, which, rlen);
+	room_seqs[slot].room[rlen] = '\0';
+	room_seqs[slot].seq = 0;
+	return slot;
+}
+
+/// @brief remembers seq as the last message we got in the room a (numbered) MSG or ROSTER frame is for.
+//			A notice (CHAT) doesn't say its room; last_seq covers it.
+void room_got(irc_frame_t *frame, uint64_t seq) {
+	irc_msg_t m;
+	irc_roster_t rr;
+	const char *which;
+	size_t rlen;
+
+	if (frame->type == IRC_MSG && irc_msg_parse(frame->payload, frame->len, frame->flags, &m) == 0) {
+		which = m.room;
+		rlen = m.rlen;
+	} else if (frame->type == IRC_ROSTER && irc_roster_parse(frame->payload, frame->len, &rr) == 0) {
+		which = rr.room;
+		rlen = rr.rlen;
+	} else {
+		return;
+	}
+	if (rlen == 0 || rlen >= sizeof(room_seqs[0].room)) {
+		return;
+	}
+	int i = room_seq_slot(which, rlen, 1);
+	if (seq > room_seqs[i].seq) {
+		room_seqs[i].seq = seq;
+	}
+}
+
+/// @brief the connection dropped: connects again (waiting a little longer, with some jitter, after every
+//			failed try, so a server that just came back isn't hit by everyone at once) and resumes our session.
+//			Lines that were still waiting to go out are lost with the old connection.
+/// @return 0 once we're back, -1 if we have no session to resume or gave up.
+int reconnect(void) {
+	if (session_token[0] == '\0') {
+		return -1;
+	}
+	printf("\nConnection lost, reconnecting...\n");
+
+	//"<name> <token> <last seq>", and the last one we got in every room we got one in.
+	char resume[96 + ROSTERS * 56];
+	int n = snprintf(resume, sizeof(resume), "%s %s %llu", name, session_token, (unsigned long long)last_seq);
+	for (int i = 0; i < ROSTERS; i++) {
+		if (room_seqs[i].room[0] != '\0') {
+			n += snprintf(resume + n, sizeof(resume) - n, " %s %llu", room_seqs[i].room, (unsigned long long)room_seqs[i].seq);
+		}
+	}
+
+	int wait_ms = RECONNECT_MIN_MS, waited = 0;
+	while (!flag && waited < RECONNECT_GIVE_UP_MS) {
+		int nap = wait_ms / 2 + rand() % (wait_ms / 2 + 1);
+		struct timespec ts = { nap / 1000, (nap % 1000) * 1000000L };
+		nanosleep(&ts, NULL);
+		waited += nap;
+
+		int fd = server_connect();
+		if (fd >= 0) {
+			close(sockfd);
+			sockfd = fd;
+			out_off = out_len = 0;
+			irc_reader_init(&reader);
+			next_seq = 0;
+			return out_frame(IRC_RESUME, resume, (uint32_t)n);
+		}
+		if (wait_ms < RECONNECT_MAX_MS) {
+			wait_ms *= 2;
+		}
+	}
+	printf("Couldn't get back to the server.\n");
+	return -1;
+}
+
+/// @brief whether we got message seq already (it can come twice right after a resume), and remembers it if not.
+int seen_before(uint64_t seq) {
+	for (unsigned i = 0; i < SEEN_SZ && i < nseen; i++) {
+		if (seen[i] == seq) {
+			return 1;
+		}
+	}
+	seen[nseen++ % SEEN_SZ] = seq;
+	if (seq > last_seq) {
+		last_seq = seq;
+	}
+	return 0;
+}
+
+/// @brief the roster we keep for room (rlen bytes), or with make, a fresh one for it (the slot of one we gave up).
+/// @return it, or NULL.
+struct roster *roster_find(const char *name, size_t rlen, int make) {
+	struct roster *free_slot = NULL;
+	for (int i = 0; i < ROSTERS; i++) {
+		if (rosters[i].room[0] == '\0') {
+			free_slot = free_slot ? free_slot : &rosters[i];
+		} else if (strlen(rosters[i].room) == rlen && memcmp(rosters[i].room, name, rlen) == 0) {
+			return &rosters[i];
+		}
+	}
+	if (!make || !free_slot || rlen >= sizeof(free_slot->room)) {
+		return NULL;
+	}
+	memcpy(free_slot->room, name, rlen);
+	free_slot->room[rlen] = '\0';
+	free_slot->n = 0;
+	free_slot->version = 0;
+	free_slot->show = 1;
+	return free_slot;
+}
+
+/// @brief forgets a room's roster and last message number (we left it).
+void roster_drop(const char *name) {
+	struct roster *r = roster_find(name, strlen(name), 0);
+	if (r) {
+		r->room[0] = '\0';
+		r->n = 0;
+	}
+	int i = room_seq_slot(name, strlen(name), 0);
+	if (i >= 0) {
+		room_seqs[i].room[0] = '\0';
+		room_seqs[i].seq = 0;
+	}
+}
+
+/// @brief puts name (nlen bytes) in the roster, or takes it out.
+void roster_set(struct roster *r, const char *name, uint32_t nlen, int in) {
+	if (nlen >= sizeof(r->names[0])) {
+		return;
+	}
+	for (size_t i = 0; i < r->n; i++) {
+		if (strlen(r->names[i]) == nlen && memcmp(r->names[i], name, nlen) == 0) {
+			if (!in) {
+				memcpy(r->names[i], r->names[--r->n], sizeof(r->names[0]));
+			}
+			return;
+		}
+	}
+	if (!in) {
+		return;
+	}
+	if (r->n == r->cap) {
+		size_t cap = r->cap ? r->cap * 2 : 16;
+		char (*grown)[32] = realloc(r->names, sizeof(r->names[0]) * cap);
+		if (!grown) {
+			return;
+		}
+		r->names = grown;
+		r->cap = cap;
+	}
+	memcpy(r->names[r->n], name, nlen);
+	r->names[r->n++][nlen] = '\0';
+}
+
+/// @brief "In #dev (3): alice, bob, carol", everyone or (!all) the first few and how many more.
+void print_roster(struct roster *r, int all) {
+	printf("In %s (%zu): ", r->room, r->n);
+	for (size_t i = 0; i < r->n; i++) {
+		if (!all && i == IRC_ROSTER_SHOWN) {
+			printf("and %zu more", r->n - i);
+			break;
+		}
+		printf("%s%s", r->names[i], i + 1 < r->n ? ", " : "");
+	}
+	printf("\n");
+}
+
+/// @brief one line the user typed (or the script holds): a command, "exit", or a chat line.
+void handle_line(char *message) {
 	//Check for user input "exit".
     if (strcmp(message, "exit") == 0) {
-			break;
+			//let the server know we're leaving on purpose.
+			leaving = 1;
+			out_frame(IRC_LEAVE, NULL, 0);
+    } else if (strncmp(message, "/who", 4) == 0 && (message[4] == '\0' || message[4] == ' ')) {
+			//we have the roster already (and keep it up to date), unless we haven't heard of the room.
+			const char *which = message[4] ? message + 5 : room;
+			struct roster *r = roster_find(which, strlen(which), 0);
+			if (r) {
+				print_roster(r, 1);
+			} else {
+				snprintf(who_pending, sizeof(who_pending), "%s", which);
+				out_frame(IRC_CONTROL, message + 1, strlen(message + 1));
+			}
+    } else if (message[0] == '/') {
+			//commands go to the server as they are: "/join #dev", "/part", "/msg bob hi".
+			if (strncmp(message, "/part", 5) == 0 && (message[5] == '\0' || message[5] == ' ')) {
+				roster_drop(message[5] ? message + 6 : room);
+			}
+			out_frame(IRC_CONTROL, message + 1, strlen(message + 1));
     } else {
+	  //Send just the message, as one CHAT frame: the server adds the time and our name, and everyone's client
+	  //formats it like "[(time)] (username): (message)", or "[(time)] #(room) (username): (message)" outside the lobby.
+      out_frame(IRC_CHAT, message, strlen(message));
+    }
+}
 
-	  //https://stackoverflow.com/questions/1442116/how-to-get-the-date-and-time-values-in-a-c-program
-	  //Some variables. They're initialized to hold the time.
-	  time_t timeT = time(NULL);
-	  struct tm localTime = *localtime(&timeT);
-	  //timeString will hold the current time in a string format.
-	  char timeString[40];
+/// @brief "2023-12-06 18:00:01" for a MSG frame's time, local time. Formatted once a second, not once a message.
+const char *stamp_of(time_t sec) {
+	static time_t last = -1;
+	static char stamp[40];
+	if (sec != last) {
+		struct tm lt;
+		localtime_r(&sec, &lt);
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &lt);
+		last = sec;
+	}
+	return stamp;
+}
 
-	  //copy the time onto timeString.
-	  snprintf(timeString, sizeof(timeString), "%d-%02d-%02d %02d:%02d:%02d", localTime.tm_year + 1900, localTime.tm_mon + 1, localTime.tm_mday, localTime.tm_hour, localTime.tm_min, localTime.tm_sec);
+/// @brief prints a MSG frame, the way it used to come as text.
+void print_msg(irc_frame_t *frame) {
+	irc_msg_t m;
+	char line[LENGTH + 128];
 
-	  //Formats the message to be like: "[(time)] (username): (message)\n"
-      snprintf(buffer, sizeof(buffer)+44, "[%s] %s: %s\n", timeString, name, message);
+	if (irc_msg_parse(frame->payload, frame->len, frame->flags, &m) < 0) {
+		return;
+	}
+	if (!m.name) {
+		//the server tells us a name before its first message, so an unknown uid shouldn't happen.
+		m.name = users[m.uid % IRC_USER_SLOTS].uid == m.uid ? users[m.uid % IRC_USER_SLOTS].name : "?";
+		m.nlen = (uint32_t)strlen(m.name);
+	}
+	size_t len = irc_render(line, sizeof(line), stamp_of((time_t)m.time), m.room, m.rlen, m.name, m.nlen, m.text, m.len);
+	fwrite(line, 1, len, stdout);
+}
 
-	  //Send this formatted message (contained in buffer) to socket file descriptor (sockfd).
-      send(sockfd, buffer, strlen(buffer), 0);
-    }
+/// @brief a ROSTER frame: a snapshot replaces what we had for the room, a delta is applied (and printed, as the
+//			"[time] bob has joined #dev" notice) unless our snapshot was newer already. A delta from further on than
+//			the next version means we missed one: we ask for the whole roster again.
+void handle_roster(irc_frame_t *frame) {
+	irc_roster_t rr;
+	const char *who;
+	uint32_t at = 0, nlen;
+	int in;
+
+	if (irc_roster_parse(frame->payload, frame->len, &rr) < 0) {
+		return;
+	}
+	struct roster *r = roster_find(rr.room, rr.rlen, frame->flags & IRC_ROSTER_FULL);
 
-	//https://www.man7.org/linux/man-pages/man3/bzero.3.html: erases the data in the n bytes of the memory starting at the location pointed to by s, by writing zeros (bytes containing '\0') to that area.
-	//basically, erases content in message.
-	bzero(message, LENGTH);
+	if (frame->flags & IRC_ROSTER_FULL) {
+		if (!r || ((frame->flags & IRC_ROSTER_MORE) && r->version != rr.version)) {
+			return;
+		}
+		if (!(frame->flags & IRC_ROSTER_MORE)) {
+			if (strcmp(who_pending, r->room) == 0) {
+				r->show = 2;
+				who_pending[0] = '\0';
+			}
+			r->n = 0;
+			r->version = rr.version;
+		}
+		while (irc_roster_next(&rr, &at, &in, &who, &nlen)) {
+			roster_set(r, who, nlen, 1);
+		}
+		return;
+	}
 
-	//erase content in buffer.
-    bzero(buffer, LENGTH + 32);
-  }
+	if (r && rr.version <= r->version) {
+		return;
+	}
+	if (r) {
+		if (rr.version != r->version + 1) {
+			char ask[48];
+			int n = snprintf(ask, sizeof(ask), "who %s", r->room);
+			out_frame(IRC_CONTROL, ask, (uint32_t)n);
+		}
+		while (irc_roster_next(&rr, &at, &in, &who, &nlen)) {
+			roster_set(r, who, nlen, in);
+		}
+		r->version = rr.version;
+	}
+	if (!quiet) {
+		char line[LENGTH];
+		size_t len = irc_roster_render(line, sizeof(line), stamp_of((time_t)rr.time), &rr);
+		fwrite(line, 1, len, stdout);
+		str_overwrite_stdout();
+	}
+}
+
+/// @brief handles the lines waiting in the input buffer, as many as -r and the outgoing queue allow.
+/// @return how many milliseconds until -r lets the next one go (-1: no wait, the loop can just poll).
+int take_lines(void) {
+	static long long next_at = 0;
+
+	while (!leaving && out_len - out_off < OUT_HIGH) {
+		char *nl = memchr(in, '\n', in_len);
+
+		//a line longer than the buffer (or the last one, without a newline) counts as a line too.
+		size_t len = nl ? (size_t)(nl - in) : ((in_len == sizeof(in) || (in_eof && in_len > 0)) ? in_len : 0);
+		if (!nl && len == 0) {
+			return -1;
+		}
+		if (rate > 0) {
+			//lines are spaced evenly; one that's late (a slow connection) doesn't make the next ones bunch up.
+			long long now = now_ns(), gap = 1000000000LL / rate;
+			if (now < next_at) {
+				return (int)((next_at - now + 999999) / 1000000);
+			}
+			next_at = (next_at && now - next_at < gap) ? next_at + gap : now + gap;
+		}
+
+		char message[LENGTH];
+		size_t n = len < LENGTH - 1 ? len : LENGTH - 1;
+		memcpy(message, in, n);
+		message[n] = '\0';
+		str_trim_lf(message, (int)n);
+		if (n > 0 && message[n - 1] == '\r') {
+			message[n - 1] = '\0';
+		}
+		size_t used = nl ? len + 1 : len;
+		memmove(in, in + used, in_len - used);
+		in_len -= used;
 
-  //User can also exit the program using CTRL+C.
-  catch_ctrl_c_and_exit(2);
+		if (message[0] != '\0') {
+			handle_line(message);
+			str_overwrite_stdout();
+		}
+	}
+	return -1;
 }
 
-/// @brief "Recieve Message Handler": This function manages recieving messages from the server.
-void recv_msg_handler() {
-	char message[LENGTH] = {};
-  while (1) {
-		//recieve messages from the socket file descriptor.
-		int receive = recv(sockfd, message, LENGTH, 0);
-    if (receive > 0) {
-      printf("%s", message);
-      str_overwrite_stdout();
-    } else if (receive == 0) {
-			break;
-    } else {
-			// -1
+/// @brief reads what the server sent and handles every frame that's whole now.
+//			One recv can hold part of a frame or several of them, so everything goes through the frame reader.
+/// @return 0 to go on, -1 if the server hung up (or broke) and we couldn't resume.
+int handle_server(void) {
+	irc_frame_t frame;
+
+	//recieve messages from the socket file descriptor.
+	ssize_t receive = irc_reader_fill(&reader, sockfd);
+	if (receive < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return 0;
+	}
+	if (receive <= 0) {
+		//hung up (0) or broke (-1): pick the session back up, unless we're the ones leaving.
+		return (flag || leaving || reconnect() < 0) ? -1 : 0;
+	}
+
+	int r;
+	while ((r = irc_reader_next(&reader, &frame)) == 1) {
+		if (frame.type == IRC_SEQ && frame.len == IRC_SEQ_LEN) {
+			next_seq = irc_seq_value(frame.payload);
+		} else if (frame.type == IRC_ROSTER) {
+			//a delta comes numbered, like a MSG; a snapshot doesn't.
+			uint64_t seq = next_seq;
+			next_seq = 0;
+			if (!seq || !seen_before(seq)) {
+				handle_roster(&frame);
+			}
+			if (seq) {
+				room_got(&frame, seq);
+			}
+		} else if (frame.type == IRC_CHAT || frame.type == IRC_MSG) {
+			uint64_t seq = next_seq;
+			next_seq = 0;
+			if (seq) {
+				room_got(&frame, seq);
+			}
+			if ((seq && seen_before(seq)) || quiet) {
+				continue;
+			}
+			if (frame.type == IRC_MSG) {
+				print_msg(&frame);
+			} else {
+				fwrite(frame.payload, 1, frame.len, stdout);
+			}
+			str_overwrite_stdout();
+		} else if (frame.type == IRC_USER && frame.len > 4) {
+			//"uid name": who MSG frames from that uid are from.
+			uint32_t uid = irc_be32(frame.payload);
+			size_t len = frame.len - 4 < sizeof(users[0].name) ? frame.len - 4 : sizeof(users[0].name) - 1;
+			users[uid % IRC_USER_SLOTS].uid = uid;
+			memcpy(users[uid % IRC_USER_SLOTS].name, frame.payload + 4, len);
+			users[uid % IRC_USER_SLOTS].name[len] = '\0';
+		} else if (frame.type == IRC_CONTROL && frame.len > 8 && frame.len < 64 && memcmp(frame.payload, "session ", 8) == 0) {
+			//"session <token> <seq>": how to resume, and the latest message before we were in.
+			char line[64];
+			unsigned long long seq = 0;
+			memcpy(line, frame.payload, frame.len);
+			line[frame.len] = '\0';
+			sscanf(line, "session %23s %llu", session_token, &seq);
+			if (seq > last_seq) {
+				last_seq = seq;
+			}
+		} else if (frame.type == IRC_PING) {
+			//the server hadn't heard from us for a while: still here.
+			out_frame(IRC_PONG, frame.payload, frame.len);
+		} else if (frame.type == IRC_CONTROL && frame.len >= 4 && memcmp(frame.payload, "room", 4) == 0) {
+			//the server moved us to another room ("room #dev"), or out of all of them ("room").
+			size_t len = frame.len > 5 ? frame.len - 5 : 0;
+			if (len >= sizeof(room)) {
+				len = sizeof(room) - 1;
+			}
+			memcpy(room, frame.payload + 5, len);
+			room[len] = '\0';
 		}
-		//https://www.man7.org/linux/man-pages/man3/memset.3.html: The memset() function fills the first n bytes of the memory area pointed to by s with the constant byte c.
-		memset(message, 0, sizeof(message));
-  }
+	}
+	if (r < 0) {
+		printf("\nERROR: the server sent something that isn't a frame\n");
+		return -1;
+	}
+
+	//snapshots are printed once everything that came is in: a big one comes in several frames.
+	for (int i = 0; i < ROSTERS; i++) {
+		if (rosters[i].show && rosters[i].room[0]) {
+			if (!quiet) {
+				print_roster(&rosters[i], rosters[i].show == 2);
+				str_overwrite_stdout();
+			}
+			rosters[i].show = 0;
+		}
+	}
+	if (scripted) {
+		fflush(stdout);
+	}
+	return 0;
+}
+
+/// @brief reads the name a line at a time, one byte per read, so nothing after it is taken out of the input.
+void read_name(void) {
+	size_t n = 0;
+	char c;
+	while (n < sizeof(name) - 1 && read(0, &c, 1) == 1 && c != '\n') {
+		name[n++] = c;
+	}
+	name[n] = '\0';
+	if (n > 0 && name[n - 1] == '\r') {
+		name[n - 1] = '\0';
+	}
 }
 
-/// @brief The main function, which handles user input messages.
+void usage(char *prog) {
+	printf("Usage: %s [-n name] [-f file|-] [-r lines_per_sec] [-q] <port>\n", prog);
+}
+
+/// @brief The main function: one loop waits on the server and the input (the keyboard, or -f's file)
+//			with poll, and handles whichever is ready. Nothing spins and nothing blocks on just one of them.
 /// @param argc 
 /// @param argv 
 /// @return 
 int main(int argc, char **argv){
-	if(argc != 2){
-		printf("Usage: %s <port>\n", argv[0]);
+	int opt;
+	const char *script = NULL;
+
+	while ((opt = getopt(argc, argv, "n:f:r:q")) != -1) {
+		switch (opt) {
+		case 'n':
+			strncpy(name, optarg, sizeof(name) - 1);
+			break;
+		case 'f':
+			script = optarg;
+			scripted = 1;
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1 || rate < 0) {
+		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 
 	char *ip = "127.0.0.1";
-	int port = atoi(argv[1]);
+	int port = atoi(argv[optind]);
+
+	if (script && strcmp(script, "-") != 0) {
+		in_fd = open(script, O_RDONLY);
+		if (in_fd < 0) {
+			perror("ERROR: can't open the script");
+			return EXIT_FAILURE;
+		}
+	}
 
 	//Whenever we press CTRL+C
 	signal(SIGINT, catch_ctrl_c_and_exit);
 
-	printf("Please enter your name: ");
-
-	//fgets accepts all user input on the line.
-	fgets(name, 32, stdin);
-
-	//Null-terminate the line.
-	str_trim_lf(name, strlen(name));
-
+	if (name[0] == '\0') {
+		if (!scripted) {
+			printf("Please enter your name: ");
+			fflush(stdout);
+		}
+		read_name();
+	}
 
 	if (strlen(name) > 32 || strlen(name) < 2){
 		printf("Name must be less than 30 and more than 2 characters.\n");
 		return EXIT_FAILURE;
 	}
 
-	struct sockaddr_in server_addr;
-
 	/* Socket settings */
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
   server_addr.sin_family = AF_INET;
   server_addr.sin_addr.s_addr = inet_addr(ip);
   server_addr.sin_port = htons(port);
 
-
   // Connect to Server through socket file descriptor and server address (and size of server address)
-  int err = connect(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+  sockfd = server_connect();
 
-  //err -1 signifies that we failed to connect to the server.
-  if (err == -1) {
+  //-1 signifies that we failed to connect to the server.
+  if (sockfd == -1) {
 		printf("ERROR: connect\n");
 		return EXIT_FAILURE;
 	}
+	srand((unsigned)time(NULL) ^ (unsigned)getpid());
+	irc_reader_init(&reader);
 
-	// Send name to the server through the socket file descriptor.
-	send(sockfd, name, 32, 0);
+	// Send name to the server through the socket file descriptor. It's the JOIN frame.
+	out_frame(IRC_JOIN, name, strlen(name));
 
+	if (!scripted) {
 	printf("   _____ _               _     _   _____  _                       _ \n");
   	printf("  / ____| |             (_)   | | |  __ \\(_)                     | |\n");
  	printf(" | (___ | |_ _   _ _ __  _  __| | | |  | |_ ___  ___ ___  _ __ __| |\n");
@@ -203,34 +786,66 @@ int main(int argc, char **argv){
  	printf(" |_____/ \\__|\\__,_| .__/|_|\\__,_| |_____/|_|___/\\___\\___/|_|  \\__,_|\n");
  	printf("                  | |                                               \n");
  	printf("                  |_|                                               \n");
+	}
+	str_overwrite_stdout();
 
+	while (!flag) {
+		int wait = take_lines();
+		if (out_flush() < 0 && (leaving || reconnect() < 0)) {
+			break;
+		}
 
-	//assigns the send_msg_thread function to a thread - meaning it can run independently while you are typing something, etc.
-	pthread_t send_msg_thread;
+		//we said goodbye and it went out: done. Running out of input (Ctrl+D, or the end of the script) says goodbye too.
+		if (leaving && out_off == out_len) {
+			break;
+		}
+		if (in_eof && in_len == 0 && !leaving) {
+			leaving = 1;
+			out_frame(IRC_LEAVE, NULL, 0);
+			continue;
+		}
 
-	//if we fail to assign send_msg_thread function to the thread.
-  if(pthread_create(&send_msg_thread, NULL, (void *) send_msg_handler, NULL) != 0){
-		printf("ERROR: pthread\n");
-    return EXIT_FAILURE;
-	}
+		struct pollfd pfd[2];
+		int nfds = 1;
+		pfd[0].fd = sockfd;
+		pfd[0].events = POLLIN | (out_off < out_len ? POLLOUT : 0);
 
-	//assigns the recv_msg_thread function to a thread - meaning it can run independently while you are typing something, etc.
-	pthread_t recv_msg_thread;
+		//only read more input once what we have is handled, so a fast script can't outrun the connection.
+		if (!in_eof && !leaving && in_len < sizeof(in) && !memchr(in, '\n', in_len)) {
+			pfd[1].fd = in_fd;
+			pfd[1].events = POLLIN;
+			nfds = 2;
+		}
 
-	//if we fail to assign recv_msg_thread function to the thread.
-  if(pthread_create(&recv_msg_thread, NULL, (void *) recv_msg_handler, NULL) != 0){
-		printf("ERROR: pthread\n");
-		return EXIT_FAILURE;
-	}
+		if (poll(pfd, nfds, wait) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("ERROR: poll");
+			break;
+		}
 
-	//if, at any point, we exit the program, print a message saying "bye" before we leave the program.
-	while (1){
-		if(flag){
-			printf("\nBye\n");
+		if ((pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) && handle_server() < 0) {
 			break;
-    }
+		}
+		if (nfds == 2 && (pfd[1].revents & (POLLIN | POLLHUP | POLLERR))) {
+			ssize_t n = read(in_fd, in + in_len, sizeof(in) - in_len);
+			if (n > 0) {
+				in_len += (size_t)n;
+			} else if (n == 0 || errno != EINTR) {
+				in_eof = 1;
+			}
+		}
+	}
+
+	//Ctrl+C: still try to say goodbye, so the server doesn't keep our session around for us to come back.
+	if (flag && !leaving) {
+		out_frame(IRC_LEAVE, NULL, 0);
+		out_flush();
 	}
 
+	//if, at any point, we exit the program, print a message saying "bye" before we leave the program.
+	printf("\nBye\n");
 	close(sockfd);
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,69 @@
+/*
+ * File: irc_clock.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The cached clock behind irc_clock.h.
+ */
+
+#include <stdatomic.h>
+#include <sched.h>
+
+#include "irc_clock.h"
+
+static clock_tick_t slots[CLOCK_SLOTS];
+static _Atomic(clock_tick_t *) current = NULL;
+
+/// @brief held by whoever is formatting the new second. Nobody waits on it: the others use the old tick.
+static atomic_flag updating = ATOMIC_FLAG_INIT;
+
+void clock_day(time_t when, struct tm *lt, time_t *start, time_t *end){
+	struct tm day;
+
+	localtime_r(&when, lt);
+
+	//midnight today and midnight tomorrow. mktime sorts out month ends and DST.
+	day = *lt;
+	day.tm_hour = day.tm_min = day.tm_sec = 0;
+	day.tm_isdst = -1;
+	*start = mktime(&day);
+	day.tm_mday++;
+	day.tm_isdst = -1;
+	*end = mktime(&day);
+}
+
+const clock_tick_t *clock_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+
+	clock_tick_t *t = atomic_load_explicit(&current, memory_order_acquire);
+	if(t && t->sec == ts.tv_sec){
+		return t;
+	}
+
+	if(atomic_flag_test_and_set_explicit(&updating, memory_order_acquire)){
+		//someone else is on it. The old second will do, unless there isn't one yet.
+		while(!t){
+			sched_yield();
+			t = atomic_load_explicit(&current, memory_order_acquire);
+		}
+		return t;
+	}
+
+	clock_tick_t *fresh = &slots[(unsigned long)ts.tv_sec % CLOCK_SLOTS];
+	struct tm lt;
+
+	fresh->sec = ts.tv_sec;
+	if(t && ts.tv_sec >= t->day_start && ts.tv_sec < t->day_end){
+		//same day as before: only the time of day changed.
+		localtime_r(&ts.tv_sec, &lt);
+		fresh->day_start = t->day_start;
+		fresh->day_end = t->day_end;
+	} else {
+		clock_day(ts.tv_sec, &lt, &fresh->day_start, &fresh->day_end);
+	}
+	strftime(fresh->stamp, sizeof(fresh->stamp), "%Y-%m-%d %H:%M:%S", &lt);
+	strftime(fresh->date, sizeof(fresh->date), "%Y-%m-%d", &lt);
+
+	atomic_store_explicit(&current, fresh, memory_order_release);
+	atomic_flag_clear_explicit(&updating, memory_order_release);
+	return fresh;
+}
@@ -0,0 +1,41 @@
+/*
+ * File: irc_clock.h
+ * Project: CSCI 3160 Chat Project
+ * Description: The wall clock, formatted once a second instead of once a message.
+ *
+ *	clock_now() reads the coarse real-time clock (no system call, just the kernel's last tick)
+ *	and hands back the current second already formatted. The first caller in a new second
+ *	formats it into the next of CLOCK_SLOTS ticks and publishes it with one atomic store;
+ *	everyone else just loads the pointer. A tick is never rewritten until CLOCK_SLOTS seconds
+ *	later, so a reader can keep using the one it got for that long without a lock.
+ *	(nginx's cached time works the same way.)
+ */
+
+#ifndef IRC_CLOCK_H
+#define IRC_CLOCK_H
+
+#include <time.h>
+
+#define CLOCK_SLOTS 64
+
+typedef struct{
+	/// @brief the second this tick is for.
+	time_t sec;
+
+	/// @brief midnight at the start and at the end of that second's local day.
+	time_t day_start;
+	time_t day_end;
+
+	/// @brief "2023-12-06 18:00:01" and "2023-12-06", local time.
+	char stamp[40];
+	char date[16];
+} clock_tick_t;
+
+/// @brief the current second, formatted. Safe to call from any thread; never blocks.
+const clock_tick_t *clock_now(void);
+
+/// @brief the local day `when` falls in: its broken-down time in *lt, and midnight at its start and end
+//			(so a day that's 23 or 25 hours long because of DST comes out right).
+void clock_day(time_t when, struct tm *lt, time_t *start, time_t *end);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * File: irc_handoff.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The Unix socket and descriptor passing behind irc_handoff.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "irc_handoff.h"
+
+/// @brief one chunk's header: the descriptors sent with it, and the bytes after it.
+typedef struct{
+	uint32_t nfds;
+	uint32_t len;
+} chunk_t;
+
+static int listenfd = -1;
+static handoff_fn serve_fn;
+
+void handoff_put(handoff_buf_t *b, const void *p, size_t n){
+	if(b->err){
+		return;
+	}
+	if(b->len + n > b->cap){
+		size_t cap = b->cap ? b->cap : 4096;
+		while(cap < b->len + n){
+			cap *= 2;
+		}
+		char *grown = realloc(b->data, cap);
+		if(!grown){
+			b->err = 1;
+			return;
+		}
+		b->data = grown;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, p, n);
+	b->len += n;
+}
+
+void handoff_put_u8(handoff_buf_t *b, uint8_t v){
+	handoff_put(b, &v, 1);
+}
+
+void handoff_put_u32(handoff_buf_t *b, uint32_t v){
+	handoff_put(b, &v, sizeof(v));
+}
+
+void handoff_put_u64(handoff_buf_t *b, uint64_t v){
+	handoff_put(b, &v, sizeof(v));
+}
+
+void handoff_put_str(handoff_buf_t *b, const char *s){
+	size_t n = strlen(s);
+	if(n > 255){
+		n = 255;
+	}
+	handoff_put_u8(b, (uint8_t)n);
+	handoff_put(b, s, n);
+}
+
+uint32_t handoff_put_fd(handoff_buf_t *b, int fd){
+	if(b->err){
+		return 0;
+	}
+	if(b->nfds == b->fds_cap){
+		int cap = b->fds_cap ? b->fds_cap * 2 : 256;
+		int *grown = realloc(b->fds, sizeof(int) * (size_t)cap);
+		if(!grown){
+			b->err = 1;
+			return 0;
+		}
+		b->fds = grown;
+		b->fds_cap = cap;
+	}
+	b->fds[b->nfds] = fd;
+	return (uint32_t)b->nfds++;
+}
+
+const char *handoff_get(handoff_buf_t *b, size_t n){
+	if(b->err || n > b->len - b->off){
+		b->err = 1;
+		return NULL;
+	}
+	const char *p = b->data + b->off;
+	b->off += n;
+	return p;
+}
+
+uint8_t handoff_get_u8(handoff_buf_t *b){
+	const char *p = handoff_get(b, 1);
+	return p ? (uint8_t)*p : 0;
+}
+
+uint32_t handoff_get_u32(handoff_buf_t *b){
+	uint32_t v = 0;
+	const char *p = handoff_get(b, sizeof(v));
+	if(p){
+		memcpy(&v, p, sizeof(v));
+	}
+	return v;
+}
+
+uint64_t handoff_get_u64(handoff_buf_t *b){
+	uint64_t v = 0;
+	const char *p = handoff_get(b, sizeof(v));
+	if(p){
+		memcpy(&v, p, sizeof(v));
+	}
+	return v;
+}
+
+void handoff_get_str(handoff_buf_t *b, char *out, size_t size){
+	size_t n = handoff_get_u8(b);
+	const char *p = handoff_get(b, n);
+	if(!p){
+		n = 0;
+	}
+	if(n >= size){
+		n = size - 1;
+	}
+	memcpy(out, p ? p : "", n);
+	out[n] = '\0';
+}
+
+int handoff_get_fd(handoff_buf_t *b, uint32_t i){
+	if(i >= (uint32_t)b->nfds){
+		b->err = 1;
+		return -1;
+	}
+	return b->fds[i];
+}
+
+void handoff_free(handoff_buf_t *b){
+	free(b->data);
+	free(b->fds);
+	memset(b, 0, sizeof(*b));
+}
+
+/// @brief writes all n bytes (the socket is blocking, so this only stops short on an error).
+static int write_all(int fd, const char *p, size_t n){
+	while(n > 0){
+		ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+		if(w < 0 && errno == EINTR){
+			continue;
+		}
+		if(w <= 0){
+			return -1;
+		}
+		p += w;
+		n -= (size_t)w;
+	}
+	return 0;
+}
+
+static int read_all(int fd, char *p, size_t n){
+	while(n > 0){
+		ssize_t r = recv(fd, p, n, 0);
+		if(r < 0 && errno == EINTR){
+			continue;
+		}
+		if(r <= 0){
+			return -1;
+		}
+		p += r;
+		n -= (size_t)r;
+	}
+	return 0;
+}
+
+/// @brief one chunk header, with nfds descriptors riding along.
+static int send_chunk(int fd, const int *fds, int nfds, uint32_t len){
+	chunk_t c = { (uint32_t)nfds, len };
+	char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MSG)];
+	struct iovec iov = { &c, sizeof(c) };
+	struct msghdr mh;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if(nfds > 0){
+		memset(control, 0, sizeof(control));
+		mh.msg_control = control;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)nfds);
+		struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)nfds);
+		memcpy(CMSG_DATA(cm), fds, sizeof(int) * (size_t)nfds);
+	}
+
+	ssize_t n;
+	while((n = sendmsg(fd, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR){
+		//try again.
+	}
+	return n == (ssize_t)sizeof(c) ? 0 : -1;
+}
+
+int handoff_send(int fd, handoff_buf_t *b){
+	for(int i = 0; i < b->nfds; i += HANDOFF_FDS_PER_MSG){
+		int n = b->nfds - i < HANDOFF_FDS_PER_MSG ? b->nfds - i : HANDOFF_FDS_PER_MSG;
+		if(send_chunk(fd, b->fds + i, n, 0) < 0){
+			return -1;
+		}
+	}
+	if(b->len > UINT32_MAX || send_chunk(fd, NULL, 0, (uint32_t)b->len) < 0 || write_all(fd, b->data, b->len) < 0){
+		return -1;
+	}
+
+	char ok;
+	return read_all(fd, &ok, 1) == 0 && ok == 1 ? 0 : -1;
+}
+
+/// @brief receives one chunk header, and the descriptors that came with it onto b's list.
+static int recv_chunk(int fd, handoff_buf_t *b, chunk_t *c){
+	char control[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MSG)];
+	struct iovec iov = { c, sizeof(*c) };
+	struct msghdr mh;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = control;
+	mh.msg_controllen = sizeof(control);
+
+	ssize_t n;
+	while((n = recvmsg(fd, &mh, MSG_CMSG_CLOEXEC | MSG_WAITALL)) < 0 && errno == EINTR){
+		//try again.
+	}
+	if(n != (ssize_t)sizeof(*c)){
+		return -1;
+	}
+
+	for(struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)){
+		if(cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS){
+			continue;
+		}
+		int got = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		for(int i = 0; i < got; i++){
+			int passed;
+			memcpy(&passed, CMSG_DATA(cm) + sizeof(int) * (size_t)i, sizeof(int));
+			handoff_put_fd(b, passed);
+		}
+	}
+
+	//too many descriptors in flight, or out of them here: the kernel drops what didn't fit and says so.
+	return (mh.msg_flags & MSG_CTRUNC) || b->err ? -1 : 0;
+}
+
+int handoff_take(const char *path, handoff_buf_t *b){
+	struct sockaddr_un addr;
+
+	memset(b, 0, sizeof(*b));
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		printf("ERROR: handoff socket path is too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0){
+		perror("ERROR: handoff socket failed");
+		return -1;
+	}
+
+	//nobody there (or a socket left behind by a server that's gone): we're the first.
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+		int err = errno;
+		close(fd);
+		if(err == ENOENT || err == ECONNREFUSED){
+			return 0;
+		}
+		errno = err;
+		perror("ERROR: handoff connect failed");
+		return -1;
+	}
+
+	chunk_t c;
+	do{
+		if(recv_chunk(fd, b, &c) < 0){
+			goto failed;
+		}
+	} while(c.nfds > 0);
+
+	b->data = malloc(c.len ? c.len : 1);
+	if(!b->data || read_all(fd, b->data, c.len) < 0){
+		goto failed;
+	}
+	b->len = b->cap = c.len;
+
+	char ok = 1;
+	if(write_all(fd, &ok, 1) < 0){
+		goto failed;
+	}
+
+	//it lets go of its history and exits; that closes the connection.
+	ssize_t r;
+	while((r = read(fd, &ok, 1)) > 0 || (r < 0 && errno == EINTR)){
+		//nothing else is ever sent.
+	}
+	close(fd);
+	return 1;
+
+failed:
+	printf("ERROR: the handoff from the old server broke off\n");
+	for(int i = 0; i < b->nfds; i++){
+		close(b->fds[i]);
+	}
+	close(fd);
+	handoff_free(b);
+	return -1;
+}
+
+static void *handoff_loop(void *arg){
+	(void)arg;
+	while(1){
+		int fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+		if(fd < 0){
+			if(errno != EINTR){
+				perror("ERROR: handoff accept failed");
+			}
+			continue;
+		}
+		if(serve_fn(fd) == 0){
+			//the new server has it all now. The process ends once the history is written out.
+			while(1){
+				pause();
+			}
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+int handoff_listen(const char *path, handoff_fn fn){
+	struct sockaddr_un addr;
+	pthread_t tid;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		printf("ERROR: handoff socket path is too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	//the server we took over from (or one that didn't get to clean up) left its socket there.
+	unlink(path);
+
+	listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listenfd < 0 || bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 1) < 0){
+		perror("ERROR: handoff socket failed");
+		return -1;
+	}
+	chmod(path, 0600);
+
+	serve_fn = fn;
+	if(pthread_create(&tid, NULL, &handoff_loop, NULL) != 0){
+		printf("ERROR: pthread\n");
+		return -1;
+	}
+	pthread_detach(tid);
+	return 0;
+}
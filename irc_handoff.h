@@ -0,0 +1,91 @@
+/*
+ * File: irc_handoff.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Hot restart: a running server hands its sockets and sessions to a new one over a Unix socket.
+ *
+ *	The running server listens on a Unix socket (-U path). A new server started with the same -U path finds it
+ *	there, connects, and gets everything in one go: the listening sockets and every client socket (as file
+ *	descriptors, SCM_RIGHTS, at most HANDOFF_FDS_PER_MSG to a sendmsg), and then the state that goes with them
+ *	as one block of bytes. What's in those bytes is up to the server; this file only moves them, and has the
+ *	little put/get helpers it writes and reads them with. The new server answers with one byte once it has it
+ *	all, and only then does the old one let go (without that, it goes back to serving its clients). The
+ *	connection closing is the old server saying it's gone (its history is on disk); the new one carries on from
+ *	there, and listens on the path itself for the server after it.
+ *
+ *	On the wire every chunk is an 8 byte header (how many descriptors ride along with it, how many bytes follow
+ *	it, both in host order: it's the same machine), sent with its descriptors in a sendmsg of its own, so the
+ *	receiver gets them with exactly those 8 bytes. Descriptor chunks come first, then one chunk with the bytes.
+ */
+
+#ifndef IRC_HANDOFF_H
+#define IRC_HANDOFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief the kernel's limit on descriptors in one SCM_RIGHTS message (SCM_MAX_FD).
+#define HANDOFF_FDS_PER_MSG 253
+
+/// @brief what gets handed over: the state bytes, and the descriptors they refer to by index.
+//			A put that runs out of memory sets err, and every put after it does nothing; a get that runs
+//			past the end sets err and returns zeros. Check err once at the end.
+typedef struct{
+	char *data;
+	size_t len;
+	size_t cap;
+
+	/// @brief where the next get reads from.
+	size_t off;
+
+	int *fds;
+	int nfds;
+	int fds_cap;
+	int err;
+} handoff_buf_t;
+
+void handoff_put(handoff_buf_t *b, const void *p, size_t n);
+void handoff_put_u8(handoff_buf_t *b, uint8_t v);
+void handoff_put_u32(handoff_buf_t *b, uint32_t v);
+void handoff_put_u64(handoff_buf_t *b, uint64_t v);
+
+/// @brief a NUL terminated string, up to 255 bytes of it.
+void handoff_put_str(handoff_buf_t *b, const char *s);
+
+/// @brief adds a descriptor to hand over (it stays open here too).
+/// @return its index, for the state bytes to refer to it by.
+uint32_t handoff_put_fd(handoff_buf_t *b, int fd);
+
+/// @return a pointer to the next n bytes, or NULL (with err set) if there aren't that many.
+const char *handoff_get(handoff_buf_t *b, size_t n);
+uint8_t handoff_get_u8(handoff_buf_t *b);
+uint32_t handoff_get_u32(handoff_buf_t *b);
+uint64_t handoff_get_u64(handoff_buf_t *b);
+
+/// @brief copies a string put with handoff_put_str into out (size bytes, always NUL terminated).
+void handoff_get_str(handoff_buf_t *b, char *out, size_t size);
+
+/// @brief the descriptor handoff_put_fd gave index i on the other side, -1 (with err set) if there's no such one.
+int handoff_get_fd(handoff_buf_t *b, uint32_t i);
+
+/// @brief frees the bytes and the descriptor list (it doesn't close the descriptors).
+void handoff_free(handoff_buf_t *b);
+
+/// @brief the old server's side: called on the handoff thread when a new server connects, with the connection.
+//			It sends the state (handoff_send) and returns 0 if the new server took over, -1 if it didn't
+//			and we carry on. The connection is closed when the process ends, or right away after a -1.
+typedef int (*handoff_fn)(int fd);
+
+/// @brief listens on path (replacing whatever is there) and calls fn for every new server that connects.
+/// @return 0 on success, -1 on failure (with a message printed).
+int handoff_listen(const char *path, handoff_fn fn);
+
+/// @brief the new server's side: connects to the old server on path, receives its state into b, says it has it
+//			and waits until the old server is gone.
+/// @return 1 if we got it, 0 if there's no server on path to take over from, -1 if the handoff failed partway.
+int handoff_take(const char *path, handoff_buf_t *b);
+
+/// @brief sends b's descriptors and then its bytes, and waits for the new server to say it has them.
+/// @return 0 on success, -1 on failure.
+int handoff_send(int fd, handoff_buf_t *b);
+
+#endif
@@ -0,0 +1,695 @@
+/*
+ * File: irc_history.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The chat history writer behind irc_history.h.
+ *
+ *	Producers (the network threads) only ever push onto the queue. If the writer is asleep,
+ *	the producer that finds it sleeping pokes its eventfd; everyone else just pushes.
+ *	The writer pops up to HISTORY_BATCH messages at a time and appends them to the day's segment
+ *	(see irc_segment.h) with as few writev() calls as it can, straight out of the shared message buffers.
+ *	Every SEG_BLOCK_RECORDS records it appends an index entry for the block.
+ *	With config.uring, a batch's writes to both files (and its fsyncs) go to the kernel as one linked
+ *	chain of io_uring requests instead: one syscall per batch rather than two to four.
+ *	A minute after midnight (and when it starts) the writer compacts the days that are over into
+ *	.segz files (segment_compact()). Producers never wait for that; the queue just gets longer meanwhile.
+ *	A replay request (history_replay()) is an entry without a buffer: the writer runs it after writing out the batch
+ *	it came in, so the backlog it reads has everything that was logged before it.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "irc_history.h"
+#include "irc_metrics.h"
+#include "irc_clock.h"
+#include "irc_mpsc.h"
+#include "irc_segment.h"
+#include "irc_uring.h"
+
+#define HISTORY_BATCH 512
+
+/// @brief how long after a day ends it gets compacted, so a message logged right before midnight
+//			that's still in the queue makes it into the day's .seg first.
+#define COMPACT_DELAY_S 60
+
+/// @brief one queued message. buf is a reference; the text is buf->data[off .. off + len).
+//			With no buf it's a replay request instead: room's last len messages, for client uid.
+typedef struct{
+	mpsc_node_t node;
+	msgbuf_t *buf;
+	uint32_t off;
+	uint32_t len;
+
+	/// @brief when it was logged (milliseconds), which also decides the day file it goes into.
+	int64_t when_ms;
+
+	/// @brief who sent it.
+	uint32_t uid;
+	uint8_t name_len;
+	char name[HISTORY_NAME_MAX];
+
+	/// @brief the room it went to.
+	uint8_t room_len;
+	char room[HISTORY_ROOM_MAX];
+} history_entry_t;
+
+static history_config_t config;
+static mpsc_queue_t queue;
+static int wakefd = -1;
+static pthread_t writer;
+
+/// @brief set by the writer right before it waits, so producers know to wake it.
+static _Atomic int writer_sleeping = 0;
+
+/// @brief set by history_shutdown().
+static _Atomic int stopping = 0;
+
+/* Writer thread state. Nobody else touches these. */
+
+/// @brief the open day's segment and index, and the span of time [day_start, day_end) that belongs in them.
+static int segfd = -1, idxfd = -1;
+static time_t day_start = 0, day_end = 0;
+static char base[PATH_MAX];
+
+/// @brief how long the segment is, counting what's in the current batch.
+static uint64_t seg_end = 0;
+
+/// @brief the block being filled, and the blocks that were closed during this batch
+//			(their index entries go out after the batch's records do).
+static seg_index_t block;
+static seg_index_t closed[HISTORY_BATCH];
+static int nclosed = 0;
+
+/// @brief the batch's writes: four iovecs (header, name, room, text) per message.
+static seg_record_t headers[HISTORY_BATCH];
+static struct iovec iov[HISTORY_BATCH * 4];
+static int niov = 0;
+
+/// @brief when compact_days() should look for finished days next (0: right away).
+static time_t compact_at = 0;
+
+/// @brief set when something was written since the last fsync.
+static int dirty = 0;
+static struct timespec last_sync;
+
+/// @brief the writer's io_uring, if config.uring asked for one and we got it.
+#if IRC_HAVE_URING
+static uring_t ring;
+#endif
+static int use_ring = 0;
+
+static long ms_since(struct timespec *then){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - then->tv_sec) * 1000 + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+static void sync_files(void){
+	if(segfd >= 0 && dirty){
+		fdatasync(segfd);
+		fdatasync(idxfd);
+		dirty = 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &last_sync);
+}
+
+/// @brief moves *v and *cnt past the first n bytes they describe.
+static void iov_skip(struct iovec **v, int *cnt, size_t n){
+	while(*cnt > 0 && n >= (*v)->iov_len){
+		n -= (*v)->iov_len;
+		(*v)++;
+		(*cnt)--;
+	}
+	if(*cnt > 0){
+		(*v)->iov_base = (char *)(*v)->iov_base + n;
+		(*v)->iov_len -= n;
+	}
+}
+
+/// @brief writes iov[0..cnt) to fd, picking up after short writes.
+static void write_all(int fd, struct iovec *v, int cnt){
+	while(cnt > 0 && fd >= 0){
+		ssize_t n = writev(fd, v, cnt > IOV_MAX ? IOV_MAX : cnt);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			printf("\nOops. Encountered an error when writing to %s: %s\n", base, strerror(errno));
+			return;
+		}
+		dirty = 1;
+		iov_skip(&v, &cnt, (size_t)n);
+	}
+}
+
+/// @brief adds a record that is (or is about to be) at seg_end to the current block, closing the block when it's full.
+static void block_add(int64_t when_ms, const char *name, size_t name_len, const char *room, size_t room_len, const char *text, size_t len){
+	size_t size = sizeof(seg_record_t) + name_len + room_len + len;
+
+	if(block.count == 0){
+		memset(&block, 0, sizeof(block));
+		block.off = seg_end;
+		block.first_ms = when_ms;
+	}
+	block.last_ms = when_ms;
+	block.count++;
+	block.bytes += (uint32_t)size;
+	seg_end += size;
+
+	seg_bloom_record(block.bloom, name, name_len, room, room_len, text, len);
+
+	if(block.count >= SEG_BLOCK_RECORDS || block.bytes >= SEG_BLOCK_BYTES){
+		closed[nclosed++] = block;
+		block.count = 0;
+	}
+}
+
+#if IRC_HAVE_URING
+/// @brief flush_batch (and, with sync, sync_files) through the ring: the records, the index entries and the
+//			fdatasyncs go in as one linked chain, so they still happen in that order, and we wait for all of it
+//			with the same io_uring_enter that submits it. Anything that comes back short (or cancelled, because
+//			something before it in the chain came back short) is finished with plain writes.
+static void ring_flush(int sync){
+	struct{
+		int fd;
+		struct iovec *v;
+		int cnt;
+		int res;
+	} ops[HISTORY_BATCH * 4 / IOV_MAX + 5];
+	struct iovec idx = { closed, sizeof(seg_index_t) * (size_t)nclosed };
+	int nops = 0;
+
+	for(int i = 0; i < niov; i += IOV_MAX){
+		ops[nops].fd = segfd;
+		ops[nops].v = iov + i;
+		ops[nops++].cnt = niov - i > IOV_MAX ? IOV_MAX : niov - i;
+	}
+	if(nclosed > 0){
+		ops[nops].fd = idxfd;
+		ops[nops].v = &idx;
+		ops[nops++].cnt = 1;
+	}
+	for(int i = 0; sync && i < 2; i++){
+		ops[nops].fd = i ? idxfd : segfd;
+		ops[nops].v = NULL;
+		ops[nops++].cnt = 0;
+	}
+	niov = 0;
+	nclosed = 0;
+
+	for(int i = 0; i < nops; i++){
+		struct io_uring_sqe *sqe = uring_sqe(&ring);
+		ops[i].res = -ECANCELED;
+		if(!sqe){
+			break;
+		}
+		sqe->fd = ops[i].fd;
+		if(ops[i].v){
+			sqe->opcode = IORING_OP_WRITEV;
+			sqe->addr = (uint64_t)(uintptr_t)ops[i].v;
+			sqe->len = (unsigned)ops[i].cnt;
+			sqe->off = (uint64_t)-1;
+		} else {
+			sqe->opcode = IORING_OP_FSYNC;
+			sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+		}
+		sqe->flags = i < nops - 1 ? IOSQE_IO_LINK : 0;
+		sqe->user_data = (uint64_t)i;
+	}
+
+	for(int got = 0; got < nops; ){
+		struct io_uring_cqe *cqe = uring_peek(&ring);
+		if(!cqe){
+			if(uring_submit(&ring, 1, NULL) < 0 && errno != EINTR){
+				break;
+			}
+			continue;
+		}
+		if(cqe->user_data < (uint64_t)nops){
+			ops[cqe->user_data].res = cqe->res;
+		}
+		uring_seen(&ring);
+		got++;
+	}
+
+	for(int i = 0; i < nops; i++){
+		if(!ops[i].v){
+			if(ops[i].res < 0){
+				fdatasync(ops[i].fd);
+			}
+			continue;
+		}
+
+		size_t want = 0;
+		for(int j = 0; j < ops[i].cnt; j++){
+			want += ops[i].v[j].iov_len;
+		}
+		if(ops[i].res >= 0){
+			dirty = 1;
+		}
+		if(ops[i].res == (int)want){
+			continue;
+		}
+		if(ops[i].res < 0 && ops[i].res != -ECANCELED){
+			printf("\nOops. Encountered an error when writing to %s: %s\n", base, strerror(-ops[i].res));
+			continue;
+		}
+		iov_skip(&ops[i].v, &ops[i].cnt, ops[i].res > 0 ? (size_t)ops[i].res : 0);
+		write_all(ops[i].fd, ops[i].v, ops[i].cnt);
+	}
+
+	if(sync){
+		dirty = 0;
+		clock_gettime(CLOCK_MONOTONIC, &last_sync);
+	}
+}
+#else
+static void ring_flush(int sync){
+	(void)sync;
+}
+#endif
+
+/// @brief writes the batch's records, then the index entries of the blocks they closed.
+static void flush_batch(void){
+	if(use_ring && segfd >= 0){
+		ring_flush(0);
+		return;
+	}
+
+	write_all(segfd, iov, niov);
+	niov = 0;
+
+	if(nclosed > 0){
+		struct iovec v = { closed, sizeof(seg_index_t) * (size_t)nclosed };
+		write_all(idxfd, &v, 1);
+		nclosed = 0;
+	}
+}
+
+/// @brief opens a segment file for appending, writing the magic if it's new.
+/// @return the fd, or -1 if it can't be used.
+static int open_log(const char *path, const char *magic, off_t *size){
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if(fd < 0){
+		return -1;
+	}
+
+	struct stat st;
+	char have[SEG_FILE_HDR];
+	if(fstat(fd, &st) < 0){
+		close(fd);
+		return -1;
+	}
+
+	if(st.st_size == 0){
+		if(write(fd, magic, SEG_FILE_HDR) != SEG_FILE_HDR){
+			close(fd);
+			return -1;
+		}
+		st.st_size = SEG_FILE_HDR;
+	} else if(pread(fd, have, SEG_FILE_HDR, 0) != SEG_FILE_HDR || memcmp(have, magic, SEG_FILE_HDR) != 0){
+		//not one of ours; leave it alone.
+		close(fd);
+		return -1;
+	}
+
+	*size = st.st_size;
+	return fd;
+}
+
+/// @brief finishes the current day: the partly filled block gets its index entry, and both files are closed.
+static void close_day(void){
+	if(segfd < 0){
+		return;
+	}
+
+	flush_batch();
+	if(block.count > 0){
+		closed[nclosed++] = block;
+		block.count = 0;
+		flush_batch();
+	}
+
+	if(config.fsync_policy != HISTORY_FSYNC_NEVER){
+		sync_files();
+	}
+	close(segfd);
+	close(idxfd);
+	segfd = idxfd = -1;
+}
+
+/// @brief opens the day files that `when` falls in (creating them if they're not there), closing the previous ones.
+//			If the server went down in the middle of a write last time, the torn record at the end is cut off,
+//			and the block that was being filled is rebuilt from the records after the last index entry.
+static void open_day(time_t when){
+	struct tm lt;
+	char path[PATH_MAX + 8];
+	off_t seg_size, idx_size;
+
+	close_day();
+
+	//the file is named after the day, and we move on to the next one at midnight.
+	clock_day(when, &lt, &day_start, &day_end);
+	segment_base(base, sizeof(base), config.dir, &lt);
+
+	//the day is ours once it's claimed, so nobody compacts it under us (see segment_claim()). If "query -z" was
+	//compacting it meanwhile, that .seg is gone now and we start a new one next to the .segz.
+	snprintf(path, sizeof(path), "%s.seg", base);
+	while((segfd = open_log(path, SEG_FILE_MAGIC, &seg_size)) >= 0){
+		struct stat st;
+		if(segment_claim(segfd) < 0){
+			perror("ERROR: history lock failed");
+			break;
+		}
+		if(fstat(segfd, &st) < 0 || st.st_nlink > 0){
+			break;
+		}
+		close(segfd);
+	}
+	snprintf(path, sizeof(path), "%s.idx", base);
+	idxfd = open_log(path, IDX_FILE_MAGIC, &idx_size);
+	if(segfd < 0 || idxfd < 0){
+		printf("\nOops. Encountered an error when trying to open %s. Not logged.\n", path);
+		if(segfd >= 0){
+			close(segfd);
+		}
+		if(idxfd >= 0){
+			close(idxfd);
+		}
+		segfd = idxfd = -1;
+		return;
+	}
+
+	block.count = 0;
+	seg_end = SEG_FILE_HDR;
+
+	segment_t s;
+	if(segment_open(&s, base) == 0){
+		const char *data;
+		size_t len, off, next;
+		seg_msg_t m;
+
+		seg_end = s.tail;
+		segment_block(&s, s.nidx, &data, &len);
+		for(off = 0; (next = segment_record(data, len, off, &m)); off = next){
+			block_add(m.hdr.when_ms, m.name, m.hdr.name_len, m.room, m.hdr.room_len, m.text, m.hdr.len);
+			if(nclosed == HISTORY_BATCH){
+				flush_batch();
+			}
+		}
+
+		//drop whatever doesn't parse (a torn last record or index entry).
+		if((off_t)seg_end < seg_size && ftruncate(segfd, (off_t)seg_end) < 0){
+			perror("ERROR: history truncate failed");
+		}
+		off_t idx_good = SEG_FILE_HDR + (off_t)((s.nidx - s.nz) * sizeof(seg_index_t));
+		if(idx_good < idx_size && ftruncate(idxfd, idx_good) < 0){
+			perror("ERROR: history truncate failed");
+		}
+		segment_close(&s);
+
+		//blocks the rebuild closed go straight to the index.
+		flush_batch();
+	}
+}
+
+/// @brief compacts every day in the history directory that ended at least COMPACT_DELAY_S ago,
+//			and works out when the next one will have.
+static void compact_days(void){
+	time_t now = time(NULL), start, end;
+	struct tm lt;
+	char day[PATH_MAX];
+
+	clock_day(now, &lt, &start, &end);
+	compact_at = end + COMPACT_DELAY_S;
+
+	DIR *d = opendir(config.dir);
+	if(!d){
+		return;
+	}
+
+	struct dirent *ent;
+	while((ent = readdir(d))){
+		int y, m, dd;
+		char ext[8];
+		if(sscanf(ent->d_name, "%4d-%2d-%2d.%7s", &y, &m, &dd, ext) != 4 || strcmp(ext, "seg") != 0){
+			continue;
+		}
+
+		memset(&lt, 0, sizeof(lt));
+		lt.tm_year = y - 1900;
+		lt.tm_mon = m - 1;
+		lt.tm_mday = dd;
+		lt.tm_hour = 12;
+		lt.tm_isdst = -1;
+		clock_day(mktime(&lt), &lt, &start, &end);
+		if(end + COMPACT_DELAY_S > now){
+			if(end + COMPACT_DELAY_S < compact_at){
+				compact_at = end + COMPACT_DELAY_S;
+			}
+			continue;
+		}
+
+		segment_base(day, sizeof(day), config.dir, &lt);
+		if(segfd >= 0 && strcmp(day, base) == 0){
+			//a late message reopened it; it's done now.
+			close_day();
+		}
+		if(segment_compact(day, NULL, NULL) < 0){
+			printf("\nOops. Couldn't compact %s: %s\n", day, strerror(errno));
+		}
+	}
+	closedir(d);
+}
+
+/// @brief pops up to HISTORY_BATCH messages and writes them out.
+/// @return how many messages it handled.
+static int drain_batch(void){
+	history_entry_t *batch[HISTORY_BATCH];
+	int n = 0, written = 0;
+
+	mpsc_node_t *node;
+	while(n < HISTORY_BATCH && (node = mpsc_pop(&queue))){
+		batch[n++] = mpsc_entry(node, history_entry_t, node);
+	}
+
+	for(int i = 0; i < n; i++){
+		history_entry_t *e = batch[i];
+		time_t when = (time_t)(e->when_ms / 1000);
+		if(!e->buf){
+			continue;
+		}
+
+		//past midnight (or before the current file's day): write what we have and switch files.
+		if(segfd < 0 || when < day_start || when >= day_end){
+			open_day(when);
+			if(segfd < 0){
+				continue;
+			}
+		}
+
+		seg_record_t *h = &headers[i];
+		memset(h, 0, sizeof(*h));
+		h->magic = SEG_RECORD_MAGIC;
+		h->name_len = e->name_len;
+		h->room_len = e->room_len;
+		h->len = e->len;
+		h->when_ms = e->when_ms;
+		h->uid = e->uid;
+
+		const char *text = e->buf->data + e->off;
+		iov[niov].iov_base = h;
+		iov[niov++].iov_len = sizeof(*h);
+		iov[niov].iov_base = e->name;
+		iov[niov++].iov_len = e->name_len;
+		iov[niov].iov_base = e->room;
+		iov[niov++].iov_len = e->room_len;
+		iov[niov].iov_base = (void *)text;
+		iov[niov++].iov_len = e->len;
+
+		block_add(e->when_ms, e->name, e->name_len, e->room, e->room_len, text, e->len);
+		written++;
+	}
+	//with the ring, the batch's fsyncs go in with its writes.
+	int sync = written > 0 && config.fsync_policy == HISTORY_FSYNC_BATCH;
+	if(use_ring && segfd >= 0){
+		ring_flush(sync);
+	} else {
+		flush_batch();
+		if(sync){
+			sync_files();
+		}
+	}
+	metrics_add(METRIC_HISTORY_WRITTEN, (uint64_t)written);
+
+	//the batch is on disk now, so the replays in it read it back too. (Not while shutting down: the clients
+	//may belong to the server that took over already.)
+	for(int i = 0; i < n; i++){
+		history_entry_t *e = batch[i];
+		if(e->buf){
+			msgbuf_unref(e->buf);
+		} else if(config.replay && !atomic_load(&stopping)){
+			char room[HISTORY_ROOM_MAX + 1];
+			memcpy(room, e->room, e->room_len);
+			room[e->room_len] = '\0';
+			config.replay((int)e->uid, room, (int)e->len);
+		}
+		free(e);
+	}
+	return n;
+}
+
+static void *writer_loop(void *arg){
+	(void)arg;
+	clock_gettime(CLOCK_MONOTONIC, &last_sync);
+
+#if IRC_HAVE_URING
+	if(config.uring){
+		static const int need[] = { IORING_OP_WRITEV, IORING_OP_FSYNC };
+		use_ring = uring_init(&ring, 16, need, 2) == 0;
+	}
+#endif
+
+	while(1){
+		if(time(NULL) >= compact_at){
+			compact_days();
+		}
+		if(drain_batch() > 0){
+			continue;
+		}
+
+		if(atomic_load(&stopping)){
+			//everything queued before the shutdown request is on disk now.
+			close_day();
+			sync_files();
+			//a real exit, so stdout is flushed and an instrumented build (make pgo) writes its profile.
+			exit(EXIT_SUCCESS);
+		}
+
+		//announce that we're about to sleep, then look one more time: a producer either
+		//sees writer_sleeping and wakes us, or its message shows up in this last drain.
+		atomic_store(&writer_sleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if(drain_batch() > 0){
+			atomic_store(&writer_sleeping, 0);
+			continue;
+		}
+
+		//wake up for the next compaction, or the next fsync if that's sooner.
+		time_t now = time(NULL);
+		int timeout = compact_at > now ? (int)(compact_at - now) * 1000 : 0;
+		if(config.fsync_policy == HISTORY_FSYNC_INTERVAL && dirty){
+			int left = config.fsync_interval_ms - (int)ms_since(&last_sync);
+			if(left < timeout){
+				timeout = left < 0 ? 0 : left;
+			}
+		}
+
+		struct pollfd pfd = { wakefd, POLLIN, 0 };
+		if(poll(&pfd, 1, timeout) > 0){
+			uint64_t count;
+			if(read(wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+				perror("ERROR: history eventfd read failed");
+			}
+		}
+		atomic_store(&writer_sleeping, 0);
+
+		if(config.fsync_policy == HISTORY_FSYNC_INTERVAL && dirty && ms_since(&last_sync) >= config.fsync_interval_ms){
+			sync_files();
+		}
+	}
+
+	return NULL;
+}
+
+int history_start(const history_config_t *cfg){
+	config = *cfg;
+	mpsc_init(&queue);
+
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wakefd < 0){
+		perror("ERROR: history eventfd failed");
+		return -1;
+	}
+
+	if(pthread_create(&writer, NULL, &writer_loop, NULL) != 0){
+		printf("ERROR: pthread\n");
+		return -1;
+	}
+	return 0;
+}
+
+/// @brief wakes the writer for what was just pushed, if it's asleep.
+static void wake_writer(void){
+	//pairs with the fence in writer_loop: either we see it sleeping, or it sees our message.
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(&writer_sleeping, memory_order_relaxed) && atomic_exchange(&writer_sleeping, 0)){
+		uint64_t one = 1;
+		if(write(wakefd, &one, sizeof(one)) < 0){
+			perror("ERROR: history eventfd write failed");
+		}
+	}
+}
+
+void history_append(msgbuf_t *buf, size_t off, size_t len, int uid, const char *name, const char *room){
+	history_entry_t *e = malloc(sizeof(history_entry_t));
+	if(!e){
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+	size_t name_len = strnlen(name, HISTORY_NAME_MAX);
+	e->buf = msgbuf_ref(buf);
+	e->off = (uint32_t)off;
+	e->len = (uint32_t)len;
+	e->when_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	e->uid = (uint32_t)uid;
+	e->name_len = (uint8_t)name_len;
+	memcpy(e->name, name, name_len);
+	size_t room_len = strnlen(room, HISTORY_ROOM_MAX);
+	e->room_len = (uint8_t)room_len;
+	memcpy(e->room, room, room_len);
+	mpsc_push(&queue, &e->node);
+	metrics_add(METRIC_HISTORY_QUEUED, 1);
+
+	wake_writer();
+}
+
+void history_replay(int uid, const char *room, int n){
+	history_entry_t *e = calloc(1, sizeof(history_entry_t));
+	if(!e){
+		return;
+	}
+
+	size_t room_len = strnlen(room, HISTORY_ROOM_MAX);
+	e->len = (uint32_t)n;
+	e->uid = (uint32_t)uid;
+	e->room_len = (uint8_t)room_len;
+	memcpy(e->room, room, room_len);
+	mpsc_push(&queue, &e->node);
+	wake_writer();
+}
+
+void history_shutdown(void){
+	uint64_t one = 1;
+	atomic_store(&stopping, 1);
+	if(write(wakefd, &one, sizeof(one)) < 0){
+		//nothing we can do from a signal handler.
+	}
+}
@@ -0,0 +1,71 @@
+/*
+ * File: irc_history.h
+ * Project: CSCI 3160 Chat Project
+ * Description: The chat history writer.
+ *	Message threads hand finished messages to history_append(), which is one lock-free push onto
+ *	an MPSC queue (no file I/O, no locks). A single writer thread drains the queue, keeps the
+ *	day's segment (YYYY-MM-DD.seg and .idx, see irc_segment.h) open, writes whole batches with writev
+ *	(or with io_uring: one io_uring_enter per batch for both files and their fsyncs),
+ *	and moves on to new files when the date changes at midnight.
+ *	Reading a room's backlog back for a client that joins goes through the same queue (history_replay()), so the
+ *	files are only ever read on the writer thread, and never by the threads serving clients.
+ */
+
+#ifndef IRC_HISTORY_H
+#define IRC_HISTORY_H
+
+#include <stddef.h>
+
+#include "irc_msgbuf.h"
+
+/// @brief the longest user name (and room name) that gets stored with a message.
+#define HISTORY_NAME_MAX 32
+#define HISTORY_ROOM_MAX 32
+
+/// @brief when the writer calls fsync() on the history file.
+typedef enum{
+	/// @brief never; leave it to the kernel (like fclose() always did).
+	HISTORY_FSYNC_NEVER,
+
+	/// @brief after every batch the writer writes.
+	HISTORY_FSYNC_BATCH,
+
+	/// @brief at most once every fsync_interval_ms, if anything was written.
+	HISTORY_FSYNC_INTERVAL
+} history_fsync_t;
+
+/// @brief reads room's last n messages back from the history files for client uid, and sends them.
+//			Runs on the writer thread (see history_replay()).
+typedef void (*history_replay_fn)(int uid, const char *room, int n);
+
+typedef struct{
+	/// @brief directory the day files go in (also where new clients' backlog is read from).
+	const char *dir;
+
+	history_fsync_t fsync_policy;
+	int fsync_interval_ms;
+
+	/// @brief 1 to hand each batch's writes (and fsyncs) to io_uring in one go, if the kernel has it.
+	int uring;
+
+	/// @brief what history_replay() requests run.
+	history_replay_fn replay;
+} history_config_t;
+
+/// @brief starts the writer thread.
+/// @return 0 on success, -1 on failure.
+int history_start(const history_config_t *cfg);
+
+/// @brief queues len bytes at buf->data + off to be logged as sent by (uid, name) to room. Takes its own reference on buf.
+//			Safe to call from any thread; never blocks on the disk.
+void history_append(msgbuf_t *buf, size_t off, size_t len, int uid, const char *name, const char *room);
+
+/// @brief queues a request for room's last n messages for client uid: the writer runs config.replay on it once
+//			it has written everything queued before. Safe to call from any thread; never blocks on the disk.
+void history_replay(int uid, const char *room, int n);
+
+/// @brief asks the writer to write out everything queued so far and then end the process.
+//			Async-signal-safe, so SIGINT/SIGTERM handlers can call it.
+void history_shutdown(void);
+
+#endif
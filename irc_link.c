@@ -0,0 +1,681 @@
+/*
+ * File: irc_link.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The link thread behind irc_link.h.
+ *
+ *	A RELAY frame's payload:
+ *	 bytes 0-3    origin node id, big endian
+ *	 bytes 4-11   the origin's sequence number for it, big endian
+ *	 then         room name length (1 byte) and the room name, sender name length (1 byte) and the name
+ *	 then         the chat text, to the end of the frame
+ *	The frame's flags are link_forward's (LINK_NOTICE).
+ *	Sequence numbers are handed out by the origin's link thread as it sends, so they go out (and, on a
+ *	TCP link, arrive) in order, and "already had it" is just "not above the last one from that origin".
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "irc_link.h"
+#include "irc_proto.h"
+#include "irc_mpsc.h"
+#include "irc_msgbuf.h"
+#include "irc_metrics.h"
+
+#define LINK_RELAY_HDR 12
+#define LINK_MAX_IOV 64
+#define LINK_RETRY_MS 1000
+
+/// @brief epoll_event.data.u64 values that aren't links.
+#define TAG_LISTEN ((uint64_t)-1)
+#define TAG_WAKE ((uint64_t)-2)
+
+typedef enum{
+	LINK_FREE,
+	LINK_CONNECTING,
+	LINK_HELLO,
+	LINK_UP
+} link_state_t;
+
+/// @brief one frame waiting on a link: bytes [pos, buf->len) still have to go out.
+typedef struct{
+	msgbuf_t *buf;
+	uint32_t pos;
+} link_out_t;
+
+typedef struct{
+	int fd;
+	link_state_t state;
+
+	/// @brief the node on the other end and its epoch, once it said hello.
+	int node;
+	uint64_t epoch;
+
+	/// @brief the -P peer this link dials, -1 for a link a peer dialed.
+	int peer;
+
+	/// @brief received bytes not parsed yet (room for one whole frame).
+	char *rbuf;
+	size_t rlen;
+
+	/// @brief frames waiting to go out, a ring of LINK_QUEUE: head is the next to send, tail the next free slot.
+	link_out_t *q;
+	unsigned head;
+	unsigned tail;
+	uint32_t events;
+} link_t;
+
+/// @brief a -P peer: where it is, the link dialing it (-1 while there's none) and when to try again.
+typedef struct{
+	struct sockaddr_in addr;
+	int link;
+	uint64_t retry_at;
+} peer_t;
+
+/// @brief every node we've heard from: its epoch, the last relay we took from it,
+//			and the link our relays for it go out on (-1 while it has none up).
+typedef struct{
+	int id;
+	uint64_t epoch;
+	uint64_t last;
+	int primary;
+} node_t;
+
+/// @brief a message another thread handed us to relay.
+typedef struct{
+	mpsc_node_t node;
+	msgbuf_t *buf;
+} relay_t;
+
+static int enabled = 0;
+static int my_node;
+static uint64_t my_epoch;
+static uint64_t out_seq = 0;
+static link_deliver_fn deliver_fn;
+
+static int epfd = -1, listenfd = -1, wakefd = -1;
+static _Atomic int wake_pending = 0;
+static mpsc_queue_t inbox;
+
+static link_t links[LINK_SLOTS];
+static peer_t peers[LINK_MAX_PEERS];
+static int npeers = 0;
+static node_t nodes[LINK_SLOTS];
+static int nnodes = 0;
+
+static uint64_t now_ms(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void put_be(char *p, uint64_t v, int n){
+	for(int i = 0; i < n; i++){
+		p[i] = (char)(v >> (8 * (n - 1 - i)));
+	}
+}
+
+static uint64_t get_be(const char *p, int n){
+	uint64_t v = 0;
+	for(int i = 0; i < n; i++){
+		v = v << 8 | (unsigned char)p[i];
+	}
+	return v;
+}
+
+/// @return the node we know as id, NULL if we've never been linked with it.
+static node_t *node_find(int id){
+	for(int i = 0; i < nnodes; i++){
+		if(nodes[i].id == id){
+			return &nodes[i];
+		}
+	}
+	return NULL;
+}
+
+/// @brief node_find, or a new node if there's room (only a hello makes one).
+static node_t *node_get(int id){
+	node_t *n = node_find(id);
+	if(n){
+		return n;
+	}
+	if(nnodes == LINK_SLOTS){
+		return NULL;
+	}
+	n = &nodes[nnodes++];
+	memset(n, 0, sizeof(*n));
+	n->id = id;
+	n->primary = -1;
+	return n;
+}
+
+/// @brief changes what epoll watches the link for, if it changed.
+static void link_watch(int i){
+	link_t *l = &links[i];
+	uint32_t want = EPOLLIN | EPOLLRDHUP;
+	if(l->state == LINK_CONNECTING || l->head != l->tail){
+		want |= EPOLLOUT;
+	}
+	if(want != l->events){
+		struct epoll_event ev;
+		ev.events = want;
+		ev.data.u64 = (uint64_t)i;
+		epoll_ctl(epfd, EPOLL_CTL_MOD, l->fd, &ev);
+		l->events = want;
+	}
+}
+
+/// @brief takes a reference to a frame for the link's queue.
+/// @return 0, or -1 if the queue is full (the peer isn't keeping up) and the frame was dropped.
+static int link_queue(link_t *l, msgbuf_t *buf){
+	if(l->tail - l->head == LINK_QUEUE){
+		metrics_add(METRIC_LINK_DROPPED, 1);
+		return -1;
+	}
+	link_out_t *o = &l->q[l->tail++ & (LINK_QUEUE - 1)];
+	o->buf = msgbuf_ref(buf);
+	o->pos = 0;
+	return 0;
+}
+
+/// @brief writes as much of the link's queue as the socket takes, up to LINK_MAX_IOV frames per sendmsg.
+/// @return 0, or -1 if the link broke.
+static int link_flush(link_t *l){
+	while(l->head != l->tail){
+		struct iovec iov[LINK_MAX_IOV];
+		int n = 0;
+		for(unsigned i = l->head; i != l->tail && n < LINK_MAX_IOV; i++, n++){
+			link_out_t *o = &l->q[i & (LINK_QUEUE - 1)];
+			iov[n].iov_base = o->buf->data + o->pos;
+			iov[n].iov_len = o->buf->len - o->pos;
+		}
+
+		struct msghdr mh;
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = (size_t)n;
+		ssize_t w = sendmsg(l->fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if(w < 0){
+			return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+		}
+
+		//retire what went out completely; a frame that went halfway stays at the head.
+		size_t left = (size_t)w;
+		while(left > 0){
+			link_out_t *o = &l->q[l->head & (LINK_QUEUE - 1)];
+			size_t rest = o->buf->len - o->pos;
+			if(left < rest){
+				o->pos += (uint32_t)left;
+				break;
+			}
+			left -= rest;
+			msgbuf_unref(o->buf);
+			l->head++;
+		}
+	}
+	return 0;
+}
+
+/// @brief sends our LINK frame: "<node id> <epoch>".
+static void link_hello(int i){
+	msgbuf_t *buf = msgbuf_alloc(IRC_FRAME_HDR + 64);
+	if(!buf){
+		return;
+	}
+	int n = snprintf(buf->data + IRC_FRAME_HDR, 64, "%d %016llx", my_node, (unsigned long long)my_epoch);
+	irc_frame_header(buf->data, IRC_LINK, 0, (uint32_t)n);
+	buf->len = IRC_FRAME_HDR + (size_t)n;
+	link_queue(&links[i], buf);
+	msgbuf_unref(buf);
+	link_flush(&links[i]);
+	link_watch(i);
+}
+
+/// @brief sets up link slot i for fd (dialing peer, or -1 for a link we accepted).
+/// @return 0, or -1 if we're out of memory or epoll won't take it.
+static int link_open(int i, int fd, int peer, link_state_t state){
+	link_t *l = &links[i];
+	memset(l, 0, sizeof(*l));
+	l->fd = fd;
+	l->peer = peer;
+	l->state = state;
+	l->node = -1;
+	l->rbuf = malloc(IRC_FRAME_HDR + IRC_MAX_PAYLOAD);
+	l->q = malloc(sizeof(link_out_t) * LINK_QUEUE);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP | (state == LINK_CONNECTING ? EPOLLOUT : 0);
+	ev.data.u64 = (uint64_t)i;
+	l->events = ev.events;
+	if(!l->rbuf || !l->q || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0){
+		free(l->rbuf);
+		free(l->q);
+		close(fd);
+		l->state = LINK_FREE;
+		return -1;
+	}
+	return 0;
+}
+
+static int link_slot(void){
+	for(int i = 0; i < LINK_SLOTS; i++){
+		if(links[i].state == LINK_FREE){
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void link_close(int i){
+	link_t *l = &links[i];
+	epoll_ctl(epfd, EPOLL_CTL_DEL, l->fd, NULL);
+	close(l->fd);
+	while(l->head != l->tail){
+		msgbuf_unref(l->q[l->head++ & (LINK_QUEUE - 1)].buf);
+	}
+	free(l->q);
+	free(l->rbuf);
+
+	//its node sends on another link to it, if there is one.
+	node_t *n = l->node >= 0 ? node_find(l->node) : NULL;
+	if(n && n->primary == i){
+		n->primary = -1;
+		for(int j = 0; j < LINK_SLOTS; j++){
+			if(j != i && links[j].state == LINK_UP && links[j].node == l->node){
+				n->primary = j;
+				break;
+			}
+		}
+		if(n->primary < 0){
+			printf("Link to node %d is down.\n", l->node);
+		}
+	}
+	if(l->peer >= 0){
+		peers[l->peer].link = -1;
+		peers[l->peer].retry_at = now_ms() + LINK_RETRY_MS;
+	}
+	l->state = LINK_FREE;
+}
+
+/// @brief starts dialing peer p (non-blocking; the link is up once the connect and both hellos are done).
+static void peer_dial(int p){
+	int i = link_slot();
+	peers[p].retry_at = now_ms() + LINK_RETRY_MS;
+	if(i < 0){
+		return;
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0){
+		return;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	int r = connect(fd, (struct sockaddr *)&peers[p].addr, sizeof(peers[p].addr));
+	if(r < 0 && errno != EINPROGRESS){
+		close(fd);
+		return;
+	}
+	if(link_open(i, fd, p, r == 0 ? LINK_HELLO : LINK_CONNECTING) == 0){
+		peers[p].link = i;
+		if(r == 0){
+			link_hello(i);
+		}
+	}
+}
+
+/// @brief the other end said hello: the link is up, and carries relays for that node if nothing else does yet.
+/// @return 0, or -1 to drop the link.
+static int link_greeted(int i, const char *payload, uint32_t len){
+	char line[64];
+	int node;
+	unsigned long long epoch;
+
+	if(len >= sizeof(line)){
+		return -1;
+	}
+	memcpy(line, payload, len);
+	line[len] = '\0';
+	if(sscanf(line, "%d %llx", &node, &epoch) != 2 || node == my_node){
+		printf("Link: bad hello (%s), dropping it.\n", line);
+		return -1;
+	}
+
+	node_t *n = node_get(node);
+	if(!n){
+		return -1;
+	}
+
+	//a node that came back up numbers its relays from the start again.
+	if(n->epoch != epoch){
+		n->epoch = epoch;
+		n->last = 0;
+	}
+
+	link_t *l = &links[i];
+	l->node = node;
+	l->epoch = epoch;
+	l->state = LINK_UP;
+	if(n->primary < 0){
+		n->primary = i;
+		printf("Linked with node %d.\n", node);
+	}
+	return 0;
+}
+
+/// @brief one RELAY frame from link i: hands it to our rooms unless we had it already.
+static void link_relay(int i, const char *p, uint32_t len, int flags){
+	link_t *l = &links[i];
+	if(len < LINK_RELAY_HDR + 2){
+		return;
+	}
+	int origin = (int)get_be(p, 4);
+	uint64_t seq = get_be(p + 4, 8);
+
+	//relays come straight from their origin, over a link from it, so any other origin is junk and mustn't take a node.
+	if(origin != l->node){
+		return;
+	}
+	node_t *n = node_find(origin);
+	if(!n || l->epoch != n->epoch){
+		return;
+	}
+	if(seq <= n->last){
+		metrics_add(METRIC_LINK_DUPLICATES, 1);
+		return;
+	}
+	n->last = seq;
+
+	char room[256], name[256];
+	uint32_t at = LINK_RELAY_HDR;
+	uint32_t rlen = (unsigned char)p[at++];
+	if(at + rlen + 1 > len){
+		return;
+	}
+	memcpy(room, p + at, rlen);
+	room[rlen] = '\0';
+	at += rlen;
+	uint32_t nlen = (unsigned char)p[at++];
+	if(at + nlen > len){
+		return;
+	}
+	memcpy(name, p + at, nlen);
+	name[nlen] = '\0';
+	at += nlen;
+
+	metrics_add(METRIC_LINK_RECEIVED, 1);
+	deliver_fn(room, name, p + at, len - at, flags);
+}
+
+/// @brief reads what link i sent and handles every whole frame.
+/// @return 0, or -1 if the link broke.
+static int link_read(int i){
+	link_t *l = &links[i];
+	ssize_t n = recv(l->fd, l->rbuf + l->rlen, IRC_FRAME_HDR + IRC_MAX_PAYLOAD - l->rlen, MSG_DONTWAIT);
+	if(n <= 0){
+		return (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) ? 0 : -1;
+	}
+	l->rlen += (size_t)n;
+
+	irc_frame_t f;
+	size_t off = 0;
+	int r;
+	while((r = irc_frame_next(l->rbuf, l->rlen, &off, &f)) == 1){
+		if(f.type == IRC_LINK && l->state == LINK_HELLO){
+			if(link_greeted(i, f.payload, f.len) < 0){
+				return -1;
+			}
+		} else if(f.type == IRC_RELAY && l->state == LINK_UP){
+			link_relay(i, f.payload, f.len, f.flags);
+		}
+	}
+	if(r < 0){
+		return -1;
+	}
+	memmove(l->rbuf, l->rbuf + off, l->rlen - off);
+	l->rlen -= off;
+	return 0;
+}
+
+/// @brief numbers every message other threads handed us and queues it on one link per linked node.
+static void link_drain_inbox(void){
+	uint64_t count;
+	if(read(wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+		perror("ERROR: eventfd read failed");
+	}
+	atomic_store(&wake_pending, 0);
+
+	mpsc_node_t *node;
+	while((node = mpsc_pop(&inbox))){
+		relay_t *r = mpsc_entry(node, relay_t, node);
+		put_be(r->buf->data + IRC_FRAME_HDR + 4, ++out_seq, 8);
+		for(int i = 0; i < nnodes; i++){
+			if(nodes[i].primary >= 0 && link_queue(&links[nodes[i].primary], r->buf) == 0){
+				metrics_add(METRIC_LINK_SENT, 1);
+			}
+		}
+		msgbuf_unref(r->buf);
+		free(r);
+	}
+
+	//one sendmsg per link for everything that came in since last time.
+	for(int i = 0; i < nnodes; i++){
+		int p = nodes[i].primary;
+		if(p >= 0){
+			if(link_flush(&links[p]) < 0){
+				link_close(p);
+			} else {
+				link_watch(p);
+			}
+		}
+	}
+}
+
+static void link_accept(void){
+	while(1){
+		int fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(fd < 0){
+			return;
+		}
+		int i = link_slot();
+		if(i < 0){
+			close(fd);
+			continue;
+		}
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if(link_open(i, fd, -1, LINK_HELLO) == 0){
+			link_hello(i);
+		}
+	}
+}
+
+static void link_event(int i, uint32_t events){
+	link_t *l = &links[i];
+
+	if(l->state == LINK_CONNECTING){
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(l->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if(err || (events & (EPOLLERR | EPOLLHUP))){
+			link_close(i);
+			return;
+		}
+		l->state = LINK_HELLO;
+		link_hello(i);
+		return;
+	}
+
+	if((events & EPOLLOUT) && link_flush(l) < 0){
+		link_close(i);
+		return;
+	}
+	if((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && link_read(i) < 0){
+		link_close(i);
+		return;
+	}
+	link_watch(i);
+}
+
+static void *link_loop(void *arg){
+	(void)arg;
+	struct epoll_event events[64];
+
+	while(1){
+		uint64_t now = now_ms();
+		for(int p = 0; p < npeers; p++){
+			if(peers[p].link < 0 && now >= peers[p].retry_at){
+				peer_dial(p);
+			}
+		}
+
+		int n = epoll_wait(epfd, events, 64, npeers ? LINK_RETRY_MS : -1);
+		for(int e = 0; e < n; e++){
+			uint64_t tag = events[e].data.u64;
+			if(tag == TAG_LISTEN){
+				link_accept();
+			} else if(tag == TAG_WAKE){
+				link_drain_inbox();
+			} else if(links[tag].state != LINK_FREE){
+				link_event((int)tag, events[e].events);
+			}
+		}
+	}
+	return NULL;
+}
+
+/// @brief reads "host:port" into addr.
+static int parse_peer(const char *spec, struct sockaddr_in *addr){
+	char host[256];
+	const char *colon = strrchr(spec, ':');
+	if(!colon || colon == spec || (size_t)(colon - spec) >= sizeof(host) || atoi(colon + 1) <= 0){
+		return -1;
+	}
+	memcpy(host, spec, (size_t)(colon - spec));
+	host[colon - spec] = '\0';
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, NULL, &hints, &res) != 0){
+		return -1;
+	}
+	*addr = *(struct sockaddr_in *)res->ai_addr;
+	addr->sin_port = htons((uint16_t)atoi(colon + 1));
+	freeaddrinfo(res);
+	return 0;
+}
+
+int link_start(const link_config_t *cfg, link_deliver_fn deliver){
+	pthread_t tid;
+
+	my_node = cfg->node;
+	deliver_fn = deliver;
+	if(getrandom(&my_epoch, sizeof(my_epoch), 0) != sizeof(my_epoch)){
+		my_epoch = now_ms() ^ ((uint64_t)getpid() << 32);
+	}
+	mpsc_init(&inbox);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(epfd < 0 || wakefd < 0){
+		perror("ERROR: link setup failed");
+		return -1;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u64 = TAG_WAKE;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+	if(cfg->port > 0){
+		struct sockaddr_in addr;
+		int one = 1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons((uint16_t)cfg->port);
+		listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(listenfd < 0 || setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+			|| bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 16) < 0){
+			perror("ERROR: link port");
+			return -1;
+		}
+		ev.events = EPOLLIN;
+		ev.data.u64 = TAG_LISTEN;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+	}
+
+	for(int p = 0; p < cfg->npeers; p++){
+		if(parse_peer(cfg->peers[p], &peers[p].addr) < 0){
+			printf("ERROR: can't make out peer %s (host:port)\n", cfg->peers[p]);
+			return -1;
+		}
+		peers[p].link = -1;
+		peers[p].retry_at = 0;
+	}
+	npeers = cfg->npeers;
+
+	if(pthread_create(&tid, NULL, &link_loop, NULL) != 0){
+		printf("ERROR: pthread\n");
+		return -1;
+	}
+	pthread_detach(tid);
+	enabled = 1;
+	return 0;
+}
+
+int link_enabled(void){
+	return enabled;
+}
+
+void link_forward(const char *room, const char *name, const char *text, uint32_t len, int flags){
+	size_t rlen = strnlen(room, 255), nlen = strnlen(name, 255);
+	size_t head = LINK_RELAY_HDR + 1 + rlen + 1 + nlen;
+	if(head + len > IRC_MAX_PAYLOAD){
+		len = (uint32_t)(IRC_MAX_PAYLOAD - head);
+	}
+
+	relay_t *r = malloc(sizeof(relay_t));
+	msgbuf_t *buf = r ? msgbuf_alloc(IRC_FRAME_HDR + head + len) : NULL;
+	if(!buf){
+		free(r);
+		return;
+	}
+
+	//the sequence number (bytes 4-11) is filled in by the link thread as it sends.
+	char *p = buf->data + IRC_FRAME_HDR;
+	put_be(p, (uint64_t)my_node, 4);
+	p[LINK_RELAY_HDR] = (char)rlen;
+	memcpy(p + LINK_RELAY_HDR + 1, room, rlen);
+	p[LINK_RELAY_HDR + 1 + rlen] = (char)nlen;
+	memcpy(p + LINK_RELAY_HDR + 2 + rlen, name, nlen);
+	memcpy(p + head, text, len);
+	irc_frame_header(buf->data, IRC_RELAY, flags, (uint32_t)(head + len));
+	buf->len = IRC_FRAME_HDR + head + len;
+
+	r->buf = buf;
+	mpsc_push(&inbox, &r->node);
+	if(!atomic_exchange(&wake_pending, 1)){
+		uint64_t one = 1;
+		if(write(wakefd, &one, sizeof(one)) < 0){
+			perror("ERROR: eventfd write failed");
+		}
+	}
+}
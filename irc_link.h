@@ -0,0 +1,61 @@
+/*
+ * File: irc_link.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Links between servers, so several server processes (nodes) share their rooms.
+ *
+ *	Every node has a node id (-N) and a port its peers link to (-L, on localhost like the client port;
+ *	links aren't authenticated), and dials the peers it's given (-P host:port). A link is a TCP connection
+ *	speaking irc_proto.h frames: both sides start with a LINK frame ("<node id> <epoch>"), and after that
+ *	every room message one node has for the others is one RELAY frame. Nodes are meant to be a full mesh:
+ *	a message leaves its node once per peer node, however many members that peer has in the room, and the
+ *	peer hands it to its own members. Nobody passes a relay on.
+ *
+ *	A relay carries its origin node and that node's sequence number for it, and a node drops a relay it has
+ *	had already (two links between the same pair of nodes, a link that came back). The epoch is new every
+ *	time a node starts, so a node that restarted counts from the beginning again.
+ *
+ *	One link thread owns every link socket and runs its own epoll loop. Other threads hand it messages
+ *	through an inbox (irc_mpsc.h) and an eventfd, the same way shards hand each other messages, so forwarding
+ *	a message costs the sender one copy and one push, not a write per peer.
+ */
+
+#ifndef IRC_LINK_H
+#define IRC_LINK_H
+
+#include <stdint.h>
+
+/// @brief how many peers -P can name, and how many links (dialed or accepted) a node keeps at once.
+#define LINK_MAX_PEERS 16
+#define LINK_SLOTS 64
+
+/// @brief what a link's outbound queue holds before relays for that peer are dropped.
+#define LINK_QUEUE 8192
+
+typedef struct{
+	/// @brief this node's id (unique among the nodes), the port peers link to (0: don't listen),
+	//			and the peers to dial, as "host:port".
+	int node;
+	int port;
+	const char *peers[LINK_MAX_PEERS];
+	int npeers;
+} link_config_t;
+
+/// @brief a relay flag: the text is a notice ("[time] bob has joined #dev"), ready to show as it is,
+//			not a chat line for the other node to stamp and render.
+#define LINK_NOTICE 1
+
+/// @brief hands one relayed message to the rooms here: room and name are NUL terminated, text is len bytes,
+//			flags are the LINK_ flags it was forwarded with. Runs on the link thread.
+typedef void (*link_deliver_fn)(const char *room, const char *name, const char *text, uint32_t len, int flags);
+
+/// @brief starts the link thread: listens on cfg->port and keeps dialing every peer until it's linked.
+/// @return 0 on success, -1 on failure (with a message printed).
+int link_start(const link_config_t *cfg, link_deliver_fn deliver);
+
+/// @brief whether links are on at all.
+int link_enabled(void);
+
+/// @brief sends a room message (text, len bytes, from name, with LINK_ flags) to every linked peer, once each. Any thread.
+void link_forward(const char *room, const char *name, const char *text, uint32_t len, int flags);
+
+#endif
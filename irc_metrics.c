@@ -0,0 +1,278 @@
+/*
+ * File: irc_metrics.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The per-thread counters and the admin socket behind irc_metrics.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "irc_metrics.h"
+
+__thread metrics_block_t *metrics_mine;
+
+const uint64_t metrics_bounds_ns[METRICS_BUCKETS - 1] = {
+	1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+/// @brief how each counter shows up in a scrape.
+static const struct{
+	const char *name;
+	const char *help;
+} counters[METRIC_COUNT] = {
+	[METRIC_MSGS_IN] = { "chat_messages_received_total", "Chat messages received from clients." },
+	[METRIC_BYTES_IN] = { "chat_bytes_received_total", "Bytes read from client sockets." },
+	[METRIC_MSGS_OUT] = { "chat_messages_sent_total", "Messages written (or queued) to clients." },
+	[METRIC_BYTES_OUT] = { "chat_bytes_sent_total", "Bytes written to client sockets." },
+	[METRIC_ACCEPTED] = { "chat_connections_accepted_total", "Connections accepted." },
+	[METRIC_REJECTED] = { "chat_connections_rejected_total", "Connections turned away (client limit, or we couldn't register them)." },
+	[METRIC_OUTQ_DROPPED] = { "chat_outq_dropped_total", "Messages dropped from full outbound queues." },
+	[METRIC_SLOW_DISCONNECTS] = { "chat_slow_disconnects_total", "Clients disconnected for a full outbound queue." },
+	[METRIC_HISTORY_QUEUED] = { "chat_history_queued_total", "Messages handed to the history writer." },
+	[METRIC_HISTORY_WRITTEN] = { "chat_history_written_total", "Messages the history writer has written out." },
+	[METRIC_SESSION_ALLOC] = { "chat_session_alloc_bytes_total", "Bytes client sessions have taken (structs, buffers, stacks)." },
+	[METRIC_SESSION_FREED] = { "chat_session_freed_bytes_total", "Bytes client sessions have given back." },
+	[METRIC_READ_CALLS] = { "chat_read_calls_total", "recv() calls on client sockets." },
+	[METRIC_WRITE_CALLS] = { "chat_write_calls_total", "write()/writev() calls on client sockets, and TCP_CORK toggles around big flushes." },
+	[METRIC_POLL_CALLS] = { "chat_poll_calls_total", "Times a loop (or an idle client thread) waited in epoll_wait() or poll()." },
+	[METRIC_CTL_CALLS] = { "chat_epoll_ctl_calls_total", "epoll_ctl() calls changing what a client is watched for." },
+	[METRIC_BATCH_FLUSHES] = { "chat_batch_flushes_total", "Times an event loop wrote out the messages it batched up." },
+	[METRIC_THROTTLED] = { "chat_throttled_total", "Times a client was held back for sending faster than its rate limit." },
+	[METRIC_FLOOD_DISCONNECTS] = { "chat_flood_disconnects_total", "Clients disconnected for flooding." },
+	[METRIC_PINGS] = { "chat_pings_sent_total", "PINGs sent to clients that went quiet." },
+	[METRIC_IDLE_DISCONNECTS] = { "chat_idle_disconnects_total", "Clients dropped for not answering a PING, or never sending a name." },
+	[METRIC_SESSIONS_PARKED] = { "chat_sessions_parked_total", "Sessions kept for a client that dropped, to resume." },
+	[METRIC_SESSIONS_RESUMED] = { "chat_sessions_resumed_total", "Parked sessions their client came back to." },
+	[METRIC_LINK_SENT] = { "chat_link_relays_sent_total", "Room messages queued to linked nodes (one per node per message)." },
+	[METRIC_LINK_RECEIVED] = { "chat_link_relays_received_total", "Room messages linked nodes relayed to us." },
+	[METRIC_LINK_DUPLICATES] = { "chat_link_duplicates_total", "Relays dropped because we had them already." },
+	[METRIC_LINK_DROPPED] = { "chat_link_dropped_total", "Relays dropped because a linked node wasn't keeping up." },
+	[METRIC_ROSTER_DELTAS] = { "chat_roster_deltas_total", "Roster deltas (joins and leaves, batched) sent to rooms." },
+	[METRIC_ROSTER_SNAPSHOTS] = { "chat_roster_snapshots_total", "Whole rosters sent to clients that joined a room or asked." },
+	[METRIC_ROSTER_COALESCED] = { "chat_roster_coalesced_total", "Joins and leaves that never went out, because a later one for the same name undid them." },
+};
+
+static const struct{
+	const char *name;
+	const char *help;
+} hists[HIST_COUNT] = {
+	[HIST_FANOUT] = { "chat_fanout_seconds", "Time send_message() takes to hand one message to a room." },
+};
+
+/// @brief taken by scrapes and by threads starting or exiting, never on the message path.
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief every live thread's block, and what exited threads counted.
+static metrics_block_t *blocks = NULL;
+static metrics_block_t retired;
+
+/// @brief what everyone shares if a block can't be allocated. Counts there may be off, but nothing breaks.
+static metrics_block_t fallback;
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+static int adminfd = -1;
+static metrics_extra_fn extra_fn;
+
+static void fold(metrics_block_t *into, metrics_block_t *from){
+	for(int i = 0; i < METRIC_COUNT; i++){
+		metrics_bump(&into->counter[i], atomic_load_explicit(&from->counter[i], memory_order_relaxed));
+	}
+	for(int h = 0; h < HIST_COUNT; h++){
+		for(int i = 0; i < METRICS_BUCKETS; i++){
+			metrics_bump(&into->bucket[h][i], atomic_load_explicit(&from->bucket[h][i], memory_order_relaxed));
+		}
+		metrics_bump(&into->sum_ns[h], atomic_load_explicit(&from->sum_ns[h], memory_order_relaxed));
+	}
+}
+
+/// @brief runs when a thread with a block exits: its counts go to the running total.
+static void thread_exit(void *arg){
+	metrics_block_t *b = arg;
+
+	pthread_mutex_lock(&metrics_lock);
+	fold(&retired, b);
+	if(b->prev){
+		b->prev->next = b->next;
+	} else {
+		blocks = b->next;
+	}
+	if(b->next){
+		b->next->prev = b->prev;
+	}
+	pthread_mutex_unlock(&metrics_lock);
+	free(b);
+}
+
+static void make_exit_key(void){
+	pthread_key_create(&exit_key, thread_exit);
+}
+
+metrics_block_t *metrics_thread_start(void){
+	pthread_once(&exit_once, make_exit_key);
+
+	metrics_block_t *b = calloc(1, sizeof(metrics_block_t));
+	if(!b){
+		metrics_mine = &fallback;
+		return metrics_mine;
+	}
+
+	pthread_mutex_lock(&metrics_lock);
+	b->next = blocks;
+	if(blocks){
+		blocks->prev = b;
+	}
+	blocks = b;
+	pthread_mutex_unlock(&metrics_lock);
+
+	pthread_setspecific(exit_key, b);
+	metrics_mine = b;
+	return b;
+}
+
+uint64_t metrics_total(metric_t m){
+	pthread_mutex_lock(&metrics_lock);
+	uint64_t total = atomic_load_explicit(&retired.counter[m], memory_order_relaxed)
+		+ atomic_load_explicit(&fallback.counter[m], memory_order_relaxed);
+	for(metrics_block_t *b = blocks; b; b = b->next){
+		total += atomic_load_explicit(&b->counter[m], memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&metrics_lock);
+	return total;
+}
+
+void metrics_write(FILE *out){
+	metrics_block_t sum;
+	memset(&sum, 0, sizeof(sum));
+
+	pthread_mutex_lock(&metrics_lock);
+	fold(&sum, &retired);
+	fold(&sum, &fallback);
+	for(metrics_block_t *b = blocks; b; b = b->next){
+		fold(&sum, b);
+	}
+	pthread_mutex_unlock(&metrics_lock);
+
+	for(int i = 0; i < METRIC_COUNT; i++){
+		fprintf(out, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", counters[i].name, counters[i].help,
+			counters[i].name, counters[i].name, (unsigned long)sum.counter[i]);
+	}
+
+	//handed over but not written yet. The two counts are read at slightly different times, so don't go below 0.
+	uint64_t queued = sum.counter[METRIC_HISTORY_QUEUED], written = sum.counter[METRIC_HISTORY_WRITTEN];
+	fprintf(out, "# HELP chat_history_queue_depth Messages waiting for the history writer.\n"
+		"# TYPE chat_history_queue_depth gauge\nchat_history_queue_depth %lu\n",
+		(unsigned long)(queued > written ? queued - written : 0));
+
+	uint64_t taken = sum.counter[METRIC_SESSION_ALLOC], given = sum.counter[METRIC_SESSION_FREED];
+	fprintf(out, "# HELP chat_session_bytes Bytes every client session holds right now.\n"
+		"# TYPE chat_session_bytes gauge\nchat_session_bytes %lu\n",
+		(unsigned long)(taken > given ? taken - given : 0));
+
+	for(int h = 0; h < HIST_COUNT; h++){
+		const char *name = hists[h].name;
+		uint64_t count = 0;
+
+		fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, hists[h].help, name);
+		for(int i = 0; i < METRICS_BUCKETS; i++){
+			count += sum.bucket[h][i];
+			if(i < METRICS_BUCKETS - 1){
+				fprintf(out, "%s_bucket{le=\"%g\"} %lu\n", name, metrics_bounds_ns[i] / 1e9, (unsigned long)count);
+			} else {
+				fprintf(out, "%s_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)count);
+			}
+		}
+		fprintf(out, "%s_sum %.9f\n%s_count %lu\n", name, sum.sum_ns[h] / 1e9, name, (unsigned long)count);
+	}
+}
+
+/// @brief answers one scrape. An HTTP GET gets an HTTP response (for curl and Prometheus),
+//			anything else (or nothing, within 200ms) gets the bare text.
+static void admin_answer(int fd){
+	char req[1024];
+	struct timeval tv = { 0, 200000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	ssize_t n = recv(fd, req, sizeof(req), 0);
+	int http = (n >= 4 && memcmp(req, "GET ", 4) == 0);
+
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out = open_memstream(&text, &len);
+	if(!out){
+		return;
+	}
+	metrics_write(out);
+	if(extra_fn){
+		extra_fn(out);
+	}
+	fclose(out);
+
+	if(http){
+		dprintf(fd, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+	}
+	for(size_t done = 0; done < len; ){
+		ssize_t w = write(fd, text + done, len - done);
+		if(w <= 0){
+			break;
+		}
+		done += (size_t)w;
+	}
+	free(text);
+}
+
+static void *admin_loop(void *arg){
+	(void)arg;
+	while(1){
+		int fd = accept4(adminfd, NULL, NULL, SOCK_CLOEXEC);
+		if(fd < 0){
+			if(errno != EINTR){
+				perror("ERROR: admin accept failed");
+			}
+			continue;
+		}
+		admin_answer(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+int metrics_serve(const char *path, metrics_extra_fn extra){
+	struct sockaddr_un addr;
+	pthread_t tid;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		printf("ERROR: admin socket path is too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	//a socket left behind by a server that didn't get to clean up would make bind fail.
+	unlink(path);
+
+	adminfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(adminfd < 0 || bind(adminfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(adminfd, 16) < 0){
+		perror("ERROR: admin socket failed");
+		return -1;
+	}
+	chmod(path, 0600);
+
+	extra_fn = extra;
+	if(pthread_create(&tid, NULL, &admin_loop, NULL) != 0){
+		printf("ERROR: pthread\n");
+		return -1;
+	}
+	pthread_detach(tid);
+	return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * File: irc_metrics.h
+ * Project: CSCI 3160 Chat Project
+ * Description: The server's counters and histograms, served in Prometheus' text format.
+ *
+ *	Every thread that counts something gets its own block of counters the first time it does,
+ *	and only that thread ever writes to it. So counting is a plain load and store on memory
+ *	nobody else writes: no locks, no atomic read-modify-writes, no cache lines bouncing between
+ *	threads on the message path. A scrape adds up all the blocks under a lock that only scrapes
+ *	and starting or exiting threads take. A thread that exits (threaded mode has one per client)
+ *	adds its counts to a running total first, so nothing counted is lost.
+ *
+ *	metrics_serve() answers on a unix socket, e.g. "curl --unix-socket <path> http://x/metrics"
+ *	or "nc -U <path>".
+ */
+
+#ifndef IRC_METRICS_H
+#define IRC_METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/// @brief the counters. Each only ever goes up.
+typedef enum{
+	METRIC_MSGS_IN,
+	METRIC_BYTES_IN,
+	METRIC_MSGS_OUT,
+	METRIC_BYTES_OUT,
+	METRIC_ACCEPTED,
+	METRIC_REJECTED,
+	METRIC_OUTQ_DROPPED,
+	METRIC_SLOW_DISCONNECTS,
+	METRIC_HISTORY_QUEUED,
+	METRIC_HISTORY_WRITTEN,
+	METRIC_SESSION_ALLOC,
+	METRIC_SESSION_FREED,
+	METRIC_READ_CALLS,
+	METRIC_WRITE_CALLS,
+	METRIC_POLL_CALLS,
+	METRIC_CTL_CALLS,
+	METRIC_BATCH_FLUSHES,
+	METRIC_THROTTLED,
+	METRIC_FLOOD_DISCONNECTS,
+	METRIC_PINGS,
+	METRIC_IDLE_DISCONNECTS,
+	METRIC_SESSIONS_PARKED,
+	METRIC_SESSIONS_RESUMED,
+	METRIC_LINK_SENT,
+	METRIC_LINK_RECEIVED,
+	METRIC_LINK_DUPLICATES,
+	METRIC_LINK_DROPPED,
+	METRIC_ROSTER_DELTAS,
+	METRIC_ROSTER_SNAPSHOTS,
+	METRIC_ROSTER_COALESCED,
+	METRIC_COUNT
+} metric_t;
+
+/// @brief the histograms (of nanoseconds).
+typedef enum{
+	HIST_FANOUT,
+	HIST_COUNT
+} metric_hist_t;
+
+/// @brief bucket upper bounds, 1us to 10ms, plus +Inf.
+#define METRICS_BUCKETS 14
+
+typedef struct metrics_block{
+	_Atomic uint64_t counter[METRIC_COUNT];
+	_Atomic uint64_t bucket[HIST_COUNT][METRICS_BUCKETS];
+	_Atomic uint64_t sum_ns[HIST_COUNT];
+
+	/// @brief the list of live blocks (under the scrape lock).
+	struct metrics_block *prev;
+	struct metrics_block *next;
+} metrics_block_t;
+
+extern __thread metrics_block_t *metrics_mine;
+extern const uint64_t metrics_bounds_ns[METRICS_BUCKETS - 1];
+
+/// @brief makes this thread its block. Use metrics_me() instead.
+metrics_block_t *metrics_thread_start(void);
+
+static inline metrics_block_t *metrics_me(void){
+	return metrics_mine ? metrics_mine : metrics_thread_start();
+}
+
+/// @brief adds v to a counter in our own block. Only the owner writes it, so no atomic add is needed;
+//			the relaxed store just keeps the scraper's read of it well defined.
+static inline void metrics_bump(_Atomic uint64_t *c, uint64_t v){
+	atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+static inline void metrics_add(metric_t m, uint64_t v){
+	metrics_bump(&metrics_me()->counter[m], v);
+}
+
+/// @brief records one observation of ns nanoseconds in histogram h.
+static inline void metrics_observe(metric_hist_t h, uint64_t ns){
+	metrics_block_t *b = metrics_me();
+	int i = 0;
+	while(i < METRICS_BUCKETS - 1 && ns > metrics_bounds_ns[i]){
+		i++;
+	}
+	metrics_bump(&b->bucket[h][i], 1);
+	metrics_bump(&b->sum_ns[h], ns);
+}
+
+static inline uint64_t metrics_now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/// @brief what the server adds to every scrape (gauges only it knows). Runs on the admin thread.
+typedef void (*metrics_extra_fn)(FILE *out);
+
+/// @brief one counter, summed over all threads.
+uint64_t metrics_total(metric_t m);
+
+/// @brief writes every counter and histogram, summed over all threads, in Prometheus' text format.
+void metrics_write(FILE *out);
+
+/// @brief starts the admin thread, answering scrapes on a unix socket at path (only we can connect).
+/// @return 0 on success, -1 on failure.
+int metrics_serve(const char *path, metrics_extra_fn extra);
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ * File: irc_mpsc.h
+ * Project: CSCI 3160 Chat Project
+ * Description: A lock-free multi-producer / single-consumer queue.
+ *	Any number of threads may push, exactly one thread pops.
+ *	It is intrusive: put an mpsc_node_t inside your struct and push that, then use
+ *	mpsc_entry() to get your struct back after popping.
+ *
+ * This is Dmitry Vyukov's non-intrusive-stub MPSC queue:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue
+ * Pushing is one atomic exchange and never waits on the consumer or other producers.
+ */
+
+#ifndef IRC_MPSC_H
+#define IRC_MPSC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct mpsc_node{
+	_Atomic(struct mpsc_node *) next;
+} mpsc_node_t;
+
+typedef struct{
+	/// @brief producers swap themselves in here.
+	_Atomic(mpsc_node_t *) head;
+
+	/// @brief only the consumer touches tail.
+	mpsc_node_t *tail;
+
+	/// @brief placeholder node so the queue is never really empty.
+	mpsc_node_t stub;
+} mpsc_queue_t;
+
+/// @brief gets the struct that contains a popped node.
+#define mpsc_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+static inline void mpsc_init(mpsc_queue_t *q){
+	atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&q->head, &q->stub, memory_order_relaxed);
+	q->tail = &q->stub;
+}
+
+/// @brief adds n to the queue. Safe to call from any thread.
+static inline void mpsc_push(mpsc_queue_t *q, mpsc_node_t *n){
+	atomic_store_explicit(&n->next, NULL, memory_order_relaxed);
+	mpsc_node_t *prev = atomic_exchange_explicit(&q->head, n, memory_order_acq_rel);
+	atomic_store_explicit(&prev->next, n, memory_order_release);
+}
+
+/// @brief takes the oldest node off the queue. Only the consumer thread may call this.
+/// @return the node, or NULL if the queue is empty or a producer is halfway through a push
+///			(in which case that producer's wake-up will bring the consumer back).
+static inline mpsc_node_t *mpsc_pop(mpsc_queue_t *q){
+	mpsc_node_t *tail = q->tail;
+	mpsc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+	if(tail == &q->stub){
+		if(!next){
+			return NULL;
+		}
+		q->tail = next;
+		tail = next;
+		next = atomic_load_explicit(&next->next, memory_order_acquire);
+	}
+
+	if(next){
+		q->tail = next;
+		return tail;
+	}
+
+	if(tail != atomic_load_explicit(&q->head, memory_order_acquire)){
+		return NULL;
+	}
+
+	//tail is the last real node. Put the stub behind it so tail can be handed out.
+	mpsc_push(q, &q->stub);
+	next = atomic_load_explicit(&tail->next, memory_order_acquire);
+	if(next){
+		q->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * File: irc_msgbuf.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The message buffer pool behind irc_msgbuf.h.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "irc_msgbuf.h"
+
+/// @brief buffer sizes the pool hands out. Anything bigger is malloc'd and freed directly.
+static const size_t class_size[] = { 256, 2048, 16384, 65536 };
+#define NUM_CLASSES (int)(sizeof(class_size) / sizeof(class_size[0]))
+
+/// @brief how many free buffers a thread keeps per class before spilling half of them to the shared list.
+#define CACHE_MAX 256
+#define CACHE_BATCH (CACHE_MAX / 2)
+
+/// @brief one thread's free buffers.
+typedef struct{
+	msgbuf_t *head[NUM_CLASSES];
+	int count[NUM_CLASSES];
+} msgbuf_cache_t;
+
+static __thread msgbuf_cache_t cache;
+
+/// @brief flushes a thread's cache when it exits, so threaded mode's per-client threads don't take buffers with them.
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+static __thread int cache_registered;
+
+/// @brief the shared free lists. Only touched in batches, when a thread's cache runs dry or overflows.
+static msgbuf_t *shared_head[NUM_CLASSES];
+static int shared_count[NUM_CLASSES];
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int size_class_for(size_t cap){
+	for(int i = 0; i < NUM_CLASSES; i++){
+		if(cap <= class_size[i]){
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void thread_exit(void *arg){
+	(void)arg;
+	msgbuf_cache_flush();
+}
+
+static void make_exit_key(void){
+	pthread_key_create(&exit_key, thread_exit);
+}
+
+/// @brief moves up to CACHE_BATCH buffers of class c from the shared list into this thread's cache.
+//			It's the first thing a thread does with the pool, so this is also where it signs up for the exit flush.
+static void cache_refill(int c){
+	if(!cache_registered){
+		pthread_once(&exit_once, make_exit_key);
+		pthread_setspecific(exit_key, &cache);
+		cache_registered = 1;
+	}
+
+	pthread_mutex_lock(&shared_mutex);
+	for(int i = 0; i < CACHE_BATCH && shared_head[c]; i++){
+		msgbuf_t *m = shared_head[c];
+		shared_head[c] = m->next_free;
+		shared_count[c]--;
+		m->next_free = cache.head[c];
+		cache.head[c] = m;
+		cache.count[c]++;
+	}
+	pthread_mutex_unlock(&shared_mutex);
+}
+
+/// @brief hands CACHE_BATCH buffers of class c from this thread's cache to the shared list.
+static void cache_spill(int c){
+	pthread_mutex_lock(&shared_mutex);
+	for(int i = 0; i < CACHE_BATCH && cache.head[c]; i++){
+		msgbuf_t *m = cache.head[c];
+		cache.head[c] = m->next_free;
+		cache.count[c]--;
+		m->next_free = shared_head[c];
+		shared_head[c] = m;
+		shared_count[c]++;
+	}
+	pthread_mutex_unlock(&shared_mutex);
+}
+
+msgbuf_t *msgbuf_alloc(size_t cap){
+	int c = size_class_for(cap);
+	msgbuf_t *m = NULL;
+
+	if(c >= 0){
+		if(!cache.head[c]){
+			cache_refill(c);
+		}
+		if(cache.head[c]){
+			m = cache.head[c];
+			cache.head[c] = m->next_free;
+			cache.count[c]--;
+		} else {
+			m = malloc(sizeof(msgbuf_t) + class_size[c] + 1);
+			if(!m){
+				return NULL;
+			}
+			m->cap = class_size[c];
+		}
+	} else {
+		m = malloc(sizeof(msgbuf_t) + cap + 1);
+		if(!m){
+			return NULL;
+		}
+		m->cap = cap;
+	}
+
+	m->size_class = c;
+	m->len = 0;
+	m->next_free = NULL;
+	atomic_store_explicit(&m->refs, 1, memory_order_relaxed);
+	return m;
+}
+
+void msgbuf_unref(msgbuf_t *m){
+	//acq_rel so everything the other owners did with the buffer happens before we recycle it.
+	if(atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) != 1){
+		return;
+	}
+
+	int c = m->size_class;
+	if(c < 0){
+		free(m);
+		return;
+	}
+
+	m->next_free = cache.head[c];
+	cache.head[c] = m;
+	if(++cache.count[c] > CACHE_MAX){
+		cache_spill(c);
+	}
+}
+
+void msgbuf_cache_flush(void){
+	pthread_mutex_lock(&shared_mutex);
+	for(int c = 0; c < NUM_CLASSES; c++){
+		while(cache.head[c]){
+			msgbuf_t *m = cache.head[c];
+			cache.head[c] = m->next_free;
+			m->next_free = shared_head[c];
+			shared_head[c] = m;
+			shared_count[c]++;
+		}
+		cache.count[c] = 0;
+	}
+	pthread_mutex_unlock(&shared_mutex);
+}
@@ -0,0 +1,54 @@
+/*
+ * File: irc_msgbuf.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Pooled, reference counted message buffers.
+ *	A message is received (or formatted) into a msgbuf once, and then every place that needs it
+ *	(each recipient's outbound queue, the chat history logger, the console echo) takes a reference
+ *	instead of a copy. The last msgbuf_unref() hands the buffer back to the pool.
+ *
+ *	The pool keeps a small free list per thread and size class, so allocating and freeing on the
+ *	message path normally doesn't take a lock. Threads spill to / refill from a shared list in batches.
+ */
+
+#ifndef IRC_MSGBUF_H
+#define IRC_MSGBUF_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+typedef struct msgbuf{
+	/// @brief how many owners this buffer has. Starts at 1 for whoever allocated it.
+	_Atomic unsigned refs;
+
+	/// @brief which pool size class it came from (-1 for oversized buffers that bypass the pool).
+	int size_class;
+
+	/// @brief usable bytes in data[], and how many of them hold the message.
+	size_t cap;
+	size_t len;
+
+	/// @brief free list link while the buffer sits in the pool.
+	struct msgbuf *next_free;
+
+	/// @brief the message itself. There is always room for one byte past cap, so it can be NUL terminated.
+	char data[];
+} msgbuf_t;
+
+/// @brief gets a buffer with room for at least cap bytes and one reference.
+/// @return the buffer, or NULL if we're out of memory.
+msgbuf_t *msgbuf_alloc(size_t cap);
+
+/// @brief adds a reference for another owner.
+static inline msgbuf_t *msgbuf_ref(msgbuf_t *m){
+	atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+	return m;
+}
+
+/// @brief drops one reference. The last one returns the buffer to the pool.
+void msgbuf_unref(msgbuf_t *m);
+
+/// @brief hands every buffer this thread has cached to the shared lists, for a thread about to go quiet.
+//			Threads that exit do this by themselves.
+void msgbuf_cache_flush(void);
+
+#endif
@@ -0,0 +1,503 @@
+/*
+ * File: irc_proto.h
+ * Project: CSCI 3160 Chat Project
+ * Description: The wire format shared by irc_server.c and irc_client.c.
+ *
+ *	Every message is one frame: an 8 byte header followed by the payload.
+ *
+ *	 byte 0     magic, always IRC_FRAME_MAGIC (0xFA, which never starts valid UTF-8 text,
+ *	            so the server can tell framed clients from old raw-text ones by the first byte)
+ *	 byte 1     protocol version (IRC_PROTO_VERSION)
+ *	 byte 2     frame type (irc_frame_type_t)
+ *	 byte 3     flags, per frame type (e.g. IRC_MSG_NAMED), 0 where a type has none
+ *	 bytes 4-7  payload length, big endian. At most IRC_MAX_PAYLOAD.
+ *
+ *	TCP is a byte stream, so one recv() can hold half a frame or several frames.
+ *	irc_frame_next() walks frames out of a buffer without ever re-reading bytes it already parsed,
+ *	and irc_reader_t wraps that up with a socket for code that just wants frames one at a time.
+ */
+
+#ifndef IRC_PROTO_H
+#define IRC_PROTO_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define IRC_FRAME_MAGIC 0xFA
+#define IRC_PROTO_VERSION 1
+#define IRC_FRAME_HDR 8
+#define IRC_MAX_PAYLOAD (65536 - IRC_FRAME_HDR)
+
+typedef enum{
+	/// @brief client -> server: the first frame on a connection, payload is the user name.
+	IRC_JOIN = 1,
+
+	/// @brief client -> server: one chat line, just what the user typed. server -> client: a line of text from the
+	//			server (notices, replies, history, raw-text senders), ready to print.
+	IRC_CHAT = 2,
+
+	/// @brief client -> server: the user is leaving (same as closing the socket, but explicit).
+	IRC_LEAVE = 3,
+
+	/// @brief either way: a command for the other side. Payload is "<verb> [args]".
+	IRC_CONTROL = 4,
+
+	/// @brief client -> server: the first frame on a connection instead of JOIN, to pick up a session that
+	//			dropped. Payload is "<name> <token> <last seq>", with the token the server handed out in a
+	//			CONTROL "session <token>" and the highest sequence number the client got before it dropped.
+	IRC_RESUME = 5,
+
+	/// @brief server -> client: the sequence number (IRC_SEQ_LEN bytes, big endian) of the room message in the
+	//			CHAT frame right after it. Numbers go up across every room. Clients that don't know it skip it.
+	IRC_SEQ = 6,
+
+	/// @brief server <-> server, on a link (irc_link.h): the first frame each way, payload "<node id> <epoch>".
+	IRC_LINK = 7,
+
+	/// @brief server <-> server: one room message for the other node's members (layout in irc_link.c).
+	IRC_RELAY = 8,
+
+	/// @brief server -> client: one chat line someone sent, as fields (see irc_msg_t): who sent it (uid), when
+	//			(the server's clock, so nobody can fake it), the room and the text. The client prints it itself.
+	IRC_MSG = 9,
+
+	/// @brief server -> client: "uid (4 bytes, big endian) then name", the name MSG frames from that uid are from.
+	//			Sent right before the first MSG from a sender the client wasn't told about yet.
+	IRC_USER = 10,
+
+	/// @brief either way: are you still there? The other side answers with a PONG carrying the same payload.
+	//			The server sends one to a client that's been quiet for a while, and drops it if nothing comes back.
+	IRC_PING = 11,
+
+	/// @brief either way: the answer to a PING.
+	IRC_PONG = 12,
+
+	/// @brief server -> client: who's in a room (see irc_roster_t). With IRC_ROSTER_FULL it's everyone, sent to a
+	//			client that just joined (or asked, CONTROL "who #room"); without, it's who came and went since the
+	//			roster's last version, sent to the whole room (numbered, like a MSG) and printed as a notice.
+	IRC_ROSTER = 13
+} irc_frame_type_t;
+
+#define IRC_SEQ_LEN 8
+
+/// @brief a whole IRC_SEQ frame, header and number.
+#define IRC_SEQ_FRAME (IRC_FRAME_HDR + IRC_SEQ_LEN)
+
+/// @brief an IRC_MSG frame's payload:
+//	 bytes 0-3    sender uid, big endian (0: not a client on this server; the name is in the frame instead)
+//	 bytes 4-11   when the server got it, seconds since 1970, big endian
+//	 then         room name length (1 byte) and the room name
+//	 then         with IRC_MSG_NAMED in the frame flags only: name length (1 byte) and the sender's name
+//	 then         the text, to the end of the frame (no newline)
+#define IRC_MSG_HDR 12
+#define IRC_MSG_NAMED 1
+
+/// @brief the server sends IRC_USER again before a uid's next MSG whenever it can't be sure the client still has
+//			its name, so a client has to keep (at least) the latest name for every uid % IRC_USER_SLOTS.
+#define IRC_USER_SLOTS 32
+
+/// @brief an IRC_ROSTER frame's payload:
+//	 bytes 0-3    the room's roster version, counting this frame, big endian
+//	 bytes 4-11   when, seconds since 1970, big endian
+//	 then         room name length (1 byte) and the room name
+//	 then         to the end of the frame, one entry per name: 1 if they're in the room (0 if they left), the
+//	              name's length (1 byte) and the name
+//	A delta (no flags) is what changed from version - 1, so a client that has an older version than that missed
+//	one. IRC_ROSTER_FULL is the whole roster at that version, everyone in it in. One too big for a frame goes in
+//	several, the ones after the first with IRC_ROSTER_MORE too.
+#define IRC_ROSTER_HDR 12
+#define IRC_ROSTER_FULL 1
+#define IRC_ROSTER_MORE 2
+
+/// @brief a delta names this many of the people who joined (and of those who left), and counts the rest.
+#define IRC_ROSTER_SHOWN 5
+
+/// @brief an IRC_ROSTER frame taken apart (the entries are walked with irc_roster_next).
+typedef struct{
+	uint32_t version;
+	uint64_t time;
+	const char *room;
+	uint32_t rlen;
+	const char *entries;
+	uint32_t elen;
+} irc_roster_t;
+
+/// @brief an IRC_MSG frame taken apart. Pointers go into the frame; names and text aren't NUL terminated.
+typedef struct{
+	uint32_t uid;
+	uint64_t time;
+	const char *room;
+	uint32_t rlen;
+	const char *name;
+	uint32_t nlen;
+	const char *text;
+	uint32_t len;
+} irc_msg_t;
+
+/// @brief one parsed frame. payload points into the buffer it was parsed from.
+typedef struct{
+	uint8_t type;
+	uint8_t flags;
+	uint32_t len;
+	char *payload;
+} irc_frame_t;
+
+/// @brief writes a frame header into hdr (IRC_FRAME_HDR bytes).
+static inline void irc_frame_header(char *hdr, int type, int flags, uint32_t len){
+	hdr[0] = (char)IRC_FRAME_MAGIC;
+	hdr[1] = IRC_PROTO_VERSION;
+	hdr[2] = (char)type;
+	hdr[3] = (char)flags;
+	hdr[4] = (char)(len >> 24);
+	hdr[5] = (char)(len >> 16);
+	hdr[6] = (char)(len >> 8);
+	hdr[7] = (char)len;
+}
+
+/// @brief writes an IRC_SEQ frame for seq into buf (IRC_SEQ_FRAME bytes).
+static inline void irc_seq_frame(char *buf, uint64_t seq){
+	irc_frame_header(buf, IRC_SEQ, 0, IRC_SEQ_LEN);
+	for(int i = 0; i < IRC_SEQ_LEN; i++){
+		buf[IRC_FRAME_HDR + i] = (char)(seq >> (8 * (IRC_SEQ_LEN - 1 - i)));
+	}
+}
+
+/// @brief the number in an IRC_SEQ frame's payload.
+static inline uint64_t irc_seq_value(const char *payload){
+	uint64_t seq = 0;
+	for(int i = 0; i < IRC_SEQ_LEN; i++){
+		seq = seq << 8 | (unsigned char)payload[i];
+	}
+	return seq;
+}
+
+static inline void irc_put_be32(char *p, uint32_t v){
+	p[0] = (char)(v >> 24);
+	p[1] = (char)(v >> 16);
+	p[2] = (char)(v >> 8);
+	p[3] = (char)v;
+}
+
+static inline uint32_t irc_be32(const char *p){
+	const unsigned char *u = (const unsigned char *)p;
+	return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+}
+
+/// @brief writes an IRC_MSG payload's fields up to the text into p. The name only goes in for uid 0
+//			(the frame gets IRC_MSG_NAMED then); everyone else's comes in an IRC_USER frame.
+/// @return how many bytes that took; the text goes right after.
+static inline uint32_t irc_msg_head(char *p, uint32_t uid, uint64_t time, const char *room, uint32_t rlen,
+	const char *name, uint32_t nlen){
+	uint32_t at = IRC_MSG_HDR;
+	irc_put_be32(p, uid);
+	irc_put_be32(p + 4, (uint32_t)(time >> 32));
+	irc_put_be32(p + 8, (uint32_t)time);
+	p[at++] = (char)rlen;
+	memcpy(p + at, room, rlen);
+	at += rlen;
+	if(uid == 0){
+		p[at++] = (char)nlen;
+		memcpy(p + at, name, nlen);
+		at += nlen;
+	}
+	return at;
+}
+
+/// @brief takes an IRC_MSG frame apart. m->name is NULL if the frame doesn't carry the name (look the uid up).
+/// @return 0, or -1 if it's malformed.
+static inline int irc_msg_parse(const char *payload, uint32_t len, uint8_t flags, irc_msg_t *m){
+	if(len < IRC_MSG_HDR + 1){
+		return -1;
+	}
+	uint32_t at = IRC_MSG_HDR;
+	m->uid = irc_be32(payload);
+	m->time = (uint64_t)irc_be32(payload + 4) << 32 | irc_be32(payload + 8);
+	m->rlen = (unsigned char)payload[at++];
+	m->room = payload + at;
+	at += m->rlen;
+	m->name = NULL;
+	m->nlen = 0;
+	if(flags & IRC_MSG_NAMED){
+		if(at >= len){
+			return -1;
+		}
+		m->nlen = (unsigned char)payload[at++];
+		m->name = payload + at;
+		at += m->nlen;
+	}
+	if(at > len){
+		return -1;
+	}
+	m->text = payload + at;
+	m->len = len - at;
+	return 0;
+}
+
+/// @brief renders a chat line the way everyone prints it: "[stamp] name: text\n", or "[stamp] #room name: text\n"
+//			outside #lobby. Cut short (still ending in a newline) if it doesn't fit in cap bytes.
+/// @return its length.
+static inline size_t irc_render(char *out, size_t cap, const char *stamp, const char *room, uint32_t rlen,
+	const char *name, uint32_t nlen, const char *text, uint32_t len){
+	int n;
+	if(rlen == 6 && memcmp(room, "#lobby", 6) == 0){
+		n = snprintf(out, cap, "[%s] %.*s: ", stamp, (int)nlen, name);
+	} else {
+		n = snprintf(out, cap, "[%s] %.*s %.*s: ", stamp, (int)rlen, room, (int)nlen, name);
+	}
+	if(n < 0 || (size_t)n >= cap){
+		return 0;
+	}
+	size_t at = (size_t)n;
+	if(len > cap - at - 1){
+		len = (uint32_t)(cap - at - 1);
+	}
+	memcpy(out + at, text, len);
+	at += len;
+	out[at++] = '\n';
+	return at;
+}
+
+/// @brief writes an IRC_ROSTER payload's fields up to the entries into p.
+/// @return how many bytes that took; the entries go right after.
+static inline uint32_t irc_roster_head(char *p, uint32_t version, uint64_t time, const char *room, uint32_t rlen){
+	uint32_t at = IRC_ROSTER_HDR;
+	irc_put_be32(p, version);
+	irc_put_be32(p + 4, (uint32_t)(time >> 32));
+	irc_put_be32(p + 8, (uint32_t)time);
+	p[at++] = (char)rlen;
+	memcpy(p + at, room, rlen);
+	return at + rlen;
+}
+
+/// @brief writes one entry (name is nlen bytes, at most 255) into p.
+/// @return how many bytes that took.
+static inline uint32_t irc_roster_entry(char *p, int in, const char *name, uint32_t nlen){
+	p[0] = (char)(in ? 1 : 0);
+	p[1] = (char)nlen;
+	memcpy(p + 2, name, nlen);
+	return 2 + nlen;
+}
+
+/// @brief takes an IRC_ROSTER frame apart.
+/// @return 0, or -1 if it's malformed.
+static inline int irc_roster_parse(const char *payload, uint32_t len, irc_roster_t *r){
+	if(len < IRC_ROSTER_HDR + 1){
+		return -1;
+	}
+	uint32_t at = IRC_ROSTER_HDR;
+	r->version = irc_be32(payload);
+	r->time = (uint64_t)irc_be32(payload + 4) << 32 | irc_be32(payload + 8);
+	r->rlen = (unsigned char)payload[at++];
+	r->room = payload + at;
+	at += r->rlen;
+	if(at > len){
+		return -1;
+	}
+	r->entries = payload + at;
+	r->elen = len - at;
+	return 0;
+}
+
+/// @brief the entry at *at (start at 0), moving *at past it.
+/// @return 1 if there was one, 0 at the end (or at an entry cut short).
+static inline int irc_roster_next(const irc_roster_t *r, uint32_t *at, int *in, const char **name, uint32_t *nlen){
+	if(*at + 2 > r->elen || *at + 2 + (unsigned char)r->entries[*at + 1] > r->elen){
+		return 0;
+	}
+	*in = r->entries[*at] != 0;
+	*nlen = (unsigned char)r->entries[*at + 1];
+	*name = r->entries + *at + 2;
+	*at += 2 + *nlen;
+	return 1;
+}
+
+/// @brief "a, b and c" for the entries that are in (or out): the first IRC_ROSTER_SHOWN of them, then
+//			"and N others". Appends to out at *at, as far as cap allows.
+/// @return how many entries there were.
+static inline uint32_t irc_roster_names(const irc_roster_t *r, int want, char *out, size_t cap, size_t *at){
+	uint32_t total = 0, shown = 0, pos = 0, nlen;
+	const char *name;
+	int in;
+
+	while(irc_roster_next(r, &pos, &in, &name, &nlen)){
+		total += (in == want);
+	}
+	pos = 0;
+	while(irc_roster_next(r, &pos, &in, &name, &nlen) && shown < IRC_ROSTER_SHOWN){
+		if(in != want){
+			continue;
+		}
+		shown++;
+		const char *sep = shown == 1 ? "" : (shown == total ? " and " : ", ");
+		int n = snprintf(out + *at, cap - *at, "%s%.*s", sep, (int)nlen, name);
+		if(n < 0 || (size_t)n >= cap - *at){
+			return total;
+		}
+		*at += (size_t)n;
+	}
+	if(total > shown){
+		int n = snprintf(out + *at, cap - *at, " and %u other%s", total - shown, total - shown == 1 ? "" : "s");
+		if(n > 0 && (size_t)n < cap - *at){
+			*at += (size_t)n;
+		}
+	}
+	return total;
+}
+
+/// @brief renders a roster delta the way everyone prints it: "[stamp] a, b and 3 others have joined #room; c has
+//			left #room\n" (either half on its own if nobody left, or nobody joined).
+/// @return its length, 0 if there's nothing to say (or it doesn't fit in cap bytes).
+static inline size_t irc_roster_render(char *out, size_t cap, const char *stamp, const irc_roster_t *r){
+	int n = snprintf(out, cap, "[%s] ", stamp);
+	if(n < 0 || (size_t)n >= cap){
+		return 0;
+	}
+	size_t at = (size_t)n, start = at;
+	for(int want = 1; want >= 0; want--){
+		size_t before = at;
+		if(at > start && at + 2 < cap){
+			memcpy(out + at, "; ", 2);
+			at += 2;
+		}
+		uint32_t count = irc_roster_names(r, want, out, cap, &at);
+		if(count == 0){
+			at = before;
+			continue;
+		}
+		n = snprintf(out + at, cap - at, " %s %s %.*s", count == 1 ? "has" : "have", want ? "joined" : "left",
+			(int)r->rlen, r->room);
+		if(n > 0 && (size_t)n < cap - at){
+			at += (size_t)n;
+		}
+	}
+	if(at == start || at + 1 >= cap){
+		return 0;
+	}
+	out[at++] = '\n';
+	return at;
+}
+
+/// @brief how many bytes the frame starting at buf needs in total, once its header is in.
+/// @return header + payload size, 0 if fewer than IRC_FRAME_HDR bytes are there yet, -1 if it isn't a valid frame.
+static inline long irc_frame_size(const char *buf, size_t avail){
+	if(avail < IRC_FRAME_HDR){
+		return 0;
+	}
+
+	const unsigned char *h = (const unsigned char *)buf;
+	if(h[0] != IRC_FRAME_MAGIC || h[1] != IRC_PROTO_VERSION){
+		return -1;
+	}
+
+	uint32_t len = ((uint32_t)h[4] << 24) | ((uint32_t)h[5] << 16) | ((uint32_t)h[6] << 8) | h[7];
+	if(len > IRC_MAX_PAYLOAD){
+		return -1;
+	}
+	return IRC_FRAME_HDR + (long)len;
+}
+
+/// @brief parses the next complete frame in buf[*off .. len).
+//			On success *off moves past the frame, so calling this in a loop walks every frame that
+//			has fully arrived. A partial frame is left alone (and *off stays on it) until more data comes in.
+/// @return 1 if f holds a frame, 0 if more data is needed, -1 on a protocol error.
+static inline int irc_frame_next(char *buf, size_t len, size_t *off, irc_frame_t *f){
+	long size = irc_frame_size(buf + *off, len - *off);
+	if(size <= 0){
+		return (int)size;
+	}
+	if((size_t)size > len - *off){
+		return 0;
+	}
+
+	char *h = buf + *off;
+	f->type = (uint8_t)h[2];
+	f->flags = (uint8_t)h[3];
+	f->len = (uint32_t)(size - IRC_FRAME_HDR);
+	f->payload = h + IRC_FRAME_HDR;
+	*off += (size_t)size;
+	return 1;
+}
+
+/// @brief sends one frame with a single writev-style send (header and payload together).
+/// @return 0 on success, -1 on error.
+static inline int irc_send_frame(int fd, int type, const char *payload, uint32_t len){
+	char hdr[IRC_FRAME_HDR];
+	struct iovec iov[2];
+	struct msghdr mh;
+
+	irc_frame_header(hdr, type, 0, len);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = IRC_FRAME_HDR;
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = len;
+
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = iov;
+	mh.msg_iovlen = len ? 2 : 1;
+
+	size_t total = IRC_FRAME_HDR + len;
+	size_t sent = 0;
+	while(sent < total){
+		ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		sent += (size_t)n;
+
+		//short send: skip what went out and try again with the rest.
+		while(mh.msg_iovlen > 0 && (size_t)n >= mh.msg_iov[0].iov_len){
+			n -= (ssize_t)mh.msg_iov[0].iov_len;
+			mh.msg_iov++;
+			mh.msg_iovlen--;
+		}
+		if(mh.msg_iovlen > 0){
+			mh.msg_iov[0].iov_base = (char *)mh.msg_iov[0].iov_base + n;
+			mh.msg_iov[0].iov_len -= (size_t)n;
+		}
+	}
+	return 0;
+}
+
+/// @brief a receive buffer that turns a socket into a sequence of frames.
+typedef struct{
+	char buf[IRC_FRAME_HDR + IRC_MAX_PAYLOAD];
+	size_t len;
+	size_t off;
+} irc_reader_t;
+
+static inline void irc_reader_init(irc_reader_t *r){
+	r->len = 0;
+	r->off = 0;
+}
+
+/// @brief reads whatever the socket has into the buffer (one recv).
+/// @return what recv() returned.
+static inline ssize_t irc_reader_fill(irc_reader_t *r, int fd){
+	//slide the unparsed tail to the front once the parsed part is in the way.
+	if(r->off > 0){
+		memmove(r->buf, r->buf + r->off, r->len - r->off);
+		r->len -= r->off;
+		r->off = 0;
+	}
+
+	ssize_t n = recv(fd, r->buf + r->len, sizeof(r->buf) - r->len, 0);
+	if(n > 0){
+		r->len += (size_t)n;
+	}
+	return n;
+}
+
+/// @brief gets the next complete frame out of the reader. Same return values as irc_frame_next().
+static inline int irc_reader_next(irc_reader_t *r, irc_frame_t *f){
+	return irc_frame_next(r->buf, r->len, &r->off, f);
+}
+
+#endif
@@ -0,0 +1,363 @@
+/*
+ * File: irc_query.c
+ * Project: CSCI 3160 Chat Project
+ * Description: Searches the chat history the server writes (see irc_segment.h).
+ * Usage: ./query [-d history_dir] [-s since] [-e until] [-c room] [-u user] [-k words] [-n max] [-v]
+ *	       ./query [-d history_dir] -z
+ *	since/until are "YYYY-MM-DD", "YYYY-MM-DD HH:MM" or "YYYY-MM-DD HH:MM:SS" (local time).
+ *	-c only shows messages sent to that room, -u only messages from that user, -k only messages containing all of the given words
+ *	(whole words, any case). Build with "gcc -o query irc_query.c irc_segment.c -lz".
+ *	-z compacts every day before today into a .segz right away, instead of waiting for the server to
+ *	(which it does a minute after midnight), and prints how much smaller each one got. A day the server
+ *	still has open is left alone.
+ *
+ *	It never reads a whole file: only the day files in the time range are opened, the index is
+ *	binary searched for the first block in range, and blocks whose bloom filter rules out the
+ *	room, user or a word are skipped without touching their records (or inflating them, in a .segz).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "irc_segment.h"
+
+#define MAX_WORDS 16
+
+/// @brief what we're looking for.
+static int64_t since_ms = 0, until_ms = INT64_MAX;
+static const char *room = NULL;
+static const char *user = NULL;
+static char *words[MAX_WORDS];
+static size_t word_len[MAX_WORDS];
+static int nwords = 0;
+static long max_results = -1, results = 0;
+
+/// @brief what it took (-v).
+static long days_opened, blocks_total, blocks_time, blocks_bloom, blocks_inflated, records_read;
+
+/// @brief parses a local date/time. A bare date means the start of that day,
+//			or the end of it if end_of_day is set.
+/// @return 0 on success, -1 if it isn't a date.
+int parse_time(const char *s, int end_of_day, int64_t *out){
+	static const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+	struct tm tm;
+
+	for(int i = 0; i < 3; i++){
+		memset(&tm, 0, sizeof(tm));
+		const char *rest = strptime(s, formats[i], &tm);
+		if(!rest || *rest != '\0'){
+			continue;
+		}
+
+		//only a bare date stretches to the end of the day.
+		if(end_of_day && i == 2){
+			tm.tm_hour = 23;
+			tm.tm_min = 59;
+			tm.tm_sec = 59;
+		}
+		tm.tm_isdst = -1;
+		*out = (int64_t)mktime(&tm) * 1000 + ((end_of_day && i == 2) ? 999 : 0);
+		return 0;
+	}
+	return -1;
+}
+
+/// @brief does the message's text contain word (as a whole word, any case)?
+int has_word(const char *text, size_t len, const char *word, size_t wlen){
+	size_t pos = 0, start, l;
+	while(seg_next_word(text, len, &pos, &start, &l)){
+		if(l == wlen && strncasecmp(text + start, word, wlen) == 0){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/// @brief could the block hold a match? Checks its time range and bloom filter.
+int block_may_match(const seg_index_t *b){
+	if(b->last_ms < since_ms || b->first_ms > until_ms){
+		blocks_time++;
+		return 0;
+	}
+	if(room && !seg_bloom_test(b->bloom, seg_hash_room(room, strlen(room)))){
+		blocks_bloom++;
+		return 0;
+	}
+	if(user && !seg_bloom_test(b->bloom, seg_hash_user(user, strlen(user)))){
+		blocks_bloom++;
+		return 0;
+	}
+	for(int i = 0; i < nwords; i++){
+		if(!seg_bloom_test(b->bloom, seg_hash(words[i], word_len[i]))){
+			blocks_bloom++;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/// @brief prints every matching record in block b (or the tail, for b == s->nidx).
+void scan(segment_t *s, size_t b){
+	const char *data;
+	size_t len, off, next;
+	seg_msg_t m;
+
+	if(segment_block(s, b, &data, &len) < 0){
+		fprintf(stderr, "A block couldn't be read; skipping it.\n");
+		return;
+	}
+	if(b < s->nz){
+		blocks_inflated++;
+	}
+
+	for(off = 0; off < len && (next = segment_record(data, len, off, &m)); off = next){
+		if(max_results >= 0 && results >= max_results){
+			return;
+		}
+		records_read++;
+
+		if(m.hdr.when_ms < since_ms || m.hdr.when_ms > until_ms){
+			continue;
+		}
+		if(room && (strlen(room) != m.hdr.room_len || memcmp(room, m.room, m.hdr.room_len) != 0)){
+			continue;
+		}
+		if(user && (strlen(user) != m.hdr.name_len || strncasecmp(user, m.name, m.hdr.name_len) != 0)){
+			continue;
+		}
+
+		int ok = 1;
+		for(int i = 0; i < nwords && ok; i++){
+			ok = has_word(m.text, m.hdr.len, words[i], word_len[i]);
+		}
+		if(!ok){
+			continue;
+		}
+
+		fwrite(m.text, 1, m.hdr.len, stdout);
+		if(m.hdr.len == 0 || m.text[m.hdr.len - 1] != '\n'){
+			putchar('\n');
+		}
+		results++;
+	}
+}
+
+/// @brief searches one day's segment.
+void search_day(const char *base){
+	segment_t s;
+	if(segment_open(&s, base) < 0){
+		return;
+	}
+	days_opened++;
+	blocks_total += (long)s.nidx;
+
+	//binary search for the first block that ends at or after since_ms.
+	size_t lo = 0, hi = s.nidx;
+	while(lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if(s.idx[mid].last_ms < since_ms){
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	blocks_time += (long)lo;
+
+	for(size_t b = lo; b < s.nidx; b++){
+		//blocks are in time order, so nothing past this one can be in range either.
+		if(s.idx[b].first_ms > until_ms){
+			blocks_time += (long)(s.nidx - b);
+			break;
+		}
+		if(block_may_match(&s.idx[b])){
+			scan(&s, b);
+		}
+	}
+
+	//the records that haven't made it into a block yet.
+	scan(&s, s.nidx);
+	segment_close(&s);
+}
+
+int by_name(const void *a, const void *b){
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void usage(char *prog){
+	printf("Usage: %s [-d history_dir] [-s since] [-e until] [-c room] [-u user] [-k words] [-n max] [-v]\n", prog);
+	printf("       %s [-d history_dir] -z\n", prog);
+	printf("  since/until: YYYY-MM-DD[ HH:MM[:SS]], local time\n");
+}
+
+/// @brief -z: compacts the days before today.
+int compact(const char *dir, char **days, size_t ndays){
+	char today[16], base[4096];
+	time_t now = time(NULL);
+	struct tm lt;
+	int status = EXIT_SUCCESS;
+
+	localtime_r(&now, &lt);
+	strftime(today, sizeof(today), "%Y-%m-%d", &lt);
+
+	for(size_t i = 0; i < ndays; i++){
+		uint64_t raw = 0, packed = 0;
+		if(strcmp(days[i], today) >= 0){
+			continue;
+		}
+		snprintf(base, sizeof(base), "%s/%s", dir, days[i]);
+		int r = segment_compact(base, &raw, &packed);
+		if(r < 0 && errno == EBUSY){
+			//the server still has it open (until its first message of the next day); it compacts it itself later.
+			printf("%s: the server is still writing it, left alone\n", days[i]);
+		} else if(r < 0){
+			perror(base);
+			status = EXIT_FAILURE;
+		} else if(raw > 0){
+			printf("%s: %lu -> %lu bytes (%.1fx)\n", days[i], (unsigned long)raw, (unsigned long)packed,
+				packed ? (double)raw / (double)packed : 0.0);
+		}
+	}
+	return status;
+}
+
+int main(int argc, char **argv){
+	const char *dir = ".";
+	int verbose = 0, compacting = 0, opt;
+	char *keywords = NULL;
+
+	while((opt = getopt(argc, argv, "d:s:e:c:u:k:n:vz")) != -1){
+		switch(opt){
+		case 'd':
+			dir = optarg;
+			break;
+		case 's':
+			if(parse_time(optarg, 0, &since_ms) < 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'e':
+			if(parse_time(optarg, 1, &until_ms) < 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			room = optarg;
+			break;
+		case 'u':
+			user = optarg;
+			break;
+		case 'k':
+			keywords = optarg;
+			break;
+		case 'n':
+			max_results = atol(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'z':
+			compacting = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if(optind != argc){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	//split the keywords the same way the server split the messages.
+	if(keywords){
+		size_t pos = 0, start, len, klen = strlen(keywords);
+		while(nwords < MAX_WORDS && seg_next_word(keywords, klen, &pos, &start, &len)){
+			words[nwords] = keywords + start;
+			word_len[nwords] = len;
+			nwords++;
+		}
+	}
+
+	//the day files, oldest first. Their names sort by date. A day has a .seg, a .segz or (briefly) both.
+	DIR *d = opendir(dir);
+	if(!d){
+		perror("ERROR: opendir");
+		return EXIT_FAILURE;
+	}
+
+	char **days = NULL;
+	size_t ndays = 0, cap = 0;
+	struct dirent *ent;
+	while((ent = readdir(d))){
+		int y, m, dd;
+		char ext[8];
+		if(sscanf(ent->d_name, "%4d-%2d-%2d.%7s", &y, &m, &dd, ext) != 4 || (strcmp(ext, "seg") != 0 && strcmp(ext, "segz") != 0)){
+			continue;
+		}
+
+		//skip days entirely outside the range.
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_year = y - 1900;
+		tm.tm_mon = m - 1;
+		tm.tm_mday = dd;
+		tm.tm_isdst = -1;
+		int64_t day_ms = (int64_t)mktime(&tm) * 1000;
+		if(day_ms > until_ms || day_ms + 25LL * 3600 * 1000 < since_ms){
+			continue;
+		}
+
+		if(ndays == cap){
+			cap = cap ? cap * 2 : 64;
+			days = realloc(days, cap * sizeof(char *));
+		}
+		days[ndays++] = strndup(ent->d_name, strlen(ent->d_name) - strlen(ext) - 1);
+	}
+	closedir(d);
+	qsort(days, ndays, sizeof(char *), by_name);
+
+	size_t uniq = 0;
+	for(size_t i = 0; i < ndays; i++){
+		if(uniq > 0 && strcmp(days[uniq - 1], days[i]) == 0){
+			free(days[i]);
+		} else {
+			days[uniq++] = days[i];
+		}
+	}
+	ndays = uniq;
+
+	if(compacting){
+		int status = compact(dir, days, ndays);
+		for(size_t i = 0; i < ndays; i++){
+			free(days[i]);
+		}
+		free(days);
+		return status;
+	}
+
+	for(size_t i = 0; i < ndays; i++){
+		char base[4096];
+		if(max_results < 0 || results < max_results){
+			snprintf(base, sizeof(base), "%s/%s", dir, days[i]);
+			search_day(base);
+		}
+		free(days[i]);
+	}
+	free(days);
+
+	if(verbose){
+		fprintf(stderr, "%ld matches. %ld day files, %ld blocks: %ld skipped by time, %ld by bloom filter, %ld inflated. %ld records read.\n",
+			results, days_opened, blocks_total, blocks_time, blocks_bloom, blocks_inflated, records_read);
+	}
+	return EXIT_SUCCESS;
+}
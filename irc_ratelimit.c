@@ -0,0 +1,128 @@
+/*
+ * File: irc_ratelimit.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The token buckets behind irc_ratelimit.h.
+ */
+
+#include <stdatomic.h>
+#include <time.h>
+
+#include "irc_ratelimit.h"
+
+typedef struct{
+	/// @brief thousandths of a message gained per millisecond (the same number as messages per second), 0 for off.
+	uint32_t rate;
+
+	/// @brief the most a bucket holds, in thousandths of a message.
+	int32_t burst;
+} limit_t;
+
+static limit_t per_conn, per_ip;
+
+/// @brief the per-IP buckets. Zeroed, which reads as full.
+static _Atomic bucket_t ip_buckets[RATELIMIT_IP_SLOTS];
+
+void ratelimit_config(unsigned conn_rate, unsigned conn_burst, unsigned ip_rate, unsigned ip_burst){
+	per_conn.rate = conn_rate;
+	per_conn.burst = (int32_t)((conn_burst ? conn_burst : 1) * RATELIMIT_UNIT);
+	per_ip.rate = ip_rate;
+	per_ip.burst = (int32_t)((ip_burst ? ip_burst : 1) * RATELIMIT_UNIT);
+}
+
+int ratelimit_enabled(void){
+	return per_conn.rate || per_ip.rate;
+}
+
+uint32_t ratelimit_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint32_t ms = (uint32_t)((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000);
+
+	//0 is what an untouched bucket says, so the clock never reads it.
+	return ms ? ms : 1;
+}
+
+/// @brief the bucket topped up to now.
+static bucket_t refill(const limit_t *l, bucket_t b, uint32_t now){
+	uint32_t stamp = (uint32_t)(b >> 32);
+	int64_t tokens = (int32_t)(uint32_t)b;
+
+	if(stamp == 0){
+		tokens = l->burst;
+	} else {
+		tokens += (int64_t)(uint32_t)(now - stamp) * l->rate;
+	}
+	if(tokens > l->burst){
+		tokens = l->burst;
+	}
+	return (uint64_t)now << 32 | (uint32_t)(int32_t)tokens;
+}
+
+/// @brief how long until a (topped up) bucket has a whole message's worth of tokens.
+static uint32_t wait_for(const limit_t *l, bucket_t b){
+	int32_t tokens = (int32_t)(uint32_t)b;
+	if(tokens >= RATELIMIT_UNIT){
+		return 0;
+	}
+	return (uint32_t)(((int64_t)RATELIMIT_UNIT - tokens + l->rate - 1) / l->rate);
+}
+
+/// @brief takes one message's tokens. Debt is capped at one burst, so a client that was forced through
+//			a lot never waits longer than it takes to fill the bucket twice.
+static bucket_t take(const limit_t *l, bucket_t b){
+	int32_t tokens = (int32_t)(uint32_t)b - RATELIMIT_UNIT;
+	if(tokens < -l->burst){
+		tokens = -l->burst;
+	}
+	return (b & ~(uint64_t)UINT32_MAX) | (uint32_t)tokens;
+}
+
+/// @brief ratelimit_try (force = 0) and ratelimit_charge (force = 1).
+static uint32_t consume(bucket_t *mine, uint32_t ip, int force){
+	uint32_t now = ratelimit_now(), wait = 0, ip_wait = 0;
+	bucket_t b = 0;
+
+	if(per_conn.rate){
+		b = refill(&per_conn, *mine, now);
+		wait = wait_for(&per_conn, b);
+	}
+
+	if(per_ip.rate){
+		//Fibonacci hashing spreads neighbouring addresses over the table.
+		_Atomic bucket_t *shared = &ip_buckets[((uint32_t)(ip * 2654435761u)) >> 16 & (RATELIMIT_IP_SLOTS - 1)];
+		bucket_t old = atomic_load_explicit(shared, memory_order_relaxed), next;
+		do{
+			next = refill(&per_ip, old, now);
+			ip_wait = wait_for(&per_ip, next);
+			if(!force && (wait || ip_wait)){
+				break;
+			}
+			next = take(&per_ip, next);
+		} while(!atomic_compare_exchange_weak_explicit(shared, &old, next, memory_order_relaxed, memory_order_relaxed));
+
+		if(force){
+			ip_wait = wait_for(&per_ip, next);
+		}
+	}
+
+	if(!force && (wait || ip_wait)){
+		return wait > ip_wait ? wait : ip_wait;
+	}
+
+	if(per_conn.rate){
+		*mine = take(&per_conn, b);
+		wait = force ? wait_for(&per_conn, *mine) : 0;
+	}
+	if(!force){
+		return 0;
+	}
+	return wait > ip_wait ? wait : ip_wait;
+}
+
+uint32_t ratelimit_try(bucket_t *mine, uint32_t ip){
+	return consume(mine, ip, 0);
+}
+
+uint32_t ratelimit_charge(bucket_t *mine, uint32_t ip){
+	return consume(mine, ip, 1);
+}
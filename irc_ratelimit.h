@@ -0,0 +1,52 @@
+/*
+ * File: irc_ratelimit.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Token buckets for flood control.
+ *
+ *	A bucket holds up to `burst` messages' worth of tokens and gains `rate` of them a second; every
+ *	message a client sends takes one. Tokens are counted in thousandths of a message, so topping a
+ *	bucket up is just the milliseconds since it was last touched times the rate. The token count and
+ *	that millisecond are packed into one 8 byte word, so a shared bucket is updated with a single
+ *	compare-and-swap, and 100k sessions' buckets fit in 800KB.
+ *
+ *	Every client has a bucket of its own in its client_t. Clients from the same IPv4 address also
+ *	share one of RATELIMIT_IP_SLOTS buckets, picked by a hash of the address. Addresses that land on
+ *	the same slot share it (which only ever makes the limit stricter for them), so the table never
+ *	grows or needs cleaning up.
+ */
+
+#ifndef IRC_RATELIMIT_H
+#define IRC_RATELIMIT_H
+
+#include <stdint.h>
+
+#define RATELIMIT_IP_SLOTS 65536
+
+/// @brief the tokens one message takes.
+#define RATELIMIT_UNIT 1000
+
+/// @brief a bucket: when it was last topped up (milliseconds, high 32 bits) and its tokens (low 32 bits,
+//			signed: a client can run into debt, see ratelimit_charge()). 0 is a full bucket.
+typedef uint64_t bucket_t;
+
+/// @brief sets the limits: rate messages a second with bursts of up to burst, per connection and per IP.
+//			A rate of 0 turns that limit off. Call before any client connects.
+void ratelimit_config(unsigned conn_rate, unsigned conn_burst, unsigned ip_rate, unsigned ip_burst);
+
+/// @brief is any limit on?
+int ratelimit_enabled(void);
+
+/// @brief the clock the buckets run on, in milliseconds (wraps every 49 days, which the buckets don't mind).
+uint32_t ratelimit_now(void);
+
+/// @brief one message from a client with bucket *mine, connected from ip (network byte order).
+/// @return 0 if it may go now (and the tokens are taken), otherwise how many milliseconds until it may
+//			(and nothing is taken).
+uint32_t ratelimit_try(bucket_t *mine, uint32_t ip);
+
+/// @brief the same, for a message that's already been read and will be handled either way: the tokens are
+//			taken even if they aren't there yet.
+/// @return how many milliseconds until the client's next message may go (0: right away).
+uint32_t ratelimit_charge(bucket_t *mine, uint32_t ip);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * File: irc_rcu.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The epoch based reclamation behind irc_rcu.h.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "irc_rcu.h"
+
+/// @brief one thread's reading state. state is (epoch << 1) | 1 while it reads, 0 otherwise.
+// Records are never freed; a thread that exits gives its record back for the next new thread.
+typedef struct rcu_thread{
+	_Atomic uint64_t state;
+	_Atomic int in_use;
+	int nest;
+	struct rcu_thread *_Atomic next;
+} rcu_thread_t;
+
+/// @brief something waiting to be freed.
+typedef struct rcu_retired{
+	void *p;
+	void (*free_fn)(void *);
+	uint64_t epoch;
+	struct rcu_retired *next;
+} rcu_retired_t;
+
+static _Atomic uint64_t global_epoch = 1;
+static rcu_thread_t *_Atomic threads = NULL;
+
+static pthread_mutex_t limbo_mutex = PTHREAD_MUTEX_INITIALIZER;
+/// @brief retired objects, oldest first. They're appended with the current epoch, so the epochs only go up.
+static rcu_retired_t *limbo = NULL, *limbo_tail = NULL;
+
+static __thread rcu_thread_t *self;
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+/// @brief runs when a thread that had a record exits: frees the record up for reuse.
+static void thread_exit(void *arg){
+	rcu_thread_t *t = arg;
+	atomic_store(&t->state, 0);
+	atomic_store(&t->in_use, 0);
+}
+
+static void make_exit_key(void){
+	pthread_key_create(&exit_key, thread_exit);
+}
+
+/// @brief finds this thread a record: a free one if there is one, a new one otherwise.
+static rcu_thread_t *thread_record(void){
+	if(self){
+		return self;
+	}
+	pthread_once(&exit_once, make_exit_key);
+
+	rcu_thread_t *t;
+	for(t = atomic_load(&threads); t; t = atomic_load(&t->next)){
+		int free_slot = 0;
+		if(atomic_compare_exchange_strong(&t->in_use, &free_slot, 1)){
+			break;
+		}
+	}
+
+	if(!t){
+		t = calloc(1, sizeof(rcu_thread_t));
+		if(!t){
+			abort();
+		}
+		atomic_store(&t->in_use, 1);
+
+		//push onto the list; records are never unlinked, so this is all the locking it needs.
+		rcu_thread_t *head = atomic_load(&threads);
+		do{
+			atomic_store(&t->next, head);
+		} while(!atomic_compare_exchange_weak(&threads, &head, t));
+	}
+
+	t->nest = 0;
+	self = t;
+	pthread_setspecific(exit_key, t);
+	return t;
+}
+
+void rcu_read_lock(void){
+	rcu_thread_t *t = thread_record();
+	if(t->nest++ > 0){
+		return;
+	}
+
+	atomic_store_explicit(&t->state, (atomic_load(&global_epoch) << 1) | 1, memory_order_relaxed);
+
+	//the writer has to see that we're reading before we look at anything it might retire.
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void rcu_read_unlock(void){
+	rcu_thread_t *t = self;
+	if(--t->nest > 0){
+		return;
+	}
+	atomic_store_explicit(&t->state, 0, memory_order_release);
+}
+
+/// @brief moves the global epoch on if every reading thread has caught up with it.
+static uint64_t try_advance(void){
+	atomic_thread_fence(memory_order_seq_cst);
+	uint64_t e = atomic_load(&global_epoch);
+
+	for(rcu_thread_t *t = atomic_load(&threads); t; t = atomic_load(&t->next)){
+		uint64_t s = atomic_load(&t->state);
+		if((s & 1) && (s >> 1) != e){
+			return e;
+		}
+	}
+
+	if(atomic_compare_exchange_strong(&global_epoch, &e, e + 1)){
+		return e + 1;
+	}
+	return e;
+}
+
+void rcu_retire(void *p, void (*free_fn)(void *)){
+	rcu_retired_t *r = malloc(sizeof(rcu_retired_t));
+	if(!r){
+		abort();
+	}
+	r->p = p;
+	r->free_fn = free_fn;
+
+	rcu_retired_t *ready = NULL;
+
+	pthread_mutex_lock(&limbo_mutex);
+	r->epoch = atomic_load(&global_epoch);
+	r->next = NULL;
+	if(limbo_tail){
+		limbo_tail->next = r;
+	} else {
+		limbo = r;
+	}
+	limbo_tail = r;
+
+	uint64_t e = try_advance();
+
+	//anything retired two epochs ago can't be in any reader's hands any more.
+	if(limbo && limbo->epoch + 2 <= e){
+		ready = limbo;
+		rcu_retired_t *last = limbo;
+		while(last->next && last->next->epoch + 2 <= e){
+			last = last->next;
+		}
+		limbo = last->next;
+		last->next = NULL;
+		if(!limbo){
+			limbo_tail = NULL;
+		}
+	}
+	pthread_mutex_unlock(&limbo_mutex);
+
+	//free outside the lock, free_fn can take its time.
+	while(ready){
+		rcu_retired_t *next = ready->next;
+		ready->free_fn(ready->p);
+		free(ready);
+		ready = next;
+	}
+}
+
+void rcu_synchronize(void){
+	uint64_t target = atomic_load(&global_epoch) + 2;
+	struct timespec nap = { 0, 50 * 1000 };
+
+	while(try_advance() < target){
+		nanosleep(&nap, NULL);
+	}
+}
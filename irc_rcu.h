@@ -0,0 +1,34 @@
+/*
+ * File: irc_rcu.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Epoch based reclamation, so readers can walk shared structures without taking a lock.
+ *
+ *	Readers wrap their walk in rcu_read_lock()/rcu_read_unlock(). Writers (which still lock among
+ *	themselves) unlink things and hand them to rcu_retire() instead of freeing them. A retired
+ *	object is only freed once every thread that was reading when it was retired has moved on,
+ *	so a reader never touches freed memory.
+ *
+ *	Each thread gets a record the first time it reads. The global epoch only moves forward once
+ *	every reading thread has seen the current one; objects retired in epoch e are freed once the
+ *	global epoch reaches e + 2.
+ */
+
+#ifndef IRC_RCU_H
+#define IRC_RCU_H
+
+/// @brief starts a read-side section. Sections can nest.
+void rcu_read_lock(void);
+
+/// @brief ends a read-side section. Nothing read inside it may be used afterwards.
+void rcu_read_unlock(void);
+
+/// @brief frees p with free_fn(p) once no reader can still be looking at it.
+//			Safe to call from any thread, including from inside a read-side section.
+//			Retired objects are checked (and freed) whenever something else is retired.
+void rcu_retire(void *p, void (*free_fn)(void *));
+
+/// @brief waits until every read-side section that was running when it was called has finished.
+//			For threads that can afford to block; never call it inside a read-side section.
+void rcu_synchronize(void);
+
+#endif
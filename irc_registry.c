@@ -0,0 +1,225 @@
+/*
+ * File: irc_registry.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The client registry behind irc_registry.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "irc_registry.h"
+#include "irc_rcu.h"
+
+/// @brief smallest table we make. Tables are rebuilt when they'd be over half full (counting tombstones)
+//			or under 1/16 full, and rebuilt tables start out at most a quarter full. Every probe
+//			is a cache miss on the client it points at, so short probe chains matter more than 8 bytes a slot.
+#define TABLE_MIN 64
+
+static size_t hash_uid(int uid){
+	return (size_t)((uint32_t)uid * 2654435761u);
+}
+
+static size_t hash_name(const char *name){
+	uint64_t h = 14695981039346656037ULL;
+	for(; *name; name++){
+		h ^= (unsigned char)*name;
+		h *= 1099511628211ULL;
+	}
+	return (size_t)(h ^ (h >> 32));
+}
+
+static size_t node_hash(reg_node_t *n, int by_name){
+	return by_name ? hash_name(n->name) : hash_uid(n->uid);
+}
+
+static int same_key(reg_node_t *a, reg_node_t *b, int by_name){
+	return by_name ? strcmp(a->name, b->name) == 0 : a->uid == b->uid;
+}
+
+static reg_table_t *table_new(size_t cap){
+	reg_table_t *t = calloc(1, sizeof(reg_table_t) + cap * sizeof(t->slot[0]));
+	if(t){
+		t->cap = cap;
+	}
+	return t;
+}
+
+/// @brief puts n in t, unless an entry with the same key is there already.
+/// @return 0 on success, -1 on a duplicate key.
+static int table_insert(reg_table_t *t, reg_node_t *n, int by_name){
+	size_t mask = t->cap - 1;
+	size_t i = node_hash(n, by_name) & mask;
+	size_t free_slot = t->cap;
+
+	//walk the whole probe chain: the key may already be there past a tombstone.
+	for(;;){
+		reg_node_t *cur = atomic_load_explicit(&t->slot[i], memory_order_relaxed);
+		if(!cur){
+			break;
+		}
+		if(cur == REG_TOMBSTONE){
+			if(free_slot == t->cap){
+				free_slot = i;
+			}
+		} else if(same_key(cur, n, by_name)){
+			return -1;
+		}
+		i = (i + 1) & mask;
+	}
+
+	if(free_slot == t->cap){
+		free_slot = i;
+		t->used++;
+	}
+	t->live++;
+
+	//release, so a reader that finds n also sees everything written to it before now.
+	atomic_store_explicit(&t->slot[free_slot], n, memory_order_release);
+	return 0;
+}
+
+/// @return 1 if n was in t, 0 if not.
+static int table_remove(reg_table_t *t, reg_node_t *n, int by_name){
+	size_t mask = t->cap - 1;
+	size_t i = node_hash(n, by_name) & mask;
+
+	for(;;){
+		reg_node_t *cur = atomic_load_explicit(&t->slot[i], memory_order_relaxed);
+		if(!cur){
+			return 0;
+		}
+		if(cur == n){
+			atomic_store_explicit(&t->slot[i], REG_TOMBSTONE, memory_order_release);
+			t->live--;
+			return 1;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+/// @brief replaces *tp with a fresh table sized for `want` entries, holding all of its live entries.
+//			Readers still walking the old one keep it until they're done.
+/// @return 0 on success, -1 if we're out of memory.
+static int table_rebuild(_Atomic(reg_table_t *) *tp, size_t want, int by_name){
+	reg_table_t *old = atomic_load_explicit(tp, memory_order_relaxed);
+
+	size_t cap = TABLE_MIN;
+	while(cap < want * 4){
+		cap *= 2;
+	}
+
+	reg_table_t *t = table_new(cap);
+	if(!t){
+		return -1;
+	}
+	for(size_t i = 0; i < old->cap; i++){
+		reg_node_t *n = atomic_load_explicit(&old->slot[i], memory_order_relaxed);
+		if(n && n != REG_TOMBSTONE){
+			table_insert(t, n, by_name);
+		}
+	}
+
+	atomic_store_explicit(tp, t, memory_order_release);
+	rcu_retire(old, free);
+	return 0;
+}
+
+/// @brief inserts into the table behind tp, growing it (or clearing out tombstones) first if needed.
+static int table_add(_Atomic(reg_table_t *) *tp, reg_node_t *n, int by_name){
+	reg_table_t *t = atomic_load_explicit(tp, memory_order_relaxed);
+	if((t->used + 1) * 2 > t->cap){
+		if(table_rebuild(tp, t->live + 1, by_name) < 0){
+			return -1;
+		}
+		t = atomic_load_explicit(tp, memory_order_relaxed);
+	}
+	return table_insert(t, n, by_name);
+}
+
+/// @return 1 if n was in the table, 0 if not.
+static int table_del(_Atomic(reg_table_t *) *tp, reg_node_t *n, int by_name){
+	reg_table_t *t = atomic_load_explicit(tp, memory_order_relaxed);
+	int found = table_remove(t, n, by_name);
+
+	//give the memory back after a crowd leaves. A failed rebuild just leaves the big table in place.
+	if(t->cap > TABLE_MIN && t->live * 16 < t->cap){
+		table_rebuild(tp, t->live, by_name);
+	}
+	return found;
+}
+
+int registry_init(registry_t *reg){
+	pthread_mutex_init(&reg->lock, NULL);
+	reg_table_t *u = table_new(TABLE_MIN), *n = table_new(TABLE_MIN);
+	if(!u || !n){
+		free(u);
+		free(n);
+		return -1;
+	}
+	atomic_store(&reg->by_uid, u);
+	atomic_store(&reg->by_name, n);
+	atomic_store(&reg->count, 0);
+	return 0;
+}
+
+int registry_add(registry_t *reg, reg_node_t *node){
+	pthread_mutex_lock(&reg->lock);
+	int r = table_add(&reg->by_uid, node, 0);
+	if(r == 0){
+		atomic_fetch_add(&reg->count, 1);
+	}
+	pthread_mutex_unlock(&reg->lock);
+	return r;
+}
+
+int registry_set_name(registry_t *reg, reg_node_t *node){
+	pthread_mutex_lock(&reg->lock);
+	int r = table_add(&reg->by_name, node, 1);
+	pthread_mutex_unlock(&reg->lock);
+	return r;
+}
+
+void registry_remove(registry_t *reg, reg_node_t *node){
+	pthread_mutex_lock(&reg->lock);
+	if(node->name){
+		table_del(&reg->by_name, node, 1);
+	}
+	if(table_del(&reg->by_uid, node, 0)){
+		atomic_fetch_sub(&reg->count, 1);
+	}
+	pthread_mutex_unlock(&reg->lock);
+}
+
+reg_node_t *registry_find_uid(registry_t *reg, int uid){
+	reg_table_t *t = atomic_load_explicit(&reg->by_uid, memory_order_acquire);
+	size_t mask = t->cap - 1;
+
+	for(size_t i = hash_uid(uid) & mask;; i = (i + 1) & mask){
+		reg_node_t *n = atomic_load_explicit(&t->slot[i], memory_order_acquire);
+		if(!n){
+			return NULL;
+		}
+		if(n != REG_TOMBSTONE && n->uid == uid){
+			return n;
+		}
+	}
+}
+
+reg_node_t *registry_find_name(registry_t *reg, const char *name){
+	reg_table_t *t = atomic_load_explicit(&reg->by_name, memory_order_acquire);
+	size_t mask = t->cap - 1;
+
+	for(size_t i = hash_name(name) & mask;; i = (i + 1) & mask){
+		reg_node_t *n = atomic_load_explicit(&t->slot[i], memory_order_acquire);
+		if(!n){
+			return NULL;
+		}
+		if(n != REG_TOMBSTONE && strcmp(n->name, name) == 0){
+			return n;
+		}
+	}
+}
+
+size_t registry_count(registry_t *reg){
+	return atomic_load(&reg->count);
+}
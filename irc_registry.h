@@ -0,0 +1,88 @@
+/*
+ * File: irc_registry.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Every connected client, findable by uid or by name.
+ *
+ *	Two open addressing hash tables of reg_node_t pointers (one keyed by uid, one by name).
+ *	Writers (joins and leaves) take reg->lock; both inserts and removes are O(1) on average.
+ *	A table that gets too full (or too empty) is rebuilt at a new size, published with one atomic
+ *	store, and the old one goes to rcu_retire().
+ *
+ *	Readers never lock. Inside rcu_read_lock() they can look clients up, or walk the uid table
+ *	to visit everyone. Removed slots become tombstones rather than being refilled by moving
+ *	entries around, so a walk never sees a client twice or skips one that stays registered.
+ *	Whoever owns the clients must not free one until readers are done with it (rcu_retire or rcu_synchronize).
+ */
+
+#ifndef IRC_REGISTRY_H
+#define IRC_REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/// @brief embed one of these in whatever you register, and get back to it with registry_entry().
+typedef struct{
+	int uid;
+
+	/// @brief NUL terminated; must not change while the node is in the name table.
+	const char *name;
+} reg_node_t;
+
+#define registry_entry(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/// @brief marks a slot whose entry was removed. Lookups probe past it, walks skip it.
+#define REG_TOMBSTONE ((reg_node_t *)1)
+
+typedef struct{
+	/// @brief number of slots, a power of two.
+	size_t cap;
+
+	/// @brief live entries, and live + tombstones (only the writer looks at these).
+	size_t live;
+	size_t used;
+
+	_Atomic(reg_node_t *) slot[];
+} reg_table_t;
+
+typedef struct{
+	pthread_mutex_t lock;
+	_Atomic(reg_table_t *) by_uid;
+	_Atomic(reg_table_t *) by_name;
+	_Atomic size_t count;
+} registry_t;
+
+/// @return 0 on success, -1 if we're out of memory.
+int registry_init(registry_t *reg);
+
+/// @brief adds a node to the uid table.
+/// @return 0 on success, -1 if we're out of memory.
+int registry_add(registry_t *reg, reg_node_t *node);
+
+/// @brief adds an already registered node to the name table, under node->name.
+/// @return 0 on success, -1 if the name is taken (or we're out of memory).
+int registry_set_name(registry_t *reg, reg_node_t *node);
+
+/// @brief takes a node out of both tables.
+void registry_remove(registry_t *reg, reg_node_t *node);
+
+/// @brief lookups. Call inside rcu_read_lock(); the result is only good until rcu_read_unlock().
+reg_node_t *registry_find_uid(registry_t *reg, int uid);
+reg_node_t *registry_find_name(registry_t *reg, const char *name);
+
+/// @brief how many nodes are registered right now.
+size_t registry_count(registry_t *reg);
+
+/// @brief the uid table, for walking every client. Call inside rcu_read_lock().
+static inline reg_table_t *registry_table(registry_t *reg){
+	return atomic_load_explicit(&reg->by_uid, memory_order_acquire);
+}
+
+/// @brief slot i of a table, or NULL if it's empty or a tombstone.
+static inline reg_node_t *registry_slot(reg_table_t *t, size_t i){
+	reg_node_t *n = atomic_load_explicit(&t->slot[i], memory_order_acquire);
+	return (n == REG_TOMBSTONE) ? NULL : n;
+}
+
+#endif
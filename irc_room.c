@@ -0,0 +1,451 @@
+/*
+ * File: irc_room.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The rooms behind irc_room.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "irc_room.h"
+#include "irc_rcu.h"
+#include "irc_proto.h"
+
+static registry_t rooms;
+static int nslices = 1;
+static _Atomic int next_id = 1;
+
+/// @brief messages every room keeps (a power of two, or 0), and the number the next message gets.
+static unsigned ring_size = 0;
+static _Atomic uint64_t next_seq = 1;
+
+/// @brief serializes making and retiring rooms, on top of the registry's own lock. Taken before a room's lock.
+static pthread_mutex_t rooms_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief the smallest slice that gets made, so a small room isn't copied on every other join.
+#define SLICE_MIN 8
+
+/// @brief what every slice with nobody in it points at, so empty slices cost nothing.
+static room_slice_t empty_slice = { 0 };
+
+static void slice_free(void *p){
+	if(p != &empty_slice){
+		free(p);
+	}
+}
+
+int rooms_init(int slices, unsigned ring){
+	nslices = slices < 1 ? 1 : slices;
+	ring_size = 0;
+	if(ring > 0){
+		ring_size = 1;
+		while(ring_size < ring && ring_size < (1u << 20)){
+			ring_size <<= 1;
+		}
+	}
+	return registry_init(&rooms);
+}
+
+unsigned room_ring_size(void){
+	return ring_size;
+}
+
+uint64_t room_seq_now(void){
+	return atomic_load(&next_seq) - 1;
+}
+
+void room_seq_start(uint64_t after){
+	atomic_store(&next_seq, after + 1);
+}
+
+/// @brief frees a retired room, and lets go of the messages in its ring.
+static void room_free(void *p){
+	room_t *room = p;
+	if(room->ring){
+		uint64_t n = room->recorded < ring_size ? room->recorded : ring_size;
+		for(uint64_t i = room->recorded - n; i < room->recorded; i++){
+			msgbuf_unref(room->ring[i & (ring_size - 1)].buf);
+		}
+		free(room->ring);
+	}
+	pthread_mutex_destroy(&room->ring_lock);
+	pthread_mutex_destroy(&room->lock);
+	free(room);
+}
+
+int room_name_ok(const char *name, size_t len){
+	if(len < 2 || len >= ROOM_NAME_SZ || name[0] != '#'){
+		return 0;
+	}
+	for(size_t i = 1; i < len; i++){
+		if((unsigned char)name[i] <= ' ' || name[i] == 0x7f){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/// @brief where member goes in a slice's index.
+static unsigned slice_hash(void *member, unsigned mask){
+	uint64_t h = (uint64_t)(uintptr_t)member * 0x9e3779b97f4a7c15ull;
+	return (unsigned)(h >> 32) & mask;
+}
+
+/// @brief an empty slice with room for cap members.
+/// @return the slice, or NULL if we're out of memory.
+static room_slice_t *slice_new(int cap){
+	//the index is at least twice as big as the slice, so it never gets more than half full.
+	unsigned slots = 1;
+	while(slots < 2 * (unsigned)cap){
+		slots <<= 1;
+	}
+
+	room_slice_t *s = malloc(sizeof(room_slice_t) + sizeof(s->member[0]) * (size_t)cap + sizeof(int) * slots);
+	if(!s){
+		return NULL;
+	}
+	atomic_init(&s->n, 0);
+	s->cap = cap;
+	s->live = 0;
+	s->mask = slots - 1;
+	s->index = (int *)&s->member[cap];
+	memset(s->index, 0, sizeof(int) * slots);
+	return s;
+}
+
+/// @brief adds member at the end of s, which has room for it, and only then publishes the new count.
+static void slice_put(room_slice_t *s, void *member){
+	int n = atomic_load_explicit(&s->n, memory_order_relaxed);
+	unsigned h = slice_hash(member, s->mask);
+	while(s->index[h] > 0){
+		h = (h + 1) & s->mask;
+	}
+	s->index[h] = n + 1;
+	s->live++;
+	atomic_store_explicit(&s->member[n], member, memory_order_relaxed);
+	atomic_store_explicit(&s->n, n + 1, memory_order_release);
+}
+
+/// @brief a new slice with everyone still in old, and room for cap.
+/// @return the slice, or NULL if we're out of memory.
+static room_slice_t *slice_copy(room_slice_t *old, int cap){
+	room_slice_t *fresh = slice_new(cap);
+	int n = atomic_load_explicit(&old->n, memory_order_relaxed);
+	for(int i = 0; fresh && i < n; i++){
+		void *member = atomic_load_explicit(&old->member[i], memory_order_relaxed);
+		if(member){
+			slice_put(fresh, member);
+		}
+	}
+	return fresh;
+}
+
+/// @brief makes fresh the room's slice s in place of old, which readers may still be walking.
+static void slice_publish(room_t *room, int s, room_slice_t *old, room_slice_t *fresh){
+	atomic_store_explicit(&room->slice[s], fresh, memory_order_release);
+	rcu_retire(old, slice_free);
+}
+
+/// @brief adds member to the room's slice s, in place unless it's full. Call with the room's lock held.
+/// @return 0 on success, -1 if we're out of memory.
+static int slice_add(room_t *room, int s, void *member){
+	room_slice_t *old = atomic_load_explicit(&room->slice[s], memory_order_relaxed);
+	if(atomic_load_explicit(&old->n, memory_order_relaxed) < old->cap){
+		slice_put(old, member);
+		return 0;
+	}
+
+	//full: whoever's still there goes into one twice their size, so copies get rarer as the room grows.
+	room_slice_t *fresh = slice_copy(old, 2 * old->live + SLICE_MIN);
+	if(!fresh){
+		return -1;
+	}
+	slice_put(fresh, member);
+	slice_publish(room, s, old, fresh);
+	return 0;
+}
+
+/// @brief takes member out of the room's slice s, leaving a NULL behind. Call with the room's lock held.
+//			Can't fail for lack of memory: the member is about to be freed and mustn't stay findable.
+/// @return 0 on success, -1 if member wasn't there.
+static int slice_remove(room_t *room, int s, void *member){
+	room_slice_t *old = atomic_load_explicit(&room->slice[s], memory_order_relaxed);
+	if(old->live == 0){
+		return -1;
+	}
+
+	unsigned h = slice_hash(member, old->mask);
+	while(old->index[h] != 0 && (old->index[h] < 0
+		|| atomic_load_explicit(&old->member[old->index[h] - 1], memory_order_relaxed) != member)){
+		h = (h + 1) & old->mask;
+	}
+	if(old->index[h] == 0){
+		return -1;
+	}
+	atomic_store_explicit(&old->member[old->index[h] - 1], NULL, memory_order_relaxed);
+	old->index[h] = -1;
+	old->live--;
+
+	//once the NULLs outnumber the members, the members get a slice of their own (if there's memory for it).
+	int n = atomic_load_explicit(&old->n, memory_order_relaxed);
+	if(old->live == 0){
+		slice_publish(room, s, old, &empty_slice);
+	} else if(n > SLICE_MIN && n - old->live > old->live){
+		room_slice_t *fresh = slice_copy(old, 2 * old->live + SLICE_MIN);
+		if(fresh){
+			slice_publish(room, s, old, fresh);
+		}
+	}
+	return 0;
+}
+
+/// @brief the room called name, made (with nobody in it) if there isn't one. Call with rooms_lock held.
+/// @return the room, or NULL if we're out of memory.
+static room_t *room_get(const char *name){
+	//rooms are only made and retired under rooms_lock, so this lookup can't race with the room going away.
+	reg_node_t *n = registry_find_name(&rooms, name);
+	room_t *room = n ? registry_entry(n, room_t, reg) : NULL;
+	if(room){
+		return room;
+	}
+
+	room = calloc(1, sizeof(room_t) + sizeof(room->slice[0]) * (size_t)nslices);
+	if(!room){
+		return NULL;
+	}
+	strncpy(room->name, name, ROOM_NAME_SZ - 1);
+	pthread_mutex_init(&room->lock, NULL);
+	pthread_mutex_init(&room->ring_lock, NULL);
+	room->reg.uid = next_id++;
+	room->reg.name = room->name;
+	for(int i = 0; i < nslices; i++){
+		atomic_store(&room->slice[i], &empty_slice);
+	}
+	if(registry_add(&rooms, &room->reg) < 0 || registry_set_name(&rooms, &room->reg) < 0){
+		registry_remove(&rooms, &room->reg);
+		rcu_retire(room, room_free);
+		return NULL;
+	}
+	return room;
+}
+
+/// @brief retires the room if nobody's in it or holds it any more. Call with rooms_lock held.
+static void room_reap(room_t *room){
+	pthread_mutex_lock(&room->lock);
+	if(room->members == 0 && !room->gone){
+		//every slice is the empty one by now, so the room is all there is to free.
+		room->gone = 1;
+		registry_remove(&rooms, &room->reg);
+		rcu_retire(room, room_free);
+	}
+	pthread_mutex_unlock(&room->lock);
+}
+
+/// @brief adds member to the room in the given slice (or, with member NULL, holds it), unless it's been retired.
+/// @return 1 if it did, 0 if the room is gone, -1 if we're out of memory.
+static int room_enter(room_t *room, void *member, int slice){
+	int ret = 0;
+	pthread_mutex_lock(&room->lock);
+	if(!room->gone){
+		ret = 1;
+		if(member && slice_add(room, slice, member) < 0){
+			ret = -1;
+		} else {
+			room->members++;
+		}
+	}
+	pthread_mutex_unlock(&room->lock);
+	return ret;
+}
+
+/// @brief room_enter on the room called name, making it if there isn't one.
+/// @return the room, or NULL if we're out of memory.
+static room_t *room_enter_name(const char *name, void *member, int slice){
+	//most joins are to a room that's there already, and only lock that one room.
+	rcu_read_lock();
+	room_t *room = room_find_name(name);
+	int ret = room ? room_enter(room, member, slice) : 0;
+	rcu_read_unlock();
+	if(ret != 0){
+		return ret > 0 ? room : NULL;
+	}
+
+	//no such room (or it was just retired): make it, under rooms_lock so there's only ever one.
+	pthread_mutex_lock(&rooms_lock);
+	room = room_get(name);
+	if(room && room_enter(room, member, slice) < 0){
+		room_reap(room);
+		room = NULL;
+	}
+	pthread_mutex_unlock(&rooms_lock);
+	return room;
+}
+
+/// @brief takes member out of the room's slice (or, with member NULL, lets go of a hold), and retires
+//			the room if that was the last of them.
+static void room_leave(room_t *room, void *member, int slice){
+	//once we let go of its lock, the room can be retired from under us by whoever joins and leaves next.
+	rcu_read_lock();
+	pthread_mutex_lock(&room->lock);
+	int last = 0;
+	if(!member || slice_remove(room, slice, member) == 0){
+		last = (--room->members == 0);
+	}
+	pthread_mutex_unlock(&room->lock);
+
+	if(last){
+		pthread_mutex_lock(&rooms_lock);
+		room_reap(room);
+		pthread_mutex_unlock(&rooms_lock);
+	}
+	rcu_read_unlock();
+}
+
+room_t *room_join(const char *name, void *member, int slice){
+	return room_enter_name(name, member, slice);
+}
+
+void room_part(room_t *room, void *member, int slice){
+	room_leave(room, member, slice);
+}
+
+void room_hold(room_t *room){
+	pthread_mutex_lock(&room->lock);
+	room->members++;
+	pthread_mutex_unlock(&room->lock);
+}
+
+room_t *room_hold_name(const char *name){
+	return room_enter_name(name, NULL, 0);
+}
+
+void room_release(room_t *room){
+	room_leave(room, NULL, 0);
+}
+
+uint64_t room_record(room_t *room, msgbuf_t *buf, int uid, char *seq_frame){
+	if(ring_size == 0){
+		irc_seq_frame(seq_frame, 0);
+		return 0;
+	}
+
+	//numbered under the ring's lock, so every ring is in order. (Two rooms can still number
+	//messages at the same time, so numbers in one room aren't consecutive.)
+	pthread_mutex_lock(&room->ring_lock);
+	uint64_t seq = atomic_fetch_add(&next_seq, 1);
+	irc_seq_frame(seq_frame, seq);
+
+	if(!room->ring){
+		room->ring = malloc(sizeof(room_msg_t) * ring_size);
+	}
+	if(room->ring){
+		room_msg_t *m = &room->ring[room->recorded & (ring_size - 1)];
+		if(room->recorded >= ring_size){
+			room->evicted = m->seq;
+			msgbuf_unref(m->buf);
+		}
+		m->seq = seq;
+		m->uid = uid;
+		m->buf = msgbuf_ref(buf);
+		room->recorded++;
+	}
+	pthread_mutex_unlock(&room->ring_lock);
+	return seq;
+}
+
+int room_since(room_t *room, uint64_t after, int uid, room_msg_fn fn, void *arg){
+	room_msg_t *found = NULL;
+	int nfound = 0, complete = 1;
+
+	if(ring_size == 0){
+		return 0;
+	}
+
+	pthread_mutex_lock(&room->ring_lock);
+	if(room->evicted > after){
+		complete = 0;
+	}
+	if(room->ring){
+		uint64_t n = room->recorded < ring_size ? room->recorded : ring_size;
+		found = malloc(sizeof(room_msg_t) * (size_t)n);
+
+		//newest first, to stop at the first one the client already has; they're copied out in order.
+		uint64_t first = room->recorded;
+		while(first > room->recorded - n && room->ring[(first - 1) & (ring_size - 1)].seq > after){
+			first--;
+		}
+		for(uint64_t i = first; found && i < room->recorded; i++){
+			room_msg_t *m = &room->ring[i & (ring_size - 1)];
+			if(m->uid != uid){
+				found[nfound] = *m;
+				msgbuf_ref(m->buf);
+				nfound++;
+			}
+		}
+		if(!found){
+			complete = 0;
+		}
+	}
+	pthread_mutex_unlock(&room->ring_lock);
+
+	for(int i = 0; i < nfound; i++){
+		fn(arg, &found[i]);
+		msgbuf_unref(found[i].buf);
+	}
+	free(found);
+	return complete;
+}
+
+void room_restore(room_t *room, uint64_t evicted, uint64_t seq, int uid, msgbuf_t *buf){
+	if(ring_size == 0){
+		return;
+	}
+
+	pthread_mutex_lock(&room->ring_lock);
+	if(!room->ring){
+		room->ring = malloc(sizeof(room_msg_t) * ring_size);
+	}
+	if(evicted > room->evicted){
+		room->evicted = evicted;
+	}
+	if(room->ring){
+		//a smaller ring than the old server's keeps the newest, like it would have.
+		room_msg_t *m = &room->ring[room->recorded & (ring_size - 1)];
+		if(room->recorded >= ring_size){
+			room->evicted = m->seq;
+			msgbuf_unref(m->buf);
+		}
+		m->seq = seq;
+		m->uid = uid;
+		m->buf = msgbuf_ref(buf);
+		room->recorded++;
+	} else {
+		room->evicted = seq;
+	}
+	pthread_mutex_unlock(&room->ring_lock);
+}
+
+void room_each(room_fn fn, void *arg){
+	reg_table_t *t = registry_table(&rooms);
+	for(size_t i = 0; i < t->cap; i++){
+		reg_node_t *n = registry_slot(t, i);
+		if(n){
+			fn(arg, registry_entry(n, room_t, reg));
+		}
+	}
+}
+
+room_t *room_find(int id){
+	reg_node_t *n = registry_find_uid(&rooms, id);
+	return n ? registry_entry(n, room_t, reg) : NULL;
+}
+
+room_t *room_find_name(const char *name){
+	reg_node_t *n = registry_find_name(&rooms, name);
+	return n ? registry_entry(n, room_t, reg) : NULL;
+}
+
+size_t room_count(void){
+	return registry_count(&rooms);
+}
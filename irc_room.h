@@ -0,0 +1,165 @@
+/*
+ * File: irc_room.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Chat rooms ("#lobby", "#dev", ...) and who is in them.
+ *
+ *	Every room keeps its own member list, so a message to a room only touches that room's members,
+ *	no matter how many other rooms (or clients) there are. The list is split into slices, one per
+ *	event loop (one slice in total in threaded mode), so each loop can walk just the members it owns.
+ *
+ *	Rooms are found by id or by name through a registry (irc_registry.h). Joins and parts take the
+ *	room's own lock, so rooms don't wait for each other. A slice has room to spare: a join adds the
+ *	member at the end and publishes the new count, and a part leaves a NULL where the member was (found
+ *	through the slice's index, not by walking it). Only a slice that's full, or mostly NULLs, is copied
+ *	into a new one, and the old one goes to rcu_retire(); either way readers walk slices without locking,
+ *	and joining or leaving a room costs the same however many are in it. A room is made on its first
+ *	join and retired when its last member leaves. A member keeps its room alive, so a room_t * is good
+ *	for as long as you're in it.
+ *
+ *	Every message a room gets is numbered (one sequence for all rooms, so a client only has to remember
+ *	one number) and the latest few are kept in the room's ring, so a client that drops for a moment can
+ *	pick up exactly the ones it missed (room_since) instead of joining all over again.
+ */
+
+#ifndef IRC_ROOM_H
+#define IRC_ROOM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "irc_registry.h"
+#include "irc_msgbuf.h"
+
+/// @brief longest room name, counting the NUL. Room names start with '#'.
+#define ROOM_NAME_SZ 32
+
+/// @brief the room everyone is put in when they join.
+#define ROOM_LOBBY "#lobby"
+
+/// @brief one slice of a room's members: n of them, some NULL (members that left). Joins only ever add
+//			past n, so a reader that loaded n never sees anyone twice.
+typedef struct{
+	_Atomic int n;
+
+	/// @brief room for cap members, live of them not NULL, and the index: where every member is
+	//			(position + 1, 0 for a free slot, -1 for one that left), mask + 1 slots. Only the writer looks at these.
+	int cap;
+	int live;
+	unsigned mask;
+	int *index;
+
+	_Atomic(void *) member[];
+} room_slice_t;
+
+/// @brief one message in a room's ring: its number, who sent it, and the buffer it went out in.
+typedef struct{
+	uint64_t seq;
+	int uid;
+	msgbuf_t *buf;
+} room_msg_t;
+
+typedef struct{
+	/// @brief our registry entry: uid is the room's id, name is name below.
+	reg_node_t reg;
+	char name[ROOM_NAME_SZ];
+
+	/// @brief joins, parts and holds. members counts everyone across all slices, plus holds, and gone is
+	//			set once the room is retired (then only under the rooms lock too).
+	pthread_mutex_t lock;
+	int members;
+	int gone;
+
+	/// @brief the latest messages (allocated with the first one), how many were ever recorded, and the number
+	//			of the last one the ring had to let go of. All under ring_lock.
+	pthread_mutex_t ring_lock;
+	room_msg_t *ring;
+	uint64_t recorded;
+	uint64_t evicted;
+
+	/// @brief who the room's members were told is in it (irc_roster.c), NULL while that's nobody.
+	struct roster *roster;
+
+	_Atomic(room_slice_t *) slice[];
+} room_t;
+
+/// @brief sets up the room registry, with nslices member slices per room, each room keeping its latest
+//			ring messages (rounded up to a power of two; 0 keeps none, and nothing is numbered).
+/// @return 0 on success, -1 if we're out of memory.
+int rooms_init(int nslices, unsigned ring);
+
+/// @brief how many messages every room keeps (0 if none).
+unsigned room_ring_size(void);
+
+/// @brief the number the latest message got (in any room), 0 before the first one.
+uint64_t room_seq_now(void);
+
+/// @brief numbers messages on from after (a server taking over from another, so numbers clients have stay good).
+//			Call before any message is recorded.
+void room_seq_start(uint64_t after);
+
+/// @brief is name usable as a room name? ('#' and then 1 to ROOM_NAME_SZ - 2 printable, non-space characters.)
+int room_name_ok(const char *name, size_t len);
+
+/// @brief adds member to the room called name (making the room if it doesn't exist), in the given slice.
+//			Joining a room you're already in adds you twice; don't.
+/// @return the room, or NULL if we're out of memory.
+room_t *room_join(const char *name, void *member, int slice);
+
+/// @brief takes member out of the room. The room is retired if that was its last member.
+void room_part(room_t *room, void *member, int slice);
+
+/// @brief keeps the room (and its ring) around without being in it, like a member that gets no messages.
+//			Every hold needs a room_release(), which retires the room if nobody else is left.
+void room_hold(room_t *room);
+void room_release(room_t *room);
+
+/// @brief room_hold by name, making the room if it doesn't exist.
+/// @return the room, or NULL if we're out of memory.
+room_t *room_hold_name(const char *name);
+
+/// @brief numbers the message in buf, from uid, and keeps it in the room's ring (by reference).
+//			The number goes into seq_frame (an IRC_SEQ frame, IRC_SEQ_FRAME bytes inside buf) before anyone
+//			else can see it there. With no ring the frame is still written, with 0.
+/// @return the message's number, 0 with no ring.
+uint64_t room_record(room_t *room, msgbuf_t *buf, int uid, char *seq_frame);
+
+typedef void (*room_msg_fn)(void *arg, const room_msg_t *m);
+
+/// @brief calls fn for every message in the room's ring numbered after after, oldest first, except uid's own.
+//			fn is called without any lock held, so it may write to clients.
+/// @return 1 if those are all the room got since after, 0 if the ring doesn't go back that far (some are gone).
+int room_since(room_t *room, uint64_t after, int uid, room_msg_fn fn, void *arg);
+
+/// @brief puts a message numbered somewhere else (by the server we took over from) at the end of the room's ring,
+//			which has let go of everything up to evicted. Messages go in oldest first, before the room records any.
+void room_restore(room_t *room, uint64_t evicted, uint64_t seq, int uid, msgbuf_t *buf);
+
+typedef void (*room_fn)(void *arg, room_t *room);
+
+/// @brief calls fn for every room there is. Call inside rcu_read_lock().
+void room_each(room_fn fn, void *arg);
+
+/// @brief lookups. Call inside rcu_read_lock(); the result is only good until rcu_read_unlock().
+room_t *room_find(int id);
+room_t *room_find_name(const char *name);
+
+/// @brief how many rooms there are right now.
+size_t room_count(void);
+
+/// @brief a room's members in one slice. Call inside rcu_read_lock() (or as the only writer of that slice).
+static inline room_slice_t *room_slice(room_t *room, int slice){
+	return atomic_load_explicit(&room->slice[slice], memory_order_acquire);
+}
+
+/// @brief how far to walk a slice. Load it once per walk: members that join meanwhile go past it.
+static inline int room_slice_count(room_slice_t *s){
+	return atomic_load_explicit(&s->n, memory_order_acquire);
+}
+
+/// @brief the member at i < room_slice_count(), NULL if it left.
+static inline void *room_member(room_slice_t *s, int i){
+	return atomic_load_explicit(&s->member[i], memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,585 @@
+/*
+ * File: irc_roster.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The rosters and the roster thread behind irc_roster.h.
+ *
+ *	Rooms with changes waiting (or snapshots to send) are on the dirty list, in the order their windows started,
+ *	which is also the order they're due in since every window is as long. The roster thread sleeps until the
+ *	first one is due, takes its changes off it under the lock and does the rest without: the last change for
+ *	every name wins (they're sorted by name, so that's one pass), and whatever that changes in the roster goes
+ *	out. A room is held while it's on the list, so it can't go away before its "has left" does.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "irc_roster.h"
+#include "irc_proto.h"
+#include "irc_clock.h"
+#include "irc_metrics.h"
+
+/// @brief longest name, counting the NUL (the server's NAME_SZ).
+#define ROSTER_NAME_SZ 32
+
+/// @brief room for a delta's notice: the stamp, and IRC_ROSTER_SHOWN names each way with the room after them.
+#define ROSTER_TEXT_SZ (64 + 2 * (IRC_ROSTER_SHOWN * (ROSTER_NAME_SZ + 2) + ROOM_NAME_SZ + 32))
+
+/// @brief one join or leave waiting for the flush. order keeps the sort from mixing up a name's changes.
+typedef struct{
+	char name[ROSTER_NAME_SZ];
+	uint8_t in;
+	uint32_t order;
+} roster_op_t;
+
+typedef struct roster{
+	room_t *room;
+
+	/// @brief the roster's version: how many deltas it's had.
+	uint32_t version;
+
+	/// @brief the names the room was last told about, and an index into them by name (linear probing, slots is a
+	//			power of two at least twice cap; 0 is an empty slot, anything else the name's place + 1).
+	//			Only the roster thread touches these.
+	char (*names)[ROSTER_NAME_SZ];
+	uint32_t n;
+	uint32_t cap;
+	uint32_t *index;
+	uint32_t slots;
+
+	/// @brief changes and the clients wanting a snapshot, since the last flush (under roster_lock).
+	roster_op_t *ops;
+	uint32_t nops;
+	uint32_t ops_cap;
+	int *wants;
+	uint32_t nwants;
+	uint32_t wants_cap;
+
+	/// @brief on the dirty list (holding the room), due when (metrics_now_ns), and the next one on it.
+	int dirty;
+	uint64_t due;
+	struct roster *next;
+
+	/// @brief every roster there is, for roster_pack.
+	struct roster *all_prev;
+	struct roster *all_next;
+} roster_t;
+
+static pthread_mutex_t roster_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t roster_cond;
+static pthread_cond_t roster_idle = PTHREAD_COND_INITIALIZER;
+static roster_t *dirty_head;
+static roster_t *dirty_tail;
+static roster_t *all_rosters;
+
+/// @brief set between roster_stop and roster_go, and while the thread is flushing a room.
+static int stopped;
+static int flushing;
+
+static uint64_t window_ns;
+static roster_snapshot_fn send_snapshot;
+static roster_delta_fn send_delta;
+
+static uint32_t name_hash(const char *s){
+	uint32_t h = 2166136261u;
+	while(*s){
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/// @brief the slot name is in, or the empty one it would go in. The index can't be full.
+static uint32_t roster_slot(const roster_t *r, const char *name){
+	uint32_t mask = r->slots - 1;
+	for(uint32_t i = name_hash(name) & mask;; i = (i + 1) & mask){
+		uint32_t at = r->index[i];
+		if(at == 0 || strcmp(r->names[at - 1], name) == 0){
+			return i;
+		}
+	}
+}
+
+static int roster_has(const roster_t *r, const char *name){
+	return r->slots > 0 && r->index[roster_slot(r, name)] != 0;
+}
+
+/// @brief adds name (which isn't there).
+/// @return 0, or -1 if we're out of memory.
+static int roster_add(roster_t *r, const char *name){
+	if(r->n == r->cap){
+		uint32_t cap = r->cap ? r->cap * 2 : 16;
+		char (*names)[ROSTER_NAME_SZ] = realloc(r->names, sizeof(*names) * cap);
+		uint32_t *index = names ? calloc((size_t)cap * 2, sizeof(uint32_t)) : NULL;
+		if(names){
+			r->names = names;
+		}
+		if(!index){
+			return -1;
+		}
+		free(r->index);
+		r->index = index;
+		r->slots = cap * 2;
+		r->cap = cap;
+		for(uint32_t i = 0; i < r->n; i++){
+			r->index[roster_slot(r, r->names[i])] = i + 1;
+		}
+	}
+	snprintf(r->names[r->n], ROSTER_NAME_SZ, "%s", name);
+	r->index[roster_slot(r, r->names[r->n])] = r->n + 1;
+	r->n++;
+	return 0;
+}
+
+/// @brief takes name (which is there) out: the last name moves into its place, and the slots after its own
+//			move back, so nothing that was found by probing past it gets lost.
+static void roster_remove(roster_t *r, const char *name){
+	uint32_t mask = r->slots - 1, i = roster_slot(r, name), at = r->index[i] - 1;
+
+	for(uint32_t j = (i + 1) & mask; r->index[j] != 0; j = (j + 1) & mask){
+		uint32_t home = name_hash(r->names[r->index[j] - 1]) & mask;
+		if(((j - home) & mask) >= ((j - i) & mask)){
+			r->index[i] = r->index[j];
+			i = j;
+		}
+	}
+	r->index[i] = 0;
+
+	if(at != --r->n){
+		memcpy(r->names[at], r->names[r->n], ROSTER_NAME_SZ);
+		r->index[roster_slot(r, r->names[at])] = at + 1;
+	}
+}
+
+/// @brief the room's roster, made if it has none. Call with roster_lock held.
+static roster_t *roster_of(room_t *room){
+	if(room->roster){
+		return room->roster;
+	}
+	roster_t *r = calloc(1, sizeof(roster_t));
+	if(!r){
+		return NULL;
+	}
+	r->room = room;
+	r->all_next = all_rosters;
+	if(all_rosters){
+		all_rosters->all_prev = r;
+	}
+	all_rosters = r;
+	room->roster = r;
+	return r;
+}
+
+static void roster_free(roster_t *r){
+	if(r->all_prev){
+		r->all_prev->all_next = r->all_next;
+	} else {
+		all_rosters = r->all_next;
+	}
+	if(r->all_next){
+		r->all_next->all_prev = r->all_prev;
+	}
+	r->room->roster = NULL;
+	free(r->names);
+	free(r->index);
+	free(r->ops);
+	free(r->wants);
+	free(r);
+}
+
+/// @brief puts the room on the dirty list if it isn't, its window starting now. Call with roster_lock held.
+static void roster_dirty(roster_t *r){
+	if(r->dirty){
+		return;
+	}
+	room_hold(r->room);
+	r->dirty = 1;
+	r->due = metrics_now_ns() + window_ns;
+	r->next = NULL;
+	if(dirty_tail){
+		dirty_tail->next = r;
+	} else {
+		dirty_head = r;
+		pthread_cond_signal(&roster_cond);
+	}
+	dirty_tail = r;
+}
+
+/// @brief one more change for the room. Call with roster_lock held.
+static void roster_push(roster_t *r, const char *name, int in){
+	if(r->nops == r->ops_cap){
+		uint32_t cap = r->ops_cap ? r->ops_cap * 2 : 8;
+		roster_op_t *ops = realloc(r->ops, sizeof(roster_op_t) * cap);
+		if(!ops){
+			return;
+		}
+		r->ops = ops;
+		r->ops_cap = cap;
+	}
+	roster_op_t *op = &r->ops[r->nops];
+	snprintf(op->name, ROSTER_NAME_SZ, "%s", name);
+	op->in = (uint8_t)(in != 0);
+	op->order = r->nops++;
+	roster_dirty(r);
+}
+
+static void roster_push_want(roster_t *r, int uid){
+	if(r->nwants == r->wants_cap){
+		uint32_t cap = r->wants_cap ? r->wants_cap * 2 : 8;
+		int *wants = realloc(r->wants, sizeof(int) * cap);
+		if(!wants){
+			return;
+		}
+		r->wants = wants;
+		r->wants_cap = cap;
+	}
+	r->wants[r->nwants++] = uid;
+	roster_dirty(r);
+}
+
+void roster_note(room_t *room, const char *name, int in){
+	pthread_mutex_lock(&roster_lock);
+	int fresh = !room->roster;
+	roster_t *r = roster_of(room);
+	if(r){
+		roster_push(r, name, in);
+	}
+	if(r && fresh && !r->dirty){
+		//out of memory before it had anything in it.
+		roster_free(r);
+	}
+	pthread_mutex_unlock(&roster_lock);
+}
+
+void roster_want(room_t *room, int uid){
+	pthread_mutex_lock(&roster_lock);
+	int fresh = !room->roster;
+	roster_t *r = roster_of(room);
+	if(r){
+		roster_push_want(r, uid);
+	}
+	if(r && fresh && !r->dirty){
+		//out of memory before it had anything in it.
+		roster_free(r);
+	}
+	pthread_mutex_unlock(&roster_lock);
+}
+
+static int op_cmp(const void *a, const void *b){
+	const roster_op_t *x = a, *y = b;
+	int c = strcmp(x->name, y->name);
+	return c ? c : (x->order > y->order) - (x->order < y->order);
+}
+
+static int uid_cmp(const void *a, const void *b){
+	int x = *(const int *)a, y = *(const int *)b;
+	return (x > y) - (x < y);
+}
+
+/// @brief how many of the entries from first on fit in one frame after a head bytes long, and their bytes.
+static uint32_t roster_chunk(uint32_t head, uint32_t first, uint32_t total, const char *(*name_at)(void *, uint32_t),
+	void *arg, uint32_t *bytes){
+	uint32_t i = first;
+	*bytes = 0;
+	while(i < total){
+		uint32_t size = 2 + (uint32_t)strlen(name_at(arg, i));
+		if(head + *bytes + size > IRC_MAX_PAYLOAD){
+			break;
+		}
+		*bytes += size;
+		i++;
+	}
+	return i - first;
+}
+
+static const char *op_name(void *arg, uint32_t i){
+	return ((roster_op_t *)arg)[i].name;
+}
+
+static const char *roster_name(void *arg, uint32_t i){
+	return ((roster_t *)arg)->names[i];
+}
+
+/// @brief the deltas for the changes ops[0 .. n) (applied already), at most a frame each, one version each:
+//			[room for an IRC_SEQ frame][IRC_ROSTER frame][the notice]. Goes into out[], which has room for n.
+/// @return how many there are.
+static uint32_t roster_deltas(roster_t *r, roster_op_t *ops, uint32_t n, msgbuf_t **out, uint32_t *frames){
+	const clock_tick_t *now = clock_now();
+	uint32_t rlen = (uint32_t)strlen(r->room->name), pre = room_ring_size() ? IRC_SEQ_FRAME : 0;
+	uint32_t head = IRC_ROSTER_HDR + 1 + rlen, count = 0, bytes;
+
+	for(uint32_t i = 0; i < n; ){
+		uint32_t k = roster_chunk(head, i, n, op_name, ops, &bytes);
+		msgbuf_t *buf = msgbuf_alloc(pre + IRC_FRAME_HDR + head + bytes + ROSTER_TEXT_SZ);
+		if(!buf){
+			break;
+		}
+		char *p = buf->data + pre;
+		irc_frame_header(p, IRC_ROSTER, 0, head + bytes);
+		uint32_t at = IRC_FRAME_HDR + irc_roster_head(p + IRC_FRAME_HDR, ++r->version, (uint64_t)now->sec, r->room->name, rlen);
+		for(uint32_t j = i; j < i + k; j++){
+			at += irc_roster_entry(p + at, ops[j].in, ops[j].name, (uint32_t)strlen(ops[j].name));
+		}
+
+		irc_roster_t parsed;
+		size_t tlen = 0;
+		if(irc_roster_parse(p + IRC_FRAME_HDR, head + bytes, &parsed) == 0){
+			tlen = irc_roster_render(p + at, ROSTER_TEXT_SZ, now->stamp, &parsed);
+		}
+		buf->len = pre + at + tlen;
+		frames[count] = pre;
+		out[count++] = buf;
+		i += k;
+	}
+	return count;
+}
+
+/// @brief the whole roster as IRC_ROSTER_FULL frames, one after another in one buffer.
+static msgbuf_t *roster_snapshot(roster_t *r){
+	const clock_tick_t *now = clock_now();
+	uint32_t rlen = (uint32_t)strlen(r->room->name), head = IRC_ROSTER_HDR + 1 + rlen, bytes;
+
+	//every frame's size first, so it all goes in one allocation.
+	size_t total = 0;
+	uint32_t i = 0;
+	do{
+		i += roster_chunk(head, i, r->n, roster_name, r, &bytes);
+		total += IRC_FRAME_HDR + head + bytes;
+	} while(i < r->n);
+
+	msgbuf_t *buf = msgbuf_alloc(total);
+	if(!buf){
+		return NULL;
+	}
+	size_t at = 0;
+	i = 0;
+	do{
+		uint32_t k = roster_chunk(head, i, r->n, roster_name, r, &bytes);
+		char *p = buf->data + at;
+		irc_frame_header(p, IRC_ROSTER, i == 0 ? IRC_ROSTER_FULL : IRC_ROSTER_FULL | IRC_ROSTER_MORE, head + bytes);
+		uint32_t off = IRC_FRAME_HDR + irc_roster_head(p + IRC_FRAME_HDR, r->version, (uint64_t)now->sec, r->room->name, rlen);
+		for(uint32_t j = i; j < i + k; j++){
+			off += irc_roster_entry(p + off, 1, r->names[j], (uint32_t)strlen(r->names[j]));
+		}
+		at += off;
+		i += k;
+	} while(i < r->n);
+	buf->len = at;
+	return buf;
+}
+
+/// @brief flushes one room: what ops change goes into the roster and out as deltas, after the snapshots for
+//			wants (at the version that ends up at). Runs on the roster thread, without roster_lock.
+static void roster_flush(roster_t *r, roster_op_t *ops, uint32_t nops, int *wants, uint32_t nwants){
+	//the last change for every name is the one that counts, and only if it isn't what the roster says already.
+	if(nops > 1){
+		qsort(ops, nops, sizeof(roster_op_t), op_cmp);
+	}
+	uint32_t n = 0;
+	for(uint32_t i = 0; i < nops; i++){
+		if(i + 1 < nops && strcmp(ops[i].name, ops[i + 1].name) == 0){
+			continue;
+		}
+		if(ops[i].in == roster_has(r, ops[i].name)){
+			continue;
+		}
+		if(ops[i].in && roster_add(r, ops[i].name) < 0){
+			continue;
+		} else if(!ops[i].in){
+			roster_remove(r, ops[i].name);
+		}
+		ops[n++] = ops[i];
+	}
+	metrics_add(METRIC_ROSTER_COALESCED, nops - n);
+
+	msgbuf_t **deltas = n ? malloc(sizeof(msgbuf_t *) * n) : NULL;
+	uint32_t *frames = n ? malloc(sizeof(uint32_t) * n) : NULL;
+	uint32_t ndeltas = (deltas && frames) ? roster_deltas(r, ops, n, deltas, frames) : 0;
+
+	//the snapshots go first, so the deltas after them (which they have already) are the ones their clients skip.
+	if(nwants > 0){
+		if(nwants > 1){
+			qsort(wants, nwants, sizeof(int), uid_cmp);
+		}
+		msgbuf_t *snap = roster_snapshot(r);
+		for(uint32_t i = 0; snap && i < nwants; i++){
+			if(i == 0 || wants[i] != wants[i - 1]){
+				send_snapshot(wants[i], snap);
+				metrics_add(METRIC_ROSTER_SNAPSHOTS, 1);
+			}
+		}
+		if(snap){
+			msgbuf_unref(snap);
+		}
+	}
+
+	for(uint32_t i = 0; i < ndeltas; i++){
+		msgbuf_t *buf = deltas[i];
+		uint32_t text = frames[i] + IRC_FRAME_HDR + irc_be32(buf->data + frames[i] + 4);
+		send_delta(r->room, buf, frames[i], text);
+		msgbuf_unref(buf);
+	}
+	metrics_add(METRIC_ROSTER_DELTAS, ndeltas);
+	free(deltas);
+	free(frames);
+}
+
+static void *roster_loop(void *arg){
+	(void)arg;
+	pthread_mutex_lock(&roster_lock);
+	while(1){
+		if(stopped || !dirty_head){
+			pthread_cond_wait(&roster_cond, &roster_lock);
+			continue;
+		}
+
+		uint64_t now = metrics_now_ns();
+		if(dirty_head->due > now){
+			struct timespec until = { (time_t)(dirty_head->due / 1000000000u), (long)(dirty_head->due % 1000000000u) };
+			pthread_cond_timedwait(&roster_cond, &roster_lock, &until);
+			continue;
+		}
+
+		roster_t *r = dirty_head;
+		dirty_head = r->next;
+		if(!dirty_head){
+			dirty_tail = NULL;
+		}
+		r->dirty = 0;
+		roster_op_t *ops = r->ops;
+		int *wants = r->wants;
+		uint32_t nops = r->nops, nwants = r->nwants;
+		r->ops = NULL;
+		r->wants = NULL;
+		r->nops = r->ops_cap = r->nwants = r->wants_cap = 0;
+		flushing = 1;
+		pthread_mutex_unlock(&roster_lock);
+
+		roster_flush(r, ops, nops, wants, nwants);
+		free(ops);
+		free(wants);
+
+		pthread_mutex_lock(&roster_lock);
+		flushing = 0;
+		pthread_cond_broadcast(&roster_idle);
+
+		//nobody left to tell about, and nothing new came in meanwhile: the room can go.
+		room_t *room = r->room;
+		if(r->n == 0 && !r->dirty){
+			roster_free(r);
+		}
+		room_release(room);
+	}
+	return NULL;
+}
+
+int roster_start(int window_ms, roster_snapshot_fn snapshot, roster_delta_fn delta){
+	pthread_condattr_t attr;
+	pthread_t tid;
+
+	//due times are CLOCK_MONOTONIC (metrics_now_ns), so the timed waits have to be too.
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&roster_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	window_ns = (uint64_t)window_ms * 1000000u;
+	send_snapshot = snapshot;
+	send_delta = delta;
+	if(pthread_create(&tid, NULL, &roster_loop, NULL) != 0){
+		return -1;
+	}
+	pthread_detach(tid);
+	return 0;
+}
+
+void roster_stop(void){
+	pthread_mutex_lock(&roster_lock);
+	stopped = 1;
+	while(flushing){
+		pthread_cond_wait(&roster_idle, &roster_lock);
+	}
+	pthread_mutex_unlock(&roster_lock);
+}
+
+void roster_go(void){
+	pthread_mutex_lock(&roster_lock);
+	stopped = 0;
+	pthread_cond_signal(&roster_cond);
+	pthread_mutex_unlock(&roster_lock);
+}
+
+void roster_pack(handoff_buf_t *b){
+	uint32_t n = 0;
+	for(roster_t *r = all_rosters; r; r = r->all_next){
+		n++;
+	}
+	handoff_put_u32(b, n);
+	for(roster_t *r = all_rosters; r; r = r->all_next){
+		handoff_put_str(b, r->room->name);
+		handoff_put_u32(b, r->version);
+		handoff_put_u32(b, r->n);
+		for(uint32_t i = 0; i < r->n; i++){
+			handoff_put_str(b, r->names[i]);
+		}
+		handoff_put_u32(b, r->nops);
+		for(uint32_t i = 0; i < r->nops; i++){
+			handoff_put_str(b, r->ops[i].name);
+			handoff_put_u8(b, r->ops[i].in);
+		}
+		handoff_put_u32(b, r->nwants);
+		for(uint32_t i = 0; i < r->nwants; i++){
+			handoff_put_u32(b, (uint32_t)r->wants[i]);
+		}
+	}
+}
+
+void roster_unpack(handoff_buf_t *b){
+	uint32_t n = handoff_get_u32(b);
+	for(uint32_t i = 0; i < n && !b->err; i++){
+		char room_name[ROOM_NAME_SZ], name[ROSTER_NAME_SZ];
+		handoff_get_str(b, room_name, ROOM_NAME_SZ);
+		room_t *room = b->err ? NULL : room_hold_name(room_name);
+
+		pthread_mutex_lock(&roster_lock);
+		roster_t *r = room ? roster_of(room) : NULL;
+		uint32_t version = handoff_get_u32(b);
+		if(r){
+			r->version = version;
+		}
+		uint32_t count = handoff_get_u32(b);
+		for(uint32_t j = 0; j < count && !b->err; j++){
+			handoff_get_str(b, name, ROSTER_NAME_SZ);
+			if(r && name[0] && !roster_has(r, name)){
+				roster_add(r, name);
+			}
+		}
+		count = handoff_get_u32(b);
+		for(uint32_t j = 0; j < count && !b->err; j++){
+			handoff_get_str(b, name, ROSTER_NAME_SZ);
+			int in = handoff_get_u8(b);
+			if(r){
+				roster_push(r, name, in);
+			}
+		}
+		count = handoff_get_u32(b);
+		for(uint32_t j = 0; j < count && !b->err; j++){
+			int uid = (int)handoff_get_u32(b);
+			if(r){
+				roster_push_want(r, uid);
+			}
+		}
+
+		//flushed once we go again, even with nothing to send, which is when the room lets go of this hold.
+		if(r){
+			roster_dirty(r);
+		}
+		pthread_mutex_unlock(&roster_lock);
+		if(room){
+			room_release(room);
+		}
+	}
+}
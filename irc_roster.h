@@ -0,0 +1,67 @@
+/*
+ * File: irc_roster.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Who's in every room, told to clients as a snapshot once and as coalesced deltas after that.
+ *
+ *	A join or leave used to be a notice of its own to the whole room, so a room of a thousand clients that all
+ *	reconnected at once (a restart, a network blip) sent a thousand notices to up to a thousand members each.
+ *	Instead, every room keeps a roster: the names its members were last told about, and a version that goes up
+ *	every time that changes. Joins and leaves (roster_note) only go on the room's list of changes. The first one
+ *	starts the room's window (-W, ROSTER_WINDOW_MS), and when that's up the roster thread flushes the room: a name
+ *	that came and went (or went and came back) in between cancels out, the rest changes the roster and goes to
+ *	the room as one IRC_ROSTER delta, with the same thing rendered as one notice line for raw-text clients and
+ *	the history. A thousand joins in a window are one message to each member, not a thousand.
+ *
+ *	A client that joins a room (or asks, roster_want) gets the whole roster as a snapshot in the same flush,
+ *	before its delta: it's built once per version and the same buffer goes to everyone who wanted it. The
+ *	client keeps it and applies deltas from then on, skipping any its snapshot already has; one that sees a
+ *	version gap asks for a snapshot again.
+ *
+ *	The roster is by name, not by client: a session that's parked (irc_server.c) keeps its name in its rooms'
+ *	rosters, so a client dropping and resuming changes nothing. One lock covers every roster's list of changes;
+ *	the roster itself is only touched by the roster thread (and hot restart, with the thread stopped).
+ */
+
+#ifndef IRC_ROSTER_H
+#define IRC_ROSTER_H
+
+#include <stdint.h>
+
+#include "irc_room.h"
+#include "irc_msgbuf.h"
+#include "irc_handoff.h"
+
+/// @brief how long (milliseconds) a room's joins and leaves are collected before they go out (-W).
+#define ROSTER_WINDOW_MS 100
+
+/// @brief a snapshot for client uid: frames from the start of buf to buf->len. Runs on the roster thread.
+typedef void (*roster_snapshot_fn)(int uid, msgbuf_t *buf);
+
+/// @brief a delta for everyone in the room: [an IRC_SEQ frame if the room numbers its messages][the IRC_ROSTER
+//			frame at frame][the notice rendered as text, from text to buf->len]. Runs on the roster thread.
+typedef void (*roster_delta_fn)(room_t *room, msgbuf_t *buf, uint32_t frame, uint32_t text);
+
+/// @brief starts the roster thread, flushing a room window_ms after its first change (0: right away).
+/// @return 0 on success, -1 if it couldn't.
+int roster_start(int window_ms, roster_snapshot_fn snapshot, roster_delta_fn delta);
+
+/// @brief name joined (in) or left (!in) the room. Any thread; the room has to be alive (you're in it, or hold it).
+void roster_note(room_t *room, const char *name, int in);
+
+/// @brief client uid gets the room's whole roster with its next flush.
+void roster_want(room_t *room, int uid);
+
+/// @brief hot restart: roster_stop waits for a flush in progress and holds off any more until roster_go,
+//			so what's packed (or unpacked) is all there is.
+void roster_stop(void);
+void roster_go(void);
+
+/// @brief every roster (room, version, names) and its pending changes and snapshots into b, between roster_stop
+//			and roster_go.
+void roster_pack(handoff_buf_t *b);
+
+/// @brief takes rosters packed by roster_pack, between roster_stop and roster_go: each room is held until
+//			its first flush, so it's still there once its members are back.
+void roster_unpack(handoff_buf_t *b);
+
+#endif
@@ -0,0 +1,677 @@
+/*
+ * File: irc_segment.c
+ * Project: CSCI 3160 Chat Project
+ * Description: Reads the chat history segments described in irc_segment.h, and compacts finished days.
+ *	Used by the server (to replay the backlog to new clients, and by the history writer) and by the history query tool.
+ *	Needs zlib (-lz).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "irc_segment.h"
+
+/// @brief the bytes of a .seg that are locked (fcntl OFD locks, which threads of one process hold separately too).
+//			LOCK_WRITER is held for writing by whoever appends to the day (segment_claim()) or compacts it, so only
+//			one of them has it at a time. LOCK_SWAP is held for reading by segment_open() while it opens the day's
+//			files, and for writing by segment_compact() while it swaps the .seg and .idx for the .segz.
+#define LOCK_WRITER 0
+#define LOCK_SWAP 1
+
+/// @brief where a record is: its block (nidx for the tail) and its offset in the block.
+typedef struct{
+	size_t block;
+	size_t off;
+} seg_pos_t;
+
+void segment_base(char *out, size_t size, const char *dir, const struct tm *day){
+	snprintf(out, size, "%s/%d-%02d-%02d", dir, day->tm_year + 1900, day->tm_mon + 1, day->tm_mday);
+}
+
+/// @brief locks byte `byte` of fd for reading or writing (type is F_RDLCK or F_WRLCK), waiting for it if wait is set.
+/// @return 0, or -1 (errno EAGAIN if it's held and we didn't wait).
+static int lock_byte(int fd, int byte, short type, int wait){
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = byte;
+	fl.l_len = 1;
+	int r;
+	while((r = fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl)) < 0 && errno == EINTR){
+	}
+	return r;
+}
+
+/// @return 1 if fd's file has been removed since it was opened.
+static int unlinked(int fd){
+	struct stat st;
+	return fstat(fd, &st) == 0 && st.st_nlink == 0;
+}
+
+/// @brief opens a day's .seg, with LOCK_SWAP held for reading, so it's the one that goes with the .idx and .segz
+//			next to it until fd is closed (-1 if the day has no .seg).
+static int open_seg_locked(const char *base){
+	char path[4096];
+	snprintf(path, sizeof(path), "%s.seg", base);
+	while(1){
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd < 0){
+			return -1;
+		}
+		if(lock_byte(fd, LOCK_SWAP, F_RDLCK, 1) < 0){
+			close(fd);
+			return -1;
+		}
+
+		//compacted while we waited: the .segz has it now, and there may be a newer .seg.
+		if(!unlinked(fd)){
+			return fd;
+		}
+		close(fd);
+	}
+}
+
+int segment_claim(int fd){
+	return lock_byte(fd, LOCK_WRITER, F_WRLCK, 1);
+}
+
+/// @brief maps the whole of fd read-only, and closes it. Files shorter than SEG_FILE_HDR count as not there.
+static void *map_fd(int fd, const char *magic, size_t *len){
+	struct stat st;
+	void *map = NULL;
+	if(fstat(fd, &st) == 0 && st.st_size >= SEG_FILE_HDR){
+		map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(map == MAP_FAILED){
+			map = NULL;
+		} else if(memcmp(map, magic, SEG_FILE_HDR) != 0){
+			munmap(map, (size_t)st.st_size);
+			map = NULL;
+		} else {
+			*len = (size_t)st.st_size;
+		}
+	}
+
+	//the mapping stays valid after the fd is closed.
+	close(fd);
+	return map;
+}
+
+/// @brief maps a whole file read-only (see map_fd). A missing file counts as not there.
+static void *map_file(const char *path, const char *magic, size_t *len){
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	return fd < 0 ? NULL : map_fd(fd, magic, len);
+}
+
+/// @brief maps a day's .seg (segfd, an open descriptor for it, which stays open) and .idx.
+static int open_plain(segment_t *s, int segfd, const char *base){
+	char path[4096];
+
+	//the index first: anything it points at was written to the .seg before it, so it's in the .seg mapping too.
+	snprintf(path, sizeof(path), "%s.idx", base);
+	s->idx_map = map_file(path, IDX_FILE_MAGIC, &s->idx_len);
+	if(s->idx_map){
+		s->idx = (const seg_index_t *)((const char *)s->idx_map + SEG_FILE_HDR);
+		s->nidx = (s->idx_len - SEG_FILE_HDR) / sizeof(seg_index_t);
+	}
+
+	int fd = dup(segfd);
+	s->seg = fd < 0 ? NULL : map_fd(fd, SEG_FILE_MAGIC, &s->seg_len);
+	if(!s->seg){
+		return -1;
+	}
+
+	//an index entry for a block that isn't (fully) in the segment can't be trusted.
+	while(s->nidx > 0 && s->idx[s->nidx - 1].off + s->idx[s->nidx - 1].bytes > s->seg_len){
+		s->nidx--;
+	}
+	s->tail = s->nidx ? s->idx[s->nidx - 1].off + s->idx[s->nidx - 1].bytes : SEG_FILE_HDR;
+	return 0;
+}
+
+/// @brief maps a day's .segz and checks its index and dictionary fit in it.
+static int open_compressed(segment_t *s, const char *base){
+	char path[4096];
+	segz_header_t h;
+	size_t at = SEG_FILE_HDR + sizeof(h);
+
+	snprintf(path, sizeof(path), "%s.segz", base);
+	s->segz = map_file(path, SEGZ_FILE_MAGIC, &s->segz_len);
+	if(!s->segz || s->segz_len < at){
+		return -1;
+	}
+	memcpy(&h, s->segz + SEG_FILE_HDR, sizeof(h));
+	if((s->segz_len - at) / sizeof(seg_index_t) < h.nblocks){
+		return -1;
+	}
+	s->idx = (const seg_index_t *)(s->segz + at);
+	at += sizeof(seg_index_t) * h.nblocks;
+	if(s->segz_len - at < h.dict_len){
+		return -1;
+	}
+	s->dict = s->segz + at;
+	s->dict_len = h.dict_len;
+	at += h.dict_len;
+
+	//the blocks follow the dictionary, in order.
+	for(uint32_t b = 0; b < h.nblocks; b++){
+		if(s->idx[b].off < at || s->idx[b].off > s->segz_len){
+			return -1;
+		}
+		at = s->idx[b].off;
+	}
+	s->nidx = s->nz = h.nblocks;
+	s->zblock = SIZE_MAX;
+	return 0;
+}
+
+int segment_open(segment_t *s, const char *base){
+	segment_t z;
+
+	memset(s, 0, sizeof(*s));
+	memset(&z, 0, sizeof(z));
+
+	//the .seg is opened (and held) first, so the .segz can't be swapped in for it while we look.
+	int fd = open_seg_locked(base);
+	int plain = fd >= 0 && open_plain(s, fd, base) == 0;
+	int compressed = open_compressed(&z, base) == 0;
+	if(fd >= 0){
+		close(fd);
+	}
+	if(!plain){
+		segment_close(s);
+	}
+	if(!compressed){
+		segment_close(&z);
+	}
+	if(!plain && !compressed){
+		return -1;
+	}
+	if(!plain){
+		*s = z;
+		return 0;
+	}
+	if(!compressed){
+		return 0;
+	}
+
+	//both: a late message reopened the day after it was compacted. The .segz's blocks go first.
+	seg_index_t *idx = malloc(sizeof(seg_index_t) * (z.nidx + s->nidx + 1));
+	if(!idx){
+		segment_close(s);
+		segment_close(&z);
+		return -1;
+	}
+	memcpy(idx, z.idx, sizeof(seg_index_t) * z.nidx);
+	memcpy(idx + z.nidx, s->idx, sizeof(seg_index_t) * s->nidx);
+	s->idx = s->idx_own = idx;
+	s->nidx += z.nidx;
+	s->nz = z.nidx;
+	s->segz = z.segz;
+	s->segz_len = z.segz_len;
+	s->dict = z.dict;
+	s->dict_len = z.dict_len;
+	s->zblock = SIZE_MAX;
+	return 0;
+}
+
+void segment_close(segment_t *s){
+	if(s->seg){
+		munmap((void *)s->seg, s->seg_len);
+	}
+	if(s->segz){
+		munmap((void *)s->segz, s->segz_len);
+	}
+	if(s->idx_map){
+		munmap(s->idx_map, s->idx_len);
+	}
+	free(s->idx_own);
+	if(s->z){
+		inflateEnd(s->z);
+		free(s->z);
+	}
+	free(s->zbuf);
+	memset(s, 0, sizeof(*s));
+	s->zblock = SIZE_MAX;
+}
+
+/// @brief inflates block b of a .segz into s->zbuf.
+static int inflate_block(segment_t *s, size_t b){
+	const seg_index_t *ix = &s->idx[b];
+	size_t end = (b + 1 < s->nz) ? s->idx[b + 1].off : s->segz_len;
+	z_stream *z = s->z;
+
+	if(!z){
+		z = calloc(1, sizeof(z_stream));
+		if(!z || inflateInit(z) != Z_OK){
+			free(z);
+			return -1;
+		}
+		s->z = z;
+	} else if(inflateReset(z) != Z_OK){
+		return -1;
+	}
+
+	if(s->zcap < ix->bytes){
+		char *buf = realloc(s->zbuf, ix->bytes);
+		if(!buf){
+			return -1;
+		}
+		s->zbuf = buf;
+		s->zcap = ix->bytes;
+	}
+	s->zblock = SIZE_MAX;
+
+	z->next_in = (Bytef *)(s->segz + ix->off);
+	z->avail_in = (uInt)(end - ix->off);
+	z->next_out = (Bytef *)s->zbuf;
+	z->avail_out = ix->bytes;
+
+	int ret = inflate(z, Z_FINISH);
+	if(ret == Z_NEED_DICT){
+		if(inflateSetDictionary(z, (const Bytef *)s->dict, (uInt)s->dict_len) != Z_OK){
+			return -1;
+		}
+		ret = inflate(z, Z_FINISH);
+	}
+	if(ret != Z_STREAM_END || z->total_out != ix->bytes){
+		return -1;
+	}
+	s->zblock = b;
+	return 0;
+}
+
+int segment_block(segment_t *s, size_t b, const char **data, size_t *len){
+	if(b >= s->nidx){
+		*data = s->seg ? s->seg + s->tail : NULL;
+		*len = s->seg ? s->seg_len - s->tail : 0;
+		return 0;
+	}
+	if(b < s->nz){
+		if(s->zblock != b && inflate_block(s, b) < 0){
+			return -1;
+		}
+		*data = s->zbuf;
+	} else {
+		*data = s->seg + s->idx[b].off;
+	}
+	*len = s->idx[b].bytes;
+	return 0;
+}
+
+size_t segment_record(const char *data, size_t len, size_t off, seg_msg_t *m){
+	if(off + sizeof(seg_record_t) > len){
+		return 0;
+	}
+
+	memcpy(&m->hdr, data + off, sizeof(seg_record_t));
+	if(m->hdr.magic != SEG_RECORD_MAGIC){
+		return 0;
+	}
+
+	size_t end = off + sizeof(seg_record_t) + m->hdr.name_len + m->hdr.room_len + m->hdr.len;
+	if(end > len){
+		return 0;
+	}
+
+	m->name = data + off + sizeof(seg_record_t);
+	m->room = m->name + m->hdr.name_len;
+	m->text = m->room + m->hdr.room_len;
+	return end;
+}
+
+static int in_room(const seg_msg_t *m, const char *room, size_t room_len){
+	return !room || (m->hdr.room_len == room_len && memcmp(m->room, room, room_len) == 0);
+}
+
+/// @brief collects where the last `want` records of a segment that went to room are into pos (oldest first).
+//			Works backwards a block at a time, skipping blocks whose bloom filter says the room isn't in them.
+/// @return how many it found.
+static int segment_last(segment_t *s, const char *room, int want, seg_pos_t *pos){
+	size_t room_len = room ? strlen(room) : 0;
+	uint64_t room_hash = room ? seg_hash_room(room, room_len) : 0;
+	size_t chunk[SEG_BLOCK_RECORDS];
+	int free_slots = want;
+
+	//chunk b is block b, and chunk nidx is the unindexed tail. pos fills from the back.
+	for(size_t b = s->nidx + 1; b-- > 0 && free_slots > 0;){
+		const char *data;
+		size_t len;
+		if(b < s->nidx && room && !seg_bloom_test(s->idx[b].bloom, room_hash)){
+			continue;
+		}
+		if(segment_block(s, b, &data, &len) < 0){
+			continue;
+		}
+
+		//the chunk's matches in order; a tail longer than a block only keeps its last SEG_BLOCK_RECORDS.
+		seg_msg_t m;
+		size_t off, next;
+		int n = 0;
+		for(off = 0; off < len && (next = segment_record(data, len, off, &m)); off = next){
+			if(in_room(&m, room, room_len)){
+				chunk[n++ % SEG_BLOCK_RECORDS] = off;
+			}
+		}
+
+		int keep = n < SEG_BLOCK_RECORDS ? n : SEG_BLOCK_RECORDS;
+		if(keep > free_slots){
+			keep = free_slots;
+		}
+		for(int i = 0; i < keep; i++){
+			pos[--free_slots].block = b;
+			pos[free_slots].off = chunk[(n - 1 - i) % SEG_BLOCK_RECORDS];
+		}
+	}
+
+	int found = want - free_slots;
+	memmove(pos, pos + free_slots, sizeof(seg_pos_t) * (size_t)found);
+	return found;
+}
+
+int segment_replay(const char *dir, int64_t now_ms, const char *room, int n, void (*fn)(void *arg, const seg_msg_t *m), void *arg){
+	segment_t segs[SEG_REPLAY_DAYS];
+	seg_pos_t *pos[SEG_REPLAY_DAYS];
+	int found[SEG_REPLAY_DAYS];
+	int have = 0, days = 0;
+
+	if(n <= 0){
+		return 0;
+	}
+
+	time_t now = (time_t)(now_ms / 1000);
+	for(int d = 0; d < SEG_REPLAY_DAYS && have < n; d++){
+		struct tm lt;
+		char base[4096];
+
+		//d days back; mktime normalizes the day of the month.
+		localtime_r(&now, &lt);
+		lt.tm_mday -= d;
+		lt.tm_hour = 12;
+		lt.tm_isdst = -1;
+		time_t day = mktime(&lt);
+		localtime_r(&day, &lt);
+
+		segment_base(base, sizeof(base), dir, &lt);
+		if(segment_open(&segs[days], base) < 0){
+			continue;
+		}
+
+		pos[days] = malloc(sizeof(seg_pos_t) * (size_t)(n - have));
+		if(!pos[days]){
+			segment_close(&segs[days]);
+			break;
+		}
+		found[days] = segment_last(&segs[days], room, n - have, pos[days]);
+		have += found[days];
+		days++;
+	}
+
+	//the oldest day we opened goes first. Positions are in order, so a compressed block is inflated once more at most.
+	for(int d = days - 1; d >= 0; d--){
+		for(int i = 0; i < found[d]; i++){
+			const char *data;
+			size_t len;
+			seg_msg_t m;
+			if(segment_block(&segs[d], pos[d][i].block, &data, &len) == 0 && segment_record(data, len, pos[d][i].off, &m)){
+				fn(arg, &m);
+			}
+		}
+		free(pos[d]);
+		segment_close(&segs[d]);
+	}
+
+	return have;
+}
+
+/* Compaction */
+
+/// @brief writes all of buf to fd.
+static int write_full(int fd, const void *buf, size_t len){
+	const char *p = buf;
+	while(len > 0){
+		ssize_t n = write(fd, p, len);
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/// @brief the index entry for a .seg's tail, which the writer never got to close (the server went down).
+//			Only the records that parse count; a torn one at the end is left out.
+static void index_tail(segment_t *s, seg_index_t *ix){
+	const char *data;
+	size_t len, off, next;
+	seg_msg_t m;
+
+	memset(ix, 0, sizeof(*ix));
+	if(!s->seg || segment_block(s, s->nidx, &data, &len) < 0){
+		return;
+	}
+	for(off = 0; off < len && (next = segment_record(data, len, off, &m)); off = next){
+		if(ix->count++ == 0){
+			ix->first_ms = m.hdr.when_ms;
+		}
+		ix->last_ms = m.hdr.when_ms;
+		seg_bloom_record(ix->bloom, m.name, m.hdr.name_len, m.room, m.hdr.room_len, m.text, m.hdr.len);
+	}
+	ix->off = s->tail;
+	ix->bytes = (uint32_t)off;
+}
+
+/// @brief block k of everything being compacted (each source's blocks in turn, then its tail), and its index entry.
+static int input_block(segment_t *src, const seg_index_t *tails, int nsrc, size_t k, const char **data, size_t *len, seg_index_t *ix){
+	for(int i = 0; i < nsrc; i++){
+		size_t n = src[i].nidx + (tails[i].count > 0);
+		if(k >= n){
+			k -= n;
+			continue;
+		}
+		if(segment_block(&src[i], k, data, len) < 0){
+			return -1;
+		}
+		*ix = (k < src[i].nidx) ? src[i].idx[k] : tails[i];
+		*len = ix->bytes;
+		return 0;
+	}
+	return -1;
+}
+
+int segment_compact(const char *base, uint64_t *raw, uint64_t *packed){
+	char seg[4096], idx[4096], segz[4096], tmp[4096];
+	segment_t src[2];
+	seg_index_t tails[2], *out = NULL;
+	char *dict = NULL;
+	Bytef *zout = NULL;
+	uLong zcap = 0;
+	z_stream z;
+	int nsrc = 0, fd = -1, segfd = -1, zok = 0, ret = -1, saved;
+	size_t nblocks = 0, dict_len = 0;
+	uint64_t before = 0, raw_bytes = 0;
+	struct stat st;
+
+	snprintf(seg, sizeof(seg), "%s.seg", base);
+	snprintf(idx, sizeof(idx), "%s.idx", base);
+	snprintf(segz, sizeof(segz), "%s.segz", base);
+	snprintf(tmp, sizeof(tmp), "%s.segz.%d.tmp", base, (int)getpid());
+
+	memset(src, 0, sizeof(src));
+	memset(tails, 0, sizeof(tails));
+
+	//no .seg: compacted already, or there's no such day.
+	segfd = open(seg, O_RDWR | O_CLOEXEC);
+	if(segfd < 0){
+		return 0;
+	}
+
+	//the writer (ours, or the server's if we're "query -z") has it, or another compaction does.
+	if(lock_byte(segfd, LOCK_WRITER, F_WRLCK, 0) < 0){
+		if(errno == EAGAIN || errno == EACCES){
+			errno = EBUSY;
+		}
+		goto done;
+	}
+	if(unlinked(segfd)){
+		ret = 0;
+		goto done;
+	}
+	if(fstat(segfd, &st) == 0){
+		before += (uint64_t)st.st_size;
+	}
+	if(stat(idx, &st) == 0){
+		before += (uint64_t)st.st_size;
+	}
+
+	//what was compacted before goes first, then the .seg.
+	if(open_compressed(&src[0], base) == 0){
+		before += src[0].segz_len;
+		nsrc++;
+	} else {
+		segment_close(&src[0]);
+	}
+	if(open_plain(&src[nsrc], segfd, base) < 0){
+		goto done;
+	}
+	index_tail(&src[nsrc], &tails[nsrc]);
+	nsrc++;
+
+	for(int i = 0; i < nsrc; i++){
+		nblocks += src[i].nidx + (tails[i].count > 0);
+	}
+	out = calloc(nblocks ? nblocks : 1, sizeof(seg_index_t));
+	dict = malloc(SEGZ_DICT_MAX);
+	if(!out || !dict){
+		goto done;
+	}
+
+	//the dictionary: the start of every block, or of evenly spaced ones if that's too much.
+	const char *data;
+	size_t len;
+	seg_index_t ix;
+	size_t per = SEGZ_DICT_MAX / SEGZ_DICT_SAMPLE;
+	size_t step = nblocks > per ? (nblocks + per - 1) / per : 1;
+	for(size_t k = 0; k < nblocks; k += step){
+		if(input_block(src, tails, nsrc, k, &data, &len, &ix) < 0){
+			goto done;
+		}
+		size_t take = len < SEGZ_DICT_SAMPLE ? len : SEGZ_DICT_SAMPLE;
+		if(take > SEGZ_DICT_MAX - dict_len){
+			take = SEGZ_DICT_MAX - dict_len;
+		}
+		memcpy(dict + dict_len, data, take);
+		dict_len += take;
+	}
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0 || deflateInit(&z, Z_BEST_COMPRESSION) != Z_OK){
+		goto done;
+	}
+	zok = 1;
+
+	//the header and index go in last, once the blocks' offsets are known.
+	uint64_t at = SEG_FILE_HDR + sizeof(segz_header_t) + sizeof(seg_index_t) * nblocks;
+	if(lseek(fd, (off_t)at, SEEK_SET) < 0 || write_full(fd, dict, dict_len) < 0){
+		goto done;
+	}
+	at += dict_len;
+
+	for(size_t k = 0; k < nblocks; k++){
+		if(input_block(src, tails, nsrc, k, &data, &len, &ix) < 0){
+			goto done;
+		}
+		if(deflateReset(&z) != Z_OK || (dict_len && deflateSetDictionary(&z, (const Bytef *)dict, (uInt)dict_len) != Z_OK)){
+			goto done;
+		}
+
+		uLong bound = deflateBound(&z, (uLong)len);
+		if(bound > zcap){
+			Bytef *grown = realloc(zout, bound);
+			if(!grown){
+				goto done;
+			}
+			zout = grown;
+			zcap = bound;
+		}
+		z.next_in = (Bytef *)data;
+		z.avail_in = (uInt)len;
+		z.next_out = zout;
+		z.avail_out = (uInt)bound;
+		if(deflate(&z, Z_FINISH) != Z_STREAM_END || write_full(fd, zout, bound - z.avail_out) < 0){
+			goto done;
+		}
+
+		out[k] = ix;
+		out[k].off = at;
+		out[k].bytes = (uint32_t)len;
+		at += bound - z.avail_out;
+		raw_bytes += len;
+	}
+
+	segz_header_t h = { (uint32_t)nblocks, (uint32_t)dict_len, raw_bytes };
+	size_t idx_sz = sizeof(seg_index_t) * nblocks;
+	if(pwrite(fd, SEGZ_FILE_MAGIC, SEG_FILE_HDR, 0) != SEG_FILE_HDR
+		|| pwrite(fd, &h, sizeof(h), SEG_FILE_HDR) != (ssize_t)sizeof(h)
+		|| pwrite(fd, out, idx_sz, SEG_FILE_HDR + sizeof(h)) != (ssize_t)idx_sz){
+		goto done;
+	}
+	if(fsync(fd) < 0){
+		goto done;
+	}
+	close(fd);
+	fd = -1;
+
+	//readers open the .seg first and hold LOCK_SWAP while they open the rest (see segment_open()), so each one
+	//sees the old files or the new .segz, never a bit of both.
+	if(lock_byte(segfd, LOCK_SWAP, F_WRLCK, 1) < 0 || rename(tmp, segz) < 0){
+		goto done;
+	}
+	unlink(seg);
+	unlink(idx);
+
+	if(raw){
+		*raw = before;
+	}
+	if(packed){
+		*packed = at;
+	}
+	ret = 0;
+
+done:
+	//what went wrong is in errno; cleaning up mustn't change it.
+	saved = errno;
+	if(fd >= 0){
+		close(fd);
+	}
+	if(ret < 0){
+		unlink(tmp);
+	}
+	if(zok){
+		deflateEnd(&z);
+	}
+	free(zout);
+	free(dict);
+	free(out);
+	segment_close(&src[0]);
+	segment_close(&src[1]);
+	if(segfd >= 0){
+		close(segfd);
+	}
+	errno = saved;
+	return ret;
+}
@@ -0,0 +1,285 @@
+/*
+ * File: irc_segment.h
+ * Project: CSCI 3160 Chat Project
+ * Description: The on-disk chat history format, and the code that reads it back.
+ *
+ *	Each day has two append-only files in the history directory:
+ *
+ *	 YYYY-MM-DD.seg   SEG_FILE_MAGIC, then one record per message: a seg_record_t, the user name
+ *	                  (name_len bytes), the room (room_len bytes), then the message text (len bytes).
+ *	                  Records are never rewritten.
+ *	 YYYY-MM-DD.idx   IDX_FILE_MAGIC, then one seg_index_t per block of up to SEG_BLOCK_RECORDS records
+ *	                  (or SEG_BLOCK_BYTES bytes): where the block starts, its time range, and a bloom
+ *	                  filter of the user names, rooms and words in it.
+ *
+ *	Once a day is over, the history writer (or "query -z") compacts its two files into one (segment_compact()):
+ *
+ *	 YYYY-MM-DD.segz  SEGZ_FILE_MAGIC, a segz_header_t, the day's index (seg_index_t as above, except that
+ *	                  off is where the block starts in this file and bytes is how big it is uncompressed),
+ *	                  the dictionary, then the blocks, each one compressed on its own (a zlib stream)
+ *	                  with the dictionary preset. A block's compressed size is the gap to the next one.
+ *
+ *	A message logged to a day after it was compacted starts a new .seg and .idx next to the .segz; readers
+ *	take the day as the .segz's blocks followed by the .seg's, and the next compaction folds them together.
+ *	The files are swapped under fcntl locks on the .seg (see segment_claim()), so a reader in another process
+ *	never sees a day twice or not at all, and nobody compacts a day the writer still has open.
+ *
+ *	Every record starts with nearly the same header, name, room and "[date time]" stamp, which a 4KB
+ *	block by itself is too small to learn; the dictionary is a sample of the whole day's records, so
+ *	every block starts out knowing them. Since the blocks are compressed separately, a reader only
+ *	inflates the ones its search didn't rule out.
+ *
+ *	The index is sparse: a reader binary searches it by time, skips blocks whose bloom filter says
+ *	the user/word isn't there, and only walks the records of the blocks that are left.
+ *	The records after the last indexed block (the block still being filled) are always walked.
+ *	The files are mmap'd, so nothing is copied out of the page cache (except to inflate a .segz block).
+ *
+ *	Numbers are stored in host byte order; the files are meant to be read on the machine that wrote them.
+ */
+
+#ifndef IRC_SEGMENT_H
+#define IRC_SEGMENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#define SEG_FILE_MAGIC "IRCSEG1\n"
+#define IDX_FILE_MAGIC "IRCIDX1\n"
+#define SEGZ_FILE_MAGIC "IRCSGZ1\n"
+#define SEG_FILE_HDR 8
+
+/// @brief how big the dictionary gets, and how much of each block goes into it. zlib could use up to 32KB,
+//			but every block inflated starts by loading the dictionary, and past 16KB that costs more than it saves.
+#define SEGZ_DICT_MAX 16384
+#define SEGZ_DICT_SAMPLE 512
+
+#define SEG_RECORD_MAGIC 0x5EC7
+
+/// @brief a block is closed (and gets an index entry) at whichever of these it reaches first.
+#define SEG_BLOCK_RECORDS 32
+#define SEG_BLOCK_BYTES 4096
+
+/// @brief bloom filter size per block, in 64 bit words (2048 bits), and how many bits each key sets.
+#define SEG_BLOOM_WORDS 32
+#define SEG_BLOOM_HASHES 3
+
+/// @brief the longest word that goes in the bloom filter. Longer ones are cut off here (and so are queries).
+#define SEG_TOKEN_MAX 32
+
+/// @brief the header in front of every record in a .seg file.
+typedef struct{
+	uint16_t magic;
+	uint8_t name_len;
+	uint8_t flags;
+
+	/// @brief bytes of message text after the name.
+	uint32_t len;
+
+	/// @brief when the server logged it, in milliseconds since the epoch.
+	int64_t when_ms;
+
+	uint32_t uid;
+
+	/// @brief bytes of room name after the user name.
+	uint8_t room_len;
+	uint8_t reserved[3];
+} seg_record_t;
+
+/// @brief one entry in a .idx file: a block of records in the .seg file.
+typedef struct{
+	int64_t first_ms;
+	int64_t last_ms;
+
+	/// @brief where the block's first record starts in the .seg file, and how many bytes/records it has.
+	uint64_t off;
+	uint32_t bytes;
+	uint32_t count;
+
+	uint64_t bloom[SEG_BLOOM_WORDS];
+} seg_index_t;
+
+/// @brief what follows SEGZ_FILE_MAGIC in a .segz file.
+typedef struct{
+	uint32_t nblocks;
+	uint32_t dict_len;
+
+	/// @brief the day's records, uncompressed.
+	uint64_t raw_bytes;
+} segz_header_t;
+
+/// @brief a day's segment, opened for reading: its .segz, its .seg, or both (a late message after the day was
+//			compacted), in which case the .segz's blocks come first.
+typedef struct{
+	/// @brief the .seg file, mapped (NULL if there's none). Only the first seg_len bytes (its size when it was opened) are looked at.
+	const char *seg;
+	size_t seg_len;
+
+	/// @brief the .segz file, mapped (NULL if there's none).
+	const char *segz;
+	size_t segz_len;
+
+	/// @brief the day's index entries, and how many complete ones there are. The first nz are the .segz's blocks
+	//			(off is into the .segz), the rest the .idx's (off is into the .seg). idx_map/idx_len is the .idx mapping
+	//			(a .segz has its index inside, so there's no separate mapping); with both files, idx is idx_own,
+	//			a copy of the two.
+	const seg_index_t *idx;
+	size_t nidx;
+	size_t nz;
+	void *idx_map;
+	size_t idx_len;
+	seg_index_t *idx_own;
+
+	/// @brief where the .seg's records that aren't in any block yet begin.
+	size_t tail;
+
+	/// @brief for a .segz: its dictionary, the inflate state, and the block segment_block() last inflated
+	//			(zblock, or SIZE_MAX) in zbuf.
+	const char *dict;
+	size_t dict_len;
+	void *z;
+	char *zbuf;
+	size_t zcap;
+	size_t zblock;
+} segment_t;
+
+/// @brief one record, as returned by segment_record(). name, room and text point into the block it came from.
+typedef struct{
+	seg_record_t hdr;
+	const char *name;
+	const char *room;
+	const char *text;
+} seg_msg_t;
+
+/// @brief FNV-1a over the lowercased key.
+static inline uint64_t seg_hash(const char *key, size_t len){
+	uint64_t h = 14695981039346656037ULL;
+	for(size_t i = 0; i < len; i++){
+		unsigned char c = (unsigned char)key[i];
+		if(c >= 'A' && c <= 'Z'){
+			c += 'a' - 'A';
+		}
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/// @brief the hash for a user name. It's salted, so a user named "hello" doesn't match the word "hello".
+static inline uint64_t seg_hash_user(const char *name, size_t len){
+	return seg_hash(name, len) ^ 0x9E3779B97F4A7C15ULL;
+}
+
+/// @brief the hash for a room name, salted differently again.
+static inline uint64_t seg_hash_room(const char *room, size_t len){
+	return seg_hash(room, len) ^ 0xC2B2AE3D27D4EB4FULL;
+}
+
+static inline void seg_bloom_add(uint64_t *bloom, uint64_t h){
+	uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+	for(int i = 0; i < SEG_BLOOM_HASHES; i++){
+		uint32_t bit = (h1 + (uint32_t)i * h2) % (SEG_BLOOM_WORDS * 64);
+		bloom[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+/// @return 0 if the key is definitely not in the block, 1 if it might be.
+static inline int seg_bloom_test(const uint64_t *bloom, uint64_t h){
+	uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+	for(int i = 0; i < SEG_BLOOM_HASHES; i++){
+		uint32_t bit = (h1 + (uint32_t)i * h2) % (SEG_BLOOM_WORDS * 64);
+		if(!(bloom[bit / 64] & (1ULL << (bit % 64)))){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static inline int seg_is_word_char(char c){
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || (unsigned char)c >= 0x80;
+}
+
+/// @brief finds the next word in text[*pos .. len). Words are runs of letters, digits, '_' and non-ASCII bytes.
+//			The "[2023-12-06 10:00:00]" stamp the client puts in front of a message is skipped;
+//			time ranges are searched through the index instead.
+/// @return 1 with the word in [*start, *start + *wlen), or 0 when there are no more.
+static inline int seg_next_word(const char *text, size_t len, size_t *pos, size_t *start, size_t *wlen){
+	size_t i = *pos;
+
+	if(i == 0 && len > 0 && text[0] == '['){
+		const char *close = memchr(text, ']', len);
+		if(close){
+			i = (size_t)(close - text) + 1;
+		}
+	}
+
+	while(i < len && !seg_is_word_char(text[i])){
+		i++;
+	}
+	if(i >= len){
+		*pos = len;
+		return 0;
+	}
+
+	size_t s = i;
+	while(i < len && seg_is_word_char(text[i])){
+		i++;
+	}
+	*start = s;
+	*wlen = (i - s > SEG_TOKEN_MAX) ? SEG_TOKEN_MAX : i - s;
+	*pos = i;
+	return 1;
+}
+
+/// @brief adds a record's user, room and words to a block's bloom filter.
+static inline void seg_bloom_record(uint64_t *bloom, const char *name, size_t name_len, const char *room, size_t room_len, const char *text, size_t len){
+	size_t pos = 0, start, wlen;
+
+	seg_bloom_add(bloom, seg_hash_user(name, name_len));
+	seg_bloom_add(bloom, seg_hash_room(room, room_len));
+	while(seg_next_word(text, len, &pos, &start, &wlen)){
+		seg_bloom_add(bloom, seg_hash(text + start, wlen));
+	}
+}
+
+/// @brief builds the name a day's files share: dir/YYYY-MM-DD (add ".seg", ".idx" or ".segz").
+void segment_base(char *out, size_t size, const char *dir, const struct tm *day);
+
+/// @brief maps dir/<day>.seg and dir/<day>.idx for reading (base is "dir/YYYY-MM-DD"), and dir/<day>.segz
+//			if the day has been compacted. Never sees the day halfway through segment_compact() swapping them.
+/// @return 0 on success, -1 if there is no such segment (or it isn't one).
+int segment_open(segment_t *s, const char *base);
+void segment_close(segment_t *s);
+
+/// @brief block b's records (b == s->nidx: the ones after the last block), inflated if the segment is compressed.
+//			*data stays valid until the next call (or segment_close()).
+/// @return 0 on success, -1 if the block can't be read.
+int segment_block(segment_t *s, size_t b, const char **data, size_t *len);
+
+/// @brief reads the record at off in a block (or any other run of records) data[0 .. len).
+/// @return the offset of the record after it, or 0 if there is no complete record at off.
+size_t segment_record(const char *data, size_t len, size_t off, seg_msg_t *m);
+
+/// @brief the history writer's claim on the day it appends to (fd is the day's .seg): segment_compact() leaves a
+//			claimed day alone, and this waits while the day is being compacted. Once it returns, the writer checks
+//			the .seg is still there (a compaction that was running has removed it) and opens it again if not.
+//			The claim is an fcntl lock on fd, so it goes when fd is closed.
+/// @return 0, or -1 if the lock failed.
+int segment_claim(int fd);
+
+/// @brief compacts a finished day's .seg and .idx into a .segz (folding in the .segz it may already have,
+//			if a late message reopened the day), then removes them. Safe to run while readers have the
+//			day open: the .segz is complete before the old files go, and segment_open() waits for the swap.
+/// @return 0 on success (or if there's nothing to compact), -1 on failure (the old files are left alone), with
+//			errno EBUSY if a writer has the day claimed (segment_claim()). raw/packed, if not NULL, get the
+//			day's size before and after.
+int segment_compact(const char *base, uint64_t *raw, uint64_t *packed);
+
+/// @brief calls fn on the last n messages logged in dir to room (any room if it's NULL), oldest first.
+//			Looks back through up to SEG_REPLAY_DAYS day files, starting at the day `now` is in.
+/// @return how many messages fn was called on.
+#define SEG_REPLAY_DAYS 7
+int segment_replay(const char *dir, int64_t now_ms, const char *room, int n, void (*fn)(void *arg, const seg_msg_t *m), void *arg);
+
+#endif
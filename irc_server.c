@@ -8,10 +8,10 @@
  * Usage: (See the readme.txt)
  *  Navigate to your folder containing irc_client.c and irc_server.c.
  *	Login to your WSL by typing in "wsl -d Ubuntu-3160 -u csci3160".
- *	Build irc_server.c by typing in "gcc -o server irc_server.c" in your Powershell. 
+ *	Build irc_server.c by typing in "gcc -pthread -o server irc_server.c irc_msgbuf.c irc_history.c irc_segment.c irc_rcu.c irc_registry.c irc_room.c irc_metrics.c irc_clock.c irc_slab.c irc_uring.c irc_ratelimit.c irc_link.c irc_handoff.c irc_timer.c irc_roster.c -lz" in your Powershell. 
  *	Afterwards, build irc_client.c by typing in "gcc -o client irc_client.c". 
  *
- *	Alternatively, you can build with "make" if the Makefile is present.
+ *	Alternatively, you can build both with "make build" (the Makefile's SERVER_SRC lists the server's files).
  *
  *	Launch the server on port 8888 by typing in "./server 8888".
  *	Launch the client on port 8888 by typing in "./client 8888". 
@@ -27,11 +27,14 @@
  * ChatGPT for some help 
  */
 
+#define _GNU_SOURCE
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -39,43 +42,458 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/random.h>
+#include <poll.h>
+
+#include "irc_mpsc.h"
+#include "irc_msgbuf.h"
+#include "irc_proto.h"
+#include "irc_history.h"
+#include "irc_segment.h"
+#include "irc_rcu.h"
+#include "irc_registry.h"
+#include "irc_room.h"
+#include "irc_metrics.h"
+#include "irc_clock.h"
+#include "irc_slab.h"
+#include "irc_uring.h"
+#include "irc_ratelimit.h"
+#include "irc_link.h"
+#include "irc_handoff.h"
+#include "irc_timer.h"
+#include "irc_roster.h"
 
-#define MAX_CLIENTS 100
 #define BUFFER_SZ 2048
+#define NAME_SZ 32
+#define MAX_EVENTS 256
+#define OUTQ_DEFAULT 256
+#define MAX_IOV 64
+#define RBUF_SZ 16384
+#define REPLAY_DEFAULT 20
+#define ROOMS_PER_CLIENT 16
+
+/// @brief threaded mode: each client thread's stack (instead of the 8 MB default), and how long a
+//			client has to be quiet before its thread gives its buffers back and waits without them.
+#define THREAD_STACK_SZ (128 * 1024)
+#define IDLE_SECS 5
+
+/// @brief -l off: no batching, every message is written to every recipient as it's sent.
+#define BATCH_OFF -1
+
+/// @brief io_uring mode: submission queue entries per shard, and the shard's receive buffers the kernel picks from.
+#define URING_ENTRIES 1024
+#define URING_BUFS 256
+#define URING_BUF_SZ 4096
+
+/// @brief flood control: messages a second each connection may send, and how many it may send at once (-R).
+//			io_uring mode keeps receiving for a moment after a client is throttled (until the cancel reaches its
+//			recv, which can be a round of the shard's buffers later), so a throttled client's receive buffer
+//			grows to hold that, up to FLOOD_RBUF_MAX. A client that gets past even that is disconnected.
+#define RATE_DEFAULT 100
+#define BURST_DEFAULT 200
+#define FLOOD_RBUF_MAX (2 * URING_BUFS * URING_BUF_SZ)
+
+/// @brief session resume: how many of its latest messages every room keeps for clients coming back (-s),
+//			and how long (seconds) a framed client that dropped has to come back before it's gone for good (-g).
+#define RESUME_RING_DEFAULT 256
+#define GRACE_DEFAULT 30
+
+/// @brief hot restart: what the state we hand a new server starts with, so a server never takes over from
+//			something it can't read (the layout is in handoff_pack), and what a room index of "none" is in it.
+#define HANDOFF_MAGIC 0x43484154
+#define HANDOFF_VERSION 2
+#define HANDOFF_NO_ROOM 0xff
+
+/// @brief keepalives: how long (seconds) a client may be quiet before it's sent a PING (-k).
+#define PING_DEFAULT 60
 
 /// @brief The _Atomic keyword protects cli_count from data races. No more than 1 process can access cli_count at a time.
 //Introduced in C11 - handles locks and unlocks automatically.
 static _Atomic unsigned int cli_count = 0;
-static int uid = 10;
+static _Atomic int uid = 10;
+
+/// @brief where the history writer puts its day files (2023-12-06.seg, 2023-12-05.seg, etc.) and when it fsyncs them.
+history_config_t history_config = { ".", HISTORY_FSYNC_NEVER, 0, 0 };
+
+/// @brief how many of the latest messages a client gets sent when it joins (-r).
+static int replay_count = REPLAY_DEFAULT;
+
+/// @brief how many messages each room keeps for resuming sessions (-s, 0: none, and messages aren't numbered),
+//			and how long a dropped session waits for its client to come back (-g, seconds, 0: not at all).
+static unsigned resume_ring = RESUME_RING_DEFAULT;
+static int park_grace = GRACE_DEFAULT;
+
+/// @brief keepalives (-k, seconds, 0: off): a framed client quiet this long gets a PING and one that stays quiet
+//			as long again is dropped; a connection that hasn't sent a name by then is dropped right away. Raw-text
+//			clients can't answer a PING, so they're left to the kernel's TCP keepalives (client_keepalive).
+static int ping_secs = PING_DEFAULT;
+
+/// @brief presence (irc_roster.h): how long (milliseconds) a room's joins and leaves are collected before they go
+//			out as one roster delta (-W, 0: each flush takes whatever came in meanwhile).
+static int roster_window = ROSTER_WINDOW_MS;
+
+/// @brief epoll mode: how long (microseconds) a loop may sit on messages it batched up before writing them (-l).
+//			0 writes them at the end of the loop iteration they arrived in, BATCH_OFF writes every message right away.
+static long batch_budget_us = 0;
+
+struct shard;
+
+/// @brief one message as it travels through the server: a frame sitting inside a shared buffer.
+// The IRC_FRAME_HDR byte header is at buf->data + off and the len bytes of text follow it,
+// so framed clients get header + text and old raw-text clients get just the text, from the same bytes.
+// Framed clients also get the pre bytes right before the header: the IRC_SEQ frame numbering a room message.
+// A chat line (an IRC_MSG frame, see msg_chat) also has an IRC_USER frame with the sender's name in the intro bytes
+// before that, for framed clients that weren't told it yet, and the line rendered as text at text, tlen bytes long,
+// after the frame: that's what raw-text clients and the history get. For everything else (text == 0) they get the
+// frame's payload.
+typedef struct{
+	msgbuf_t *buf;
+	uint32_t off;
+	uint32_t len;
+	uint32_t pre;
+	uint32_t intro;
+	uint32_t text;
+	uint32_t tlen;
+} msg_t;
+
+/// @brief one message waiting in a client's outbound queue.
+// The queue holds a reference to the shared buffer, never a copy. Bytes [pos, end) still have to go out.
+typedef struct{
+	msgbuf_t *buf;
+	uint32_t pos;
+	uint32_t end;
+} outmsg_t;
+
+/// @brief a client's outbound queue: a ring of out_capacity messages that
+//			didn't fit in the socket buffer yet. It is flushed (with writev) when epoll says
+//			the socket is writable. What happens when it fills up is up to slow_policy.
+typedef struct{
+	/// @brief allocated the first time the client falls behind.
+	outmsg_t *ring;
+
+	/// @brief head is the next message to send, tail the next free slot. tail - head is the depth.
+	unsigned head;
+	unsigned tail;
 
-/// @brief timeString[40] will hold the string containing the date and time.
-char timeString[40];
+	/// @brief set once part of ring[head] went out, so it must not be dropped.
+	int head_started;
 
-/// @brief date is timeString, but only containing date.
-// This is also useful for assigning the name to our chat history file. 
-// (chat history files will be named by date, e.g., 2023-12-06, 2023-12-05, etc.)
-char date[15];
+	/// @brief io_uring mode: how many messages from head on the send in flight points at. Those can't be dropped either.
+	unsigned sending;
 
-/// @brief currentTime is timeString, but only containing the time.
-// It's here, but I commented it out since we don't need it.
-//char currentTime[25];
+	/// @brief bytes waiting in the queue.
+	size_t bytes;
 
-FILE *FilePointerToChatHistory;
-char pathToTextFile[20];
+	/// @brief queue-depth counters (dumped with SIGUSR1).
+	unsigned depth_max;
+	unsigned long queued;
+	unsigned long dropped;
+} outq_t;
+
+/// @brief io_uring mode: a send in flight. The kernel reads the iovecs (and the buffers they point at)
+//			until it completes, so they live here instead of on the stack.
+typedef struct{
+	struct msghdr mh;
+	struct iovec iov[MAX_IOV];
+} uring_send_t;
 
 /* Client structure */
 typedef struct{
 	struct sockaddr_in address;
 	int sockfd;
 	int uid;
-	char name[32];
+	char name[NAME_SZ];
+
+	/// @brief our entry in the registry (uid, and name once we have one).
+	reg_node_t reg;
+
+	/// @brief threaded mode: held while a thread writes to this client, so two messages can't interleave.
+	pthread_mutex_t wlock;
+
+	/// @brief set once the client has sent a valid name.
+	int named;
+
+	/// @brief what the client has to show to pick this session back up if it drops (framed clients only).
+	uint64_t token;
+
+	/// @brief the rooms we're in, and the one our chat lines go to (NULL once we've left them all).
+	room_t *rooms[ROOMS_PER_CLIENT];
+	int nrooms;
+	room_t *room;
+
+	/// @brief 1 if the client speaks irc_proto.h frames, 0 for the old raw-text protocol
+	//			(a NAME_SZ name block, then one recv per message). Decided by the first byte it sends.
+	int framed;
+
+	/// @brief receive buffer for framed clients. Frames are parsed in place from [roff, rlen);
+	//			the buffer is shared with whoever the frames were broadcast to, so it is only reused
+	//			once we hold the last reference.
+	msgbuf_t *rbuf;
+	size_t rlen;
+	size_t roff;
+
+	/// @brief the senders whose names (IRC_USER) the client has, by uid % IRC_USER_SLOTS (framed clients only).
+	//			Forgotten whenever a message to us is dropped, since it may have been the one that told it.
+	uint32_t known[IRC_USER_SLOTS];
+
+	/// @brief set when a write failed; the event loop closes the client on its next event.
+	//			(threaded mode: only touched under wlock, and later writes to the client are skipped.)
+	int dead;
+
+	/// @brief messages a non-blocking write() could not push yet (epoll mode only).
+	outq_t out;
+
+	/// @brief the epoll events we are currently registered for, so we only call epoll_ctl on changes.
+	uint32_t events;
+
+	/// @brief backpressure state: paused means we stopped reading from this client,
+	//			congested means this client's own queue is over the high watermark.
+	int paused;
+	int congested;
+
+	/// @brief the event loop that owns this client (epoll mode), and where it sits in that loop's list.
+	// Only the owning loop's thread ever reads or writes the client.
+	struct shard *shard;
+	int shard_slot;
+
+	/// @brief bytes this session holds: its client_t, its buffers while it has them, its thread's stack.
+	size_t mem;
+
+	/// @brief set while messages for us sit in our queue waiting for the loop's next batch flush,
+	//			and where we are in the shard's list of those clients.
+	int batched;
+	int batch_slot;
+
+	/// @brief io_uring mode: how many of our requests the kernel hasn't completed yet (we can't be freed
+	//			while it could still complete one), whether our multishot recv is running and whether we asked
+	//			it to stop, the send in flight, and whether we're on the list of clients to close
+	//			or already on our way out.
+	int inflight;
+	int recv_armed;
+	int recv_cancel;
+	uring_send_t *send;
+	int reap_slot;
+	int reaping;
+	int closing;
+
+	/// @brief flood control: our token bucket (irc_ratelimit.h), and while we're sending too fast, when
+	//			(ratelimit_now() milliseconds) we may go on, and where we are in the shard's list of throttled clients.
+	bucket_t bucket;
+	uint32_t throttle_until;
+	int throttled;
+	int throttle_slot;
+
+	/// @brief keepalives (epoll and io_uring modes): our timer on the shard's wheel, the tick (of that wheel)
+	//			we last heard from the client on, and whether it's been sent a PING since. Hearing from it only
+	//			sets heard; the timer catches up when it fires, so a busy client never touches the wheel.
+	wheel_timer_t idle;
+	uint64_t heard;
+	int pinged;
 } client_t;
 
-//The array to hold clients.
-client_t *clients[MAX_CLIENTS];
+/// @brief a message handed from one shard to another through the receiver's inbox.
+// It carries a reference to the message, not a copy.
+typedef struct{
+	mpsc_node_t node;
+
+	/// @brief the sender, who doesn't get it.
+	int uid;
+
+	/// @brief the room whose members (on the receiving shard) get it, or for a direct message,
+	//			the one client that does (to is 0 otherwise).
+	int room;
+	int to;
+	msg_t msg;
+} shard_msg_t;
+
+/// @brief one event loop in epoll mode. Each worker thread owns exactly one shard:
+//			its own SO_REUSEPORT listening socket, its own epoll instance and its own clients.
+//			Other shards never touch those clients; they drop broadcasts into the inbox
+//			and kick wakefd, and the owning thread delivers them.
+typedef struct shard{
+	int id;
+	int epfd;
+	int listenfd;
+
+	/// @brief eventfd that wakes the loop when something lands in the inbox.
+	int wakefd;
+
+	/// @brief set while a wake-up is already on its way, so busy senders only write wakefd once.
+	_Atomic int wake_pending;
+	mpsc_queue_t inbox;
+
+	/// @brief the clients this shard owns.
+	client_t **locals;
+	int nlocals;
+	int locals_cap;
+
+	/// @brief the clients with messages batched up (room for all of locals, so adding one never allocates),
+	//			and when the oldest of those messages came in (only tracked with a latency budget).
+	client_t **batch;
+	int nbatch;
+	uint64_t batch_start;
+
+	/// @brief io_uring mode: the clients that broke somewhere we couldn't close them (like halfway through
+	//			a room's member list); the loop closes them once it's done with the completions at hand.
+	client_t **reap;
+	int nreap;
+
+	/// @brief the clients flood control has us not reading from, until their throttle_until.
+	client_t **throttled;
+	int nthrottled;
+
+	/// @brief our clients' keepalive timers.
+	timer_wheel_t wheel;
+
+	/// @brief io_uring mode: the ring, the receive buffers its multishot recvs fill, and where sends in flight live.
+	uring_t ring;
+	uring_bufs_t bufs;
+	slab_pool_t sends;
+
+	/// @brief how many of our clients are paused by backpressure.
+	int npaused;
+
+	/// @brief set by the SIGUSR1 handler; the loop then prints its clients' queue counters.
+	_Atomic int dump_requested;
+
+	/// @brief set by a metrics scrape (to its round); the loop then reports its clients' outbound backlog.
+	_Atomic unsigned backlog_requested;
+
+	/// @brief outbound queue rings for our clients. Only this shard's thread uses it.
+	slab_pool_t rings;
+
+	pthread_t thread;
+} shard_t;
+
+/// @brief How the server drives its sockets.
+// SERVER_THREADED is the original design: one thread and one blocking recv() per client.
+// SERVER_EPOLL runs the clients from a few worker threads (see shard_t) with non-blocking sockets and epoll.
+// SERVER_URING runs the same shards from io_uring instead: multishot accept and recv, and every send
+//   a round batched up goes to the kernel in the same io_uring_enter() the loop waits in.
+typedef enum{
+	SERVER_THREADED,
+	SERVER_EPOLL,
+	SERVER_URING
+} server_mode_t;
+
+static server_mode_t server_mode = SERVER_EPOLL;
+
+/// @brief the most clients we will accept at once (-c). 0 means no limit but the file descriptor limit.
+static int max_clients = 0;
+
+/// @brief what to do with a client whose outbound queue is full (-p).
+// SLOW_DROP_OLDEST throws away the oldest queued message to make room.
+// SLOW_DISCONNECT kicks the slow client.
+// SLOW_BACKPRESSURE stops reading from senders while any queue is over its high watermark,
+//   so the room slows down to the slowest reader. If a queue fills anyway it drops the oldest message.
+typedef enum{
+	SLOW_DROP_OLDEST,
+	SLOW_DISCONNECT,
+	SLOW_BACKPRESSURE
+} slow_policy_t;
 
+static slow_policy_t slow_policy = SLOW_DROP_OLDEST;
+
+/// @brief what to do with a client sending faster than its rate limit (-F).
+// FLOOD_THROTTLE stops reading from it until its bucket has a message's worth of tokens again;
+//   what it already sent waits in its receive buffer (and then the socket), and nothing is lost.
+// FLOOD_DISCONNECT tells it why and kicks it.
+typedef enum{
+	FLOOD_THROTTLE,
+	FLOOD_DISCONNECT
+} flood_policy_t;
+
+static flood_policy_t flood_policy = FLOOD_THROTTLE;
+
+/// @brief how many messages a client's outbound queue holds (-q). Always a power of two.
+static unsigned out_capacity = OUTQ_DEFAULT;
+
+/// @brief clients over their high watermark, across all shards (backpressure only).
+static _Atomic int congested_clients = 0;
+
+/// @brief where every client_t comes from.
+static slab_pool_t client_pool;
+
+/// @brief every connected client, by uid and by name. Both modes use it; threaded mode broadcasts by walking it.
+static registry_t registry;
+
+/// @brief a framed client that dropped without saying goodbye: its name, token and rooms, kept (with a hold
+//			on every room) until it resumes or park_grace runs out. Nobody hears it left until then.
+typedef struct parked{
+	reg_node_t reg;
+	char name[NAME_SZ];
+	uint64_t token;
+	room_t *rooms[ROOMS_PER_CLIENT];
+	int nrooms;
+
+	/// @brief rooms[] index of the room it talked in, -1 for none.
+	int current;
+
+	/// @brief when it's gone for good (metrics_now_ns() time).
+	uint64_t expires;
+	struct parked *prev;
+	struct parked *next;
+} parked_t;
+
+/// @brief parked sessions: by name (reg.uid is the old client's uid), and oldest first, which is also the
+//			order they expire in. All of it under park_lock; park_cond wakes the thread expiring them.
+static registry_t parked;
+static parked_t *park_head, *park_tail;
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond;
+
+/// @brief the event loops in epoll mode. One per worker thread, set with -w.
+static shard_t *shards;
+static int nshards = 1;
+
+/// @brief the shard whose thread we are running on (NULL outside the workers).
+static __thread shard_t *cur_shard;
+
+/// @brief epoll_event.data.ptr values that aren't clients.
+static int listen_marker, wake_marker;
+
+/// @brief the admin socket metrics are served on (-a), or NULL for none.
+static char *admin_path = NULL;
+
+/// @brief hot restart (-U): the Unix socket a new server takes over from us on, or NULL for none.
+static char *handoff_path = NULL;
+
+/// @brief a hot restart under way: the handoff thread sets handoff_requested to stop every shard where it is,
+//			and then the shards and the handoff thread go through handoff_step together, one phase at a time
+//			(see server_hand_off). handoff_taken says whether the new server took everything.
+static _Atomic int handoff_requested = 0;
+static int handoff_taken = 0;
+static pthread_barrier_t handoff_step;
+
+/// @brief what the server we took over from handed us (with -U), until the shards are set up with it.
+static handoff_buf_t handed;
+static int taken_over = 0;
+
+/// @brief a scrape waiting for the shards to report their clients' outbound backlog.
+// Only the admin thread and the shards answering it take the lock, never the message path.
+static struct{
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+
+	/// @brief where the per-client lines go, NULL once the scrape stopped waiting.
+	//			round tells a shard answering late apart from one answering the current scrape.
+	FILE *out;
+	unsigned round;
+	int pending;
+
+	/// @brief totals over every client, for the gauges after the per-client lines.
+	unsigned long messages;
+	unsigned long bytes;
+	unsigned long backed_up;
+	unsigned depth_max;
+} backlog = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0, 0, 0, 0 };
 
-pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 void str_overwrite_stdout() {
     printf("\r%s", "> ");
@@ -84,47 +502,25 @@ void str_overwrite_stdout() {
     fflush(stdout);
 }
 
-void updateTimeAndDirectory()
-{
-	//https://stackoverflow.com/questions/1442116/how-to-get-the-date-and-time-values-in-a-c-program
-	//Holds the timestamp.
-	time_t timeT = time(NULL);
-	struct tm localTime = *localtime(&timeT);
-
-	//update the char timeString[40] to the current day and time.
-	snprintf(timeString, sizeof(timeString), "%d-%02d-%02d %02d:%02d:%02d", localTime.tm_year + 1900, localTime.tm_mon + 1, localTime.tm_mday, localTime.tm_hour, localTime.tm_min, localTime.tm_sec);
-
-	//update the char date[15] to the current date.
-	snprintf(date, sizeof(date), "%d-%02d-%02d", localTime.tm_year + 1900, localTime.tm_mon + 1, localTime.tm_mday);
-
-	//update the currentTime[25] to the current time.
-	//snprintf(currentTime, sizeof(currentTime), "%02d:%02d:%02d", localTime.tm_hour, localTime.tm_min, localTime.tm_sec);
+/// @brief where the message's text is (what raw-text clients get, the history and the console), and how long it is.
+uint32_t msg_text(const msg_t *m, uint32_t *len){
+	*len = m->text ? m->tlen : m->len;
+	return m->text ? m->text : m->off + IRC_FRAME_HDR;
 }
 
 /// @brief the printToTextFile function is meant to assist with 
 ///			logging information from the server to a text file.
-//			it opens a file stream, prints buffer to the file, 
-//			then closes the stream.
-/// @param buffer 
-void printToTextFile(char buffer[])
+//			it hands the message to the history writer thread (irc_history.c), which keeps the
+//			day's segment open and writes messages out in batches. No file I/O happens on our thread.
+/// @param uid who the message is from.
+/// @param name their name.
+/// @param room where it went.
+/// @param m the message to log.
+void printToTextFile(int uid, const char *name, room_t *room, msg_t *m)
 {
-	//build path to text file.
-	snprintf(pathToTextFile, sizeof(pathToTextFile), "%s.txt", date);
-
-	//create the file if it's not present.
-	FilePointerToChatHistory = fopen(pathToTextFile, "ab+");
-	if(FilePointerToChatHistory)
-	{
-		fprintf(FilePointerToChatHistory, "%s", buffer);
-		printf("{Logged}");
-	}
-	else 
-	{
-		printf("\nOops. Encountered an error when trying to open %s. Not logged.", pathToTextFile);
-	}
-
-	//close the file pointer.
-	fclose(FilePointerToChatHistory);
+	uint32_t len;
+	uint32_t at = msg_text(m, &len);
+	history_append(m->buf, at, len, uid, name, room->name);
 }
 
 /// @brief again, replace the first occurence of \n with \0.
@@ -147,243 +543,3872 @@ void print_client_addr(struct sockaddr_in addr){
         (addr.sin_addr.s_addr & 0xff000000) >> 24);
 }
 
-/* Add clients to queue */
-void queue_add(client_t *cl){
-	pthread_mutex_lock(&clients_mutex);
+void shard_wake(shard_t *sh);
+void shard_resume(shard_t *sh);
+void shard_batch(client_t *cli);
+int client_flush(client_t *cli);
+void uring_watch(client_t *cli);
+int uring_flush(client_t *cli);
+void uring_close(client_t *cli);
 
-	for(int i=0; i < MAX_CLIENTS; ++i){
+/// @brief turns Nagle off on a client socket. We decide ourselves when bytes go out (a write per message in
+//			threaded mode, a writev per batch in epoll mode), and Nagle holding a short write back until
+//			the previous one is ACKed only adds latency, up to a whole delayed ACK (40ms).
+void client_nodelay(int fd){
+	int one = 1;
+	if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0){
+		perror("ERROR: TCP_NODELAY");
+	}
+}
 
-		//if clients[i] is NULL
-		if(!clients[i]){
-			clients[i] = cl;
-			break;
-		}
+/// @brief has the kernel check on a client socket nobody else checks on (a raw-text client, see ping_secs):
+//			TCP keepalive probes once it's been quiet for ping_secs, and the connection errors out if they go
+//			unanswered, or if what we sent goes unacknowledged for as long, just as if it had been reset.
+void client_keepalive(int fd){
+	int one = 1, idle = ping_secs, interval = ping_secs / 3 > 0 ? ping_secs / 3 : 1, count = 3;
+	unsigned timeout = 2u * (unsigned)ping_secs * 1000;
+	if(setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one)) < 0
+		|| setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) < 0
+		|| setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) < 0
+		|| setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)) < 0
+		|| setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout)) < 0){
+		perror("ERROR: TCP keepalive");
 	}
+}
+
+/// @brief corks (on = 1) or uncorks a client socket: while corked, the kernel only sends full segments.
+/// @return 0 on success, -1 on failure.
+int client_cork(int fd, int on){
+	metrics_add(METRIC_WRITE_CALLS, 1);
+	return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
 
-	pthread_mutex_unlock(&clients_mutex);
+/// @brief adds bytes to (or with a negative count, takes them off) what this session holds.
+void client_account(client_t *cli, long bytes){
+	cli->mem += bytes;
+	if(bytes > 0){
+		metrics_add(METRIC_SESSION_ALLOC, (uint64_t)bytes);
+	} else {
+		metrics_add(METRIC_SESSION_FREED, (uint64_t)-bytes);
+	}
 }
 
-/* Remove clients to queue */
-void queue_remove(int uid){
-	pthread_mutex_lock(&clients_mutex);
+/// @brief gives a client_t back to the pool (rcu_retire takes this).
+void client_free(void *p){
+	slab_free(&client_pool, p);
+}
 
-	for(int i=0; i < MAX_CLIENTS; ++i){
-		//clients[i] has something in it.
-		if(clients[i]){
+/// @brief tells epoll what we want to hear about for this client.
+//			EPOLLOUT only while something is queued (or the socket is dead, so the loop notices it),
+//			otherwise epoll would wake us constantly. Not for a batch either: the loop writes that itself.
+//			No EPOLLIN while backpressure has us paused or flood control has us throttled.
+void client_watch(client_t *cli){
+	if(server_mode == SERVER_URING){
+		uring_watch(cli);
+		return;
+	}
 
-			//client[i]'s uid equals our field uid.
-			if(clients[i]->uid == uid){
-				clients[i] = NULL;
-				break;
+	uint32_t want = (cli->paused || cli->throttled) ? 0 : (EPOLLIN | EPOLLRDHUP);
+	if(cli->dead || (cli->out.tail != cli->out.head && !cli->batched)){
+		want |= EPOLLOUT;
+	}
+	if(want == cli->events){
+		return;
+	}
+
+	struct epoll_event ev;
+	ev.events = want;
+	ev.data.ptr = cli;
+	metrics_add(METRIC_CTL_CALLS, 1);
+	if(epoll_ctl(cli->shard->epfd, EPOLL_CTL_MOD, cli->sockfd, &ev) == 0){
+		cli->events = want;
+	}
+}
+
+/// @brief marks a client as broken. The loop closes it on the next EPOLLOUT (io_uring mode: once it's done with its completions).
+void client_kill(client_t *cli){
+	int err = errno;
+	cli->dead = 1;
+	client_watch(cli);
+	errno = err;
+}
+
+unsigned outq_depth(outq_t *q){
+	return q->tail - q->head;
+}
+
+/// @brief throws away one queued message to make room, but never the one that's halfway out the door
+//			(that would cut a message in half on the wire), or one an io_uring send is still reading.
+/// @return 1 if a message was dropped, 0 if every queued message is already on its way out.
+int outq_drop_oldest(outq_t *q){
+	unsigned busy = q->sending > (unsigned)q->head_started ? q->sending : (unsigned)q->head_started;
+	unsigned victim = q->head + busy;
+	if(victim == q->tail){
+		return 0;
+	}
+
+	outmsg_t *m = &q->ring[victim & (out_capacity - 1)];
+	q->bytes -= m->end - m->pos;
+	msgbuf_unref(m->buf);
+
+	//slide everything before the victim up one slot to close the hole.
+	for(unsigned i = victim; i != q->head; i--){
+		q->ring[i & (out_capacity - 1)] = q->ring[(i - 1) & (out_capacity - 1)];
+	}
+	q->head++;
+	q->dropped++;
+	metrics_add(METRIC_OUTQ_DROPPED, 1);
+	return 1;
+}
+
+/// @brief this client is no longer backed up. If it was the last one, let every shard start reading again.
+void client_uncongest(client_t *cli){
+	cli->congested = 0;
+	if(--congested_clients == 0){
+		for(int i = 0; i < nshards; i++){
+			shard_t *sh = &shards[i];
+			if(sh == cli->shard){
+				shard_resume(sh);
+			} else {
+				shard_wake(sh);
 			}
 		}
 	}
+}
+
+/// @brief backpressure bookkeeping: is this client over the high (3/4) or under the low (1/4) watermark?
+void client_check_congestion(client_t *cli){
+	if(slow_policy != SLOW_BACKPRESSURE){
+		return;
+	}
 
-	pthread_mutex_unlock(&clients_mutex);
+	unsigned depth = outq_depth(&cli->out);
+	if(!cli->congested && depth >= out_capacity - out_capacity / 4){
+		cli->congested = 1;
+		congested_clients++;
+	} else if(cli->congested && depth <= out_capacity / 4){
+		client_uncongest(cli);
+	}
 }
 
-/* Send message to all clients except sender */
-void send_message(char *s, int uid){
-	pthread_mutex_lock(&clients_mutex);
+/// @brief puts bytes [pos, end) of buf on the client's outbound queue. The queue takes its own reference.
+/// @return 0 if it was queued (or dropped per policy), -1 if the client got disconnected.
+int outq_push(client_t *cli, msgbuf_t *buf, size_t pos, size_t end){
+	outq_t *q = &cli->out;
+
+	//a batch filled the whole queue before the loop got around to it: write it now instead of dropping anything.
+	if(cli->batched && outq_depth(q) == out_capacity && client_flush(cli) < 0){
+		return -1;
+	}
 
-	for(int i=0; i<MAX_CLIENTS; ++i){
-		//client[i] is not null
-		if(clients[i]){
+	if(!q->ring){
+		q->ring = slab_alloc(&cli->shard->rings);
+		if(!q->ring){
+			client_kill(cli);
+			return -1;
+		}
+		client_account(cli, (long)cli->shard->rings.size);
+	}
 
-			//write to all clients that aren't the sender.
-			if(clients[i]->uid != uid){
-				
-				//the method in the if statement writes to the client's socket file descriptor.
-				if(write(clients[i]->sockfd, s, strlen(s)) < 0){
-					perror("ERROR: write to descriptor failed");
-					break;
-				}
-			}
+	if(outq_depth(q) == out_capacity){
+		if(slow_policy == SLOW_DISCONNECT){
+			printf("Slow consumer: disconnecting %s (%u messages queued)\n", cli->name, outq_depth(q));
+			q->dropped++;
+			metrics_add(METRIC_SLOW_DISCONNECTS, 1);
+			client_kill(cli);
+			return -1;
 		}
+
+		//whatever goes may have told the client a name, so it's told again next time.
+		memset(cli->known, 0, sizeof(cli->known));
+		if(!outq_drop_oldest(q)){
+			//all of it is in flight already, so the new message is the one that goes.
+			q->dropped++;
+			metrics_add(METRIC_OUTQ_DROPPED, 1);
+			return 0;
+		}
+	}
+
+	outmsg_t *m = &q->ring[q->tail & (out_capacity - 1)];
+	m->buf = msgbuf_ref(buf);
+	m->pos = (uint32_t)pos;
+	m->end = (uint32_t)end;
+	q->tail++;
+	q->bytes += end - pos;
+	q->queued++;
+
+	if(outq_depth(q) > q->depth_max){
+		q->depth_max = outq_depth(q);
 	}
 
-	pthread_mutex_unlock(&clients_mutex);
+	//a batch isn't a backlog: whether the client keeps up is decided once it has been written.
+	if(!cli->batched){
+		client_check_congestion(cli);
+	}
+	client_watch(cli);
+	return 0;
 }
 
-/* Handle all communication with the client */
-void *handle_client(void *arg){
-	char buff_out[BUFFER_SZ];
-	char name[32];
-	int leave_flag = 0;
+/// @brief which bytes of a message the client gets: framed clients the header (and sequence number, and
+//			the sender's name if it doesn't have it yet) too, raw-text clients only the text.
+//			Threaded mode: call under wlock, since it updates what the client knows.
+void client_range(client_t *cli, msg_t *msg, size_t *pos, size_t *end){
+	if(!cli->framed){
+		uint32_t len;
+		*pos = msg_text(msg, &len);
+		*end = *pos + len;
+		return;
+	}
 
-	cli_count++;
-	client_t *cli = (client_t *)arg;
+	*pos = msg->off - msg->pre;
+	*end = msg->off + IRC_FRAME_HDR + msg->len;
+	if(msg->intro){
+		uint32_t from = irc_be32(msg->buf->data + *pos - msg->intro + IRC_FRAME_HDR);
+		if(cli->known[from % IRC_USER_SLOTS] != from){
+			cli->known[from % IRC_USER_SLOTS] = from;
+			*pos -= msg->intro;
+		}
+	}
+}
 
-	// Receive the username from the client.
-	//if recieving the username failed OR username was less than 2 characters long OR username was more than 31 characters long.
-	if(recv(cli->sockfd, name, 32, 0) <= 0 || strlen(name) <  2 || strlen(name) >= 32-1){
-		printf("Didn't enter the name.\n");
-		leave_flag = 1;
-	} else{
-		//copy the client's name to, well, name. 
-		strcpy(cli->name, name);
+/// @brief sends a message to a client.
+//			In threaded mode this is a plain blocking write(), like it always was.
+//			In epoll mode the message goes on the client's outbound queue (by reference), and the loop writes
+//			everything the client got this round with one writev when the round is over (see shard_flush).
+//			With -l off we try the socket directly instead, and only queue what the kernel won't take right now.
+/// @return 0 on success, -1 if the client is broken.
+int client_write(client_t *cli, msg_t *msg){
+	size_t pos, end;
+	const char *data = msg->buf->data;
 
-		//update timeString
-		updateTimeAndDirectory();
+	if(server_mode == SERVER_THREADED){
+		ssize_t n = 0;
+		pthread_mutex_lock(&cli->wlock);
+		client_range(cli, msg, &pos, &end);
+		if(!cli->dead){
+			n = write(cli->sockfd, data + pos, end - pos);
+			cli->dead = (n < 0);
+			metrics_add(METRIC_WRITE_CALLS, 1);
+		}
+		pthread_mutex_unlock(&cli->wlock);
+		if(n > 0){
+			metrics_add(METRIC_MSGS_OUT, 1);
+			metrics_add(METRIC_BYTES_OUT, (uint64_t)n);
+		}
+		return n < 0 ? -1 : 0;
+	}
+
+	if(cli->dead){
+		return -1;
+	}
+	client_range(cli, msg, &pos, &end);
 
-		//build the string saying that {client name} has joined and put it in the variable buff_out.
-		snprintf(buff_out, sizeof(buff_out), "[%s] %s has joined\n", timeString, cli->name);
+	//only write directly if nothing is queued, otherwise the bytes would arrive out of order.
+	if(outq_depth(&cli->out) > 0){
+		metrics_add(METRIC_MSGS_OUT, 1);
+		return outq_push(cli, msg->buf, pos, end);
+	}
 
-		//print the message to a text file.
-		printToTextFile(buff_out);
+	//io_uring mode always batches: its sends only go to the kernel with the loop's next io_uring_enter anyway.
+	if(batch_budget_us != BATCH_OFF || server_mode == SERVER_URING){
+		metrics_add(METRIC_MSGS_OUT, 1);
+		shard_batch(cli);
+		return outq_push(cli, msg->buf, pos, end);
+	}
 
-		//print out the message.
-		printf("%s", buff_out);
+	ssize_t n = write(cli->sockfd, data + pos, end - pos);
+	metrics_add(METRIC_WRITE_CALLS, 1);
+	if(n < 0){
+		if(errno != EAGAIN && errno != EWOULDBLOCK){
+			client_kill(cli);
+			return -1;
+		}
+		n = 0;
+	}
+	metrics_add(METRIC_MSGS_OUT, 1);
+	metrics_add(METRIC_BYTES_OUT, (uint64_t)n);
 
-		//send the message to everyone but the client that joined.
-		send_message(buff_out, cli->uid);
+	if(pos + (size_t)n < end){
+		int r = outq_push(cli, msg->buf, pos + (size_t)n, end);
+		cli->out.head_started = (n > 0);
+		return r;
 	}
 
-	//https://www.man7.org/linux/man-pages/man3/bzero.3.html: erases the data in the n bytes of the memory starting at the location pointed to by s, by writing zeros (bytes containing '\0') to that area.
-	//basically, erases content in message. buff_out represents the buffer - BUFFER_SZ represents buffer size.
-	bzero(buff_out, BUFFER_SZ);
+	return 0;
+}
 
-	while(1){
-		if (leave_flag) {
+/// @brief gives an empty outbound queue's ring back to the shard's pool; the next message that has to wait takes one again.
+void outq_release(client_t *cli){
+	outq_t *q = &cli->out;
+	if(q->ring && outq_depth(q) == 0){
+		slab_free(&cli->shard->rings, q->ring);
+		q->ring = NULL;
+		client_account(cli, -(long)cli->shard->rings.size);
+	}
+}
+
+/// @brief takes n bytes that went out off the front of the queue, retiring every message that went out completely.
+void outq_retire(outq_t *q, size_t n){
+	metrics_add(METRIC_BYTES_OUT, (uint64_t)n);
+	q->bytes -= n;
+	while(n > 0){
+		outmsg_t *m = &q->ring[q->head & (out_capacity - 1)];
+		size_t rest = m->end - m->pos;
+		if(n < rest){
+			m->pos += n;
+			q->head_started = 1;
 			break;
 		}
+		n -= rest;
+		msgbuf_unref(m->buf);
+		m->buf = NULL;
+		q->head++;
+		q->head_started = 0;
+	}
+}
 
-		//recieve a message from the client.
-		int receive = recv(cli->sockfd, buff_out, BUFFER_SZ, 0);
+/// @brief points iov[] at up to MAX_IOV queued messages, straight in the shared buffers.
+/// @return how many iovecs it filled; *total is how many bytes they hold.
+int outq_iov(outq_t *q, struct iovec *iov, size_t *total){
+	int cnt = 0;
+	*total = 0;
+	for(unsigned i = q->head; i != q->tail && cnt < MAX_IOV; i++, cnt++){
+		outmsg_t *m = &q->ring[i & (out_capacity - 1)];
+		iov[cnt].iov_base = m->buf->data + m->pos;
+		iov[cnt].iov_len = m->end - m->pos;
+		*total += iov[cnt].iov_len;
+	}
+	return cnt;
+}
+
+/// @brief writes as much of the outbound queue as the socket will take, with one writev per MAX_IOV messages.
+//			If that takes more than one writev, the socket is corked meanwhile, so the seams between
+//			them don't go out as short segments of their own (TCP_NODELAY would send them right away).
+/// @return 0 if the client is still healthy, -1 if the socket broke.
+int client_flush(client_t *cli){
+	if(server_mode == SERVER_URING){
+		return uring_flush(cli);
+	}
 
-		updateTimeAndDirectory();
+	outq_t *q = &cli->out;
+	int corked = outq_depth(q) > MAX_IOV && client_cork(cli->sockfd, 1) == 0;
 
-		//if our recieve succeeded.
-		if (receive > 0){
-			if(strlen(buff_out) > 0){
+	while(outq_depth(q) > 0){
+		struct iovec iov[MAX_IOV];
+		size_t total;
+		int cnt = outq_iov(q, iov, &total);
 
-				//Send the message to everyone but the sender.
-				send_message(buff_out, cli->uid);
+		ssize_t n = writev(cli->sockfd, iov, cnt);
+		metrics_add(METRIC_WRITE_CALLS, 1);
+		if(n < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				break;
+			}
+			client_kill(cli);
+			return -1;
+		}
 
-				//replace the first occurence of \n with \0.
-				//str_trim_lf(buff_out, strlen(buff_out));
+		outq_retire(q, (size_t)n);
 
-				//print the message to a text file.
-				printToTextFile(buff_out);
+		//the socket took less than we offered, so it's full. Wait for the next EPOLLOUT.
+		if((size_t)n < total){
+			break;
+		}
+	}
 
-				//print the client's name and their message to the server.
-				printf("%s", buff_out);
-			}
-		} else if (receive == 0 || strcmp(buff_out, "exit") == 0){
+	if(corked){
+		client_cork(cli->sockfd, 0);
+	}
 
-			//format buff_out to say that someone has left the chat.
-			snprintf(buff_out, sizeof(buff_out), "[%s] %s has left\n", timeString, cli->name);
+	client_check_congestion(cli);
+	client_watch(cli);
 
-			//print the message to a text file.
-			printToTextFile(buff_out);
+	//caught up: the ring goes back to the pool until the client falls behind again.
+	outq_release(cli);
+	return 0;
+}
 
-			//print buff_out to the server.
-			printf("%s", buff_out);
+/// @brief frees whatever is still queued for a client.
+void outq_free(client_t *cli){
+	outq_t *q = &cli->out;
+	if(!q->ring){
+		return;
+	}
+	for(; q->head != q->tail; q->head++){
+		msgbuf_unref(q->ring[q->head & (out_capacity - 1)].buf);
+	}
+	q->bytes = 0;
+	outq_release(cli);
 
-			//send this same message to everyone except the person exiting the server.
-			send_message(buff_out, cli->uid);
+	if(cli->congested){
+		client_uncongest(cli);
+	}
+}
 
-			leave_flag = 1;
-		} else {
-			//we encountered an error when recieving a message from a client.
-			printf("ERROR: -1\n");
-			leave_flag = 1;
+/// @brief writes a message to a room's members on this shard (members is the room's slice for it), except the sender.
+void shard_deliver(room_slice_t *members, msg_t *msg, int uid){
+	int n = room_slice_count(members);
+	for(int i = 0; i < n; i++){
+		client_t *cli = room_member(members, i);
+		if(!cli || cli->uid == uid || cli->dead){
+			continue;
 		}
 
-		
-		//basically, erases content in message. buff_out represents the buffer - BUFFER_SZ represents buffer size.
-		bzero(buff_out, BUFFER_SZ);
+		//a broken client is closed by the loop later; keep going so everyone else still gets the message.
+		if(client_write(cli, msg) < 0 && cli->dead){
+			perror("ERROR: write to descriptor failed");
+		}
 	}
+}
 
-  /* Delete client from queue and yield thread */
-	close(cli->sockfd);
-    queue_remove(cli->uid);
-    free(cli);
-    cli_count--;
-    pthread_detach(pthread_self());
+/// @brief puts a client on its shard's list of clients with a batch to write, unless it's there already.
+void shard_batch(client_t *cli){
+	shard_t *sh = cli->shard;
+	if(cli->batched){
+		return;
+	}
+	if(sh->nbatch == 0 && batch_budget_us > 0){
+		sh->batch_start = metrics_now_ns();
+	}
+	cli->batched = 1;
+	cli->batch_slot = sh->nbatch;
+	sh->batch[sh->nbatch++] = cli;
+}
 
-	return NULL;
+/// @brief takes a client that's going away off the batch list. The last client moves into its slot.
+void shard_unbatch(client_t *cli){
+	shard_t *sh = cli->shard;
+	if(!cli->batched){
+		return;
+	}
+	client_t *last = sh->batch[--sh->nbatch];
+	sh->batch[cli->batch_slot] = last;
+	last->batch_slot = cli->batch_slot;
+	cli->batched = 0;
 }
 
-int main(int argc, char **argv){
-	//if we don't have 2 arguments, don't enter the server method.
-	if(argc != 2){
-		printf("Usage: %s <port>\n", argv[0]);
-		return EXIT_FAILURE;
+/// @brief flood control: stops reading from a client for wait milliseconds. Threaded mode's thread sleeps
+//			it off itself (see handle_client); the event loops keep a list and pick it up again in shard_unthrottle_due.
+void client_throttle(client_t *cli, uint32_t wait){
+	cli->throttle_until = ratelimit_now() + wait;
+	if(cli->throttled){
+		return;
 	}
+	cli->throttled = 1;
+	metrics_add(METRIC_THROTTLED, 1);
 
-	char *ip = "127.0.0.1";
-	int port = atoi(argv[1]);
-	int option = 1;
-	int listenfd = 0, connfd = 0;
-	struct sockaddr_in serv_addr;
-	struct sockaddr_in cli_addr;
-	pthread_t tid;
+	if(cli->shard){
+		shard_t *sh = cli->shard;
+		cli->throttle_slot = sh->nthrottled;
+		sh->throttled[sh->nthrottled++] = cli;
+		client_watch(cli);
+	}
+}
 
-	/* Socket settings */
-	listenfd = socket(AF_INET, SOCK_STREAM, 0);
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = inet_addr(ip);
-	serv_addr.sin_port = htons(port);
+/// @brief takes a client off its shard's list of throttled clients. The last one moves into its slot.
+void shard_unthrottle(client_t *cli){
+	shard_t *sh = cli->shard;
+	if(!cli->throttled){
+		return;
+	}
+	client_t *last = sh->throttled[--sh->nthrottled];
+	sh->throttled[cli->throttle_slot] = last;
+	last->throttle_slot = cli->throttle_slot;
+	cli->throttled = 0;
+}
 
-	/* Ignore pipe signals. */
-	signal(SIGPIPE, SIG_IGN);
+/// @brief how long (milliseconds) until the first of the shard's throttled clients may go on, or -1 if none are throttled.
+long shard_throttle_wait(shard_t *sh){
+	if(sh->nthrottled == 0){
+		return -1;
+	}
 
-	//https://linux.die.net/man/3/setsockopt: set socket options. 
-	if(setsockopt(listenfd, SOL_SOCKET,(SO_REUSEPORT | SO_REUSEADDR),(char*)&option,sizeof(option)) < 0){
-		perror("ERROR: setsockopt failed");
-		return EXIT_FAILURE;
+	uint32_t now = ratelimit_now();
+	long least = -1;
+	for(int i = 0; i < sh->nthrottled; i++){
+		int32_t left = (int32_t)(sh->throttled[i]->throttle_until - now);
+		if(left <= 0){
+			return 0;
+		}
+		if(least < 0 || left < least){
+			least = left;
+		}
 	}
+	return least;
+}
 
-	/* Bind listen to */
-	if(bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-		perror("ERROR: Socket binding failed");
-		return EXIT_FAILURE;
+/// @brief writes out everything batched up since the last flush: one writev per client, however many
+//			messages it got. Whatever a socket won't take stays queued and waits for EPOLLOUT as usual.
+void shard_flush(shard_t *sh){
+	for(int i = 0; i < sh->nbatch; i++){
+		client_t *cli = sh->batch[i];
+		cli->batched = 0;
+
+		//a client that broke is closed on its next event, there's nothing to write to.
+		if(!cli->dead){
+			client_flush(cli);
+		}
 	}
+	sh->nbatch = 0;
+	metrics_add(METRIC_BATCH_FLUSHES, 1);
+}
 
-  	/* Listen */
-	if (listen(listenfd, 10) < 0) {
-		perror("ERROR: Socket listening failed");
-		return EXIT_FAILURE;
+/// @brief wakes a shard's loop through its eventfd.
+//			Only the first caller since the shard last woke up actually writes to it.
+void shard_wake(shard_t *sh){
+	if(!atomic_exchange(&sh->wake_pending, 1)){
+		uint64_t one = 1;
+		if(write(sh->wakefd, &one, sizeof(one)) < 0){
+			perror("ERROR: eventfd write failed");
+		}
 	}
+}
 
-	printf("   _____ _               _     _   _____  _                       _ \n");
-  	printf("  / ____| |             (_)   | | |  __ \\(_)                     | |\n");
- 	printf(" | (___ | |_ _   _ _ __  _  __| | | |  | |_ ___  ___ ___  _ __ __| |\n");
-  	printf("  \\___ \\| __| | | | '_ \\| |/ _` | | |  | | / __|/ __/ _ \\| '__/ _` |\n");
-  	printf("  ____) | |_| |_| | |_) | | (_| | | |__| | \\__ \\ (_| (_) | | | (_| |\n");
- 	printf(" |_____/ \\__|\\__,_| .__/|_|\\__,_| |_____/|_|___/\\___\\___/|_|  \\__,_|\n");
- 	printf("                  | |                                               \n");
- 	printf("                  |_|                                               \n");
+/// @brief starts reading again from every client backpressure paused on this shard.
+void shard_resume(shard_t *sh){
+	for(int i = 0; i < sh->nlocals && sh->npaused > 0; i++){
+		client_t *cli = sh->locals[i];
+		if(cli->paused){
+			cli->paused = 0;
+			sh->npaused--;
+			client_watch(cli);
+		}
+	}
+}
 
-	while(1){
-		socklen_t clilen = sizeof(cli_addr);
+/// @brief prints every client's outbound queue counters (SIGUSR1).
+void shard_dump_stats(shard_t *sh){
+	for(int i = 0; i < sh->nlocals; i++){
+		client_t *cli = sh->locals[i];
+		outq_t *q = &cli->out;
+		printf("[shard %d] uid=%d name=%s depth=%u depth_max=%u bytes=%zu queued=%lu dropped=%lu mem=%zu%s%s\n",
+			sh->id, cli->uid, cli->named ? cli->name : "-", outq_depth(q), q->depth_max, q->bytes,
+			q->queued, q->dropped, cli->mem, cli->paused ? " paused" : "", cli->throttled ? " throttled" : "");
+	}
+	fflush(stdout);
+}
 
-		//accept a connection from the client.
-		connfd = accept(listenfd, (struct sockaddr*)&cli_addr, &clilen);
+/// @brief adds this shard's clients with anything queued to the waiting scrape, one line each.
+void shard_report_backlog(shard_t *sh, unsigned round){
+	pthread_mutex_lock(&backlog.lock);
+	if(!backlog.out || round != backlog.round){
+		pthread_mutex_unlock(&backlog.lock);
+		return;
+	}
 
-		/* Check if max clients is reached */
-		if((cli_count + 1) == MAX_CLIENTS){
-			printf("Max clients reached. Rejected: ");
-			print_client_addr(cli_addr);
-			printf(":%d\n", cli_addr.sin_port);
-			close(connfd);
+	for(int i = 0; i < sh->nlocals; i++){
+		client_t *cli = sh->locals[i];
+		unsigned depth = outq_depth(&cli->out);
+		if(depth == 0){
 			continue;
 		}
 
-		/* Client settings */
-		client_t *cli = (client_t *)malloc(sizeof(client_t));
-		cli->address = cli_addr;
-		cli->sockfd = connfd;
+		//label values are quoted, so quotes and backslashes in names get escaped.
+		fprintf(backlog.out, "chat_client_outq_messages{shard=\"%d\",uid=\"%d\",name=\"", sh->id, cli->uid);
+		for(const char *c = cli->named ? cli->name : ""; *c; c++){
+			if(*c == '"' || *c == '\\'){
+				fputc('\\', backlog.out);
+			}
+			fputc(*c, backlog.out);
+		}
+		fprintf(backlog.out, "\"} %u\n", depth);
+
+		backlog.messages += depth;
+		backlog.bytes += cli->out.bytes;
+		backlog.backed_up++;
+		if(depth > backlog.depth_max){
+			backlog.depth_max = depth;
+		}
+	}
+	if(--backlog.pending == 0){
+		pthread_cond_signal(&backlog.done);
+	}
+	pthread_mutex_unlock(&backlog.lock);
+}
+
+/// @brief hands a message to another shard: queues a reference to it and wakes that shard up.
+//			It goes to the room's members on that shard, or only to client `to` if that's set.
+void shard_post(shard_t *sh, msg_t *msg, int uid, int room, int to){
+	shard_msg_t *m = malloc(sizeof(shard_msg_t));
+	if(!m){
+		return;
+	}
+	m->uid = uid;
+	m->room = room;
+	m->to = to;
+	m->msg = *msg;
+	msgbuf_ref(msg->buf);
+	mpsc_push(&sh->inbox, &m->node);
+	shard_wake(sh);
+}
+
+/// @brief delivers everything other shards have posted to us.
+void shard_drain_inbox(shard_t *sh){
+	uint64_t count;
+	if(read(sh->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN){
+		perror("ERROR: eventfd read failed");
+	}
+
+	//clear the flag before popping, so a post that races with us wakes us again instead of getting lost.
+	atomic_store(&sh->wake_pending, 0);
+
+	mpsc_node_t *node;
+	while((node = mpsc_pop(&sh->inbox))){
+		shard_msg_t *m = mpsc_entry(node, shard_msg_t, node);
+
+		//look the room (or the client) up again: it may have gone away since the message was posted.
+		rcu_read_lock();
+		if(m->to){
+			reg_node_t *n = registry_find_uid(&registry, m->to);
+			client_t *cli = n ? registry_entry(n, client_t, reg) : NULL;
+			if(cli && cli->shard == sh && !cli->dead){
+				client_write(cli, &m->msg);
+			}
+		} else {
+			room_t *room = room_find(m->room);
+			if(room){
+				shard_deliver(room_slice(room, sh->id), &m->msg, m->uid);
+			}
+		}
+		rcu_read_unlock();
+
+		msgbuf_unref(m->msg.buf);
+		free(m);
+	}
+
+	if(sh->npaused > 0 && congested_clients == 0){
+		shard_resume(sh);
+	}
+
+	if(atomic_exchange(&sh->dump_requested, 0)){
+		shard_dump_stats(sh);
+	}
+
+	unsigned round = atomic_exchange(&sh->backlog_requested, 0);
+	if(round){
+		shard_report_backlog(sh, round);
+	}
+}
+
+/* Send message to everyone in the room except the sender */
+void send_message(room_t *room, msg_t *msg, int uid){
+	uint64_t start = metrics_now_ns();
+	rcu_read_lock();
+
+	//epoll and io_uring mode: our own members get it straight away, and every other shard with members in the room
+	//gets it through its inbox. Nobody else is touched, no global lock is involved, and nobody copies the message.
+	//(the thread expiring parked sessions isn't a shard, so it posts to all of them.)
+	if(server_mode != SERVER_THREADED){
+		if(cur_shard){
+			shard_deliver(room_slice(room, cur_shard->id), msg, uid);
+		}
+		for(int i = 0; i < nshards; i++){
+			if(&shards[i] != cur_shard && room_slice_count(room_slice(room, i)) > 0){
+				shard_post(&shards[i], msg, uid, room->reg.uid, 0);
+			}
+		}
+		rcu_read_unlock();
+		metrics_observe(HIST_FANOUT, metrics_now_ns() - start);
+		return;
+	}
+
+	//threaded mode: walk the room's members without a lock; joins and leaves don't wait for us, or we for them.
+	room_slice_t *members = room_slice(room, 0);
+	int n = room_slice_count(members);
+	for(int i = 0; i < n; i++){
+		client_t *c = room_member(members, i);
+
+		//write to all clients that aren't the sender (or that left).
+		if(c && c->uid != uid){
+			//the method in the if statement writes to the client's socket file descriptor.
+			//a failed write only affects that one client, keep going for the rest.
+			if(client_write(c, msg) < 0){
+				perror("ERROR: write to descriptor failed");
+			}
+		}
+	}
+
+	rcu_read_unlock();
+	metrics_observe(HIST_FANOUT, metrics_now_ns() - start);
+}
+
+/// @brief sends a message to one client, wherever it lives. Call inside rcu_read_lock().
+void send_direct(client_t *to, msg_t *msg){
+	if(server_mode != SERVER_THREADED && to->shard != cur_shard){
+		shard_post(to->shard, msg, 0, 0, to->uid);
+	} else {
+		client_write(to, msg);
+	}
+}
+
+/// @brief formats "[time] name <what>" into a fresh message, for direct messages.
+/// @return 0 on success (out holds the caller's reference), -1 if we're out of memory.
+int make_notice(const char *name, const char *what, msg_t *out){
+	msgbuf_t *m = msgbuf_alloc(IRC_FRAME_HDR + BUFFER_SZ);
+	if(!m){
+		return -1;
+	}
+
+	//the timestamp was formatted once for this second (irc_clock.c), not once per notice.
+	size_t room = m->cap - IRC_FRAME_HDR;
+	int n = snprintf(m->data + IRC_FRAME_HDR, room + 1, "[%s] %s %s\n", clock_now()->stamp, name, what);
+	*out = (msg_t){ m, 0, (n < 0) ? 0 : ((size_t)n > room ? room : (size_t)n), 0, 0, 0, 0 };
+	irc_frame_header(m->data, IRC_CHAT, 0, out->len);
+	return 0;
+}
+
+/// @brief makes a chat line from uid (name) in room into a message, laid out as [IRC_USER][room for an IRC_SEQ]
+//			[IRC_MSG][the line rendered as text] in one buffer: framed clients get the fields, the name once, and the
+//			number (publish_here fills it in), raw-text clients and the history get the text. The time is ours and
+//			rendering happens here, once per message, not once per member. uid 0 (a message from another node)
+//			carries its name in the IRC_MSG frame instead.
+/// @return 0 on success (out holds the caller's reference), -1 if we're out of memory.
+int msg_chat(int uid, const char *name, room_t *room, const char *text, uint32_t len, msg_t *out){
+	//the line, without the newline (or CR LF) it may end in.
+	while(len > 0 && (text[len - 1] == '\n' || text[len - 1] == '\r')){
+		len--;
+	}
+
+	const clock_tick_t *now = clock_now();
+	uint32_t rlen = (uint32_t)strlen(room->name), nlen = (uint32_t)strnlen(name, 255);
+	uint32_t intro = uid ? IRC_FRAME_HDR + 4 + nlen : 0;
+	uint32_t pre = room_ring_size() ? IRC_SEQ_FRAME : 0;
+	uint32_t head = IRC_MSG_HDR + 1 + rlen + (uid ? 0 : 1 + nlen);
+	if(head + len > IRC_MAX_PAYLOAD){
+		len = IRC_MAX_PAYLOAD - head;
+	}
+	size_t tcap = strlen(now->stamp) + rlen + nlen + len + 8;
+
+	msgbuf_t *buf = msgbuf_alloc(intro + pre + IRC_FRAME_HDR + head + len + tcap);
+	if(!buf){
+		return -1;
+	}
+	char *p = buf->data;
+	if(uid){
+		irc_frame_header(p, IRC_USER, 0, 4 + nlen);
+		irc_put_be32(p + IRC_FRAME_HDR, (uint32_t)uid);
+		memcpy(p + IRC_FRAME_HDR + 4, name, nlen);
+	}
+
+	uint32_t off = intro + pre;
+	irc_frame_header(p + off, IRC_MSG, uid ? 0 : IRC_MSG_NAMED, head + len);
+	irc_msg_head(p + off + IRC_FRAME_HDR, (uint32_t)uid, (uint64_t)now->sec, room->name, rlen, name, nlen);
+	memcpy(p + off + IRC_FRAME_HDR + head, text, len);
+
+	uint32_t at = off + IRC_FRAME_HDR + head + len;
+	size_t tlen = irc_render(p + at, tcap, now->stamp, room->name, rlen, name, nlen, text, len);
+	buf->len = at + tlen;
+	*out = (msg_t){ buf, off, head + len, pre, intro, at, (uint32_t)tlen };
+	return 0;
+}
+
+/// @brief everything a message goes through on the server: everyone else in the room, the history file and our console.
+//			All three share the same buffer. With resume on it's numbered and kept in the room's ring: a chat line from
+//			msg_chat has room for the number already, anything else (notices) is copied to [IRC_SEQ frame][CHAT frame]
+//			first. One copy per message, however many members get it.
+void publish_here(int uid, const char *name, room_t *room, msg_t *m){
+	msg_t numbered;
+	msgbuf_t *buf = (room_ring_size() && !m->pre) ? msgbuf_alloc(IRC_SEQ_FRAME + IRC_FRAME_HDR + m->len) : NULL;
+	if(buf){
+		memcpy(buf->data + IRC_SEQ_FRAME, m->buf->data + m->off, IRC_FRAME_HDR + m->len);
+		buf->len = IRC_SEQ_FRAME + IRC_FRAME_HDR + m->len;
+		room_record(room, buf, uid, buf->data);
+		numbered = (msg_t){ buf, IRC_SEQ_FRAME, m->len, IRC_SEQ_FRAME, 0, 0, 0 };
+		m = &numbered;
+	} else if(m->pre){
+		room_record(room, m->buf, uid, m->buf->data + m->off - m->pre);
+	}
+
+	//send the message to everyone in the room but the client it came from.
+	send_message(room, m, uid);
+
+	//print the message to a text file.
+	printToTextFile(uid, name, room, m);
+
+	//print out the message.
+	uint32_t len;
+	uint32_t at = msg_text(m, &len);
+	fwrite(m->buf->data + at, 1, len, stdout);
+
+	if(buf){
+		msgbuf_unref(buf);
+	}
+}
+
+/// @brief publish_here, and the same message to every linked node (irc_link.h) for its members of the room.
+void publish_as(int uid, const char *name, room_t *room, msg_t *m){
+	publish_here(uid, name, room, m);
+	if(!link_enabled()){
+		return;
+	}
+
+	//a chat line goes as its text, for the other node to stamp and render; a notice as it reads.
+	const char *frame = m->buf->data + m->off;
+	irc_msg_t f;
+	if(frame[2] == IRC_MSG && irc_msg_parse(frame + IRC_FRAME_HDR, m->len, (uint8_t)frame[3], &f) == 0){
+		link_forward(room->name, name, f.text, f.len, 0);
+	} else {
+		uint32_t len;
+		uint32_t at = msg_text(m, &len);
+		link_forward(room->name, name, m->buf->data + at, len, LINK_NOTICE);
+	}
+}
+
+/// @brief a message another node relayed to us: our members of the room get it (and our history), if we have any.
+//			Runs on the link thread. It isn't passed on: its origin sent it to every node itself.
+void link_deliver(const char *room_name, const char *name, const char *text, uint32_t len, int flags){
+	msg_t m;
+	int ok = 0;
+
+	rcu_read_lock();
+	room_t *room = room_find_name(room_name);
+	if(room && (flags & LINK_NOTICE)){
+		m = (msg_t){ msgbuf_alloc(IRC_FRAME_HDR + len), 0, len, 0, 0, 0, 0 };
+		if(m.buf){
+			irc_frame_header(m.buf->data, IRC_CHAT, 0, len);
+			memcpy(m.buf->data + IRC_FRAME_HDR, text, len);
+			ok = 1;
+		}
+	} else if(room){
+		ok = (msg_chat(0, name, room, text, len, &m) == 0);
+	}
+	if(ok){
+		publish_here(0, name, room, &m);
+		msgbuf_unref(m.buf);
+	}
+	rcu_read_unlock();
+}
+
+void publish(client_t *cli, room_t *room, msg_t *m){
+	publish_as(cli->uid, cli->name, room, m);
+}
+
+/// @brief a backlog being read back from the history files: one CHAT frame per message, data[0 .. len).
+typedef struct{
+	char *data;
+	size_t len;
+	size_t cap;
+} replay_t;
+
+/// @brief adds one message from the history files to the backlog at arg.
+void replay_one(void *arg, const seg_msg_t *rec){
+	replay_t *r = arg;
+	uint32_t len = rec->hdr.len > IRC_MAX_PAYLOAD ? IRC_MAX_PAYLOAD : rec->hdr.len;
+
+	if(r->len + IRC_FRAME_HDR + len > r->cap){
+		size_t cap = r->cap ? r->cap : 4096;
+		while(cap < r->len + IRC_FRAME_HDR + len){
+			cap *= 2;
+		}
+		char *grown = realloc(r->data, cap);
+		if(!grown){
+			return;
+		}
+		r->data = grown;
+		r->cap = cap;
+	}
+	irc_frame_header(r->data + r->len, IRC_CHAT, 0, len);
+	memcpy(r->data + r->len + IRC_FRAME_HDR, rec->text, len);
+	r->len += IRC_FRAME_HDR + len;
+}
+
+/// @brief reads room's last n messages back for the client with that uid and sends them, if it's still here.
+//			Runs on the history writer thread (history_replay()), so no event loop waits on the disk for a join.
+void replay_send(int uid, const char *room, int n){
+	replay_t r = { NULL, 0, 0 };
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	segment_replay(history_config.dir, (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000, room, n, replay_one, &r);
+
+	msgbuf_t *buf = r.len ? msgbuf_alloc(r.len) : NULL;
+	if(buf){
+		memcpy(buf->data, r.data, r.len);
+		buf->len = r.len;
+
+		//a framed client gets the whole backlog as one message, a raw-text one each line's text.
+		rcu_read_lock();
+		reg_node_t *node = registry_find_uid(&registry, uid);
+		client_t *cli = node ? registry_entry(node, client_t, reg) : NULL;
+		for(size_t at = 0; cli && at < r.len; ){
+			uint32_t len = cli->framed ? (uint32_t)(r.len - at - IRC_FRAME_HDR) : irc_be32(buf->data + at + 4);
+			msg_t m = { buf, (uint32_t)at, len };
+			send_direct(cli, &m);
+			at += IRC_FRAME_HDR + len;
+		}
+		rcu_read_unlock();
+		msgbuf_unref(buf);
+	}
+	free(r.data);
+}
+
+/// @brief sends the client a line of text from the server (errors, "now talking in ...").
+void client_tell(client_t *cli, const char *fmt, ...){
+	msgbuf_t *buf = msgbuf_alloc(IRC_FRAME_HDR + BUFFER_SZ);
+	if(!buf){
+		return;
+	}
+
+	va_list ap;
+	va_start(ap, fmt);
+	size_t room = buf->cap - IRC_FRAME_HDR;
+	int n = vsnprintf(buf->data + IRC_FRAME_HDR, room + 1, fmt, ap);
+	va_end(ap);
+
+	msg_t m = { buf, 0, (n < 0) ? 0 : ((size_t)n > room ? room : (size_t)n) };
+	irc_frame_header(buf->data, IRC_CHAT, 0, m.len);
+	client_write(cli, &m);
+	msgbuf_unref(buf);
+}
+
+/// @brief sends a framed client one frame of type with the given payload (a short one: PING, PONG).
+void client_frame(client_t *cli, int type, const char *payload, uint32_t len){
+	msgbuf_t *buf = msgbuf_alloc(IRC_FRAME_HDR + len);
+	if(!buf){
+		return;
+	}
+	msg_t m = { buf, 0, len, 0 };
+	irc_frame_header(buf->data, type, 0, len);
+	memcpy(buf->data + IRC_FRAME_HDR, payload, len);
+	client_write(cli, &m);
+	msgbuf_unref(buf);
+}
+
+/// @brief tells the client which room its chat lines go to now: a line for the user, and for
+//			framed clients a CONTROL "room <name>" (just "room" if it's in none) the client can act on.
+void client_room_changed(client_t *cli){
+	if(cli->room){
+		client_tell(cli, "Now talking in %s.\n", cli->room->name);
+	} else {
+		client_tell(cli, "You're not in any room now. /join one to talk.\n");
+	}
+	if(!cli->framed){
+		return;
+	}
+
+	char ctl[8 + ROOM_NAME_SZ];
+	int n = snprintf(ctl, sizeof(ctl), cli->room ? "room %s" : "room", cli->room ? cli->room->name : "");
+	msgbuf_t *buf = msgbuf_alloc(IRC_FRAME_HDR + sizeof(ctl));
+	if(buf){
+		msg_t m = { buf, 0, (uint32_t)n };
+		irc_frame_header(buf->data, IRC_CONTROL, 0, m.len);
+		memcpy(buf->data + IRC_FRAME_HDR, ctl, m.len);
+		client_write(cli, &m);
+		msgbuf_unref(buf);
+	}
+}
+
+/// @brief our member slice in every room: the shard we run on (epoll mode), or the only one there is.
+int client_slice(client_t *cli){
+	return cli->shard ? cli->shard->id : 0;
+}
+
+/// @brief a roster snapshot (irc_roster.h) for the client with that uid, if it's still here. Runs on the roster thread.
+void roster_send_snapshot(int id, msgbuf_t *buf){
+	rcu_read_lock();
+	reg_node_t *n = registry_find_uid(&registry, id);
+	client_t *cli = n ? registry_entry(n, client_t, reg) : NULL;
+	if(cli && cli->framed){
+		msg_t m = { buf, 0, (uint32_t)buf->len - IRC_FRAME_HDR, 0, 0, 0, 0 };
+		send_direct(cli, &m);
+	}
+	rcu_read_unlock();
+}
+
+/// @brief a roster delta (irc_roster.h) for the room: numbered and kept like a chat line, with its notice for raw-text
+//			clients, the history and other nodes. It's from nobody, so every member gets it. Runs on the roster thread.
+void roster_send_delta(room_t *room, msgbuf_t *buf, uint32_t frame, uint32_t text){
+	msg_t m = { buf, frame, text - frame - IRC_FRAME_HDR, frame, 0, text, (uint32_t)buf->len - text };
+	publish_as(0, "*", room, &m);
+}
+
+/// @brief puts the client in a room (if it isn't already) and makes that the room it talks in.
+//			A new member is caught up on the room's last few messages, the room hears that they joined with its next
+//			roster delta, and a framed client gets the room's roster.
+void session_enter(client_t *cli, const char *name){
+	for(int i = 0; i < cli->nrooms; i++){
+		if(strcmp(cli->rooms[i]->name, name) == 0){
+			cli->room = cli->rooms[i];
+			client_room_changed(cli);
+			return;
+		}
+	}
+
+	if(cli->nrooms == ROOMS_PER_CLIENT){
+		client_tell(cli, "You're in %d rooms already. /part one first.\n", ROOMS_PER_CLIENT);
+		return;
+	}
+
+	room_t *room = room_join(name, cli, client_slice(cli));
+	if(!room){
+		client_tell(cli, "Couldn't join %s right now.\n", name);
+		return;
+	}
+	cli->rooms[cli->nrooms++] = room;
+	cli->room = room;
+	client_room_changed(cli);
+
+	//the backlog comes out of the mmap'd history segments, read on the history thread (replay_send), so it
+	//shows up a moment later and nobody else on this loop waits for the disk meanwhile.
+	if(replay_count > 0){
+		history_replay(cli->uid, room->name, replay_count);
+	}
+
+	//everyone joining at once (a restart) is one delta per room, not a notice each.
+	roster_note(room, cli->name, 1);
+	if(cli->framed){
+		roster_want(room, cli->uid);
+	}
+}
+
+/// @brief takes the client out of one of its rooms, quietly. If it was the room they talk in,
+//			they now talk in the room they joined most recently.
+void session_drop_room(client_t *cli, int i){
+	room_t *room = cli->rooms[i];
+	room_part(room, cli, client_slice(cli));
+
+	memmove(&cli->rooms[i], &cli->rooms[i + 1], sizeof(room_t *) * (size_t)(cli->nrooms - i - 1));
+	cli->nrooms--;
+	if(cli->room == room){
+		cli->room = cli->nrooms > 0 ? cli->rooms[cli->nrooms - 1] : NULL;
+	}
+}
+
+/// @brief "/part [#room]": leaves a room (the current one if none is given) and tells it so.
+void session_part(client_t *cli, const char *name){
+	for(int i = 0; i < cli->nrooms; i++){
+		room_t *room = cli->rooms[i];
+		if(name ? strcmp(room->name, name) == 0 : room == cli->room){
+			int was_current = (room == cli->room);
+			roster_note(room, cli->name, 0);
+			session_drop_room(cli, i);
+			if(was_current){
+				client_room_changed(cli);
+			}
+			return;
+		}
+	}
+	client_tell(cli, "You're not in %s.\n", name ? name : "a room");
+}
+
+/// @brief "/msg name text": sends text to that one client, wherever it is. Direct messages aren't logged.
+void session_direct(client_t *cli, const char *to, const char *text){
+	msg_t m;
+
+	rcu_read_lock();
+	reg_node_t *n = registry_find_name(&registry, to);
+	if(!n){
+		rcu_read_unlock();
+		client_tell(cli, "No one called %s is here.\n", to);
+		return;
+	}
+
+	char what[BUFFER_SZ];
+	snprintf(what, sizeof(what), "-> %s: %s", to, text);
+	if(make_notice(cli->name, what, &m) == 0){
+		send_direct(registry_entry(n, client_t, reg), &m);
+		msgbuf_unref(m.buf);
+	}
+	rcu_read_unlock();
+}
+
+/// @brief "/who [#room]": the room's whole roster (the current room's if none is given), with its next flush.
+void session_who(client_t *cli, const char *name){
+	for(int i = 0; i < cli->nrooms; i++){
+		if(name ? strcmp(cli->rooms[i]->name, name) == 0 : cli->rooms[i] == cli->room){
+			roster_want(cli->rooms[i], cli->uid);
+			return;
+		}
+	}
+	client_tell(cli, "You're not in %s.\n", name ? name : "a room");
+}
+
+/// @brief a CONTROL frame from the client: "join #room", "part [#room]", "who [#room]" or "msg <name> <text>".
+void session_control(client_t *cli, const char *payload, size_t len){
+	char line[BUFFER_SZ];
+	char *rest;
+
+	if(len >= sizeof(line)){
+		len = sizeof(line) - 1;
+	}
+	memcpy(line, payload, len);
+	line[len] = '\0';
+	str_trim_lf(line, (int)len);
+
+	char *verb = strtok_r(line, " ", &rest);
+	if(!verb){
+		return;
+	}
+
+	if(strcmp(verb, "join") == 0){
+		char *name = strtok_r(NULL, " ", &rest);
+		if(!name || !room_name_ok(name, strlen(name))){
+			client_tell(cli, "Room names start with # and have no spaces, like #general.\n");
+			return;
+		}
+		session_enter(cli, name);
+	} else if(strcmp(verb, "part") == 0){
+		session_part(cli, strtok_r(NULL, " ", &rest));
+	} else if(strcmp(verb, "who") == 0){
+		session_who(cli, strtok_r(NULL, " ", &rest));
+	} else if(strcmp(verb, "msg") == 0){
+		char *to = strtok_r(NULL, " ", &rest);
+		while(*rest == ' '){
+			rest++;
+		}
+		if(!to || *rest == '\0'){
+			client_tell(cli, "Usage: /msg <name> <message>\n");
+			return;
+		}
+		session_direct(cli, to, rest);
+	} else {
+		client_tell(cli, "Unknown command: %s\n", verb);
+	}
+}
+
+/// @brief called once the client's name arrived: everyone starts out in the lobby.
+void session_joined(client_t *cli){
+	session_enter(cli, ROOM_LOBBY);
+}
+
+/// @brief called when a named client goes away: tells every room they were in that they left.
+void session_left(client_t *cli){
+	for(int i = 0; i < cli->nrooms; i++){
+		roster_note(cli->rooms[i], cli->name, 0);
+	}
+}
+
+/// @brief takes a departing client out of all of its rooms (quietly; session_left did the talking).
+void session_leave_rooms(client_t *cli){
+	while(cli->nrooms > 0){
+		session_drop_room(cli, cli->nrooms - 1);
+	}
+}
+
+/// @brief hands a framed client the token it needs to resume this session: CONTROL "session <hex token> <seq>",
+//			with seq the latest message number so far (anything before that the client never missed).
+void session_send_token(client_t *cli){
+	if(!cli->framed || park_grace == 0){
+		return;
+	}
+	if(getrandom(&cli->token, sizeof(cli->token), 0) != sizeof(cli->token)){
+		cli->token = metrics_now_ns() * 0x9E3779B97F4A7C15ull ^ (uint64_t)cli->uid;
+	}
+
+	char ctl[64];
+	int n = snprintf(ctl, sizeof(ctl), "session %016llx %llu", (unsigned long long)cli->token,
+		(unsigned long long)room_seq_now());
+	msgbuf_t *buf = msgbuf_alloc(IRC_FRAME_HDR + sizeof(ctl));
+	if(buf){
+		msg_t m = { buf, 0, (uint32_t)n, 0 };
+		irc_frame_header(buf->data, IRC_CONTROL, 0, m.len);
+		memcpy(buf->data + IRC_FRAME_HDR, ctl, m.len);
+		client_write(cli, &m);
+		msgbuf_unref(buf);
+	}
+}
+
+/// @brief a framed client dropped without a LEAVE: keeps its rooms (held, so they stay around with their rings)
+//			and its name for park_grace seconds, so it can come back without anyone noticing. Its member slots
+//			go as usual when it's closed. A reconnect storm then costs no join or leave notices at all.
+/// @return 0 if it's parked, -1 if it can't be (legacy client, resume off, out of memory).
+int session_park(client_t *cli){
+	if(!cli->framed || park_grace == 0 || cli->token == 0){
+		return -1;
+	}
+	parked_t *p = calloc(1, sizeof(parked_t));
+	if(!p){
+		return -1;
+	}
+	memcpy(p->name, cli->name, NAME_SZ);
+	p->reg.uid = cli->uid;
+	p->reg.name = p->name;
+	p->token = cli->token;
+	p->current = -1;
+	p->expires = metrics_now_ns() + (uint64_t)park_grace * 1000000000u;
+
+	//the name goes from the live clients to the parked ones before anyone can resume under it.
+	registry_remove(&registry, &cli->reg);
+
+	pthread_mutex_lock(&park_lock);
+	if(registry_add(&parked, &p->reg) < 0){
+		pthread_mutex_unlock(&park_lock);
+		free(p);
+		return -1;
+	}
+	if(registry_set_name(&parked, &p->reg) < 0){
+		registry_remove(&parked, &p->reg);
+		pthread_mutex_unlock(&park_lock);
+		free(p);
+		return -1;
+	}
+	for(int i = 0; i < cli->nrooms; i++){
+		room_hold(cli->rooms[i]);
+		p->rooms[p->nrooms] = cli->rooms[i];
+		if(cli->rooms[i] == cli->room){
+			p->current = p->nrooms;
+		}
+		p->nrooms++;
+	}
+
+	//everyone waits the same grace, so the newest is always the last to expire.
+	p->prev = park_tail;
+	if(park_tail){
+		park_tail->next = p;
+	} else {
+		park_head = p;
+		pthread_cond_signal(&park_cond);
+	}
+	park_tail = p;
+	pthread_mutex_unlock(&park_lock);
+
+	metrics_add(METRIC_SESSIONS_PARKED, 1);
+	return 0;
+}
+
+/// @brief takes name's parked session off the list, if there is one (and token matches, unless it's 0).
+//			Call with park_lock held. The caller owns what it gets back.
+parked_t *session_unpark_locked(const char *name, uint64_t token){
+	rcu_read_lock();
+	reg_node_t *n = registry_find_name(&parked, name);
+	parked_t *p = n ? registry_entry(n, parked_t, reg) : NULL;
+	rcu_read_unlock();
+	if(!p || (token && p->token != token)){
+		return NULL;
+	}
+
+	registry_remove(&parked, &p->reg);
+	if(p->prev){
+		p->prev->next = p->next;
+	} else {
+		park_head = p->next;
+	}
+	if(p->next){
+		p->next->prev = p->prev;
+	} else {
+		park_tail = p->prev;
+	}
+	return p;
+}
+
+parked_t *session_unpark(const char *name, uint64_t token){
+	pthread_mutex_lock(&park_lock);
+	parked_t *p = session_unpark_locked(name, token);
+	pthread_mutex_unlock(&park_lock);
+	return p;
+}
+
+/// @brief a parked session that's over: its rooms hear it left (like session_left would have said), and let go of it.
+void session_expire(parked_t *p){
+	for(int i = 0; i < p->nrooms; i++){
+		roster_note(p->rooms[i], p->name, 0);
+		room_release(p->rooms[i]);
+	}
+	free(p);
+}
+
+/// @brief the thread that expires parked sessions, each when its grace is up.
+void *park_loop(void *arg){
+	(void)arg;
+	pthread_mutex_lock(&park_lock);
+	while(1){
+		if(!park_head){
+			pthread_cond_wait(&park_cond, &park_lock);
+			continue;
+		}
+
+		uint64_t now = metrics_now_ns();
+		if(park_head->expires > now){
+			struct timespec until = { (time_t)(park_head->expires / 1000000000u), (long)(park_head->expires % 1000000000u) };
+			pthread_cond_timedwait(&park_cond, &park_lock, &until);
+			continue;
+		}
+
+		parked_t *p = session_unpark_locked(park_head->name, 0);
+		pthread_mutex_unlock(&park_lock);
+		session_expire(p);
+		pthread_mutex_lock(&park_lock);
+	}
+	return NULL;
+}
+
+/// @brief starts the thread expiring parked sessions.
+/// @return 0 on success, -1 if it couldn't.
+int park_start(void){
+	pthread_condattr_t attr;
+	pthread_t tid;
+
+	//expiry times are CLOCK_MONOTONIC (metrics_now_ns), so the timed waits have to be too.
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&park_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if(registry_init(&parked) < 0 || pthread_create(&tid, NULL, &park_loop, NULL) != 0){
+		return -1;
+	}
+	pthread_detach(tid);
+	return 0;
+}
+
+/// @brief a named client's connection went away (hung up or broke): parks the session if it can come back,
+//			otherwise tells its rooms it left.
+void session_gone(client_t *cli){
+	if(session_park(cli) < 0){
+		session_left(cli);
+	}
+}
+
+/// @brief a client resuming its session, and how many messages it got from the rings so far.
+typedef struct{
+	client_t *cli;
+	int missed;
+} resume_t;
+
+/// @brief sends one message from a room's ring to a client resuming its session, numbered like it was the first time.
+void resume_one(void *arg, const room_msg_t *rm){
+	resume_t *r = arg;
+	const char *data = rm->buf->data;
+
+	//[IRC_USER][IRC_SEQ][IRC_MSG][text] from msg_chat, [IRC_SEQ][IRC_ROSTER][text] from the roster thread,
+	//or [IRC_SEQ][IRC_CHAT] (see publish_here).
+	uint32_t intro = (data[2] == IRC_USER) ? (uint32_t)irc_frame_size(data, rm->buf->len) : 0;
+	uint32_t off = intro + IRC_SEQ_FRAME;
+	long size = irc_frame_size(data + off, rm->buf->len - off);
+	if(size < IRC_FRAME_HDR){
+		return;
+	}
+
+	msg_t m = { rm->buf, off, (uint32_t)(size - IRC_FRAME_HDR), IRC_SEQ_FRAME, intro, 0, 0 };
+	if(data[off + 2] == IRC_MSG || data[off + 2] == IRC_ROSTER){
+		m.text = off + (uint32_t)size;
+		m.tlen = (uint32_t)rm->buf->len - m.text;
+	}
+	client_write(r->cli, &m);
+	r->missed++;
+}
+
+/// @brief the client told us its name.
+/// @return 0 to keep the client, -1 to drop it.
+int session_join(client_t *cli, const char *name, size_t len){
+	// the username has to be between 2 and 30 characters long.
+	if(cli->named || len <  2 || len >= NAME_SZ-1 || memchr(name, '\0', len)){
+		printf("Didn't enter the name.\n");
+		return -1;
+	}
+
+	//copy the client's name to, well, name. 
+	memcpy(cli->name, name, len);
+	cli->name[len] = '\0';
+
+	//names are unique, so /msg-style lookups by name find exactly one client.
+	cli->reg.name = cli->name;
+	if(registry_set_name(&registry, &cli->reg) < 0){
+		client_tell(cli, "That name is taken. Pick another one.\n");
+		printf("Name %s is taken.\n", cli->name);
+		return -1;
+	}
+	cli->named = 1;
+
+	//somebody (maybe the same person, without a token) took a name a dropped session was waiting on: that session is over.
+	if(park_grace > 0){
+		parked_t *p = session_unpark(cli->name, 0);
+		if(p){
+			session_expire(p);
+		}
+	}
+
+	session_send_token(cli);
+	session_joined(cli);
+	return 0;
+}
+
+/// @brief the client is back from a dropped connection: RESUME "<name> <token> <last seq> [<room> <last seq>]...".
+//			With the right token it takes its parked session over, rooms and all, and gets each room's messages
+//			numbered after the last one it had from that room (or after the first last seq, for a room it didn't
+//			name) from the rings, without any join or leave notices. If a ring doesn't go back that far, that
+//			room's backlog comes from the history files instead, like a join's.
+//			With no such session it just joins under that name.
+/// @return 0 to keep the client, -1 to drop it.
+int session_resume(client_t *cli, const char *payload, size_t len){
+	char line[NAME_SZ + 64 + ROOMS_PER_CLIENT * (ROOM_NAME_SZ + 24)];
+	char *rest;
+
+	if(cli->named || len >= sizeof(line)){
+		printf("Didn't enter the name.\n");
+		return -1;
+	}
+	memcpy(line, payload, len);
+	line[len] = '\0';
+
+	char *name = strtok_r(line, " ", &rest);
+	char *token = strtok_r(NULL, " ", &rest);
+	char *last = strtok_r(NULL, " ", &rest);
+	if(!name){
+		printf("Didn't enter the name.\n");
+		return -1;
+	}
+
+	parked_t *p = NULL;
+	if(park_grace > 0 && token && last){
+		uint64_t t = strtoull(token, NULL, 16);
+		p = t ? session_unpark(name, t) : NULL;
+	}
+	if(!p){
+		client_tell(cli, "Your old session is gone, joining as new.\n");
+		return session_join(cli, name, strlen(name));
+	}
+
+	//it's still our name: nobody else could take it without ending the parked session first.
+	size_t nlen = strlen(name);
+	if(nlen < 2 || nlen >= NAME_SZ - 1){
+		session_expire(p);
+		return -1;
+	}
+	memcpy(cli->name, name, nlen + 1);
+	cli->reg.name = cli->name;
+	if(registry_set_name(&registry, &cli->reg) < 0){
+		client_tell(cli, "That name is taken. Pick another one.\n");
+		session_expire(p);
+		return -1;
+	}
+	cli->named = 1;
+	session_send_token(cli);
+
+	//back in every room (the holds kept them alive), then let go of the holds.
+	for(int i = 0; i < p->nrooms; i++){
+		room_t *room = room_join(p->rooms[i]->name, cli, client_slice(cli));
+		if(room){
+			cli->rooms[cli->nrooms++] = room;
+			if(i == p->current){
+				cli->room = room;
+			}
+		} else {
+			roster_note(p->rooms[i], p->name, 0);
+		}
+		room_release(p->rooms[i]);
+	}
+	client_room_changed(cli);
+
+	//the last message they had from each room they named.
+	char *rooms[ROOMS_PER_CLIENT];
+	uint64_t afters[ROOMS_PER_CLIENT];
+	int nafters = 0;
+	char *which, *seq;
+	while(nafters < ROOMS_PER_CLIENT && (which = strtok_r(NULL, " ", &rest)) && (seq = strtok_r(NULL, " ", &rest))){
+		rooms[nafters] = which;
+		afters[nafters++] = strtoull(seq, NULL, 10);
+	}
+
+	//what they missed, straight from the rooms' rings, roster deltas included. Something sent while we do this may
+	//show up twice; the client skips sequence numbers it has seen. A room whose ring doesn't go back that far sends
+	//its whole roster again too.
+	resume_t r = { cli, 0 };
+	for(int i = 0; i < cli->nrooms; i++){
+		room_t *room = cli->rooms[i];
+		uint64_t after = strtoull(last, NULL, 10);
+		for(int j = 0; j < nafters; j++){
+			if(strcmp(rooms[j], room->name) == 0){
+				after = afters[j];
+			}
+		}
+		if(!room_since(room, after, p->reg.uid, resume_one, &r)){
+			client_tell(cli, "You missed more in %s than it keeps; here's the latest.\n", room->name);
+			roster_want(room, cli->uid);
+			if(replay_count > 0){
+				history_replay(cli->uid, room->name, replay_count);
+			}
+		}
+	}
+	client_tell(cli, "Welcome back, %s. You missed %d messages.\n", cli->name, r.missed);
+
+	free(p);
+	metrics_add(METRIC_SESSIONS_RESUMED, 1);
+	return 0;
+}
+
+/// @brief one chat line from a named client, for the room it talks in.
+void session_chat(client_t *cli, msg_t *m){
+	if(m->len > 0 && !cli->room){
+		client_tell(cli, "You're not in any room. /join one first.\n");
+	} else if(m->len > 0 && !cli->framed){
+		metrics_add(METRIC_MSGS_IN, 1);
+
+		//Send the message to everyone else in the room, log it and print it to the server.
+		//(old raw-text clients send their lines formatted already, so those go as they are.)
+		publish(cli, cli->room, m);
+	} else if(m->len > 0){
+		metrics_add(METRIC_MSGS_IN, 1);
+
+		msg_t line;
+		if(msg_chat(cli->uid, cli->name, cli->room, m->buf->data + m->off + IRC_FRAME_HDR, m->len, &line) == 0){
+			publish(cli, cli->room, &line);
+			msgbuf_unref(line.buf);
+		}
+	}
+}
+
+/// @brief handles one frame from a framed client. Shared by the threaded and epoll modes.
+//			The frame sits at cli->rbuf->data + off; a chat line is copied out of it into the message everyone gets (msg_chat).
+/// @return 0 to keep the client, -1 to drop it.
+int session_frame(client_t *cli, irc_frame_t *f, size_t off){
+	//nothing but JOIN (or RESUME) is allowed until we have a name.
+	if(!cli->named && f->type != IRC_JOIN && f->type != IRC_RESUME){
+		printf("Didn't enter the name.\n");
+		return -1;
+	}
+
+	switch(f->type){
+	case IRC_JOIN:
+		return session_join(cli, f->payload, f->len);
+	case IRC_RESUME:
+		return session_resume(cli, f->payload, f->len);
+	case IRC_CHAT:{
+		msg_t m = { cli->rbuf, (uint32_t)off, f->len, 0, 0, 0, 0 };
+		session_chat(cli, &m);
+		return 0;
+	}
+	case IRC_LEAVE:
+		session_left(cli);
+		return -1;
+	case IRC_CONTROL:
+		session_control(cli, f->payload, f->len);
+		return 0;
+	case IRC_PING:
+		client_frame(cli, IRC_PONG, f->payload, f->len > 64 ? 64 : f->len);
+		return 0;
+	case IRC_PONG:
+		//hearing from the client at all is what counts (client_after_read), so there's nothing left to do.
+		return 0;
+	default:
+		//anything newer than us: ignore it, so newer clients still work.
+		return 0;
+	}
+}
+
+/// @brief gives a framed client a receive buffer from the pool, if it gave its last one back.
+/// @return 0 on success, -1 if we're out of memory.
+int client_take_rbuf(client_t *cli){
+	if(cli->rbuf){
+		return 0;
+	}
+	cli->rbuf = msgbuf_alloc(RBUF_SZ);
+	if(!cli->rbuf){
+		return -1;
+	}
+	cli->rlen = cli->roff = 0;
+	client_account(cli, (long)cli->rbuf->cap);
+	return 0;
+}
+
+/// @brief lets go of the client's receive buffer (whoever it was broadcast to keeps their references).
+void client_drop_rbuf(client_t *cli){
+	if(cli->rbuf){
+		client_account(cli, -(long)cli->rbuf->cap);
+		msgbuf_unref(cli->rbuf);
+		cli->rbuf = NULL;
+		cli->rlen = cli->roff = 0;
+	}
+}
+
+/// @brief a client with nothing left to parse and nothing queued holds no buffers: they go back to
+//			the pools and come out again when it next says something or falls behind.
+void client_idle(client_t *cli){
+	if(cli->rbuf && cli->roff == cli->rlen){
+		client_drop_rbuf(cli);
+	}
+	if(cli->shard){
+		outq_release(cli);
+	}
+}
+
+/// @brief flood control for one message (a chat line, or a control line like /join or /msg) from a named client.
+//			One bucket check (two with a per-IP limit); nothing is allocated or looked up.
+/// @return 0 if it may go now, 1 if the client is throttled and it has to wait, -1 to drop the client.
+int client_flood_check(client_t *cli){
+	uint32_t wait = ratelimit_try(&cli->bucket, cli->address.sin_addr.s_addr);
+	if(wait == 0){
+		return 0;
+	}
+
+	if(flood_policy == FLOOD_DISCONNECT){
+		printf("Flooding: disconnecting %s\n", cli->name);
+		metrics_add(METRIC_FLOOD_DISCONNECTS, 1);
+
+		//write it out now rather than with the batch (the client is closed before that). Best effort:
+		//whatever the socket won't take right away is gone with the client.
+		client_tell(cli, "You're sending messages too fast. Bye!\n");
+		if(cli->shard){
+			client_flush(cli);
+		}
+		return -1;
+	}
+	client_throttle(cli, wait);
+	return 1;
+}
+
+/// @brief moves the unparsed end of the client's receive buffer into a fresh one of at least cap bytes
+//			and lets the old one go (whoever it was broadcast to keeps their references).
+/// @return 0 on success, -1 if we're out of memory.
+int client_move_rbuf(client_t *cli, size_t cap){
+	msgbuf_t *old = cli->rbuf;
+	size_t partial = cli->rlen - cli->roff;
+
+	msgbuf_t *fresh = msgbuf_alloc(cap);
+	if(!fresh){
+		return -1;
+	}
+	memcpy(fresh->data, old->data + cli->roff, partial);
+	client_account(cli, (long)fresh->cap - (long)old->cap);
+	msgbuf_unref(old);
+	cli->rbuf = fresh;
+	cli->rlen = partial;
+	cli->roff = 0;
+	return 0;
+}
+
+/// @brief parses and handles every complete frame in the client's receive buffer (until flood control
+//			throttles the client, if it does), then gets the buffer ready for the next recv.
+/// @return 0 to keep the client, -1 to drop it.
+int client_parse_frames(client_t *cli){
+	irc_frame_t f;
+	int r = 0;
+
+	size_t start = cli->roff;
+	while(!cli->throttled && (r = irc_frame_next(cli->rbuf->data, cli->rlen, &cli->roff, &f)) == 1){
+		if(cli->named && (f.type == IRC_CHAT || f.type == IRC_CONTROL) && ratelimit_enabled()){
+			int held = client_flood_check(cli);
+			if(held < 0){
+				return -1;
+			}
+			if(held){
+				//leave the frame where it is; it's handled once the client may go on.
+				cli->roff = start;
+				break;
+			}
+		}
+		if(session_frame(cli, &f, start) < 0){
+			return -1;
+		}
+		start = cli->roff;
+	}
+	if(cli->throttled){
+		r = 0;
+	}
+	if(r < 0){
+		printf("ERROR: bad frame from %s, dropping them\n", cli->named ? cli->name : "a new client");
+		return -1;
+	}
+
+	msgbuf_t *old = cli->rbuf;
+	size_t partial = cli->rlen - cli->roff;
+	long need = irc_frame_size(old->data + cli->roff, partial);
+	size_t cap = (need > RBUF_SZ) ? (size_t)need : RBUF_SZ;
+	int shared = atomic_load(&old->refs) > 1;
+
+	//a throttled client can leave more than one frame behind.
+	if(cap < partial){
+		cap = partial;
+	}
+
+	if(partial == 0 && !shared){
+		//everything was handled and nobody else holds the buffer: start over at the front.
+		cli->rlen = cli->roff = 0;
+	} else if(partial == 0){
+		//everything was handled, but the frames are still queued for others: let it go, and take
+		//a fresh one for the next recv.
+		client_drop_rbuf(cli);
+	} else if(shared || cap > old->cap){
+		//frames from this buffer are still queued for other clients (or the next frame won't fit):
+		//move the partial frame into a fresh buffer and let the old one go.
+		if(client_move_rbuf(cli, cap) < 0){
+			return -1;
+		}
+	} else if(cli->rlen == old->cap){
+		//full, with a partial frame at the end: slide it to the front.
+		memmove(old->data, old->data + cli->roff, partial);
+		cli->rlen = partial;
+		cli->roff = 0;
+	}
+
+	return 0;
+}
+
+/// @brief one recv() from an old raw-text client: the first one is the name block, every one after that is a message.
+//			The text is received right after a frame header's worth of room, so it can go out to framed clients as is.
+/// @return 0 to keep the client, -1 to drop it.
+int client_read_legacy(client_t *cli, msgbuf_t *m, int receive){
+	m->data[IRC_FRAME_HDR + receive] = '\0';
+
+	//Like the old bzero'd buffer + strlen, the message ends at the first NUL.
+	size_t len = strlen(m->data + IRC_FRAME_HDR);
+
+	if(!cli->named){
+		return session_join(cli, m->data + IRC_FRAME_HDR, len);
+	}
+
+	//flood control: the message is here already, so under FLOOD_THROTTLE it goes and the wait comes after it.
+	if(ratelimit_enabled() && flood_policy == FLOOD_DISCONNECT && client_flood_check(cli) < 0){
+		return -1;
+	}
+
+	msg_t msg = { m, 0, (uint32_t)len };
+	irc_frame_header(m->data, IRC_CHAT, 0, msg.len);
+	session_chat(cli, &msg);
+
+	if(ratelimit_enabled() && flood_policy == FLOOD_THROTTLE){
+		uint32_t wait = ratelimit_charge(&cli->bucket, cli->address.sin_addr.s_addr);
+		if(wait > 0){
+			client_throttle(cli, wait);
+		}
+	}
+	return 0;
+}
+
+/// @brief reads from a client once and handles whatever arrived. Shared by the threaded and epoll modes.
+/// @return the recv() result: > 0 if data was handled, 0 if the client hung up, < 0 on error (errno set).
+//			*drop is set when the client has to go (bad name, bad frame, LEAVE).
+int client_read(client_t *cli, int *drop){
+	int receive;
+	*drop = 0;
+
+	if(cli->framed){
+		if(client_take_rbuf(cli) < 0){
+			errno = ENOMEM;
+			return -1;
+		}
+		receive = recv(cli->sockfd, cli->rbuf->data + cli->rlen, cli->rbuf->cap - cli->rlen, 0);
+		metrics_add(METRIC_READ_CALLS, 1);
+		if(receive > 0){
+			metrics_add(METRIC_BYTES_IN, (uint64_t)receive);
+			cli->rlen += receive;
+			*drop = client_parse_frames(cli) < 0;
+		}
+		return receive;
+	}
+
+	msgbuf_t *m = msgbuf_alloc(IRC_FRAME_HDR + BUFFER_SZ);
+	if(!m){
+		errno = ENOMEM;
+		return -1;
+	}
+
+	//The name is sent as one NAME_SZ block, so we don't read past it.
+	receive = recv(cli->sockfd, m->data + IRC_FRAME_HDR, cli->named ? BUFFER_SZ - 1 : NAME_SZ, 0);
+	metrics_add(METRIC_READ_CALLS, 1);
+
+	if(receive > 0 && !cli->named && (unsigned char)m->data[IRC_FRAME_HDR] == IRC_FRAME_MAGIC){
+		//the very first byte is a frame header: this client speaks irc_proto.h. Keep the buffer as its receive buffer.
+		memmove(m->data, m->data + IRC_FRAME_HDR, receive);
+		metrics_add(METRIC_BYTES_IN, (uint64_t)receive);
+		cli->framed = 1;
+		cli->rbuf = m;
+		client_account(cli, (long)m->cap);
+		cli->rlen = receive;
+		cli->roff = 0;
+		*drop = client_parse_frames(cli) < 0;
+		return receive;
+	}
+
+	if(receive > 0){
+		metrics_add(METRIC_BYTES_IN, (uint64_t)receive);
+		*drop = client_read_legacy(cli, m, receive) < 0;
+	}
+
+	int err = errno;
+	msgbuf_unref(m);
+	errno = err;
+	return receive;
+}
+
+/// @brief a throttled client may go on: handles what it sent meanwhile (as far as its bucket lets it)
+//			and, unless it's throttled again, starts reading from it again.
+/// @return 0 to keep the client, -1 to drop it.
+int client_unthrottle(client_t *cli){
+	if(cli->shard){
+		shard_unthrottle(cli);
+	} else {
+		cli->throttled = 0;
+	}
+
+	if(cli->framed && cli->rbuf && cli->roff < cli->rlen && client_parse_frames(cli) < 0){
+		return -1;
+	}
+	client_idle(cli);
+	if(cli->shard){
+		client_watch(cli);
+	}
+	return 0;
+}
+
+void client_close(client_t *cli);
+
+/// @brief lets every throttled client whose wait is over go on. One that's throttled again goes
+//			back on the end of the list with a wait still ahead of it, so this always finishes.
+void shard_unthrottle_due(shard_t *sh){
+	uint32_t now = ratelimit_now();
+	for(int i = 0; i < sh->nthrottled; ){
+		client_t *cli = sh->throttled[i];
+		if((int32_t)(cli->throttle_until - now) > 0){
+			i++;
+			continue;
+		}
+		if(client_unthrottle(cli) < 0 || cli->dead){
+			client_close(cli);
+		}
+	}
+}
+
+/// @brief keepalives: the client hasn't said anything for ping_secs (or since its PING, for as long again).
+/// @return 1 to check on it again in ping_secs, 0 if we're done checking on it, -1 to drop it.
+int client_quiet(client_t *cli){
+	if(!cli->named){
+		printf("Didn't enter the name.\n");
+		metrics_add(METRIC_IDLE_DISCONNECTS, 1);
+		return -1;
+	}
+	if(!cli->framed){
+		//it can't answer a PING; from here on the kernel finds out whether it's still there.
+		client_keepalive(cli->sockfd);
+		return 0;
+	}
+	if(cli->pinged){
+		printf("No answer to a PING: disconnecting %s\n", cli->name);
+		metrics_add(METRIC_IDLE_DISCONNECTS, 1);
+		session_gone(cli);
+		return -1;
+	}
+
+	cli->pinged = 1;
+	metrics_add(METRIC_PINGS, 1);
+	client_frame(cli, IRC_PING, "", 0);
+	return 1;
+}
+
+/// @brief starts a shard's new client's keepalive timer.
+void shard_watch_idle(shard_t *sh, client_t *cli){
+	if(ping_secs > 0){
+		cli->heard = sh->wheel.now;
+		timer_arm(&sh->wheel, &cli->idle, cli->heard + (uint64_t)ping_secs * 1000 / TIMER_TICK_MS);
+	}
+}
+
+/// @brief a client's keepalive timer went off (timer_run calls this). A client we heard from since it was
+//			armed only gets it armed again for ping_secs after that; nothing more happened than one list move.
+void shard_idle_due(wheel_timer_t *t, void *arg){
+	shard_t *sh = arg;
+	client_t *cli = (client_t *)((char *)t - offsetof(client_t, idle));
+	uint64_t ticks = (uint64_t)ping_secs * 1000 / TIMER_TICK_MS;
+
+	//we aren't reading from it (backpressure, flood control), so its being quiet says nothing.
+	if(cli->paused || cli->throttled){
+		cli->heard = sh->wheel.now;
+	}
+	if((int64_t)(cli->heard + ticks - sh->wheel.now) >= 0){
+		timer_arm(&sh->wheel, t, cli->heard + ticks);
+		return;
+	}
+
+	int r = client_quiet(cli);
+	if(r > 0){
+		timer_arm(&sh->wheel, t, sh->wheel.now + ticks);
+	} else if(r < 0 || cli->dead){
+		client_close(cli);
+	}
+}
+
+/// @brief threaded mode: a client that's been quiet for IDLE_SECS waits here, without its buffers, for its
+//			next message. Its thread is its keepalive timer: a poll that runs out is client_quiet's turn.
+/// @return 0 once there's something to read, -1 to drop the client.
+int client_wait(client_t *cli){
+	struct pollfd pfd = { cli->sockfd, POLLIN, 0 };
+	int watching = ping_secs > 0, quiet_ms = IDLE_SECS * 1000;
+
+	while(1){
+		int timeout = -1;
+		if(watching){
+			timeout = ping_secs * 1000 > quiet_ms ? ping_secs * 1000 - quiet_ms : 0;
+		}
+
+		metrics_add(METRIC_POLL_CALLS, 1);
+		int n = poll(&pfd, 1, timeout);
+		if(n < 0 && errno == EINTR){
+			continue;
+		}
+		if(n != 0){
+			//something to read (or an error, which the recv will see).
+			return 0;
+		}
+
+		int r = client_quiet(cli);
+		if(r < 0){
+			return -1;
+		}
+		watching = r > 0;
+		quiet_ms = 0;
+	}
+}
+
+/* Handle all communication with the client */
+void *handle_client(void *arg){
+	int leave_flag = 0;
+
+	cli_count++;
+	client_t *cli = (client_t *)arg;
+
+	while(!leave_flag){
+		int drop;
+
+		//recieve a message from the client.
+		int receive = client_read(cli, &drop);
+
+		//if our recieve succeeded.
+		if (receive > 0){
+			cli->pinged = 0;
+			leave_flag = drop;
+		} else if (receive == 0 && cli->named){
+			session_gone(cli);
+			leave_flag = 1;
+		} else if (receive == 0){
+			printf("Didn't enter the name.\n");
+			leave_flag = 1;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK){
+			//quiet for IDLE_SECS: hand the buffers back and wait for the next message without them.
+			client_idle(cli);
+			msgbuf_cache_flush();
+			leave_flag = client_wait(cli) < 0;
+		} else {
+			//we encountered an error when recieving a message from a client (a reset is a dropped connection too).
+			printf("ERROR: -1\n");
+			if(cli->named){
+				session_gone(cli);
+			}
+			leave_flag = 1;
+		}
+
+		//flood control: sit out the wait, then handle what's left in the buffer.
+		while(!leave_flag && cli->throttled){
+			int32_t left = (int32_t)(cli->throttle_until - ratelimit_now());
+			if(left > 0){
+				struct timespec nap = { left / 1000, (left % 1000) * 1000000L };
+				nanosleep(&nap, NULL);
+				continue;
+			}
+			leave_flag = client_unthrottle(cli) < 0;
+		}
+	}
+
+  /* Delete client from the registry and its rooms, and yield thread */
+    registry_remove(&registry, &cli->reg);
+	session_leave_rooms(cli);
+
+	//other threads may still be writing to us; once they're done, nobody can find us any more.
+	rcu_synchronize();
+	close(cli->sockfd);
+	client_drop_rbuf(cli);
+	client_account(cli, -(long)cli->mem);
+	pthread_mutex_destroy(&cli->wlock);
+    client_free(cli);
+    cli_count--;
+    pthread_detach(pthread_self());
+
+	return NULL;
+}
+
+/// @brief adds a client to the shard's list of clients.
+int shard_attach(shard_t *sh, client_t *cli){
+	if(sh->nlocals == sh->locals_cap){
+		int cap = sh->locals_cap ? sh->locals_cap * 2 : 64;
+		client_t **grown = realloc(sh->locals, cap * sizeof(client_t *));
+		if(!grown){
+			return -1;
+		}
+		sh->locals = grown;
+
+		//every client can have a batch at once (or need closing), so those lists grow with this one.
+		grown = realloc(sh->batch, cap * sizeof(client_t *));
+		if(!grown){
+			return -1;
+		}
+		sh->batch = grown;
+
+		grown = realloc(sh->reap, cap * sizeof(client_t *));
+		if(!grown){
+			return -1;
+		}
+		sh->reap = grown;
+
+		grown = realloc(sh->throttled, cap * sizeof(client_t *));
+		if(!grown){
+			return -1;
+		}
+		sh->throttled = grown;
+		sh->locals_cap = cap;
+	}
+
+	cli->shard = sh;
+	cli->shard_slot = sh->nlocals;
+	sh->locals[sh->nlocals++] = cli;
+	return 0;
+}
+
+/// @brief takes a client out of its shard's list. The last client moves into its slot.
+void shard_detach(client_t *cli){
+	shard_t *sh = cli->shard;
+	client_t *last = sh->locals[--sh->nlocals];
+	sh->locals[cli->shard_slot] = last;
+	last->shard_slot = cli->shard_slot;
+}
+
+/// @brief removes a client from epoll, its shard, its rooms and the registry, and frees it
+//			once no other thread can be looking it up any more.
+void client_close(client_t *cli){
+	if(server_mode == SERVER_URING){
+		uring_close(cli);
+		return;
+	}
+
+	registry_remove(&registry, &cli->reg);
+	session_leave_rooms(cli);
+	epoll_ctl(cli->shard->epfd, EPOLL_CTL_DEL, cli->sockfd, NULL);
+	close(cli->sockfd);
+	shard_unbatch(cli);
+	shard_unthrottle(cli);
+	timer_cancel(&cli->shard->wheel, &cli->idle);
+	shard_detach(cli);
+	if(cli->paused){
+		cli->shard->npaused--;
+	}
+	outq_free(cli);
+	client_drop_rbuf(cli);
+	client_account(cli, -(long)cli->mem);
+	rcu_retire(cli, client_free);
+	cli_count--;
+}
+
+/// @brief takes on a connection the shard just accepted: turns it away if we're full, otherwise
+//			sets up its client, registers it and starts listening to it.
+void shard_adopt(shard_t *sh, int connfd, struct sockaddr_in *cli_addr){
+	/* Check if max clients is reached */
+	if(max_clients > 0 && cli_count >= (unsigned)max_clients){
+		printf("Max clients reached. Rejected: ");
+		print_client_addr(*cli_addr);
+		printf(":%d\n", cli_addr->sin_port);
+		metrics_add(METRIC_REJECTED, 1);
+		close(connfd);
+		return;
+	}
+
+	/* Client settings */
+	client_t *cli = slab_alloc(&client_pool);
+	if(!cli){
+		perror("ERROR: could not allocate client");
+		metrics_add(METRIC_REJECTED, 1);
+		close(connfd);
+		return;
+	}
+	cli->address = *cli_addr;
+	cli->sockfd = connfd;
+	cli->uid = uid++;
+	cli->reg.uid = cli->uid;
+	client_nodelay(connfd);
+	client_account(cli, (long)client_pool.size);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = cli;
+	if(registry_add(&registry, &cli->reg) < 0){
+		perror("ERROR: could not register client");
+		metrics_add(METRIC_REJECTED, 1);
+		close(connfd);
+		client_account(cli, -(long)cli->mem);
+		client_free(cli);
+		return;
+	}
+	if(shard_attach(sh, cli) < 0 || (server_mode == SERVER_EPOLL && epoll_ctl(sh->epfd, EPOLL_CTL_ADD, connfd, &ev) < 0)){
+		perror("ERROR: could not register client");
+		registry_remove(&registry, &cli->reg);
+		if(cli->shard){
+			shard_detach(cli);
+		}
+		metrics_add(METRIC_REJECTED, 1);
+		close(connfd);
+		client_account(cli, -(long)cli->mem);
+		rcu_retire(cli, client_free);
+		return;
+	}
+
+	cli_count++;
+	metrics_add(METRIC_ACCEPTED, 1);
+	shard_watch_idle(sh, cli);
+
+	//epoll mode is watching it already; io_uring mode starts its recv here.
+	if(server_mode == SERVER_EPOLL){
+		cli->events = ev.events;
+	} else {
+		client_watch(cli);
+	}
+}
+
+/// @brief accepts every connection waiting on the shard's listening socket (it is non-blocking, so we stop at EAGAIN).
+void accept_clients(shard_t *sh){
+	while(1){
+		struct sockaddr_in cli_addr;
+		socklen_t clilen = sizeof(cli_addr);
+
+		int connfd = accept4(sh->listenfd, (struct sockaddr*)&cli_addr, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(connfd < 0){
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+				perror("ERROR: accept failed");
+			}
+			return;
+		}
+		shard_adopt(sh, connfd, &cli_addr);
+	}
+}
+
+/// @brief what both event loops do after a read: receive and drop are what client_read (or client_feed) gave back.
+/// @return 0 to keep the client, -1 to close it.
+int client_after_read(client_t *cli, int receive, int drop){
+	if(receive > 0){
+		if(drop){
+			return -1;
+		}
+		cli->heard = cli->shard->wheel.now;
+		cli->pinged = 0;
+
+		//someone's queue is backed up: stop reading from this sender until it drains.
+		if(slow_policy == SLOW_BACKPRESSURE && congested_clients > 0 && !cli->paused){
+			cli->paused = 1;
+			cli->shard->npaused++;
+			client_watch(cli);
+		}
+
+		//a recv takes everything there is, so unless half a frame is left we're idle until the next one.
+		client_idle(cli);
+	} else if(receive == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+		if(cli->named){
+			session_gone(cli);
+		} else {
+			printf("Didn't enter the name.\n");
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+/// @brief handles one epoll event for a client.
+/// @return 0 to keep the client, -1 to close it.
+int client_event(client_t *cli, uint32_t events){
+	if(events & EPOLLOUT){
+		if(cli->dead || client_flush(cli) < 0){
+			return -1;
+		}
+	}
+
+	if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+		//one recv per wakeup, exactly like handle_client does. A framed client's recv can carry many frames.
+		int drop;
+		int receive = client_read(cli, &drop);
+		return client_after_read(cli, receive, drop);
+	}
+
+	return 0;
+}
+
+/// @brief how long (nanoseconds) a shard's loop may sleep: until its batch is due, its first throttled
+//			client may go on or its timer wheel has something to do, whichever comes first. UINT64_MAX if none is waiting.
+uint64_t shard_timeout_ns(shard_t *sh, uint64_t budget_ns){
+	uint64_t left = UINT64_MAX;
+	if(sh->nbatch > 0){
+		uint64_t waited = metrics_now_ns() - sh->batch_start;
+		left = waited < budget_ns ? budget_ns - waited : 0;
+	}
+
+	long throttle_ms = shard_throttle_wait(sh);
+	if(throttle_ms >= 0 && (uint64_t)throttle_ms * 1000000 < left){
+		left = (uint64_t)throttle_ms * 1000000;
+	}
+
+	uint64_t timers = timer_wait_ns(&sh->wheel);
+	return timers < left ? timers : left;
+}
+
+/// @brief a shard's part of a hot restart (see server_hand_off): stops reading, delivers what the others posted
+//			to us once they've stopped too, writes out our batch, and waits while our clients are packed up.
+//			If the new server took them we never come back (the process is about to end); if not, the loop goes on.
+void shard_hand_off(shard_t *sh){
+	pthread_barrier_wait(&handoff_step);
+	pthread_barrier_wait(&handoff_step);
+
+	shard_drain_inbox(sh);
+	if(sh->nbatch > 0){
+		shard_flush(sh);
+	}
+	pthread_barrier_wait(&handoff_step);
+	pthread_barrier_wait(&handoff_step);
+
+	while(handoff_taken){
+		pause();
+	}
+}
+
+/// @brief one epoll worker: waits on its listening socket, its inbox and its clients.
+//			Level-triggered; each epoll_event carries the client_t pointer,
+//			or &listen_marker / &wake_marker for the two shard sockets.
+//			Messages sent during a round are batched per recipient and written once the round is over,
+//			or with a latency budget (-l), once the oldest of them has waited that long.
+void *shard_loop(void *arg){
+	shard_t *sh = arg;
+	struct epoll_event events[MAX_EVENTS];
+	uint64_t budget_ns = batch_budget_us > 0 ? (uint64_t)batch_budget_us * 1000 : 0;
+
+	cur_shard = sh;
+
+	while(1){
+		//with a batch waiting, only sleep until it's due (and with clients throttled, until the first may go on).
+		struct timespec due, *timeout = NULL;
+		uint64_t left = shard_timeout_ns(sh, budget_ns);
+		if(left != UINT64_MAX){
+			due.tv_sec = left / 1000000000u;
+			due.tv_nsec = left % 1000000000u;
+			timeout = &due;
+		}
+
+		metrics_add(METRIC_POLL_CALLS, 1);
+		int n = epoll_pwait2(sh->epfd, events, MAX_EVENTS, timeout, NULL);
+		if(n < 0 && errno == ENOSYS){
+			//kernels older than 5.11 only take milliseconds; round up so we never flush early.
+			n = epoll_wait(sh->epfd, events, MAX_EVENTS, timeout ? (int)((left + 999999) / 1000000) : -1);
+		}
+		if(n < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("ERROR: epoll_wait failed");
+			exit(EXIT_FAILURE);
+		}
+
+		for(int i = 0; i < n; i++){
+			void *ptr = events[i].data.ptr;
+			if(ptr == &listen_marker){
+				accept_clients(sh);
+				continue;
+			}
+			if(ptr == &wake_marker){
+				shard_drain_inbox(sh);
+				continue;
+			}
+
+			client_t *cli = ptr;
+			if(client_event(cli, events[i].events) < 0 || cli->dead){
+				client_close(cli);
+			}
+		}
+
+		//a new server is taking over: nothing more is read here until we know whether it did.
+		if(atomic_load(&handoff_requested)){
+			shard_hand_off(sh);
+			continue;
+		}
+
+		if(sh->nthrottled > 0){
+			shard_unthrottle_due(sh);
+		}
+
+		//keepalives: PINGs go out with the batch below.
+		timer_run(&sh->wheel, timer_ticks(), shard_idle_due, sh);
+
+		if(sh->nbatch > 0 && (budget_ns == 0 || metrics_now_ns() - sh->batch_start >= budget_ns)){
+			shard_flush(sh);
+		}
+	}
+
+	return NULL;
+}
+
+#if IRC_HAVE_URING
+
+/// @brief what a completion is for. user_data is the client_t (or &listen_marker / &wake_marker)
+//			with one of these in its low bits; both are at least 4 byte aligned.
+enum{
+	OP_RECV,
+	OP_SEND,
+	OP_CANCEL
+};
+
+/// @brief what io_uring mode needs from the kernel. Multishot recv has no opcode of its own for the probe
+//			to find, but it came in 6.0 together with IORING_OP_SEND_ZC, so that one stands in for it.
+static const int uring_ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD,
+	IORING_OP_ASYNC_CANCEL, IORING_OP_SEND_ZC };
+
+static inline uint64_t uring_tag(void *p, int op){
+	return (uint64_t)(uintptr_t)p | (uint64_t)op;
+}
+
+/// @brief io_uring mode: one multishot accept on the listening socket, for every connection from here on.
+void uring_arm_accept(shard_t *sh){
+	struct io_uring_sqe *sqe = uring_sqe(&sh->ring);
+	if(!sqe){
+		perror("ERROR: io_uring accept");
+		return;
+	}
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = sh->listenfd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	sqe->user_data = uring_tag(&listen_marker, 0);
+}
+
+/// @brief io_uring mode: a multishot poll on the inbox's eventfd.
+void uring_arm_wake(shard_t *sh){
+	struct io_uring_sqe *sqe = uring_sqe(&sh->ring);
+	if(!sqe){
+		perror("ERROR: io_uring poll");
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = sh->wakefd;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = uring_tag(&wake_marker, 0);
+}
+
+/// @brief io_uring mode: puts a broken client on the list the loop closes after its completions.
+void shard_reap(client_t *cli){
+	shard_t *sh = cli->shard;
+	if(cli->reaping || cli->closing){
+		return;
+	}
+	cli->reaping = 1;
+	cli->reap_slot = sh->nreap;
+	sh->reap[sh->nreap++] = cli;
+}
+
+void shard_unreap(client_t *cli){
+	shard_t *sh = cli->shard;
+	if(!cli->reaping){
+		return;
+	}
+	client_t *last = sh->reap[--sh->nreap];
+	sh->reap[cli->reap_slot] = last;
+	last->reap_slot = cli->reap_slot;
+	cli->reaping = 0;
+}
+
+/// @brief io_uring mode's client_watch: keeps one multishot recv running unless backpressure has us paused
+//			or flood control has us throttled, and hands a broken client to the loop to close.
+void uring_watch(client_t *cli){
+	if(cli->closing){
+		return;
+	}
+	if(cli->dead){
+		shard_reap(cli);
+		return;
+	}
+
+	uring_t *ring = &cli->shard->ring;
+	int hold = cli->paused || cli->throttled;
+	if(hold && cli->recv_armed && !cli->recv_cancel){
+		struct io_uring_sqe *sqe = uring_sqe(ring);
+		if(!sqe){
+			return;
+		}
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = uring_tag(cli, OP_RECV);
+		sqe->user_data = uring_tag(cli, OP_CANCEL);
+		cli->recv_cancel = 1;
+		cli->inflight++;
+	} else if(!hold && !cli->recv_armed){
+		struct io_uring_sqe *sqe = uring_sqe(ring);
+		if(!sqe){
+			client_kill(cli);
+			return;
+		}
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = cli->sockfd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = (unsigned short)cli->shard->bufs.gid;
+		sqe->user_data = uring_tag(cli, OP_RECV);
+		cli->recv_armed = 1;
+		cli->recv_cancel = 0;
+		cli->inflight++;
+	}
+}
+
+/// @brief io_uring mode's client_flush: hands the front of the queue (up to MAX_IOV messages) to the kernel
+//			as one sendmsg, unless one is in flight already. It goes in with the loop's next io_uring_enter;
+//			uring_sent picks up from wherever it got to.
+/// @return 0 if the client is still healthy, -1 if it broke.
+int uring_flush(client_t *cli){
+	outq_t *q = &cli->out;
+	if(cli->send || cli->dead || cli->closing || outq_depth(q) == 0){
+		return cli->dead ? -1 : 0;
+	}
+
+	uring_send_t *s = slab_alloc(&cli->shard->sends);
+	struct io_uring_sqe *sqe = s ? uring_sqe(&cli->shard->ring) : NULL;
+	if(!sqe){
+		if(s){
+			slab_free(&cli->shard->sends, s);
+		}
+		client_kill(cli);
+		return -1;
+	}
+
+	size_t total;
+	q->sending = (unsigned)outq_iov(q, s->iov, &total);
+	s->mh.msg_iov = s->iov;
+	s->mh.msg_iovlen = q->sending;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = cli->sockfd;
+	sqe->addr = (uint64_t)(uintptr_t)&s->mh;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = uring_tag(cli, OP_SEND);
+	cli->send = s;
+	cli->inflight++;
+	client_account(cli, (long)cli->shard->sends.size);
+	return 0;
+}
+
+/// @brief a send finished: retire what went out, and send the rest (or whatever came in meanwhile).
+void uring_sent(client_t *cli, int res){
+	outq_t *q = &cli->out;
+
+	slab_free(&cli->shard->sends, cli->send);
+	client_account(cli, -(long)cli->shard->sends.size);
+	cli->send = NULL;
+	cli->inflight--;
+	q->sending = 0;
+
+	if(res < 0){
+		if(!cli->closing){
+			errno = -res;
+			client_kill(cli);
+		}
+		return;
+	}
+	outq_retire(q, (size_t)res);
+	if(cli->closing){
+		return;
+	}
+
+	if(outq_depth(q) > 0 && !cli->batched){
+		uring_flush(cli);
+	}
+	client_check_congestion(cli);
+	outq_release(cli);
+}
+
+/// @brief io_uring mode's version of client_read: n bytes the kernel received for the client into one of
+//			the shard's buffers. A framed client's bytes are copied into its receive buffer, so its frames can
+//			still be broadcast by reference, and parsed from there. An old raw-text client's first NAME_SZ bytes
+//			are its name and each recv after that is one message, like in client_read.
+/// @return n, or -1 with errno set. *drop is set when the client has to go.
+int client_feed(client_t *cli, const char *data, size_t n, int *drop){
+	size_t done = 0;
+	*drop = 0;
+	metrics_add(METRIC_BYTES_IN, (uint64_t)n);
+
+	if(!cli->framed && !cli->named && (unsigned char)data[0] == IRC_FRAME_MAGIC){
+		cli->framed = 1;
+	}
+
+	while(done < n && !cli->framed && !*drop){
+		size_t take = cli->named ? BUFFER_SZ - 1 : NAME_SZ;
+		if(take > n - done){
+			take = n - done;
+		}
+		msgbuf_t *m = msgbuf_alloc(IRC_FRAME_HDR + BUFFER_SZ);
+		if(!m){
+			errno = ENOMEM;
+			return -1;
+		}
+		memcpy(m->data + IRC_FRAME_HDR, data + done, take);
+		*drop = client_read_legacy(cli, m, (int)take) < 0;
+		msgbuf_unref(m);
+		done += take;
+	}
+
+	while(done < n && !*drop){
+		if(client_take_rbuf(cli) < 0){
+			errno = ENOMEM;
+			return -1;
+		}
+
+		//only a throttled client's buffer fills up (we don't parse it), while the kernel keeps receiving
+		//until our cancel gets to its recv. Make room for that, but not for a client that just keeps going.
+		if(cli->rlen == cli->rbuf->cap){
+			if(cli->roff == 0 && cli->rbuf->cap >= FLOOD_RBUF_MAX){
+				printf("Flooding: disconnecting %s\n", cli->named ? cli->name : "a new client");
+				metrics_add(METRIC_FLOOD_DISCONNECTS, 1);
+				*drop = 1;
+				break;
+			}
+			if(client_move_rbuf(cli, cli->roff > 0 ? cli->rbuf->cap : cli->rbuf->cap * 2) < 0){
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		size_t take = cli->rbuf->cap - cli->rlen;
+		if(take > n - done){
+			take = n - done;
+		}
+		memcpy(cli->rbuf->data + cli->rlen, data + done, take);
+		cli->rlen += take;
+		done += take;
+		*drop = client_parse_frames(cli) < 0;
+	}
+	return (int)n;
+}
+
+/// @brief a multishot recv completion: data (in one of the shard's buffers), the end of the connection, or the recv stopping.
+/// @return 0 to keep the client, -1 to close it.
+int uring_received(client_t *cli, int res, unsigned flags){
+	shard_t *sh = cli->shard;
+	int r = 0;
+
+	if(!(flags & IORING_CQE_F_MORE)){
+		cli->recv_armed = 0;
+		cli->inflight--;
+	}
+
+	if(res > 0 && (flags & IORING_CQE_F_BUFFER)){
+		unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		if(!cli->closing){
+			int drop;
+			int receive = client_feed(cli, uring_buf(&sh->bufs, bid), (size_t)res, &drop);
+			r = client_after_read(cli, receive, drop);
+		}
+		uring_bufs_put(&sh->bufs, bid);
+	} else if(res == -ENOBUFS || (res == -ECANCELED && cli->recv_cancel)){
+		//out of buffers (they're back by now), or backpressure or flood control stopped us: started again below, if we should be.
+	} else if(!cli->closing){
+		errno = res < 0 ? -res : 0;
+		r = client_after_read(cli, res < 0 ? -1 : 0, 0);
+	}
+
+	if(r == 0 && !cli->recv_armed){
+		client_watch(cli);
+	}
+	return r;
+}
+
+void uring_finish(client_t *cli);
+
+/// @brief io_uring mode's client_close: everything but the freeing happens now. The kernel may still complete
+//			requests that point at the client, so those are cancelled and the last one to come back frees it.
+void uring_close(client_t *cli){
+	shard_unreap(cli);
+	if(cli->closing){
+		return;
+	}
+	cli->closing = 1;
+
+	registry_remove(&registry, &cli->reg);
+	session_leave_rooms(cli);
+	shard_unbatch(cli);
+	shard_unthrottle(cli);
+	timer_cancel(&cli->shard->wheel, &cli->idle);
+	shard_detach(cli);
+	if(cli->paused){
+		cli->shard->npaused--;
+	}
+
+	struct io_uring_sqe *sqe = cli->inflight ? uring_sqe(&cli->shard->ring) : NULL;
+	if(sqe){
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = cli->sockfd;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+		sqe->user_data = uring_tag(cli, OP_CANCEL);
+		cli->inflight++;
+	} else if(cli->inflight){
+		//no room to ask: shutting the socket down ends its recv and send just the same.
+		shutdown(cli->sockfd, SHUT_RDWR);
+	}
+
+	if(cli->inflight == 0){
+		uring_finish(cli);
+	}
+}
+
+/// @brief the last of a closing client's requests is back: now it can go.
+void uring_finish(client_t *cli){
+	close(cli->sockfd);
+	outq_free(cli);
+	client_drop_rbuf(cli);
+	client_account(cli, -(long)cli->mem);
+	rcu_retire(cli, client_free);
+	cli_count--;
+}
+
+/// @brief handles one completion.
+void uring_complete(shard_t *sh, uint64_t data, int res, unsigned flags){
+	void *ptr = (void *)(uintptr_t)(data & ~(uint64_t)3);
+	int op = (int)(data & 3);
+
+	if(ptr == &listen_marker){
+		if(res >= 0){
+			struct sockaddr_in cli_addr;
+			socklen_t clilen = sizeof(cli_addr);
+			memset(&cli_addr, 0, sizeof(cli_addr));
+			getpeername(res, (struct sockaddr *)&cli_addr, &clilen);
+			shard_adopt(sh, res, &cli_addr);
+		} else {
+			errno = -res;
+			perror("ERROR: accept failed");
+		}
+		if(!(flags & IORING_CQE_F_MORE)){
+			uring_arm_accept(sh);
+		}
+		return;
+	}
+	if(ptr == &wake_marker){
+		shard_drain_inbox(sh);
+		if(!(flags & IORING_CQE_F_MORE)){
+			uring_arm_wake(sh);
+		}
+		return;
+	}
+
+	client_t *cli = ptr;
+	int r = 0;
+	if(op == OP_RECV){
+		r = uring_received(cli, res, flags);
+	} else if(op == OP_SEND){
+		uring_sent(cli, res);
+	} else {
+		cli->inflight--;
+	}
+
+	if(cli->closing){
+		if(cli->inflight == 0){
+			uring_finish(cli);
+		}
+	} else if(r < 0 || cli->dead){
+		uring_close(cli);
+	}
+}
+
+/// @brief the io_uring worker: shard_loop, with completions instead of readiness events.
+//			Everything submitted while handling a round (recvs to restart, the batch's sends, cancels)
+//			goes to the kernel with the io_uring_enter that waits for the next round.
+void *uring_loop(void *arg){
+	shard_t *sh = arg;
+	uint64_t budget_ns = batch_budget_us > 0 ? (uint64_t)batch_budget_us * 1000 : 0;
+
+	cur_shard = sh;
+	uring_arm_accept(sh);
+	uring_arm_wake(sh);
+
+	while(1){
+		struct timespec due, *timeout = NULL;
+		uint64_t left = shard_timeout_ns(sh, budget_ns);
+		if(left != UINT64_MAX){
+			due.tv_sec = left / 1000000000u;
+			due.tv_nsec = left % 1000000000u;
+			timeout = &due;
+		}
+
+		metrics_add(METRIC_POLL_CALLS, 1);
+		if(uring_submit(&sh->ring, 1, timeout) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY){
+			perror("ERROR: io_uring_enter failed");
+			exit(EXIT_FAILURE);
+		}
+
+		struct io_uring_cqe *cqe;
+		while((cqe = uring_peek(&sh->ring))){
+			uint64_t data = cqe->user_data;
+			int res = cqe->res;
+			unsigned flags = cqe->flags;
+			uring_seen(&sh->ring);
+			uring_complete(sh, data, res, flags);
+		}
+
+		if(sh->nthrottled > 0){
+			shard_unthrottle_due(sh);
+		}
+		timer_run(&sh->wheel, timer_ticks(), shard_idle_due, sh);
+
+		//clients that broke while we were busy with someone else.
+		while(sh->nreap > 0){
+			uring_close(sh->reap[sh->nreap - 1]);
+		}
+
+		if(sh->nbatch > 0 && (budget_ns == 0 || metrics_now_ns() - sh->batch_start >= budget_ns)){
+			shard_flush(sh);
+		}
+	}
+
+	return NULL;
+}
+
+/// @brief io_uring mode: the shard's ring, its receive buffers and its pool of sends.
+int uring_shard_init(shard_t *sh){
+	if(uring_init(&sh->ring, URING_ENTRIES, uring_ops, (int)(sizeof(uring_ops) / sizeof(uring_ops[0]))) < 0){
+		return -1;
+	}
+	if(uring_bufs_init(&sh->ring, &sh->bufs, 0, URING_BUFS, URING_BUF_SZ) < 0){
+		int err = errno;
+		uring_exit(&sh->ring);
+		errno = err;
+		return -1;
+	}
+	slab_init(&sh->sends, sizeof(uring_send_t));
+	return 0;
+}
+
+/// @brief can io_uring mode run here? It needs a kernel with everything in uring_ops and provided buffer rings.
+/// @return 0 if it can, -1 with errno set if not.
+int uring_usable(void){
+	uring_t ring;
+	uring_bufs_t bufs;
+	if(uring_init(&ring, 8, uring_ops, (int)(sizeof(uring_ops) / sizeof(uring_ops[0]))) < 0){
+		return -1;
+	}
+	int r = uring_bufs_init(&ring, &bufs, 0, 2, URING_BUF_SZ);
+	int err = errno;
+	uring_exit(&ring);
+	if(r == 0){
+		uring_bufs_free(&bufs);
+	}
+	errno = err;
+	return r;
+}
+
+#else
+
+/// @brief built without io_uring: -m uring always falls back to epoll, so none of these ever run.
+void uring_watch(client_t *cli){
+	(void)cli;
+}
+
+int uring_flush(client_t *cli){
+	(void)cli;
+	return -1;
+}
+
+void uring_close(client_t *cli){
+	(void)cli;
+}
+
+void *uring_loop(void *arg){
+	return arg;
+}
+
+int uring_shard_init(shard_t *sh){
+	(void)sh;
+	errno = ENOSYS;
+	return -1;
+}
+
+int uring_usable(void){
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
+
+/// @brief sets up a shard: its epoll instance (or io_uring), its inbox eventfd and its listening socket.
+int shard_init(shard_t *sh, int id, int listenfd){
+	memset(sh, 0, sizeof(*sh));
+	sh->id = id;
+	sh->listenfd = listenfd;
+	mpsc_init(&sh->inbox);
+	timer_init(&sh->wheel, timer_ticks());
+
+	slab_init(&sh->rings, out_capacity * sizeof(outmsg_t));
+
+	sh->epfd = server_mode == SERVER_EPOLL ? epoll_create1(EPOLL_CLOEXEC) : -1;
+	sh->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if((server_mode == SERVER_EPOLL && sh->epfd < 0) || sh->wakefd < 0
+		|| (server_mode == SERVER_URING && uring_shard_init(sh) < 0)){
+		perror("ERROR: could not create shard");
+		return -1;
+	}
+
+	fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+	if(server_mode == SERVER_URING){
+		return 0;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_marker;
+	epoll_ctl(sh->epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &wake_marker;
+	epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->wakefd, &ev);
+
+	return 0;
+}
+
+/// @brief the original server: one thread per client, each sitting in a blocking recv().
+void run_threaded(int listenfd){
+	struct sockaddr_in cli_addr;
+	pthread_t tid;
+	pthread_attr_t attr;
+
+	//a client thread needs a few KB of stack, not the 8 MB it gets by default.
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, THREAD_STACK_SZ);
+
+	//recv() gives up after IDLE_SECS, so an idle client's thread can give its buffers back.
+	struct timeval idle = { IDLE_SECS, 0 };
+
+	while(1){
+		socklen_t clilen = sizeof(cli_addr);
+
+		//accept a connection from the client.
+		int connfd = accept(listenfd, (struct sockaddr*)&cli_addr, &clilen);
+		if(connfd < 0){
+			perror("ERROR: accept failed");
+			continue;
+		}
+
+		/* Check if max clients is reached */
+		if(max_clients > 0 && cli_count >= (unsigned)max_clients){
+			printf("Max clients reached. Rejected: ");
+			print_client_addr(cli_addr);
+			printf(":%d\n", cli_addr.sin_port);
+			metrics_add(METRIC_REJECTED, 1);
+			close(connfd);
+			continue;
+		}
+
+		/* Client settings */
+		client_t *cli = slab_alloc(&client_pool);
+		if(!cli){
+			perror("ERROR: could not allocate client");
+			metrics_add(METRIC_REJECTED, 1);
+			close(connfd);
+			continue;
+		}
+		cli->address = cli_addr;
+		cli->sockfd = connfd;
 		cli->uid = uid++;
+		cli->reg.uid = cli->uid;
+		pthread_mutex_init(&cli->wlock, NULL);
+		setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+		client_nodelay(connfd);
+		client_account(cli, (long)(client_pool.size + THREAD_STACK_SZ));
+
+		/* Add client to the registry and fork thread */
+		if(registry_add(&registry, &cli->reg) < 0){
+			perror("ERROR: could not register client");
+			metrics_add(METRIC_REJECTED, 1);
+			close(connfd);
+			client_account(cli, -(long)cli->mem);
+			client_free(cli);
+			continue;
+		}
+		pthread_create(&tid, &attr, &handle_client, (void*)cli);
+		metrics_add(METRIC_ACCEPTED, 1);
+	}
+}
+
+/// @brief makes a listening socket on ip:port.
+//			SO_REUSEPORT lets every shard bind its own socket to the same port;
+//			the kernel then spreads incoming connections across them.
+/// @return the socket, or -1 on failure.
+int open_listener(char *ip, int port){
+	int option = 1;
+	struct sockaddr_in serv_addr;
+
+	/* Socket settings */
+	int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	memset(&serv_addr, 0, sizeof(serv_addr));
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = inet_addr(ip);
+	serv_addr.sin_port = htons(port);
+
+	//https://linux.die.net/man/3/setsockopt: set socket options. 
+	//(each option needs its own call, OR-ing the names together only sets one of them.)
+	if(setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (char*)&option, sizeof(option)) < 0 ||
+	   setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, (char*)&option, sizeof(option)) < 0){
+		perror("ERROR: setsockopt failed");
+		return -1;
+	}
+
+	/* Bind listen to */
+	if(bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+		perror("ERROR: Socket binding failed");
+		return -1;
+	}
+
+  	/* Listen */
+	if (listen(listenfd, SOMAXCONN) < 0) {
+		perror("ERROR: Socket listening failed");
+		return -1;
+	}
+
+	return listenfd;
+}
+
+/// @brief SIGUSR1: asks every shard to print its clients' outbound queue counters.
+// Only async-signal-safe things in here: atomic stores and write() on the eventfds.
+void request_stats_dump(int sig){
+	(void)sig;
+	for(int i = 0; i < nshards; i++){
+		uint64_t one = 1;
+		atomic_store(&shards[i].dump_requested, 1);
+		if(write(shards[i].wakefd, &one, sizeof(one)) < 0){
+			//nothing we can do from a signal handler.
+		}
+	}
+}
+
+/// @brief the server's part of a metrics scrape (runs on the admin thread): gauges, and in epoll mode
+//			every backed-up client's outbound queue. Each shard reports its own clients from its own
+//			thread, so nothing here reads a client another thread is changing.
+void server_metrics(FILE *out){
+	fprintf(out, "# HELP chat_clients Connected clients.\n# TYPE chat_clients gauge\nchat_clients %u\n", cli_count);
+	fprintf(out, "# HELP chat_rooms Rooms with anyone in them.\n# TYPE chat_rooms gauge\nchat_rooms %zu\n", room_count());
 
-		/* Add client to the queue and fork thread */
-		queue_add(cli);
-		pthread_create(&tid, NULL, &handle_client, (void*)cli);
+	//what a session costs: its client_t, the buffers it's holding right now and (threaded mode) its thread's stack.
+	uint64_t taken = metrics_total(METRIC_SESSION_ALLOC), given = metrics_total(METRIC_SESSION_FREED);
+	unsigned clients = cli_count;
+	fprintf(out, "# HELP chat_session_bytes_per_client Bytes the average client session holds.\n"
+		"# TYPE chat_session_bytes_per_client gauge\nchat_session_bytes_per_client %lu\n",
+		(unsigned long)(taken > given && clients ? (taken - given) / clients : 0));
 
-		/* Reduce CPU usage */
-		//What happens if two clients connect at the same time? (The client has to wait for the other client to be added before it can be added.)
-		sleep(1);
+	size_t in_use, reserved, rings_in_use = 0, rings_reserved = 0;
+	for(int i = 0; server_mode != SERVER_THREADED && i < nshards; i++){
+		slab_stats(&shards[i].rings, &in_use, &reserved);
+		rings_in_use += in_use;
+		rings_reserved += reserved;
+	}
+	slab_stats(&client_pool, &in_use, &reserved);
+	fprintf(out, "# HELP chat_slab_objects Objects handed out by each pool.\n# TYPE chat_slab_objects gauge\n"
+		"chat_slab_objects{pool=\"clients\"} %zu\nchat_slab_objects{pool=\"rings\"} %zu\n", in_use, rings_in_use);
+	fprintf(out, "# HELP chat_slab_bytes Bytes each pool has allocated.\n# TYPE chat_slab_bytes gauge\n"
+		"chat_slab_bytes{pool=\"clients\"} %zu\nchat_slab_bytes{pool=\"rings\"} %zu\n", reserved, rings_reserved);
+
+	if(server_mode == SERVER_THREADED){
+		return;
+	}
+	fprintf(out, "# HELP chat_congested_clients Clients over their queue's high watermark (backpressure).\n"
+		"# TYPE chat_congested_clients gauge\nchat_congested_clients %d\n", congested_clients);
+
+	fprintf(out, "# HELP chat_client_outq_messages Messages queued for each client that has any.\n"
+		"# TYPE chat_client_outq_messages gauge\n");
+
+	pthread_mutex_lock(&backlog.lock);
+	backlog.out = out;
+	backlog.round = backlog.round + 1 ? backlog.round + 1 : 1;
+	backlog.pending = nshards;
+	backlog.messages = backlog.bytes = backlog.backed_up = 0;
+	backlog.depth_max = 0;
+	for(int i = 0; i < nshards; i++){
+		atomic_store(&shards[i].backlog_requested, backlog.round);
+		shard_wake(&shards[i]);
+	}
+
+	//a shard that's stuck for a whole second is left out rather than holding up the scrape.
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec++;
+	while(backlog.pending > 0 && pthread_cond_timedwait(&backlog.done, &backlog.lock, &deadline) == 0){
+		//a shard answered; see if that was the last one.
+	}
+	backlog.out = NULL;
+
+	fprintf(out, "# HELP chat_outq_messages Messages queued for all clients.\n# TYPE chat_outq_messages gauge\n"
+		"chat_outq_messages %lu\n", backlog.messages);
+	fprintf(out, "# HELP chat_outq_bytes Bytes queued for all clients.\n# TYPE chat_outq_bytes gauge\n"
+		"chat_outq_bytes %lu\n", backlog.bytes);
+	fprintf(out, "# HELP chat_outq_backed_up_clients Clients with anything queued.\n# TYPE chat_outq_backed_up_clients gauge\n"
+		"chat_outq_backed_up_clients %lu\n", backlog.backed_up);
+	fprintf(out, "# HELP chat_outq_depth_max Longest queue of any client.\n# TYPE chat_outq_depth_max gauge\n"
+		"chat_outq_depth_max %u\n", backlog.depth_max);
+	fprintf(out, "# HELP chat_outq_shards_missing Shards that didn't answer this scrape in time.\n"
+		"# TYPE chat_outq_shards_missing gauge\nchat_outq_shards_missing %d\n", backlog.pending);
+	pthread_mutex_unlock(&backlog.lock);
+}
+
+/// @brief a room's name and the messages in its ring (see handoff_pack), and how many of those there were.
+typedef struct{
+	handoff_buf_t *b;
+	uint32_t n;
+} handoff_ring_t;
+
+/// @brief one ring message: its number, its sender and its bytes.
+void handoff_pack_msg(void *arg, const room_msg_t *m){
+	handoff_ring_t *r = arg;
+	handoff_put_u64(r->b, m->seq);
+	handoff_put_u32(r->b, (uint32_t)m->uid);
+	handoff_put_u32(r->b, (uint32_t)m->buf->len);
+	handoff_put(r->b, m->buf->data, m->buf->len);
+	r->n++;
+}
+
+/// @brief one room's ring. arg counts the rooms.
+void handoff_pack_room(void *arg, room_t *room){
+	handoff_ring_t *rooms = arg;
+	handoff_buf_t *b = rooms->b;
+
+	pthread_mutex_lock(&room->ring_lock);
+	uint64_t evicted = room->evicted;
+	pthread_mutex_unlock(&room->ring_lock);
+
+	handoff_put_str(b, room->name);
+	handoff_put_u64(b, evicted);
+	size_t at = b->len;
+	handoff_ring_t r = { b, 0 };
+	handoff_put_u32(b, 0);
+	room_since(room, 0, -1, handoff_pack_msg, &r);
+	if(!b->err){
+		memcpy(b->data + at, &r.n, sizeof(r.n));
+	}
+	rooms->n++;
+}
+
+/// @brief the rooms someone is in, and the one they talk in (HANDOFF_NO_ROOM for none).
+void handoff_pack_rooms(handoff_buf_t *b, room_t **rooms, int nrooms, int current){
+	handoff_put_u8(b, (uint8_t)nrooms);
+	for(int i = 0; i < nrooms; i++){
+		handoff_put_str(b, rooms[i]->name);
+	}
+	handoff_put_u8(b, current < 0 ? HANDOFF_NO_ROOM : (uint8_t)current);
+}
+
+/// @brief one client: its socket, who it is, its rooms, what we still owe it and what it sent we haven't handled.
+void handoff_pack_client(handoff_buf_t *b, client_t *cli){
+	int current = -1;
+	for(int i = 0; i < cli->nrooms; i++){
+		if(cli->rooms[i] == cli->room){
+			current = i;
+		}
+	}
+
+	handoff_put_u32(b, handoff_put_fd(b, cli->sockfd));
+	handoff_put_u32(b, cli->address.sin_addr.s_addr);
+	handoff_put_u32(b, cli->address.sin_port);
+	handoff_put_u32(b, (uint32_t)cli->uid);
+	handoff_put_u8(b, (uint8_t)cli->framed);
+	handoff_put_u8(b, (uint8_t)cli->named);
+	handoff_put_str(b, cli->named ? cli->name : "");
+	handoff_put_u64(b, cli->token);
+	handoff_pack_rooms(b, cli->rooms, cli->nrooms, current);
+
+	//the rest of the outbound queue, as one run of bytes: from where the first message got to, on.
+	outq_t *q = &cli->out;
+	uint32_t out = 0;
+	for(unsigned i = q->head; i != q->tail; i++){
+		outmsg_t *m = &q->ring[i & (out_capacity - 1)];
+		out += m->end - m->pos;
+	}
+	handoff_put_u32(b, out);
+	for(unsigned i = q->head; i != q->tail; i++){
+		outmsg_t *m = &q->ring[i & (out_capacity - 1)];
+		handoff_put(b, m->buf->data + m->pos, m->end - m->pos);
+	}
+
+	//half a frame, or frames flood control was holding back.
+	uint32_t in = (cli->framed && cli->rbuf) ? (uint32_t)(cli->rlen - cli->roff) : 0;
+	handoff_put_u32(b, in);
+	if(in > 0){
+		handoff_put(b, cli->rbuf->data + cli->roff, in);
+	}
+}
+
+/// @brief everything a new server needs to carry on where we are. Every shard is stopped and park_lock is held.
+//			In order: HANDOFF_MAGIC and HANDOFF_VERSION; how many listening sockets (descriptors 0 to n - 1);
+//			the next uid and the latest message number; every room's ring (name, evicted, then each message's
+//			number, sender and bytes); every room's roster (roster_pack); the parked sessions, oldest first (name, uid, token, rooms, milliseconds
+//			left); and every client (see handoff_pack_client).
+/// @return how many clients went in.
+uint32_t handoff_pack(handoff_buf_t *b){
+	handoff_put_u32(b, HANDOFF_MAGIC);
+	handoff_put_u32(b, HANDOFF_VERSION);
+	handoff_put_u32(b, (uint32_t)nshards);
+	for(int i = 0; i < nshards; i++){
+		handoff_put_fd(b, shards[i].listenfd);
+	}
+	handoff_put_u32(b, (uint32_t)uid);
+	handoff_put_u64(b, room_seq_now());
+
+	size_t at = b->len;
+	handoff_ring_t rooms = { b, 0 };
+	handoff_put_u32(b, 0);
+	if(room_ring_size() > 0){
+		rcu_read_lock();
+		room_each(handoff_pack_room, &rooms);
+		rcu_read_unlock();
+	}
+	if(!b->err){
+		memcpy(b->data + at, &rooms.n, sizeof(rooms.n));
+	}
+	roster_pack(b);
+
+	uint32_t n = 0;
+	uint64_t now = metrics_now_ns();
+	for(parked_t *p = park_head; p; p = p->next){
+		n++;
+	}
+	handoff_put_u32(b, n);
+	for(parked_t *p = park_head; p; p = p->next){
+		handoff_put_str(b, p->name);
+		handoff_put_u32(b, (uint32_t)p->reg.uid);
+		handoff_put_u64(b, p->token);
+		handoff_pack_rooms(b, p->rooms, p->nrooms, p->current);
+		handoff_put_u32(b, p->expires > now ? (uint32_t)((p->expires - now) / 1000000) : 0);
+	}
+
+	//broken clients go too: the new server finds out on its first read, and does what we would have.
+	n = 0;
+	for(int i = 0; i < nshards; i++){
+		n += (uint32_t)shards[i].nlocals;
+	}
+	handoff_put_u32(b, n);
+	for(int i = 0; i < nshards; i++){
+		for(int j = 0; j < shards[i].nlocals; j++){
+			handoff_pack_client(b, shards[i].locals[j]);
+		}
+	}
+	return n;
+}
+
+/// @brief the handoff thread, when a new server connects to -U: stops every shard, packs up everything and sends it.
+//			The shards and this thread meet at handoff_step four times: everyone has stopped reading; the threads
+//			expiring parked sessions and flushing rosters are held off (they post to the shards too); every shard has delivered what the
+//			others posted to it and written out its batch; the new server has everything (or didn't take it).
+//			Clients see none of it: their connections stay open and whatever they send meanwhile waits in the socket.
+/// @return 0 if the new server took over (the history is written out and the process ends), -1 if we carry on.
+int server_hand_off(int fd){
+	uint64_t start = metrics_now_ns();
+
+	atomic_store(&handoff_requested, 1);
+	for(int i = 0; i < nshards; i++){
+		shard_wake(&shards[i]);
+	}
+	pthread_barrier_wait(&handoff_step);
+	pthread_mutex_lock(&park_lock);
+	roster_stop();
+	pthread_barrier_wait(&handoff_step);
+	pthread_barrier_wait(&handoff_step);
+
+	handoff_buf_t b;
+	memset(&b, 0, sizeof(b));
+	uint32_t n = handoff_pack(&b);
+	int r = b.err ? -1 : handoff_send(fd, &b);
+	size_t bytes = b.len;
+	handoff_free(&b);
+
+	handoff_taken = (r == 0);
+	atomic_store(&handoff_requested, 0);
+	if(!handoff_taken){
+		pthread_mutex_unlock(&park_lock);
+		roster_go();
+	}
+	pthread_barrier_wait(&handoff_step);
+
+	if(r < 0){
+		printf("ERROR: the new server didn't take over, carrying on\n");
+		return -1;
+	}
+	printf("Handed %u clients (%zu bytes of state) to the new server in %.2f ms.\n", n, bytes,
+		(metrics_now_ns() - start) / 1e6);
+	history_shutdown();
+	return 0;
+}
+
+/// @brief checks that b is state we can read and reads how many listening sockets it has.
+/// @return that many (they're descriptors 0 to n - 1), or -1 if it isn't.
+int handoff_open(handoff_buf_t *b){
+	if(handoff_get_u32(b) != HANDOFF_MAGIC || handoff_get_u32(b) != HANDOFF_VERSION){
+		printf("ERROR: the old server handed over something we can't read\n");
+		return -1;
+	}
+	uint32_t n = handoff_get_u32(b);
+	return b->err || n > (uint32_t)b->nfds ? -1 : (int)n;
+}
+
+/// @brief reads a room list put there by handoff_pack_rooms into names[], and which one is current (-1 for none).
+/// @return how many rooms.
+int handoff_get_rooms(handoff_buf_t *b, char names[][ROOM_NAME_SZ], int *current){
+	int n = handoff_get_u8(b);
+	if(n > ROOMS_PER_CLIENT){
+		b->err = 1;
+		n = 0;
+	}
+	for(int i = 0; i < n; i++){
+		handoff_get_str(b, names[i], ROOM_NAME_SZ);
+	}
+	int c = handoff_get_u8(b);
+	*current = (c == HANDOFF_NO_ROOM || c >= n) ? -1 : c;
+	return n;
+}
+
+/// @brief a parked session the old server was keeping, kept here for the time it had left.
+void handoff_take_parked(handoff_buf_t *b){
+	char names[ROOMS_PER_CLIENT][ROOM_NAME_SZ];
+	parked_t *p = calloc(1, sizeof(parked_t));
+	char name[NAME_SZ];
+
+	handoff_get_str(b, name, NAME_SZ);
+	int id = (int)handoff_get_u32(b);
+	uint64_t token = handoff_get_u64(b);
+	int current, nrooms = handoff_get_rooms(b, names, &current);
+	uint64_t left_ms = handoff_get_u32(b);
+	if(!p || b->err || park_grace == 0){
+		free(p);
+		return;
+	}
+
+	memcpy(p->name, name, NAME_SZ);
+	p->reg.uid = id;
+	p->reg.name = p->name;
+	p->token = token;
+	p->current = -1;
+	p->expires = metrics_now_ns() + left_ms * 1000000u;
+	for(int i = 0; i < nrooms; i++){
+		room_t *room = room_hold_name(names[i]);
+		if(room){
+			if(i == current){
+				p->current = p->nrooms;
+			}
+			p->rooms[p->nrooms++] = room;
+		}
+	}
+
+	pthread_mutex_lock(&park_lock);
+	if(registry_add(&parked, &p->reg) < 0 || registry_set_name(&parked, &p->reg) < 0){
+		registry_remove(&parked, &p->reg);
+		pthread_mutex_unlock(&park_lock);
+		for(int i = 0; i < p->nrooms; i++){
+			room_release(p->rooms[i]);
+		}
+		free(p);
+		return;
+	}
+	p->prev = park_tail;
+	if(park_tail){
+		park_tail->next = p;
+	} else {
+		park_head = p;
+		pthread_cond_signal(&park_cond);
+	}
+	park_tail = p;
+	pthread_mutex_unlock(&park_lock);
+}
+
+/// @brief a client the old server handed over, set up on shard sh the way it was there: same uid, name, rooms and token,
+//			with what the old server still owed it queued first. What it had sent but wasn't handled is left in its
+//			receive buffer for handoff_unpack to handle once everyone is here.
+/// @return the client, or NULL if it's gone (out of memory, or the record doesn't make sense).
+client_t *handoff_take_client(handoff_buf_t *b, shard_t *sh){
+	char names[ROOMS_PER_CLIENT][ROOM_NAME_SZ];
+	char name[NAME_SZ];
+
+	int fd = handoff_get_fd(b, handoff_get_u32(b));
+	in_addr_t addr = handoff_get_u32(b);
+	in_port_t port = (in_port_t)handoff_get_u32(b);
+	int id = (int)handoff_get_u32(b);
+	int framed = handoff_get_u8(b);
+	int named = handoff_get_u8(b);
+	handoff_get_str(b, name, NAME_SZ);
+	uint64_t token = handoff_get_u64(b);
+	int current, nrooms = handoff_get_rooms(b, names, &current);
+	uint32_t outlen = handoff_get_u32(b);
+	const char *out = handoff_get(b, outlen);
+	uint32_t inlen = handoff_get_u32(b);
+	const char *in = handoff_get(b, inlen);
+	if(b->err){
+		return NULL;
+	}
+
+	client_t *cli = slab_alloc(&client_pool);
+	if(!cli){
+		perror("ERROR: could not allocate client");
+		close(fd);
+		return NULL;
+	}
+	cli->address.sin_family = AF_INET;
+	cli->address.sin_addr.s_addr = addr;
+	cli->address.sin_port = port;
+	cli->sockfd = fd;
+	cli->uid = id;
+	cli->reg.uid = id;
+	cli->framed = framed;
+	memcpy(cli->name, name, NAME_SZ);
+	client_account(cli, (long)client_pool.size);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = cli;
+	if(registry_add(&registry, &cli->reg) < 0){
+		perror("ERROR: could not register client");
+		close(fd);
+		client_account(cli, -(long)cli->mem);
+		client_free(cli);
+		return NULL;
+	}
+	if(named){
+		cli->reg.name = cli->name;
+		cli->named = (registry_set_name(&registry, &cli->reg) == 0);
+	}
+	if((named && !cli->named) || shard_attach(sh, cli) < 0 || epoll_ctl(sh->epfd, EPOLL_CTL_ADD, fd, &ev) < 0){
+		perror("ERROR: could not register client");
+		registry_remove(&registry, &cli->reg);
+		if(cli->shard){
+			shard_detach(cli);
+		}
+		close(fd);
+		client_account(cli, -(long)cli->mem);
+		rcu_retire(cli, client_free);
+		return NULL;
+	}
+	cli->events = ev.events;
+	cli->token = token;
+	cli_count++;
+	shard_watch_idle(sh, cli);
+
+	for(int i = 0; i < nrooms; i++){
+		room_t *room = room_join(names[i], cli, sh->id);
+		if(room){
+			if(i == current || !cli->room){
+				cli->room = room;
+			}
+			cli->rooms[cli->nrooms++] = room;
+		}
+	}
+	if(current < 0){
+		cli->room = NULL;
+	}
+
+	if(outlen > 0){
+		msgbuf_t *m = msgbuf_alloc(outlen);
+		if(m){
+			memcpy(m->data, out, outlen);
+			m->len = outlen;
+			outq_push(cli, m, 0, outlen);
+			msgbuf_unref(m);
+		} else {
+			client_kill(cli);
+		}
+	}
+	if(inlen > 0){
+		cli->rbuf = msgbuf_alloc(inlen > RBUF_SZ ? inlen : RBUF_SZ);
+		if(cli->rbuf){
+			client_account(cli, (long)cli->rbuf->cap);
+			memcpy(cli->rbuf->data, in, inlen);
+			cli->rlen = inlen;
+		} else {
+			client_kill(cli);
+		}
+	}
+	return cli;
+}
+
+/// @brief sets us up with what the old server handed over (see handoff_pack), once the shards exist: message numbers,
+//			rings, rosters, parked sessions and clients, and then whatever the clients had sent that the old server hadn't
+//			handled. nlisten is how many listening sockets it handed us; connections waiting on the ones no shard
+//			took are accepted here, and those sockets closed.
+/// @return 0 on success, -1 if what we got doesn't make sense.
+int handoff_unpack(handoff_buf_t *b, int nlisten){
+	uint64_t start = metrics_now_ns();
+
+	//no roster goes out until everyone is back in its room.
+	roster_stop();
+	int next = (int)handoff_get_u32(b);
+	if(next > uid){
+		uid = next;
+	}
+	room_seq_start(handoff_get_u64(b));
+
+	//the rings go in before anyone is back in the rooms, so nothing new can come before the old messages.
+	//Each room is held meanwhile, so it's still there once its members are.
+	uint32_t nrooms = handoff_get_u32(b);
+	room_t **held = calloc(nrooms ? nrooms : 1, sizeof(room_t *));
+	if(!held){
+		printf("ERROR: out of memory\n");
+		return -1;
+	}
+	for(uint32_t i = 0; i < nrooms && !b->err; i++){
+		char name[ROOM_NAME_SZ];
+		handoff_get_str(b, name, ROOM_NAME_SZ);
+		uint64_t evicted = handoff_get_u64(b);
+		uint32_t n = handoff_get_u32(b);
+		held[i] = room_hold_name(name);
+		for(uint32_t j = 0; j < n && !b->err; j++){
+			uint64_t seq = handoff_get_u64(b);
+			int from = (int)handoff_get_u32(b);
+			uint32_t len = handoff_get_u32(b);
+			const char *data = handoff_get(b, len);
+			msgbuf_t *m = data ? msgbuf_alloc(len) : NULL;
+			if(m && held[i]){
+				memcpy(m->data, data, len);
+				m->len = len;
+				room_restore(held[i], evicted, seq, from, m);
+			}
+			if(m){
+				msgbuf_unref(m);
+			}
+		}
+	}
+
+	roster_unpack(b);
+
+	uint32_t nparked = handoff_get_u32(b);
+	for(uint32_t i = 0; i < nparked && !b->err; i++){
+		handoff_take_parked(b);
+	}
+
+	//spread over our shards however many the old server had.
+	uint32_t nclients = handoff_get_u32(b);
+	client_t **clients = calloc(nclients ? nclients : 1, sizeof(client_t *));
+	if(!clients){
+		//nobody can be taken on: hang up on them all (they reconnect and resume) rather than leave them waiting,
+		//along with the listening sockets no shard took.
+		printf("ERROR: out of memory\n");
+		for(int i = nshards; i < b->nfds; i++){
+			close(b->fds[i]);
+		}
+		for(uint32_t i = 0; i < nrooms; i++){
+			if(held[i]){
+				room_release(held[i]);
+			}
+		}
+		free(held);
+		roster_go();
+		return -1;
+	}
+	uint32_t taken = 0;
+	for(uint32_t i = 0; i < nclients && !b->err; i++){
+		client_t *cli = handoff_take_client(b, &shards[i % (uint32_t)nshards]);
+		if(cli){
+			clients[taken++] = cli;
+		}
+	}
+
+	for(uint32_t i = 0; i < nrooms; i++){
+		if(held[i]){
+			room_release(held[i]);
+		}
+	}
+	free(held);
+
+	//now that everybody's here, the messages nobody had handled yet go out, as if the old server had just read them.
+	for(uint32_t i = 0; i < taken; i++){
+		client_t *cli = clients[i];
+		if(cli->rbuf && !cli->dead){
+			cur_shard = cli->shard;
+			if(client_parse_frames(cli) < 0){
+				client_kill(cli);
+			}
+		}
+	}
+	cur_shard = NULL;
+	free(clients);
+	roster_go();
+
+	for(int i = nshards; i < nlisten; i++){
+		int listenfd = handoff_get_fd(b, (uint32_t)i);
+		fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+		for(int j = 0; ; j++){
+			struct sockaddr_in cli_addr;
+			socklen_t clilen = sizeof(cli_addr);
+			int connfd = accept4(listenfd, (struct sockaddr*)&cli_addr, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if(connfd < 0){
+				break;
+			}
+			shard_adopt(&shards[j % nshards], connfd, &cli_addr);
+		}
+		close(listenfd);
+	}
+
+	if(b->err){
+		printf("ERROR: what the old server handed over doesn't make sense\n");
+		return -1;
+	}
+	printf("Took over %u clients and %u parked sessions from the old server (%.2f ms to set them up).\n",
+		taken, nparked, (metrics_now_ns() - start) / 1e6);
+	return 0;
+}
+
+/// @brief starts nshards epoll workers, each with its own listening socket, and waits on them.
+int run_shards(char *ip, int port){
+	shards = calloc(nshards, sizeof(shard_t));
+
+	//a hot restart hands us the old server's listening sockets; shards beyond those get new ones.
+	int nlisten = taken_over ? handoff_open(&handed) : 0;
+	if(nlisten < 0){
+		return -1;
+	}
+	for(int i = 0; i < nshards; i++){
+		int listenfd = i < nlisten ? handoff_get_fd(&handed, (uint32_t)i) : open_listener(ip, port);
+		if(listenfd < 0 || shard_init(&shards[i], i, listenfd) < 0){
+			return -1;
+		}
+	}
+
+	if(taken_over){
+		if(handoff_unpack(&handed, nlisten) < 0){
+			return -1;
+		}
+		handoff_free(&handed);
+	}
+	if(handoff_path){
+		pthread_barrier_init(&handoff_step, NULL, (unsigned)nshards + 1);
+		if(handoff_listen(handoff_path, server_hand_off) < 0){
+			return -1;
+		}
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = request_stats_dump;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	for(int i = 0; i < nshards; i++){
+		if(pthread_create(&shards[i].thread, NULL, server_mode == SERVER_URING ? &uring_loop : &shard_loop, &shards[i]) != 0){
+			printf("ERROR: pthread\n");
+			return -1;
+		}
+	}
+
+	for(int i = 0; i < nshards; i++){
+		pthread_join(shards[i].thread, NULL);
+	}
+
+	return 0;
+}
+
+/// @brief SIGINT/SIGTERM: lets the history writer finish what's queued; it ends the process once that's on disk.
+void request_shutdown(int sig){
+	(void)sig;
+	history_shutdown();
+}
+
+void usage(char *prog){
+	printf("Usage: %s [-m threaded|epoll|uring] [-w workers] [-c max_clients] [-q queue_len] [-p drop|disconnect|backpressure] [-d history_dir] [-f never|batch|<ms>] [-r replay_count] [-a admin_socket] [-l batch_us|off] [-R rate[/burst]] [-I rate[/burst]] [-F throttle|disconnect] [-s resume_ring] [-g grace_secs] [-k ping_secs] [-W roster_ms] [-N node_id] [-L link_port] [-P peer_host:link_port]... [-U handoff_socket] <port>\n", prog);
+}
+
+/// @brief reads a -R or -I limit: messages a second, and optionally how many at once (twice the rate if not given).
+//			"0" (or "off") turns the limit off.
+/// @return 0 on success, -1 if it doesn't parse.
+int parse_rate(const char *arg, unsigned *rate, unsigned *burst){
+	char *end;
+	if(strcmp(arg, "off") == 0){
+		*rate = *burst = 0;
+		return 0;
+	}
+
+	long r = strtol(arg, &end, 10);
+	long b = 2 * r;
+	if(end == arg || r < 0 || r > 1000000){
+		return -1;
+	}
+	if(*end == '/'){
+		const char *from = end + 1;
+		b = strtol(from, &end, 10);
+		if(end == from || b < 1 || b > 1000000){
+			return -1;
+		}
+	}
+	if(*end != '\0'){
+		return -1;
+	}
+	*rate = (unsigned)r;
+	*burst = b > 0 ? (unsigned)b : 1;
+	return 0;
+}
+
+int main(int argc, char **argv){
+	int opt;
+	unsigned conn_rate = RATE_DEFAULT, conn_burst = BURST_DEFAULT, ip_rate = 0, ip_burst = 0;
+	link_config_t links = { 0, 0, { NULL }, 0 };
+
+	//one epoll worker per core unless told otherwise.
+	nshards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(nshards < 1){
+		nshards = 1;
+	}
+
+	while((opt = getopt(argc, argv, "m:w:c:q:p:d:f:r:a:l:R:I:F:s:g:k:W:N:L:P:U:")) != -1){
+		switch(opt){
+		case 'm':
+			if(strcmp(optarg, "threaded") == 0){
+				server_mode = SERVER_THREADED;
+			} else if(strcmp(optarg, "epoll") == 0){
+				server_mode = SERVER_EPOLL;
+			} else if(strcmp(optarg, "uring") == 0){
+				server_mode = SERVER_URING;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			nshards = atoi(optarg);
+			if(nshards < 1){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			max_clients = atoi(optarg);
+			if(max_clients < 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'q':
+			//round up to a power of two so the ring can wrap with a mask.
+			out_capacity = 2;
+			while(out_capacity < (unsigned)atoi(optarg) && out_capacity < (1u << 20)){
+				out_capacity <<= 1;
+			}
+			break;
+		case 'p':
+			if(strcmp(optarg, "drop") == 0){
+				slow_policy = SLOW_DROP_OLDEST;
+			} else if(strcmp(optarg, "disconnect") == 0){
+				slow_policy = SLOW_DISCONNECT;
+			} else if(strcmp(optarg, "backpressure") == 0){
+				slow_policy = SLOW_BACKPRESSURE;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'd':
+			history_config.dir = optarg;
+			break;
+		case 'f':
+			//fsync after every batch, never, or at most every <ms> milliseconds.
+			if(strcmp(optarg, "never") == 0){
+				history_config.fsync_policy = HISTORY_FSYNC_NEVER;
+			} else if(strcmp(optarg, "batch") == 0){
+				history_config.fsync_policy = HISTORY_FSYNC_BATCH;
+			} else if(atoi(optarg) > 0){
+				history_config.fsync_policy = HISTORY_FSYNC_INTERVAL;
+				history_config.fsync_interval_ms = atoi(optarg);
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'r':
+			replay_count = atoi(optarg);
+			if(replay_count < 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'a':
+			admin_path = optarg;
+			break;
+		case 'l':
+			//how long epoll mode may hold messages to write them together, in microseconds, or off.
+			if(strcmp(optarg, "off") == 0){
+				batch_budget_us = BATCH_OFF;
+			} else if(atol(optarg) >= 0 && optarg[0] >= '0' && optarg[0] <= '9'){
+				batch_budget_us = atol(optarg);
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'R':
+			//flood control per connection: messages a second, and how many it may send at once.
+			if(parse_rate(optarg, &conn_rate, &conn_burst) < 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'I':
+			//the same, shared by every connection from one address.
+			if(parse_rate(optarg, &ip_rate, &ip_burst) < 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'F':
+			if(strcmp(optarg, "throttle") == 0){
+				flood_policy = FLOOD_THROTTLE;
+			} else if(strcmp(optarg, "disconnect") == 0){
+				flood_policy = FLOOD_DISCONNECT;
+			} else {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 's':
+			//messages every room keeps for resuming clients, 0 for none.
+			if(optarg[0] < '0' || optarg[0] > '9'){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			resume_ring = (unsigned)atoi(optarg);
+			break;
+		case 'g':
+			//seconds a dropped client has to come back, 0 to end sessions right away.
+			if(optarg[0] < '0' || optarg[0] > '9'){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			park_grace = atoi(optarg);
+			break;
+		case 'k':
+			//seconds a client may be quiet before it's sent a PING, 0 for no keepalives.
+			if(optarg[0] < '0' || optarg[0] > '9'){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			ping_secs = atoi(optarg);
+			break;
+		case 'W':
+			//milliseconds a room's joins and leaves are collected before they go out together.
+			if(optarg[0] < '0' || optarg[0] > '9'){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			roster_window = atoi(optarg);
+			break;
+		case 'N':
+			//this node's id among linked servers (default: its client port).
+			links.node = atoi(optarg);
+			if(links.node <= 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'L':
+			//the port other nodes link to.
+			links.port = atoi(optarg);
+			if(links.port <= 0){
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'P':
+			//a node to link to, host:link_port. Once per peer.
+			if(links.npeers == LINK_MAX_PEERS){
+				printf("At most %d peers.\n", LINK_MAX_PEERS);
+				return EXIT_FAILURE;
+			}
+			links.peers[links.npeers++] = optarg;
+			break;
+		case 'U':
+			//hot restart: take over from the server on this socket if there is one, and hand over to the next one.
+			handoff_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	//io_uring mode needs a kernel (and a build) that has everything it uses; otherwise it's epoll mode.
+	if(server_mode == SERVER_URING && uring_usable() < 0){
+		printf("io_uring isn't usable here (%s), using epoll instead.\n", strerror(errno));
+		server_mode = SERVER_EPOLL;
+	}
+	history_config.uring = (server_mode == SERVER_URING);
+	ratelimit_config(conn_rate, conn_burst, ip_rate, ip_burst);
+
+	//the backlog has to fit in a new client's outbound queue, with room to spare for live messages.
+	if(server_mode != SERVER_THREADED && replay_count > (int)out_capacity / 2){
+		replay_count = (int)out_capacity / 2;
+	}
+
+	//if we don't have a port argument, don't enter the server method.
+	if(optind != argc - 1){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char *ip = "127.0.0.1";
+	int port = atoi(argv[optind]);
+
+	/* Ignore pipe signals. */
+	signal(SIGPIPE, SIG_IGN);
+
+	//every client is a file descriptor, so take all of them the system lets us have.
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max){
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	slab_init(&client_pool, sizeof(client_t));
+
+	//one member slice per event loop, so each loop only walks the members it owns.
+	if(registry_init(&registry) < 0 || rooms_init(server_mode != SERVER_THREADED ? nshards : 1, resume_ring) < 0){
+		printf("ERROR: out of memory\n");
+		return EXIT_FAILURE;
+	}
+	if(park_grace > 0 && park_start() < 0){
+		printf("ERROR: could not start the session parking thread\n");
+		return EXIT_FAILURE;
+	}
+	if(roster_start(roster_window, roster_send_snapshot, roster_send_delta) < 0){
+		printf("ERROR: could not start the roster thread\n");
+		return EXIT_FAILURE;
+	}
+
+	//a hot restart: the old server's sockets and sessions come over before anything else starts, and once we have them
+	//it writes out its history and exits (so the history, link port and admin socket are free for us).
+	if(handoff_path){
+		if(server_mode != SERVER_EPOLL){
+			printf("ERROR: hot restart (-U) needs epoll mode\n");
+			return EXIT_FAILURE;
+		}
+		taken_over = handoff_take(handoff_path, &handed);
+		if(taken_over < 0){
+			return EXIT_FAILURE;
+		}
+	}
+
+	history_config.replay = replay_send;
+	if(history_start(&history_config) < 0){
+		return EXIT_FAILURE;
+	}
+
+	//other nodes sharing our rooms.
+	if(links.port > 0 || links.npeers > 0){
+		if(links.node == 0){
+			links.node = port;
+		}
+		if(link_start(&links, link_deliver) < 0){
+			return EXIT_FAILURE;
+		}
+	}
+
+	//counters, histograms and queue depths, for curl --unix-socket or Prometheus.
+	if(admin_path && metrics_serve(admin_path, server_metrics) < 0){
+		return EXIT_FAILURE;
+	}
+
+	//on Ctrl+C or kill, flush the chat history before going down.
+	signal(SIGINT, request_shutdown);
+	signal(SIGTERM, request_shutdown);
+
+	printf("   _____ _               _     _   _____  _                       _ \n");
+  	printf("  / ____| |             (_)   | | |  __ \\(_)                     | |\n");
+ 	printf(" | (___ | |_ _   _ _ __  _  __| | | |  | |_ ___  ___ ___  _ __ __| |\n");
+  	printf("  \\___ \\| __| | | | '_ \\| |/ _` | | |  | | / __|/ __/ _ \\| '__/ _` |\n");
+  	printf("  ____) | |_| |_| | |_) | | (_| | | |__| | \\__ \\ (_| (_) | | | (_| |\n");
+ 	printf(" |_____/ \\__|\\__,_| .__/|_|\\__,_| |_____/|_|___/\\___\\___/|_|  \\__,_|\n");
+ 	printf("                  | |                                               \n");
+ 	printf("                  |_|                                               \n");
+
+	if(server_mode != SERVER_THREADED){
+		if(run_shards(ip, port) < 0){
+			return EXIT_FAILURE;
+		}
+	} else {
+		int listenfd = open_listener(ip, port);
+		if(listenfd < 0){
+			return EXIT_FAILURE;
+		}
+		run_threaded(listenfd);
 	}
 
 	return EXIT_SUCCESS;
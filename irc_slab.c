@@ -0,0 +1,74 @@
+/*
+ * File: irc_slab.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The object pools behind irc_slab.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "irc_slab.h"
+
+void slab_init(slab_pool_t *p, size_t size){
+	memset(p, 0, sizeof(*p));
+	pthread_mutex_init(&p->lock, NULL);
+
+	//16 byte aligned, and big enough to hold the free list link.
+	if(size < sizeof(slab_obj_t)){
+		size = sizeof(slab_obj_t);
+	}
+	p->size = (size + 15) & ~(size_t)15;
+	p->per_chunk = SLAB_CHUNK / p->size;
+	if(p->per_chunk < 1){
+		p->per_chunk = 1;
+	}
+}
+
+/// @brief allocates another chunk and puts all of its objects on the free list. Called with the lock held.
+static int slab_grow(slab_pool_t *p){
+	char *chunk = malloc(p->size * p->per_chunk);
+	if(!chunk){
+		return -1;
+	}
+
+	//push them in reverse, so they're handed out front to back.
+	for(size_t i = p->per_chunk; i-- > 0; ){
+		slab_obj_t *o = (slab_obj_t *)(chunk + i * p->size);
+		o->next = p->free;
+		p->free = o;
+	}
+	p->chunks++;
+	return 0;
+}
+
+void *slab_alloc(slab_pool_t *p){
+	pthread_mutex_lock(&p->lock);
+	if(!p->free && slab_grow(p) < 0){
+		pthread_mutex_unlock(&p->lock);
+		return NULL;
+	}
+	slab_obj_t *o = p->free;
+	p->free = o->next;
+	p->in_use++;
+	pthread_mutex_unlock(&p->lock);
+
+	memset(o, 0, p->size);
+	return o;
+}
+
+void slab_free(slab_pool_t *p, void *obj){
+	slab_obj_t *o = obj;
+
+	pthread_mutex_lock(&p->lock);
+	o->next = p->free;
+	p->free = o;
+	p->in_use--;
+	pthread_mutex_unlock(&p->lock);
+}
+
+void slab_stats(slab_pool_t *p, size_t *in_use, size_t *reserved){
+	pthread_mutex_lock(&p->lock);
+	*in_use = p->in_use;
+	*reserved = p->chunks * p->per_chunk * p->size;
+	pthread_mutex_unlock(&p->lock);
+}
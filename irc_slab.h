@@ -0,0 +1,54 @@
+/*
+ * File: irc_slab.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Pools of same-sized objects (clients, outbound queue rings).
+ *
+ *	A pool carves its objects out of chunks of at least SLAB_CHUNK bytes and keeps the free ones
+ *	on a list, so a connection coming and going is a pop and a push instead of a malloc and a free,
+ *	and a few thousand clients sit next to each other in a few dozen chunks instead of all over the heap.
+ *	Chunks are kept for the life of the pool, so it only ever grows to its high-water mark.
+ *
+ *	The lock is only there for pools used from more than one thread; a pool that one thread owns
+ *	(like a shard's rings) never finds it taken.
+ */
+
+#ifndef IRC_SLAB_H
+#define IRC_SLAB_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define SLAB_CHUNK (64 * 1024)
+
+typedef struct slab_obj{
+	struct slab_obj *next;
+} slab_obj_t;
+
+typedef struct{
+	pthread_mutex_t lock;
+
+	/// @brief object size (rounded up to 16 bytes) and how many fit in a chunk.
+	size_t size;
+	size_t per_chunk;
+
+	slab_obj_t *free;
+
+	/// @brief objects handed out right now, and chunks we've allocated (for the memory accounting).
+	size_t in_use;
+	size_t chunks;
+} slab_pool_t;
+
+/// @brief sets up an empty pool of size-byte objects.
+void slab_init(slab_pool_t *p, size_t size);
+
+/// @brief gets a zeroed object.
+/// @return the object, or NULL if we're out of memory.
+void *slab_alloc(slab_pool_t *p);
+
+/// @brief puts an object back.
+void slab_free(slab_pool_t *p, void *obj);
+
+/// @brief objects in use and bytes the pool has allocated, read under the pool's lock.
+void slab_stats(slab_pool_t *p, size_t *in_use, size_t *reserved);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * File: irc_timer.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The timer wheel behind irc_timer.h.
+ */
+
+#include <time.h>
+
+#include "irc_timer.h"
+
+#define TIMER_MASK (TIMER_SLOTS - 1)
+#define TICK_NS ((uint64_t)TIMER_TICK_MS * 1000000)
+
+/// @brief the furthest ahead a timer can be; anything later is put there (and fires early, after 19 days).
+#define TIMER_SPAN ((uint64_t)1 << (TIMER_LEVELS * TIMER_BITS))
+
+static uint64_t clock_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t timer_ticks(void){
+	return clock_ns() / TICK_NS;
+}
+
+void timer_init(timer_wheel_t *w, uint64_t now){
+	w->now = now;
+	for(int level = 0; level < TIMER_LEVELS; level++){
+		for(int i = 0; i < TIMER_SLOTS; i++){
+			w->slots[level][i].next = w->slots[level][i].prev = &w->slots[level][i];
+		}
+		w->used[level] = 0;
+	}
+}
+
+/// @brief puts t on the list its expiry belongs on, counted from w->now.
+static void timer_place(timer_wheel_t *w, wheel_timer_t *t){
+	if((int64_t)(t->expires - w->now) < 0){
+		t->expires = w->now;
+	}
+	uint64_t delta = t->expires - w->now;
+	if(delta >= TIMER_SPAN){
+		t->expires = w->now + TIMER_SPAN - 1;
+		delta = TIMER_SPAN - 1;
+	}
+
+	int level = 0;
+	while(delta >= (uint64_t)1 << ((level + 1) * TIMER_BITS)){
+		level++;
+	}
+	int i = (int)((t->expires >> (level * TIMER_BITS)) & TIMER_MASK);
+
+	wheel_timer_t *head = &w->slots[level][i];
+	t->slot = level * TIMER_SLOTS + i;
+	t->prev = head->prev;
+	t->next = head;
+	head->prev->next = t;
+	head->prev = t;
+	w->used[level] |= (uint64_t)1 << i;
+}
+
+static void timer_unlink(timer_wheel_t *w, wheel_timer_t *t){
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = t->prev = NULL;
+
+	int level = t->slot / TIMER_SLOTS, i = t->slot % TIMER_SLOTS;
+	if(w->slots[level][i].next == &w->slots[level][i]){
+		w->used[level] &= ~((uint64_t)1 << i);
+	}
+}
+
+void timer_arm(timer_wheel_t *w, wheel_timer_t *t, uint64_t expires){
+	if(timer_armed(t)){
+		timer_unlink(w, t);
+	}
+	t->expires = expires;
+	timer_place(w, t);
+}
+
+void timer_cancel(timer_wheel_t *w, wheel_timer_t *t){
+	if(timer_armed(t)){
+		timer_unlink(w, t);
+	}
+}
+
+/// @brief moves a slot's whole list onto list (an empty head), leaving the slot empty.
+static void timer_take(timer_wheel_t *w, int level, int i, wheel_timer_t *list){
+	wheel_timer_t *head = &w->slots[level][i];
+	if(head->next == head){
+		list->next = list->prev = list;
+		return;
+	}
+	list->next = head->next;
+	list->prev = head->prev;
+	list->next->prev = list;
+	list->prev->next = list;
+	head->next = head->prev = head;
+	w->used[level] &= ~((uint64_t)1 << i);
+}
+
+/// @brief empties slot i of a level into the levels below it, now that it's within their reach.
+static void timer_cascade(timer_wheel_t *w, int level, int i){
+	wheel_timer_t list;
+	timer_take(w, level, i, &list);
+	while(list.next != &list){
+		wheel_timer_t *t = list.next;
+		list.next = t->next;
+		t->next->prev = &list;
+		timer_place(w, t);
+	}
+}
+
+void timer_run(timer_wheel_t *w, uint64_t now, timer_fn fn, void *arg){
+	while((int64_t)(now - w->now) >= 0){
+		uint64_t idle = 0;
+		for(int level = 0; level < TIMER_LEVELS; level++){
+			idle |= w->used[level];
+		}
+		if(!idle){
+			//nothing armed: no tick in between has anything to do.
+			w->now = now + 1;
+			return;
+		}
+
+		int i = (int)(w->now & TIMER_MASK);
+
+		//level 0 came round: the next slot of each level up (as far as that one came round too) moves down.
+		for(int level = 1; i == 0 && level < TIMER_LEVELS; level++){
+			int up = (int)((w->now >> (level * TIMER_BITS)) & TIMER_MASK);
+			timer_cascade(w, level, up);
+			if(up != 0){
+				break;
+			}
+		}
+
+		//anything fn arms from here on counts from the tick after this one, so it never lands on the list at hand.
+		wheel_timer_t list;
+		timer_take(w, 0, i, &list);
+		w->now++;
+
+		while(list.next != &list){
+			wheel_timer_t *t = list.next;
+			list.next = t->next;
+			t->next->prev = &list;
+			t->next = t->prev = NULL;
+			fn(t, arg);
+		}
+	}
+}
+
+uint64_t timer_wait_ns(const timer_wheel_t *w){
+	int i = (int)(w->now & TIMER_MASK);
+	uint64_t ticks = UINT64_MAX;
+
+	//the nearest used slot on level 0, counting round from the next tick.
+	uint64_t used = w->used[0];
+	if(used){
+		uint64_t turned = i ? (used >> i) | (used << (TIMER_SLOTS - i)) : used;
+		ticks = (uint64_t)__builtin_ctzll(turned);
+	}
+
+	//anything further up moves down when level 0 next comes round.
+	for(int level = 1; level < TIMER_LEVELS; level++){
+		if(w->used[level]){
+			uint64_t wrap = (uint64_t)((TIMER_SLOTS - i) & TIMER_MASK);
+			if(wrap < ticks){
+				ticks = wrap;
+			}
+			break;
+		}
+	}
+
+	if(ticks == UINT64_MAX){
+		return UINT64_MAX;
+	}
+	uint64_t due = (w->now + ticks) * TICK_NS, now = clock_ns();
+	return due > now ? due - now : 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * File: irc_timer.h
+ * Project: CSCI 3160 Chat Project
+ * Description: A hierarchical timer wheel, for timeouts on every connection without a thread or a sort.
+ *
+ *	Time goes in ticks (TIMER_TICK_MS each). The wheel has TIMER_LEVELS levels of TIMER_SLOTS slots: level 0
+ *	has a slot per tick for the next TIMER_SLOTS ticks, level 1 a slot per TIMER_SLOTS ticks, and so on, so four
+ *	levels of 64 reach 64^4 ticks (about 19 days) ahead. A timer sits on the list of the slot its expiry falls in
+ *	at the coarsest level it needs, which is a shift and a mask to work out. Arming and cancelling are a list
+ *	insert and unlink. Every time level 0 comes round, the next slot up is emptied into the levels below it, so a
+ *	timer moves down at most TIMER_LEVELS - 1 times before it fires, and a tick with nothing due costs nothing.
+ *
+ *	A wheel belongs to one thread (a shard); nothing here is locked. The timer itself lives inside whatever it
+ *	times (a client_t), so nothing is allocated either.
+ */
+
+#ifndef IRC_TIMER_H
+#define IRC_TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_TICK_MS 100
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+
+/// @brief one timer. Zeroed, it isn't armed.
+typedef struct wheel_timer{
+	struct wheel_timer *next;
+	struct wheel_timer *prev;
+
+	/// @brief the tick it fires on.
+	uint64_t expires;
+
+	/// @brief level * TIMER_SLOTS + slot of the list it's on (while it's armed).
+	int slot;
+} wheel_timer_t;
+
+typedef void (*timer_fn)(wheel_timer_t *t, void *arg);
+
+typedef struct{
+	/// @brief the next tick to run.
+	uint64_t now;
+
+	/// @brief each slot's list (its head is a timer that never fires), and which slots have anything on them.
+	wheel_timer_t slots[TIMER_LEVELS][TIMER_SLOTS];
+	uint64_t used[TIMER_LEVELS];
+} timer_wheel_t;
+
+/// @brief the clock the wheel runs on: ticks since boot (CLOCK_MONOTONIC).
+uint64_t timer_ticks(void);
+
+/// @brief an empty wheel, starting at tick now.
+void timer_init(timer_wheel_t *w, uint64_t now);
+
+/// @brief arms t to fire on tick expires (or on the next tick, if that's gone by). An armed t is moved.
+void timer_arm(timer_wheel_t *w, wheel_timer_t *t, uint64_t expires);
+
+/// @brief disarms t, if it's armed.
+void timer_cancel(timer_wheel_t *w, wheel_timer_t *t);
+
+static inline int timer_armed(const wheel_timer_t *t){
+	return t->next != NULL;
+}
+
+/// @brief runs every tick up to and including now: fn(t, arg) for each timer due, disarmed first, so fn may arm
+//			it again (or cancel others, or free the thing it's in).
+void timer_run(timer_wheel_t *w, uint64_t now, timer_fn fn, void *arg);
+
+/// @brief how long (nanoseconds) until the wheel next has anything to do (a timer due, or timers to move down a
+//			level): how long a loop running it may sleep. 0 if that's now, UINT64_MAX if nothing is armed.
+uint64_t timer_wait_ns(const timer_wheel_t *w);
+
+#endif
@@ -0,0 +1,307 @@
+/*
+ * File: irc_uring.c
+ * Project: CSCI 3160 Chat Project
+ * Description: The io_uring plumbing behind irc_uring.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "irc_uring.h"
+
+#if IRC_HAVE_URING
+
+/// @brief the ring indexes are shared with the kernel: we publish our side with release stores
+//			and read its side with acquire loads, so the sqes/cqes themselves are in place before the index moves.
+static inline unsigned load_acquire(unsigned *p){
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned *p, unsigned v){
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/// @brief checks every opcode in need[0..nneed) is one the kernel knows.
+static int probe(uring_t *r, const int *need, int nneed){
+	size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *p = calloc(1, len);
+	if(!p){
+		return -1;
+	}
+
+	int ok = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, p, 256) == 0;
+	for(int i = 0; ok && i < nneed; i++){
+		ok = need[i] <= p->last_op && (p->ops[need[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(p);
+	if(!ok){
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	return 0;
+}
+
+int uring_init(uring_t *r, unsigned entries, const int *need, int nneed){
+	struct io_uring_params p;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 4;
+
+	r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if(r->fd < 0){
+		return -1;
+	}
+
+	//uring_submit waits with a timeout argument, which came in 5.11.
+	if(!(p.features & IORING_FEAT_EXT_ARG)){
+		close(r->fd);
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	r->sq_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		if(r->cq_map_sz > r->sq_map_sz){
+			r->sq_map_sz = r->cq_map_sz;
+		}
+		r->cq_map_sz = 0;
+	}
+
+	r->sq_map = mmap(NULL, r->sq_map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if(r->sq_map == MAP_FAILED){
+		close(r->fd);
+		return -1;
+	}
+	r->cq_map = r->sq_map;
+	if(r->cq_map_sz){
+		r->cq_map = mmap(NULL, r->cq_map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if(r->cq_map == MAP_FAILED){
+			munmap(r->sq_map, r->sq_map_sz);
+			close(r->fd);
+			return -1;
+		}
+	}
+
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if(r->sqes == MAP_FAILED){
+		r->sqes = NULL;
+		uring_exit(r);
+		return -1;
+	}
+
+	char *sq = r->sq_map, *cq = r->cq_map;
+	r->sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->sq_entries = p.sq_entries;
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	//sqes are always used in ring order, so the indirection array never changes.
+	for(unsigned i = 0; i < r->sq_entries; i++){
+		r->sq_array[i] = i;
+	}
+	r->sqe_tail = r->submitted = *r->sq_tail;
+
+	if(probe(r, need, nneed) < 0){
+		int err = errno;
+		uring_exit(r);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+void uring_exit(uring_t *r){
+	if(r->sqes){
+		munmap(r->sqes, r->sqes_sz);
+	}
+	if(r->cq_map_sz){
+		munmap(r->cq_map, r->cq_map_sz);
+	}
+	munmap(r->sq_map, r->sq_map_sz);
+	close(r->fd);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *r){
+	if(r->sqe_tail - load_acquire(r->sq_head) >= r->sq_entries){
+		uring_submit(r, 0, NULL);
+		if(r->sqe_tail - load_acquire(r->sq_head) >= r->sq_entries){
+			return NULL;
+		}
+	}
+
+	struct io_uring_sqe *sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sqe_tail++;
+	return sqe;
+}
+
+int uring_submit(uring_t *r, unsigned wait_nr, const struct timespec *timeout){
+	unsigned to_submit = r->sqe_tail - r->submitted;
+	unsigned flags = 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	void *argp = NULL;
+	size_t argsz = 0;
+
+	if(to_submit == 0 && wait_nr == 0){
+		return 0;
+	}
+	store_release(r->sq_tail, r->sqe_tail);
+
+	if(wait_nr){
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+	if(timeout){
+		memset(&arg, 0, sizeof(arg));
+		ts.tv_sec = timeout->tv_sec;
+		ts.tv_nsec = timeout->tv_nsec;
+		arg.ts = (unsigned long long)(uintptr_t)&ts;
+		flags |= IORING_ENTER_EXT_ARG;
+		argp = &arg;
+		argsz = sizeof(arg);
+	}
+
+	int n = (int)syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr, flags, argp, argsz);
+	if(n > 0){
+		r->submitted += (unsigned)n;
+	}
+	return n;
+}
+
+struct io_uring_cqe *uring_peek(uring_t *r){
+	unsigned head = *r->cq_head;
+	if(head == load_acquire(r->cq_tail)){
+		return NULL;
+	}
+	return &r->cqes[head & *r->cq_mask];
+}
+
+void uring_seen(uring_t *r){
+	store_release(r->cq_head, *r->cq_head + 1);
+}
+
+int uring_bufs_init(uring_t *r, uring_bufs_t *b, int gid, unsigned count, unsigned size){
+	memset(b, 0, sizeof(*b));
+	b->ring = mmap(NULL, count * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(b->ring == MAP_FAILED){
+		return -1;
+	}
+	b->base = malloc((size_t)count * size);
+	if(!b->base){
+		munmap(b->ring, count * sizeof(struct io_uring_buf));
+		errno = ENOMEM;
+		return -1;
+	}
+	b->size = size;
+	b->count = count;
+	b->gid = gid;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)(uintptr_t)b->ring;
+	reg.ring_entries = count;
+	reg.bgid = (unsigned short)gid;
+	if(syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+		int err = errno;
+		free(b->base);
+		munmap(b->ring, count * sizeof(struct io_uring_buf));
+		errno = err;
+		return -1;
+	}
+
+	for(unsigned i = 0; i < count; i++){
+		uring_bufs_put(b, i);
+	}
+	return 0;
+}
+
+void uring_bufs_put(uring_bufs_t *b, unsigned bid){
+	struct io_uring_buf *buf = &b->ring->bufs[b->tail & (b->count - 1)];
+	buf->addr = (unsigned long long)(uintptr_t)uring_buf(b, bid);
+	buf->len = b->size;
+	buf->bid = (unsigned short)bid;
+	b->tail++;
+	__atomic_store_n(&b->ring->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+void uring_bufs_free(uring_bufs_t *b){
+	free(b->base);
+	munmap(b->ring, b->count * sizeof(struct io_uring_buf));
+	memset(b, 0, sizeof(*b));
+}
+
+#else
+
+int uring_init(uring_t *r, unsigned entries, const int *need, int nneed){
+	(void)entries;
+	(void)need;
+	(void)nneed;
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_exit(uring_t *r){
+	(void)r;
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *r){
+	(void)r;
+	return NULL;
+}
+
+int uring_submit(uring_t *r, unsigned wait_nr, const struct timespec *timeout){
+	(void)r;
+	(void)wait_nr;
+	(void)timeout;
+	errno = ENOSYS;
+	return -1;
+}
+
+struct io_uring_cqe *uring_peek(uring_t *r){
+	(void)r;
+	return NULL;
+}
+
+void uring_seen(uring_t *r){
+	(void)r;
+}
+
+int uring_bufs_init(uring_t *r, uring_bufs_t *b, int gid, unsigned count, unsigned size){
+	(void)r;
+	(void)b;
+	(void)gid;
+	(void)count;
+	(void)size;
+	errno = ENOSYS;
+	return -1;
+}
+
+void uring_bufs_put(uring_bufs_t *b, unsigned bid){
+	(void)b;
+	(void)bid;
+}
+
+void uring_bufs_free(uring_bufs_t *b){
+	(void)b;
+}
+
+#endif
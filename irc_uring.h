@@ -0,0 +1,109 @@
+/*
+ * File: irc_uring.h
+ * Project: CSCI 3160 Chat Project
+ * Description: Just enough io_uring for the server and the history writer, straight on the syscalls
+ *	(no liburing needed).
+ *
+ *	A ring is a submission queue we fill with requests (sqes) and a completion queue the kernel
+ *	fills with their results (cqes), both shared memory. uring_sqe() hands out the next free sqe,
+ *	uring_submit() tells the kernel about everything filled in since the last call (and can wait
+ *	for completions in the same syscall), and uring_peek()/uring_seen() walk the completions.
+ *	A provided buffer ring (uring_bufs_t) is a set of receive buffers the kernel picks from itself,
+ *	so a multishot recv doesn't need a buffer of its own per connection.
+ *
+ *	Everything here is for one thread per ring. Built without <linux/io_uring.h> (or with
+ *	-DIRC_NO_URING), uring_init() always fails with ENOSYS and callers fall back to what they did before.
+ */
+
+#ifndef IRC_URING_H
+#define IRC_URING_H
+
+#include <stddef.h>
+#include <time.h>
+
+#if defined(__linux__) && !defined(IRC_NO_URING) && __has_include(<linux/io_uring.h>)
+#define IRC_HAVE_URING 1
+#include <linux/io_uring.h>
+#else
+#define IRC_HAVE_URING 0
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+#endif
+
+typedef struct{
+	int fd;
+
+	/// @brief the submission queue: head/tail/mask/array live in the kernel's shared ring,
+	//			sqe_tail counts the sqes we handed out, submitted how many of those the kernel has seen.
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned sqe_tail;
+	unsigned submitted;
+
+	/// @brief the completion queue.
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/// @brief the mappings, for uring_exit().
+	void *sq_map;
+	size_t sq_map_sz;
+	void *cq_map;
+	size_t cq_map_sz;
+	size_t sqes_sz;
+} uring_t;
+
+/// @brief a provided buffer ring: count buffers of size bytes, registered as buffer group gid.
+typedef struct{
+	struct io_uring_buf_ring *ring;
+	char *base;
+	unsigned size;
+	unsigned count;
+	unsigned short tail;
+	int gid;
+} uring_bufs_t;
+
+/// @brief sets up a ring with room for entries submissions (and four times as many completions).
+//			Fails if the kernel lacks any of the opcodes in need[0..nneed) or the timeout argument uring_submit uses.
+/// @return 0 on success, -1 with errno set (ENOSYS: no io_uring here, EOPNOTSUPP: too old).
+int uring_init(uring_t *r, unsigned entries, const int *need, int nneed);
+
+void uring_exit(uring_t *r);
+
+/// @brief the next free sqe, zeroed. If the submission queue is full, what's in it is submitted first.
+/// @return the sqe, or NULL if the kernel wouldn't take the ones waiting.
+struct io_uring_sqe *uring_sqe(uring_t *r);
+
+/// @brief submits everything handed out since last time, and waits for wait_nr completions
+//			(or until timeout, if it isn't NULL). One io_uring_enter() either way.
+/// @return how many sqes were submitted, or -1 with errno set (ETIME and EINTR just mean "nothing yet").
+int uring_submit(uring_t *r, unsigned wait_nr, const struct timespec *timeout);
+
+/// @brief the oldest completion we haven't handled, or NULL.
+struct io_uring_cqe *uring_peek(uring_t *r);
+
+/// @brief marks the completion uring_peek() returned as handled.
+void uring_seen(uring_t *r);
+
+/// @brief registers count buffers of size bytes as buffer group gid, all of them ready to receive into.
+/// @return 0 on success, -1 with errno set.
+int uring_bufs_init(uring_t *r, uring_bufs_t *b, int gid, unsigned count, unsigned size);
+
+/// @brief buffer bid, as the kernel filled it.
+static inline char *uring_buf(uring_bufs_t *b, unsigned bid){
+	return b->base + (size_t)bid * b->size;
+}
+
+/// @brief hands buffer bid back to the kernel.
+void uring_bufs_put(uring_bufs_t *b, unsigned bid);
+
+/// @brief frees the buffers, once the ring they were registered with is gone.
+void uring_bufs_free(uring_bufs_t *b);
+
+#endif
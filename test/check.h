@@ -0,0 +1,33 @@
+/*
+ * File: test/check.h
+ * Project: CSCI 3160 Chat Project
+ * Description: What the programs under test/ check with.
+ *
+ *	CHECK(cond, ...) counts a check, and prints where it was and the printf-style message if cond is false.
+ *	check_done() prints how it went and is what main() returns, so make test stops at the first program that failed.
+ */
+
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int checks = 0, failed = 0;
+
+#define CHECK(cond, ...) do{ \
+	checks++; \
+	if(!(cond)){ \
+		failed++; \
+		fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+	} \
+} while(0)
+
+static inline int check_done(const char *what){
+	printf("%-10s %d checks, %d failed\n", what, checks, failed);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
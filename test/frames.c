@@ -0,0 +1,231 @@
+/*
+ * File: test/frames.c
+ * Project: CSCI 3160 Chat Project
+ * Description: Checks irc_frame_next() and irc_reader_t (irc_proto.h) on the ways frames really arrive.
+ *
+ *	A stream of frames (empty, small, numbered, flagged and one of the largest size there is) is parsed all
+ *	in one buffer, then cut in two at every byte and parsed as the halves come in, then fed to a reader
+ *	through a socket at every cut and one byte at a time. Every time, the same frames have to come out, in
+ *	order, each exactly once. Then headers that aren't frames: bad magic, another version, a length over
+ *	IRC_MAX_PAYLOAD, each whole and cut short.
+ *
+ * Usage: test/frames (make test runs it)
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../irc_proto.h"
+#include "check.h"
+
+#define NFRAMES 7
+
+/// @brief the frames in the stream, in order.
+static struct{
+	int type;
+	int flags;
+	uint32_t len;
+	char payload[IRC_MAX_PAYLOAD];
+} want[NFRAMES];
+
+static char stream[NFRAMES * IRC_FRAME_HDR + 3 * IRC_MAX_PAYLOAD];
+static size_t stream_len = 0;
+
+static void add_frame(int type, int flags, const char *payload, uint32_t len){
+	static int n = 0;
+	want[n].type = type;
+	want[n].flags = flags;
+	want[n].len = len;
+	memcpy(want[n].payload, payload, len);
+	n++;
+
+	irc_frame_header(stream + stream_len, type, flags, len);
+	memcpy(stream + stream_len + IRC_FRAME_HDR, payload, len);
+	stream_len += IRC_FRAME_HDR + len;
+}
+
+static void make_stream(void){
+	static char big[IRC_MAX_PAYLOAD];
+	char seq[IRC_SEQ_FRAME];
+
+	for(size_t i = 0; i < sizeof(big); i++){
+		big[i] = (char)(i * 7 + i / 251);
+	}
+	irc_seq_frame(seq, 0x0102030405060708ull);
+
+	add_frame(IRC_CHAT, 0, "hello", 5);
+	add_frame(IRC_CONTROL, 0, "", 0);
+	add_frame(IRC_SEQ, 0, seq + IRC_FRAME_HDR, IRC_SEQ_LEN);
+	add_frame(IRC_MSG, IRC_MSG_NAMED, big, 300);
+	add_frame(IRC_CHAT, 0, big, IRC_MAX_PAYLOAD);
+	add_frame(IRC_CHAT, 0xff, big + 1, IRC_MAX_PAYLOAD - 1);
+	add_frame(IRC_LEAVE, 0, "bye", 3);
+}
+
+/// @brief checks that f is frame number *got of the stream, and counts it.
+static void got_frame(const irc_frame_t *f, int *got, const char *how, size_t cut){
+	if(*got >= NFRAMES){
+		CHECK(0, "%s, cut at %zu: frame %d is one too many", how, cut, *got);
+		return;
+	}
+	int i = (*got)++;
+	CHECK(f->type == want[i].type && f->flags == want[i].flags && f->len == want[i].len
+		&& memcmp(f->payload, want[i].payload, f->len) == 0,
+		"%s, cut at %zu: frame %d came out as type %d flags %d len %u", how, cut, i, f->type, f->flags, f->len);
+}
+
+/// @brief the whole stream in one buffer: every frame, then "need more".
+static void test_pipelined(void){
+	irc_frame_t f;
+	size_t off = 0;
+	int got = 0, r;
+
+	while((r = irc_frame_next(stream, stream_len, &off, &f)) == 1){
+		got_frame(&f, &got, "pipelined", 0);
+	}
+	CHECK(r == 0 && got == NFRAMES && off == stream_len, "pipelined: r %d, %d frames, off %zu of %zu",
+		r, got, off, stream_len);
+}
+
+/// @brief the stream arriving in two parts, cut at every byte: what's complete comes out of the first part,
+//			the rest once all of it is there, and a cut frame is never taken early.
+static void test_cut(void){
+	for(size_t cut = 0; cut <= stream_len; cut++){
+		irc_frame_t f;
+		size_t off = 0;
+		int got = 0, r;
+
+		while((r = irc_frame_next(stream, cut, &off, &f)) == 1){
+			got_frame(&f, &got, "cut", cut);
+			CHECK((size_t)(f.payload - stream) + f.len <= cut, "cut at %zu: frame %d runs past what's there",
+				cut, got - 1);
+		}
+		CHECK(r == 0, "cut at %zu: first part ended with %d", cut, r);
+		while((r = irc_frame_next(stream, stream_len, &off, &f)) == 1){
+			got_frame(&f, &got, "cut", cut);
+		}
+		CHECK(r == 0 && got == NFRAMES && off == stream_len, "cut at %zu: r %d, %d frames", cut, r, got);
+	}
+}
+
+/// @brief writes stream[from, to) into the socket and has the reader take all of it, frames as they complete.
+static void feed(irc_reader_t *reader, int fds[2], size_t from, size_t to, int *got, const char *how, size_t cut){
+	irc_frame_t f;
+	size_t left = to - from;
+	int r;
+
+	while(left > 0){
+		//the socket takes a frame and a bit at a time; the reader has to keep up with it.
+		size_t chunk = left < IRC_FRAME_HDR + IRC_MAX_PAYLOAD ? left : IRC_FRAME_HDR + IRC_MAX_PAYLOAD;
+		CHECK(write(fds[0], stream + to - left, chunk) == (ssize_t)chunk, "%s, cut at %zu: short write", how, cut);
+		left -= chunk;
+
+		while(chunk > 0){
+			ssize_t n = irc_reader_fill(reader, fds[1]);
+			if(n <= 0){
+				CHECK(0, "%s, cut at %zu: the reader took %zd (full up with %zu bytes)", how, cut, n, reader->len);
+				return;
+			}
+			chunk -= (size_t)n;
+			while((r = irc_reader_next(reader, &f)) == 1){
+				got_frame(&f, got, how, cut);
+			}
+			CHECK(r == 0, "%s, cut at %zu: reader said %d", how, cut, r);
+		}
+	}
+}
+
+/// @brief the stream through a socket into an irc_reader_t, in two writes cut at every byte, and then
+//			one byte at a time, so the reader slides partial frames to the front of its buffer at every offset.
+static void test_reader(void){
+	static irc_reader_t reader;
+	int fds[2], got;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0){
+		CHECK(0, "socketpair failed");
+		return;
+	}
+	for(size_t cut = 0; cut <= stream_len; cut++){
+		irc_reader_init(&reader);
+		got = 0;
+		feed(&reader, fds, 0, cut, &got, "reader", cut);
+		feed(&reader, fds, cut, stream_len, &got, "reader", cut);
+		CHECK(got == NFRAMES, "reader, cut at %zu: %d frames", cut, got);
+	}
+
+	irc_reader_init(&reader);
+	got = 0;
+	for(size_t i = 0; i < stream_len; i++){
+		feed(&reader, fds, i, i + 1, &got, "byte by byte", i);
+	}
+	CHECK(got == NFRAMES, "byte by byte: %d frames", got);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/// @brief headers that aren't frames are errors as soon as the whole header is there (not before), whatever
+//			follows, and leave the offset where it was. So are they after a good frame, once it's out.
+static void test_bad(void){
+	static char buf[2 * IRC_FRAME_HDR + 16];
+	irc_frame_t f;
+	struct{
+		const char *what;
+		int byte;
+		int value;
+		uint32_t len;
+	} bad[] = {
+		{ "bad magic", 0, 0x46, 4 },
+		{ "no magic", 0, 0, 0 },
+		{ "version 2", 1, 2, 4 },
+		{ "version 0", 1, 0, 4 },
+		{ "one byte too long", -1, 0, IRC_MAX_PAYLOAD + 1 },
+		{ "4 GB long", -1, 0, 0xffffffffu },
+	};
+
+	for(size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++){
+		irc_frame_header(buf, IRC_CHAT, 0, bad[i].len);
+		if(bad[i].byte >= 0){
+			buf[bad[i].byte] = (char)bad[i].value;
+		}
+		memset(buf + IRC_FRAME_HDR, 'x', 16);
+
+		for(size_t have = 0; have < IRC_FRAME_HDR; have++){
+			size_t off = 0;
+			CHECK(irc_frame_next(buf, have, &off, &f) == 0 && off == 0, "%s: %zu bytes of header aren't an error yet",
+				bad[i].what, have);
+		}
+		for(size_t have = IRC_FRAME_HDR; have <= IRC_FRAME_HDR + 16; have++){
+			size_t off = 0;
+			CHECK(irc_frame_next(buf, have, &off, &f) == -1 && off == 0, "%s: not an error with %zu bytes",
+				bad[i].what, have);
+		}
+		CHECK(irc_frame_size(buf, IRC_FRAME_HDR) == -1, "%s: irc_frame_size took it", bad[i].what);
+
+		//the same after a good frame: that one comes out first.
+		size_t off = 0;
+		irc_frame_header(buf + IRC_FRAME_HDR + 4, IRC_CHAT, 0, bad[i].len);
+		if(bad[i].byte >= 0){
+			buf[IRC_FRAME_HDR + 4 + bad[i].byte] = (char)bad[i].value;
+		}
+		irc_frame_header(buf, IRC_CHAT, 0, 4);
+		CHECK(irc_frame_next(buf, sizeof(buf), &off, &f) == 1 && f.len == 4, "%s: the good frame before it", bad[i].what);
+		CHECK(irc_frame_next(buf, sizeof(buf), &off, &f) == -1 && off == IRC_FRAME_HDR + 4, "%s: after a good frame",
+			bad[i].what);
+	}
+
+	//the longest frame there is is fine, and waits for all of its payload.
+	size_t off = 0;
+	irc_frame_header(buf, IRC_CHAT, 0, IRC_MAX_PAYLOAD);
+	CHECK(irc_frame_size(buf, IRC_FRAME_HDR) == IRC_FRAME_HDR + IRC_MAX_PAYLOAD, "largest frame: wrong size");
+	CHECK(irc_frame_next(buf, sizeof(buf), &off, &f) == 0 && off == 0, "largest frame: taken before it's all there");
+}
+
+int main(void){
+	make_stream();
+	test_pipelined();
+	test_cut();
+	test_reader();
+	test_bad();
+	return check_done("frames");
+}
@@ -0,0 +1,174 @@
+/*
+ * File: test/registry.c
+ * Project: CSCI 3160 Chat Project
+ * Description: Checks the client registry (irc_registry.c) against a plain array of who should be in it.
+ *
+ *	A fixed sequence of random adds, names, removes and lookups, in phases that grow the tables, shrink them
+ *	again and churn a few clients until the tombstones force rebuilds. After every step the registry has to
+ *	agree with the array: lookups by uid and by name find exactly who's in, adding a uid or a name that's
+ *	taken fails (even with the one that has it past a tombstone), the count is right, a walk of the uid table
+ *	sees everyone once, and the tables stay within their limits (at most half full counting tombstones, and
+ *	shrunk once they're under 1/16 full).
+ *
+ * Usage: test/registry (make test runs it)
+ */
+
+#include <string.h>
+
+#include "../irc_registry.h"
+#include "../irc_rcu.h"
+#include "check.h"
+
+/// @brief uids go from 1 to UIDS. TABLE_MIN is irc_registry.c's smallest table.
+#define UIDS 4000
+#define TABLE_MIN 64
+
+typedef struct{
+	reg_node_t reg;
+	char name[16];
+} client_t;
+
+static registry_t reg;
+
+/// @brief who's in, by uid (NULL if they aren't).
+static client_t *in[UIDS + 1];
+static int nin = 0;
+
+static uint64_t seed = 0x853c49e6748fea9bull;
+
+static int next_rand(int n){
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return (int)(seed % (uint64_t)n);
+}
+
+static client_t *client_new(int uid, int name_of){
+	client_t *c = calloc(1, sizeof(client_t));
+	c->reg.uid = uid;
+	snprintf(c->name, sizeof(c->name), "user%d", name_of);
+	c->reg.name = c->name;
+	return c;
+}
+
+/// @brief the tables' limits, after any add or remove.
+static void check_tables(const char *after){
+	reg_table_t *tables[2] = { atomic_load(&reg.by_uid), atomic_load(&reg.by_name) };
+	for(int i = 0; i < 2; i++){
+		reg_table_t *t = tables[i];
+		CHECK(t->live == (size_t)nin, "after %s: %s table has %zu, should be %d", after, i ? "name" : "uid", t->live, nin);
+		CHECK(t->used * 2 <= t->cap, "after %s: %s table is %zu/%zu full", after, i ? "name" : "uid", t->used, t->cap);
+		CHECK(t->cap <= TABLE_MIN || t->live * 16 >= t->cap, "after %s: %s table has %zu in %zu slots", after,
+			i ? "name" : "uid", t->live, t->cap);
+	}
+	CHECK(registry_count(&reg) == (size_t)nin, "after %s: count %zu, should be %d", after, registry_count(&reg), nin);
+}
+
+static void add(int uid){
+	client_t *c = client_new(uid, uid);
+	if(in[uid]){
+		//the uid is taken, and so is the name (by someone with another uid).
+		CHECK(registry_add(&reg, &c->reg) == -1, "uid %d added twice", uid);
+		c->reg.uid = uid + UIDS;
+		CHECK(registry_add(&reg, &c->reg) == 0, "uid %d", uid + UIDS);
+		CHECK(registry_set_name(&reg, &c->reg) == -1, "name user%d taken twice", uid);
+		registry_remove(&reg, &c->reg);
+		free(c);
+		return;
+	}
+
+	CHECK(registry_add(&reg, &c->reg) == 0 && registry_set_name(&reg, &c->reg) == 0, "couldn't add %d", uid);
+	in[uid] = c;
+	nin++;
+	check_tables("an add");
+}
+
+static void remove_one(int uid){
+	if(!in[uid]){
+		return;
+	}
+	registry_remove(&reg, &in[uid]->reg);
+	free(in[uid]);
+	in[uid] = NULL;
+	nin--;
+	check_tables("a remove");
+}
+
+/// @brief looks up uid both ways, and checks the answer against in[].
+static void lookup(int uid){
+	char name[16];
+	snprintf(name, sizeof(name), "user%d", uid);
+
+	rcu_read_lock();
+	reg_node_t *by_uid = registry_find_uid(&reg, uid), *by_name = registry_find_name(&reg, name);
+	rcu_read_unlock();
+	CHECK(by_uid == (in[uid] ? &in[uid]->reg : NULL), "uid %d found %p", uid, (void *)by_uid);
+	CHECK(by_name == (in[uid] ? &in[uid]->reg : NULL), "name %s found %p", name, (void *)by_name);
+}
+
+/// @brief everyone in the uid table once, and nobody who isn't in.
+static void walk(void){
+	static int seen[UIDS + 1];
+	static int walks = 0;
+	int found = 0;
+
+	walks++;
+	rcu_read_lock();
+	reg_table_t *t = registry_table(&reg);
+	for(size_t i = 0; i < t->cap; i++){
+		reg_node_t *n = registry_slot(t, i);
+		if(!n){
+			continue;
+		}
+		CHECK(n->uid >= 1 && n->uid <= UIDS && in[n->uid] && &in[n->uid]->reg == n && seen[n->uid] != walks,
+			"walk found uid %d that it shouldn't have", n->uid);
+		if(n->uid >= 1 && n->uid <= UIDS){
+			seen[n->uid] = walks;
+		}
+		found++;
+	}
+	rcu_read_unlock();
+	CHECK(found == nin, "walk found %d, should be %d", found, nin);
+}
+
+/// @brief steps random operations on uids 1 .. range, adding with odds add_in_8 in 8.
+static void phase(int steps, int range, int add_in_8){
+	for(int i = 0; i < steps; i++){
+		int uid = next_rand(range) + 1;
+		if(next_rand(8) < add_in_8){
+			add(uid);
+		} else {
+			remove_one(uid);
+		}
+		lookup(next_rand(UIDS) + 1);
+		if(i % 500 == 0){
+			walk();
+		}
+	}
+	for(int uid = 1; uid <= UIDS; uid++){
+		lookup(uid);
+	}
+	walk();
+}
+
+int main(void){
+	if(registry_init(&reg) < 0){
+		return EXIT_FAILURE;
+	}
+
+	//grow: mostly adds, over every uid.
+	phase(20000, UIDS, 7);
+	size_t big = atomic_load(&reg.by_uid)->cap;
+
+	//shrink: mostly removes, until only a few are left.
+	phase(40000, UIDS, 1);
+	CHECK(atomic_load(&reg.by_uid)->cap < big, "the uid table never shrank from %zu", big);
+
+	//churn: a handful of uids in and out, so tombstones pile up until the table is rebuilt without them.
+	phase(50000, 40, 4);
+
+	//and everyone again, on top of what churning left.
+	phase(20000, UIDS, 6);
+
+	return check_done("registry");
+}
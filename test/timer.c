@@ -0,0 +1,197 @@
+/*
+ * File: test/timer.c
+ * Project: CSCI 3160 Chat Project
+ * Description: Checks the timer wheel (irc_timer.c) fires every timer on exactly its tick.
+ *
+ *	The wheel only ever sees the ticks it's given, so this runs it on made up ones. From starting ticks at and
+ *	around every level's wrap, timers are armed 0, 1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144 ticks
+ *	ahead, at the furthest the wheel reaches and past it (which fires at the furthest), and the wheel is run up
+ *	to them one tick at a time, in one jump per timer, and in one jump past all of them. Every timer has to fire
+ *	once, on its tick. On the way, timer_wait_ns() has to say exactly when the wheel next has something to do,
+ *	and never later than the next timer is due. Then: a timer in the past, cancelling, a timer that re-arms
+ *	itself, and a wheel that sat empty for a long time before anything was armed.
+ *
+ * Usage: test/timer (make test runs it)
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "../irc_timer.h"
+#include "check.h"
+
+/// @brief how many ticks ahead a timer can be (irc_timer.c's TIMER_SPAN).
+#define SPAN ((uint64_t)1 << (TIMER_LEVELS * TIMER_BITS))
+#define TICK_NS ((uint64_t)TIMER_TICK_MS * 1000000)
+
+#define NDELTAS 14
+static const uint64_t deltas[NDELTAS] = {
+	0, 1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, SPAN - 2, SPAN - 1, SPAN, SPAN + 1000,
+};
+
+/// @brief a timer, the tick it should fire on and the ticks it did.
+typedef struct{
+	wheel_timer_t t;
+	uint64_t want;
+	uint64_t fired;
+	int nfired;
+	uint64_t period;
+} test_timer_t;
+
+static timer_wheel_t wheel;
+static test_timer_t timers[NDELTAS];
+
+/// @brief where made up time starts: well past the real clock (so timer_wait_ns() has something to count down
+//			to) and on a tick where every level wraps.
+static uint64_t base;
+
+static void fired(wheel_timer_t *t, void *arg){
+	test_timer_t *tt = (test_timer_t *)t;
+	timer_wheel_t *w = arg;
+
+	//the tick being run is the one before w->now.
+	tt->fired = w->now - 1;
+	tt->nfired++;
+	CHECK(tt->fired == tt->want, "timer for tick base+%llu fired on base+%llu",
+		(unsigned long long)(tt->want - base), (unsigned long long)(tt->fired - base));
+	if(tt->period){
+		tt->want = tt->fired + tt->period;
+		timer_arm(w, t, tt->want);
+	}
+}
+
+static uint64_t clock_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/// @brief timer_wait_ns() in ticks from w->now, as the wheel worked it out (UINT64_MAX for "nothing armed").
+static uint64_t wait_ticks(void){
+	uint64_t before = clock_ns(), ns = timer_wait_ns(&wheel);
+	if(ns == UINT64_MAX){
+		return UINT64_MAX;
+	}
+
+	//it's a whole tick from the clock it read, a moment after before.
+	return (ns + before + TICK_NS / 2) / TICK_NS - wheel.now;
+}
+
+/// @brief what timer_wait_ns() should say: a timer on level 0 is due in so many ticks, anything further up
+//			moves down when level 0 comes round. And never later than any timer is due.
+static void check_wait(int n){
+	uint64_t want = UINT64_MAX, due = UINT64_MAX;
+	for(int i = 0; i < n; i++){
+		wheel_timer_t *t = &timers[i].t;
+		if(!timer_armed(t)){
+			continue;
+		}
+		uint64_t in = t->slot < TIMER_SLOTS ? t->expires - wheel.now : (TIMER_SLOTS - (wheel.now % TIMER_SLOTS)) % TIMER_SLOTS;
+		want = in < want ? in : want;
+		due = t->expires - wheel.now < due ? t->expires - wheel.now : due;
+	}
+	uint64_t got = wait_ticks();
+	CHECK(got == want && (due == UINT64_MAX || got <= due), "at base+%llu: wait %llu ticks, should be %llu (next due in %llu)",
+		(unsigned long long)(wheel.now - base), (unsigned long long)got, (unsigned long long)want, (unsigned long long)due);
+}
+
+/// @brief every delta's timer armed from start (the wheel's next tick).
+static void arm_all(uint64_t start){
+	memset(timers, 0, sizeof(timers));
+	for(int i = 0; i < NDELTAS; i++){
+		uint64_t d = deltas[i] < SPAN ? deltas[i] : SPAN - 1;
+		timers[i].want = start + d;
+		timer_arm(&wheel, &timers[i].t, start + deltas[i]);
+	}
+}
+
+static void check_all_fired(const char *how, uint64_t start){
+	for(int i = 0; i < NDELTAS; i++){
+		CHECK(timers[i].nfired == 1 && !timer_armed(&timers[i].t), "%s from base+%llu: delta %llu fired %d times",
+			how, (unsigned long long)(start - base), (unsigned long long)deltas[i], timers[i].nfired);
+	}
+}
+
+/// @brief from start (a fresh wheel, or with fresh 0 the one there is, which has to be at start), one tick at a
+//			time as far as step_to (checking timer_wait_ns() on every one), then in one jump per timer: up to the
+//			tick before it (nothing may fire early) and then its tick.
+static void run_stepping(uint64_t start, uint64_t step_to, int fresh){
+	if(fresh){
+		timer_init(&wheel, start);
+	}
+	arm_all(start);
+	while(wheel.now <= start + step_to){
+		check_wait(NDELTAS);
+		timer_run(&wheel, wheel.now, fired, &wheel);
+	}
+	for(int i = 0; i < NDELTAS; i++){
+		if(timers[i].nfired == 0){
+			timer_run(&wheel, timers[i].want - 1, fired, &wheel);
+			CHECK(timers[i].nfired == 0, "delta %llu fired early", (unsigned long long)deltas[i]);
+			check_wait(NDELTAS);
+			timer_run(&wheel, timers[i].want, fired, &wheel);
+		}
+	}
+	check_all_fired("stepping", start);
+	CHECK(wait_ticks() == UINT64_MAX, "from base+%llu: still waiting on something", (unsigned long long)(start - base));
+}
+
+/// @brief everything in one call: every timer still fires on its own tick.
+static void run_jump(uint64_t start){
+	timer_init(&wheel, start);
+	arm_all(start);
+	timer_run(&wheel, start + SPAN + 5000, fired, &wheel);
+	check_all_fired("one jump", start);
+}
+
+/// @brief timers in the past fire on the next tick, cancelled ones never, and a periodic one on every period.
+static void run_misc(void){
+	uint64_t start = base + 12345;
+	timer_init(&wheel, start);
+	memset(timers, 0, sizeof(timers));
+
+	timers[0].want = start;
+	timer_arm(&wheel, &timers[0].t, start - 100);
+	timers[1].want = start + 70;
+	timer_arm(&wheel, &timers[1].t, start + 70);
+	timer_cancel(&wheel, &timers[1].t);
+	timers[2].want = start + 5000;
+	timer_arm(&wheel, &timers[2].t, start + 10);
+	timer_arm(&wheel, &timers[2].t, start + 5000);
+	timers[3].want = start + 1;
+	timers[3].period = 100;
+	timer_arm(&wheel, &timers[3].t, start + 1);
+
+	for(uint64_t now = start; now < start + 20000; now += 7){
+		check_wait(4);
+		timer_run(&wheel, now, fired, &wheel);
+	}
+	CHECK(timers[0].nfired == 1, "a timer in the past fired %d times", timers[0].nfired);
+	CHECK(timers[1].nfired == 0, "a cancelled timer fired %d times", timers[1].nfired);
+	CHECK(timers[2].nfired == 1, "a moved timer fired %d times", timers[2].nfired);
+	CHECK(timers[3].nfired == 200, "a timer every 100 ticks fired %d times in 20000", timers[3].nfired);
+	timer_cancel(&wheel, &timers[3].t);
+	CHECK(wait_ticks() == UINT64_MAX, "still waiting with nothing armed");
+}
+
+int main(void){
+	base = ((timer_ticks() + SPAN) | (SPAN - 1)) + 1;
+
+	//at every level's wrap and the ticks either side of it, and somewhere in the middle of nowhere.
+	uint64_t starts[] = {
+		0, 1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, SPAN - 1, SPAN + 4096 * 5 + 64 * 3 + 17,
+	};
+	for(size_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++){
+		run_stepping(base + starts[i], 262144 + 64, 1);
+		run_jump(base + starts[i]);
+	}
+	run_misc();
+
+	//an empty wheel left alone for years of ticks, then used from wherever it got to.
+	timer_init(&wheel, base);
+	timer_run(&wheel, base + 1000 * SPAN + 777, fired, &wheel);
+	CHECK(wheel.now == base + 1000 * SPAN + 778, "an empty wheel went to base+%llu", (unsigned long long)(wheel.now - base));
+	run_stepping(wheel.now, 5000, 0);
+
+	return check_done("timer");
+}